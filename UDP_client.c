@@ -8,9 +8,40 @@
 #include <unistd.h>
 #include <arpa/inet.h>
 #include <time.h>
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
 #include "UDP_client.h"
+#include "protocol.h"
+#include "shm_cmd.h"
 
 int UDP_fd=0;
+int UDP_fd2=-1; // second path opened by UDP_redundant(), -1 if none
+long UDP_offset_usec=0; // delay of the second copy
+
+// second copies waiting for their offset, sent by path2_thread()
+#define UDP_PATH2_QUEUE 8
+struct path2_slot {
+    struct timespec due;    // CLOCK_MONOTONIC send time
+    size_t len;
+    uint8_t pkt[KNODE_MAX_PKT];
+};
+struct path2_slot UDP_path2_q[UDP_PATH2_QUEUE];
+uint32_t UDP_path2_head=0; // next copy to send
+uint32_t UDP_path2_tail=0; // next free slot
+pthread_mutex_t UDP_path2_mutex = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t UDP_path2_cond = PTHREAD_COND_INITIALIZER;
+char UDP_host[NI_MAXHOST]; // UDP_init() host and port, the default second path
+char UDP_port[NI_MAXSERV];
+shm_cmd_t UDP_shm; // open when UDP_init() was given UDP_SHM_HOST
+uint32_t UDP_seq=0; // sequence number of the next knode packet
+
+// delta encoder state
+int UDP_keyframe_interval = 100; // packets between keyframes
+int UDP_delta_varint = 1; // send varint coded differences
+uint32_t UDP_keyframe_seq = 0; // sequence number of the last keyframe
+int16_t UDP_delta_base[KNODE_NUM_VALS]; // command values of the last packet
+int UDP_delta_valid = 0; // set once a packet has been sent
 
 int UDP_init(char *ip, char *port){
 
@@ -19,6 +50,16 @@ int UDP_init(char *ip, char *port){
     struct addrinfo  hints;
     struct addrinfo  *result, *rp; // pointers to linked list of addrinfo structures
 
+    if (strcmp(ip, UDP_SHM_HOST) == 0) {
+        if (shm_cmd_open(&UDP_shm, port) != 0) {
+            fprintf(stderr, "Could not open shared memory %s: %s\n", port, strerror(errno));
+            return(-1);
+        }
+        return(0);
+    }
+    snprintf(UDP_host, sizeof(UDP_host), "%s", ip);
+    snprintf(UDP_port, sizeof(UDP_port), "%s", port);
+
         /* Obtain address(es) matching host/port. */
     memset(&hints, 0, sizeof(hints));
     hints.ai_family = AF_UNSPEC;    // Allow IPv4 or IPv6
@@ -79,10 +120,108 @@ int UDP_init(char *ip, char *port){
 }
 
 
+/**
+ * @brief: sends the queued second copies once they are due, so the caller
+ * never waits out the offset
+ */
+static void *path2_thread(void *arg){
+    struct path2_slot *slot;
+
+    (void)arg;
+    pthread_mutex_lock(&UDP_path2_mutex);
+    while (1) {
+        while (UDP_path2_head == UDP_path2_tail) {
+            pthread_cond_wait(&UDP_path2_cond, &UDP_path2_mutex);
+        }
+        slot = &UDP_path2_q[UDP_path2_head % UDP_PATH2_QUEUE]; // not reused until head moves on
+        pthread_mutex_unlock(&UDP_path2_mutex);
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &slot->due, NULL) == EINTR);
+        if (send(UDP_fd2, slot->pkt, slot->len, 0) != (ssize_t)slot->len) {
+            fprintf(stderr, "partial/failed write on the second path\n");
+        }
+        pthread_mutex_lock(&UDP_path2_mutex);
+        UDP_path2_head++;
+    }
+    return(NULL);
+}
+
+int UDP_redundant(const char *ip, const char *port, const char *bind_ip, long offset_usec){
+    struct addrinfo hints = {0};
+    struct addrinfo *result, *rp;
+    struct timeval timeout = {1, 0};
+    int sfd = -1;
+    int s;
+
+    if (UDP_shm.seg != NULL) {
+        fprintf(stderr, "Redundant paths need the UDP transport\n");
+        return(-1);
+    }
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_DGRAM;
+    s = getaddrinfo(ip != NULL ? ip : UDP_host, port != NULL ? port : UDP_port, &hints, &result);
+    if (s != 0) {
+        fprintf(stderr, "getaddrinfo: %s\n", gai_strerror(s));
+        return(-1);
+    }
+    for (rp = result; rp != NULL; rp = rp->ai_next) {
+        sfd = socket(rp->ai_family, rp->ai_socktype, rp->ai_protocol);
+        if (sfd == -1)
+            continue;
+        if (bind_ip != NULL) {
+            struct addrinfo *local;
+
+            hints.ai_family = rp->ai_family;
+            hints.ai_flags = AI_PASSIVE;
+            if (getaddrinfo(bind_ip, NULL, &hints, &local) != 0) {
+                close(sfd);
+                sfd = -1;
+                continue;
+            }
+            s = bind(sfd, local->ai_addr, local->ai_addrlen);
+            freeaddrinfo(local);
+            if (s != 0) {
+                close(sfd);
+                sfd = -1;
+                continue;
+            }
+        }
+        if (connect(sfd, rp->ai_addr, rp->ai_addrlen) != -1)
+            break;                  // Success
+        close(sfd);
+        sfd = -1;
+    }
+    freeaddrinfo(result);
+    if (sfd == -1) {
+        fprintf(stderr, "Could not connect the second path\n");
+        return(-1);
+    }
+    if (setsockopt(sfd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof timeout) < 0) {
+        fprintf(stderr, "Failed to set socket options: %s\n", strerror(errno));
+        close(sfd);
+        return(-1);
+    }
+    UDP_offset_usec = offset_usec > 0 ? offset_usec : 0;
+    if (UDP_offset_usec > 0) {
+        pthread_t thread;
+
+        if (pthread_create(&thread, NULL, path2_thread, NULL) != 0) {
+            fprintf(stderr, "Could not start the second path thread\n");
+            close(sfd);
+            return(-1);
+        }
+        pthread_detach(thread);
+    }
+    UDP_fd2 = sfd;
+    return(0);
+}
+
 int UDP_send(union CMD_DATA data){
     ssize_t len = CMD_SIZE;
     ssize_t sent = 0;
 
+    if (UDP_shm.seg != NULL) {
+        return(shm_cmd_send(&UDP_shm, data.bytes, len));
+    }
     sent = send(UDP_fd, data.bytes, len, 0);
     if (sent != len) {
         fprintf(stderr, "partial/failed write\n");
@@ -91,15 +230,124 @@ int UDP_send(union CMD_DATA data){
 }
 
 int UDP_send_protocol(uint8_t * data, size_t data_len){
+    uint8_t copy[KNODE_MAX_PKT];
+    struct path2_slot *slot = NULL;
     ssize_t sent = 0;
+    ssize_t sent2 = 0;
 
-    sent = send(UDP_fd, data, data_len, 0);
-    if (sent != data_len) {
+    if (UDP_shm.seg != NULL) {
+        return(shm_cmd_send(&UDP_shm, data, data_len));
+    }
+    if (UDP_fd2 < 0 || knode_get_path(data, data_len) < 0 || data_len > sizeof(copy)) {
+        sent = send(UDP_fd, data, data_len, 0);
+        if (sent != (ssize_t)data_len) {
+            fprintf(stderr, "partial/failed write\n");
+        }
+        return(sent);
+    }
+    // the same packet on both paths, the node keeps whichever copy arrives first
+    memcpy(copy, data, data_len);
+    knode_set_path(copy, data_len, 0);
+    sent = send(UDP_fd, copy, data_len, 0);
+    knode_set_path(copy, data_len, 1);
+    if (UDP_offset_usec > 0) {
+        pthread_mutex_lock(&UDP_path2_mutex);
+        if (UDP_path2_tail - UDP_path2_head < UDP_PATH2_QUEUE) {
+            slot = &UDP_path2_q[UDP_path2_tail % UDP_PATH2_QUEUE];
+            clock_gettime(CLOCK_MONOTONIC, &slot->due);
+            slot->due.tv_nsec += UDP_offset_usec * 1000;
+            slot->due.tv_sec += slot->due.tv_nsec / 1000000000;
+            slot->due.tv_nsec %= 1000000000;
+            slot->len = data_len;
+            memcpy(slot->pkt, copy, data_len);
+            UDP_path2_tail++;
+            pthread_cond_signal(&UDP_path2_cond);
+        }
+        pthread_mutex_unlock(&UDP_path2_mutex);
+        if (slot != NULL) {
+            // the second copy goes out later, only the first path can be reported
+            if (sent != (ssize_t)data_len) fprintf(stderr, "partial/failed write\n");
+            return(sent);
+        }
+        // the sender fell a whole queue behind, send the copy now rather than lose it
+    }
+    sent2 = send(UDP_fd2, copy, data_len, 0);
+    if (sent != (ssize_t)data_len && sent2 != (ssize_t)data_len) {
         fprintf(stderr, "partial/failed write\n");
     }
-    return(sent);
+    return(sent == (ssize_t)data_len ? sent : sent2);
+}
+
+int UDP_recv(uint8_t *buf, size_t len, int timeout_ms){
+    struct pollfd fds[2] = {{UDP_fd, POLLIN, 0}, {UDP_fd2, POLLIN, 0}};
+    ssize_t nread = 0;
+
+    if (UDP_shm.seg != NULL) {
+        nread = shm_cmd_recv(&UDP_shm, buf, len, NULL);
+        if (nread < 0 && shm_cmd_wait(&UDP_shm, timeout_ms) == 1) {
+            nread = shm_cmd_recv(&UDP_shm, buf, len, NULL);
+        }
+        return(nread < 0 ? 0 : nread);
+    }
+    // telemetry goes to the path of the last command the node applied
+    switch (poll(fds, UDP_fd2 < 0 ? 1 : 2, timeout_ms)) {
+        case -1:
+            return(errno == EINTR ? 0 : -1);
+        case 0:
+            return(0);
+        default:
+            break;
+    }
+    return(recv((fds[0].revents & POLLIN) ? UDP_fd : UDP_fd2, buf, len, 0));
+}
+
+
+/**
+ * @brief: converts network byte order command values to host order
+ */
+static void to_host(int16_t *vals, const union CMD_DATA *data){
+    for(int i = 0; i < KNODE_NUM_VALS; i++){
+        vals[i] = ntohs(data->values[i]);
+    }
+}
+
+int UDP_send_seq(union CMD_DATA data){
+    uint8_t pkt[KNODE_MAX_PKT];
+    int16_t vals[KNODE_NUM_VALS];
+    size_t len;
+
+    to_host(vals, &data);
+    len = knode_encode_full(pkt, UDP_seq++, vals);
+    return UDP_send_protocol(pkt, len);
+}
+
+void UDP_delta_config(int keyframe_interval, int varint){
+    UDP_keyframe_interval = keyframe_interval > 0 ? keyframe_interval : 1;
+    UDP_delta_varint = varint;
 }
 
+int UDP_send_delta(union CMD_DATA data){
+    uint8_t pkt[KNODE_MAX_PKT];
+    int16_t vals[KNODE_NUM_VALS];
+    size_t len;
+
+    to_host(vals, &data);
+    if (UDP_seq - UDP_keyframe_seq >= (uint32_t)UDP_keyframe_interval || UDP_delta_valid == 0) {
+        len = knode_encode_full(pkt, UDP_seq, vals);
+    } else {
+        len = knode_encode_delta(pkt, UDP_seq, vals, UDP_delta_base, UDP_delta_varint);
+        if (len >= sizeof(knode_full_t)) {
+            len = knode_encode_full(pkt, UDP_seq, vals); // keyframe is no bigger
+        }
+    }
+    if (len == sizeof(knode_full_t)) {
+        UDP_keyframe_seq = UDP_seq;
+    }
+    UDP_seq++;
+    memcpy(UDP_delta_base, vals, sizeof(vals));
+    UDP_delta_valid = 1;
+    return UDP_send_protocol(pkt, len);
+}
 
 
 #ifdef UDP_TESTING
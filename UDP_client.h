@@ -6,25 +6,69 @@
 #include <sys/types.h>
 #include <unistd.h>
 #include <arpa/inet.h>
+#include "kasm_frame.h"
 
 #define BUF_SIZE 500
-#define CMD_SIZE 52 // 52 bytes for 26 int16_t values
-
-union CMD_DATA {
-    unsigned char bytes[CMD_SIZE];
-    int16_t values[CMD_SIZE/2];
-};
+#define CMD_SIZE KASM_CMD_SIZE // 52 bytes for 26 int16_t values, the crc is added by the node
+#define UDP_SHM_HOST "shm" // host that selects the shared memory transport, the port is the segment name
 
 
 /**
  * @brief: initializes UDP system and sets the socket file descriptor
- * @param: IP address 
- * @param: port 
+ * @param: IP address, or UDP_SHM_HOST for a knodeRT -M on this host
+ * @param: port, or the shared memory segment name
  * @return: 0 on success, -1 on failure
+ * @note: every send and receive function works on either transport
  */
 
 int UDP_init(char *ip, char *port);
 
+/**
+ * @brief: opens a second path to the node for redundant sending, after UDP_init()
+ * @param: ip IP address of the second path, NULL for the UDP_init() host
+ * @param: port port of the second path, NULL for the UDP_init() port
+ * @param: bind_ip local address to send from, picks the NIC of the second path, NULL for any
+ * @param: offset_usec delay of the second copy after the first
+ * @return: 0 on success, -1 on failure
+ * @note: every sequenced packet is then sent on both paths, marked path 0
+ * and path 1, and the node applies whichever copy arrives first. With an
+ * offset the second copies are sent by a helper thread, so the send calls
+ * return at once and report the first path only. Not available on the
+ * shared memory transport.
+ */
+int UDP_redundant(const char *ip, const char *port, const char *bind_ip, long offset_usec);
+
+/**
+ * @brief: waits for a datagram from the node, the knodeRT telemetry
+ * @param: buf output buffer
+ * @param: len size of buf
+ * @param: timeout_ms longest wait
+ * @return: bytes received, 0 on timeout, -1 on error
+ */
+int UDP_recv(uint8_t *buf, size_t len, int timeout_ms);
+
 int UDP_send(union CMD_DATA data);
 
 int UDP_send_protocol(uint8_t * data, size_t data_len);
+
+/**
+ * @brief: sends the command values as a sequenced knode packet
+ * @param: data command values in network byte order
+ * @return: number of bytes sent
+ */
+int UDP_send_seq(union CMD_DATA data);
+
+/**
+ * @brief: configures the delta encoder used by UDP_send_delta()
+ * @param: keyframe_interval maximum number of packets between keyframes
+ * @param: varint non-zero to send varint coded differences
+ */
+void UDP_delta_config(int keyframe_interval, int varint);
+
+/**
+ * @brief: sends the words that changed since the last packet, with
+ * periodic full keyframes for resync
+ * @param: data command values in network byte order
+ * @return: number of bytes sent
+ */
+int UDP_send_delta(union CMD_DATA data);
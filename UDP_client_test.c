@@ -8,25 +8,41 @@
 #include <arpa/inet.h>
 #include <time.h>
 #include <syslog.h>
-#include <poll.h>
 #include <pthread.h>
 #include <sched.h>
 #include <sys/mman.h>
 #include <errno.h>
 #include "UDP_client.h"
+#include "protocol.h"
 
 #define	TRUE	(1==1)
 #define	FALSE	(!TRUE)
-#define BUFFER_SIZE 96
+#define BUFFER_SIZE 1024
+#define SEND_RING 4096 // send times kept for round trip matching
 #define PERIOD_NSEC 500000// UDP_send interval in nanoseconds
 #define NSEC_PER_SEC 1000*1000*1000
 
 /********** Module level variables ***************************/
 extern int UDP_fd; // file descriptor for the UDP socket, set by UDP_init()
+extern uint32_t UDP_seq; // sequence number of the next packet, set by UDP_client
 uint8_t running = TRUE; // set flag to false to terminate the threads and exit the program
 char ip_addr[80] = "128.114.22.117";
 char port[20] = "5001";
 int num_cmds = 1; // number of commands to send, default is 1
+int use_seq = FALSE; // send sequenced knode packets instead of bare commands
+int use_delta = FALSE; // send delta packets with periodic keyframes
+char path2_addr[80] = ""; // host of the second path, empty for a single path
+char bind_addr[80] = ""; // local address of the second path
+long path2_offset_usec = 0; // delay of the second copy
+
+// round trip measurement from node telemetry
+uint64_t send_ns[SEND_RING]; // client send time, indexed by seq % SEND_RING
+long *rtt_ns; // network round trip, node processing removed
+long *spi_ns; // node receive to SPI completion
+size_t num_rtt = {0};
+size_t num_spi = {0};
+size_t num_bad_crc = {0};
+size_t num_bad_echo = {0};
 
 
 /********** functions ***************************************/
@@ -41,50 +57,89 @@ static void normalize_timespec(struct timespec *ts) {
     }
 }
 
+/**
+ * @brief Current CLOCK_MONOTONIC time in nanoseconds
+ */
+static uint64_t now_ns(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+static int cmp_long(const void *a, const void *b){
+    long x = *(const long *)a;
+    long y = *(const long *)b;
+    return (x > y) - (x < y);
+}
+
+/**
+ * @brief Print min, percentiles and max of a latency sample
+ */
+static void print_latency(const char *name, long *vals, size_t n){
+    if (n == 0) {
+        printf("%s: no samples\n", name);
+        return;
+    }
+    qsort(vals, n, sizeof(long), cmp_long);
+    printf("%s (usec, %zu samples): min %.1f p50 %.1f p90 %.1f p99 %.1f max %.1f\n", name, n,
+           vals[0] / 1e3, vals[n / 2] / 1e3, vals[n * 9 / 10] / 1e3, vals[n * 99 / 100] / 1e3,
+           vals[n - 1] / 1e3);
+}
+
+/**
+ * @brief Receive telemetry from knodeRT and match it to the commands sent
+ * @note The round trip is measured on the client clock and the node time
+ * between command receipt and telemetry send is subtracted, so only the
+ * network and socket stack latency remains.
+ */
 void * recv_UDP(void *data){
+    (void)data;
     ssize_t nread;
-    socklen_t peer_addrlen;
-    struct sockaddr_storage peer_addr;
-    char buf_data[BUFFER_SIZE]={0}; // buffer for UDP data
+    uint8_t buf_data[BUFFER_SIZE]={0}; // buffer for UDP data
+    knode_tlm_rec_t recs[KNODE_TLM_MAX_RECS];
+    knode_reg_rec_t regs[KNODE_REG_MAX_RECS];
+    uint64_t tx_ns = {0};
+    uint64_t rx_ns = {0};
     int timeout_ms = 1; 
-    const char *filename = "testing/UDP_client_test_data.csv";
-
-    peer_addrlen = sizeof(peer_addr);
-    // set up polling
-    struct pollfd fds[1]; //monitor UDP for incoming data
-    fds[0].fd = UDP_fd;
-    fds[0].events = POLLIN; // look for new data
-    int poll_ret = {0};
-
-    /* datalogging of returns values */
-    FILE *fp = fopen(filename, "w"); // open file for writing
-    if (fp == NULL) {
-        perror("Failed to open file");
-        exit(EXIT_FAILURE);
-    }
+    int n = {0};
 
     while(running == TRUE){
-        poll_ret = poll(fds, 1, timeout_ms);
-        if(poll_ret < 0) exit(EXIT_FAILURE); // error
-        if(poll_ret == 0) {
-            syslog(LOG_WARNING, "UDP poll timeout after %d ms", timeout_ms);
-        } else {
-            // Receive data from the UDP socket
-            nread = recvfrom(UDP_fd, buf_data, BUFFER_SIZE, 0,
-                            (struct sockaddr *)&peer_addr, &peer_addrlen);
-            if (nread == -1)
-            {
-                syslog(LOG_ERR, "Error receiving UDP data: %s\n", strerror(errno));
+        // Receive data from the UDP socket or the shared memory segment
+        nread = UDP_recv(buf_data, BUFFER_SIZE, timeout_ms);
+        if(nread == 0) {
+            continue;
+        }
+        rx_ns = now_ns();
+        if (nread == -1) {
+            syslog(LOG_ERR, "Error receiving UDP data: %s\n", strerror(errno));
+            continue;
+        }
+        n = knode_decode_reg(buf_data, nread, regs);
+        for (int i = 0; i < n; i++) {
+            printf("bus %u dac %u register 0x%02x = 0x%04x status %u\n", regs[i].bus, regs[i].dac,
+                   regs[i].reg, regs[i].value, regs[i].status);
+        }
+        if (n >= 0) continue;
+        n = knode_decode_tlm(buf_data, nread, &tx_ns, recs);
+        if (n < 0) {
+            syslog(LOG_INFO, "Received %zd bytes of non telemetry data", nread);
+            continue;
+        }
+        for (int i = 0; i < n; i++) {
+            if ((recs[i].status & KNODE_TLM_CRC_OK) == 0) num_bad_crc++;
+            if ((recs[i].status & KNODE_TLM_ECHO_OK) == 0) num_bad_echo++;
+            if ((recs[i].status & KNODE_TLM_FRESH) == 0) continue;
+            if (num_spi < (size_t)num_cmds * 8) {
+                spi_ns[num_spi++] = recs[i].spi_ns - recs[i].rx_ns;
             }
-
-            else {
-                syslog(LOG_INFO, "Received %zd bytes", nread);
-                buf_data[nread] = '\0'; // null-terminate the response
-                fprintf(fp, "%s\r\n", buf_data); // write data to datalog
+            // one round trip per sequenced command, taken from bus 0
+            if ((use_seq == TRUE || use_delta == TRUE) && recs[i].bus == 0
+                && UDP_seq - recs[i].seq < SEND_RING && num_rtt < (size_t)num_cmds) {
+                rtt_ns[num_rtt++] = (rx_ns - send_ns[recs[i].seq % SEND_RING])
+                                    - (tx_ns - recs[i].rx_ns);
             }
         }
     }
-    fclose(fp); // close the datalog file
     pthread_exit(NULL); // Return NULL to indicate thread completion
 
 }
@@ -111,7 +166,14 @@ void * send_UDP(void *data){
         }
 
         /* send command buffer values */
-        bytes_sent = UDP_send(buf_data);
+        send_ns[UDP_seq % SEND_RING] = now_ns();
+        if (use_delta == TRUE) {
+            bytes_sent = UDP_send_delta(buf_data);
+        } else if (use_seq == TRUE) {
+            bytes_sent = UDP_send_seq(buf_data);
+        } else {
+            bytes_sent = UDP_send(buf_data);
+        }
         syslog(LOG_DEBUG, "Sent %zu bytes, iter %d of %d\n", (size_t)bytes_sent,i,num_cmds);
 
         // Calculate next wake-up time
@@ -135,6 +197,9 @@ void * send_UDP(void *data){
         clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &prd_tmr, NULL);
 
     }
+    // give the last telemetry time to arrive
+    struct timespec linger = {0, 50*1000*1000};
+    nanosleep(&linger, NULL);
     running = FALSE; // set running to false to signal the recv thread to exit
     pthread_exit(NULL); // Return NULL to indicate thread completion
 }
@@ -144,7 +209,7 @@ int main(int argc, char *argv[])
     int opt = {0}; // for getopt()
 
     /*  parse command line arguments*/
-    while ((opt = getopt(argc, argv, "s:hp:n:")) != -1){
+    while ((opt = getopt(argc, argv, "s:hp:n:qdr:b:o:")) != -1){
         switch(opt){
             case 's':
                 strcpy(ip_addr, optarg); 
@@ -158,12 +223,32 @@ int main(int argc, char *argv[])
                 num_cmds = atoi(optarg);
                 printf("number of commands to send set to %d\n", num_cmds);
                 break;
+            case 'q':
+                use_seq = TRUE;
+                printf("sending sequenced packets\n");
+                break;
+            case 'd':
+                use_delta = TRUE;
+                printf("sending delta packets\n");
+                break;
+            case 'r':
+                strcpy(path2_addr, optarg);
+                printf("second path to %s\n", path2_addr);
+                break;
+            case 'b':
+                strcpy(bind_addr, optarg);
+                printf("second path bound to %s\n", bind_addr);
+                break;
+            case 'o':
+                path2_offset_usec = atol(optarg);
+                printf("second copy sent %ld us after the first\n", path2_offset_usec);
+                break;
             case 'h':
-                printf("Usage: %s host port [-n num cmds to send] \n", argv[0]);
+                printf("Usage: %s host port [-n num cmds to send] [-q] [-d] [-r host2] [-b bind addr] [-o usec]\n", argv[0]);
                 exit(EXIT_SUCCESS);
                 break;
             default:
-                printf("Usage: %s -s host -p port [-n num cmds to send] \n", argv[0]);
+                printf("Usage: %s -s host -p port [-n num cmds to send] [-q] [-d] [-r host2] [-b bind addr] [-o usec]\n", argv[0]);
                 exit(EXIT_FAILURE);
                 break;
         }
@@ -183,6 +268,24 @@ int main(int argc, char *argv[])
     } else {
         syslog(LOG_INFO, "UDP client initialized with socket descriptor %d", UDP_fd);
     }
+    if (path2_addr[0] != '\0' || bind_addr[0] != '\0') {
+        if (use_seq == FALSE && use_delta == FALSE) {
+            fprintf(stderr, "A second path needs -q or -d\n");
+            exit(EXIT_FAILURE);
+        }
+        if (UDP_redundant(path2_addr[0] != '\0' ? path2_addr : NULL, NULL,
+                          bind_addr[0] != '\0' ? bind_addr : NULL, path2_offset_usec) != 0) {
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    /* room for one round trip and up to 8 SPI records per command */
+    rtt_ns = calloc(num_cmds, sizeof(long));
+    spi_ns = calloc((size_t)num_cmds * 8, sizeof(long));
+    if (rtt_ns == NULL || spi_ns == NULL) {
+        perror("calloc");
+        exit(EXIT_FAILURE);
+    }
 
     /* start UDP listener thread */
     pthread_t udp_recv_thread;
@@ -199,6 +302,9 @@ int main(int argc, char *argv[])
 
     pthread_join(udp_recv_thread, NULL);
     pthread_join(udp_send_thread, NULL);
+    print_latency("network round trip", rtt_ns, num_rtt);
+    print_latency("node rx to SPI done", spi_ns, num_spi);
+    printf("SPI readback: %zu crc failures, %zu echo mismatches\n", num_bad_crc, num_bad_echo);
     syslog(LOG_INFO, "UDP client exiting");
     printf("UDP client exiting\n");
 
@@ -6,14 +6,12 @@
 #include <sys/types.h>
 #include <unistd.h>
 #include <arpa/inet.h>
+#include "kasm_frame.h"
 
 #define BUF_SIZE 500
-#define CMD_SIZE 52 // 52 bytes for 26 int16_t values
+#define CMD_SIZE KASM_CMD_SIZE // 52 bytes for 26 int16_t values
 
-union CMD_DATA {
-    unsigned char bytes[CMD_SIZE];
-    int16_t values[CMD_SIZE/2];
-} cmd_data, buf_data;
+union CMD_DATA cmd_data, buf_data;
 
 int
 main(int argc, char *argv[])
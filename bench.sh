@@ -0,0 +1,72 @@
+#!/bin/sh
+# Closed loop latency benchmark: rtc_sim -> knodeRT_sim -> simulated SPI -> telemetry.
+# Runs every combination of SPI bus count, SPI engine, handoff scheme (threads
+# engine only), scheduling mode, thread layout and receive mode and writes one JSON file per invocation to bench/, named after the git
+# revision, so results can be compared across versions.
+#
+# Environment: BENCH_SECS (run length, default 5), BENCH_RATE (Hz, default 1000),
+# BENCH_PORT (default 2400), BENCH_BUSES, BENCH_ENGINE, BENCH_HANDOFF, BENCH_SCHED, BENCH_LAYOUT
+# BENCH_RX (lists), BENCH_SPIN (spin budget in usec, default one period), BENCH_CPUS (CPU list for the node threads, default the isolated CPUs,
+# else every CPU but 0).
+
+secs=${BENCH_SECS:-5}
+rate=${BENCH_RATE:-1000}
+port=${BENCH_PORT:-2400}
+buses=${BENCH_BUSES:-"1 3"}
+engines=${BENCH_ENGINE:-"threads single"}
+handoffs=${BENCH_HANDOFF:-"condvar spin"}
+scheds=${BENCH_SCHED:-"fifo deadline other"}
+layouts=${BENCH_LAYOUT:-"spread packed"}
+rxs=${BENCH_RX:-"block spin"}
+spin=${BENCH_SPIN:-$((1000000 / rate))}
+ncpu=$(nproc)
+cpus=${BENCH_CPUS:-$(cat /sys/devices/system/cpu/isolated 2>/dev/null)}
+if [ -z "$cpus" ]; then
+    if [ "$ncpu" -gt 1 ]; then cpus="1-$((ncpu - 1))"; else cpus=0; fi
+fi
+
+rev=$(git describe --always --dirty 2>/dev/null || echo unknown)
+mkdir -p bench
+out=bench/$rev-$(date +%Y%m%d-%H%M%S).json
+tmp=$(mktemp -d)
+trap 'rm -rf "$tmp"' EXIT
+
+printf '{"version": "%s", "date": "%s", "host": "%s", "rate_hz": %s, "seconds": %s, "cpus": "%s", "spin_us": %s, "runs": [\n' \
+    "$rev" "$(date -u +%Y-%m-%dT%H:%M:%SZ)" "$(uname -n)" "$rate" "$secs" "$cpus" "$spin" > "$out"
+sep=""
+for b in $buses; do
+for e in $engines; do
+    hs=$handoffs
+    [ "$e" = single ] && hs=${handoffs%% *} # no handoff without SPI threads
+for h in $hs; do
+for s in $scheds; do
+for l in $layouts; do
+for x in $rxs; do
+    echo "bench: $b buses, $e engine, $h handoff, $s scheduling, $l on cpus $cpus, $x receive"
+    ./knodeRT_sim -t 4 -b "$b" -e "$e" -H "$h" -s "$s" -a "$cpus" -L "$l" -R "$x" -S "$spin" -j "$tmp/node.json" "$port" > "$tmp/log" 2>&1 &
+    node=$!
+    sleep 0.5
+    ./rtc_sim -f seq -r "$rate" -d "$secs" -L -o "$tmp/client.json" "127.0.0.1:$port" 2>> "$tmp/log" | grep "^ \|Hz"
+    kill -TERM $node
+    wait $node
+    if [ ! -s "$tmp/client.json" ] || [ ! -s "$tmp/node.json" ]; then
+        cat "$tmp/log" >&2
+        echo "bench: run failed" >&2
+        exit 1
+    fi
+    printf '%s{"buses": %s, "engine": "%s", "handoff": "%s", "sched": "%s", "layout": "%s", "rx": "%s",\n "client": ' "$sep" "$b" "$e" "$h" "$s" "$l" "$x" >> "$out"
+    cat "$tmp/client.json" >> "$out"
+    printf ' ,"node": ' >> "$out"
+    cat "$tmp/node.json" >> "$out"
+    printf '}' >> "$out"
+    rm -f "$tmp/client.json" "$tmp/node.json"
+    sep=",
+"
+done
+done
+done
+done
+done
+done
+printf '\n]}\n' >> "$out"
+echo "bench: results in $out"
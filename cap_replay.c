@@ -0,0 +1,173 @@
+/**
+*   cap_replay.c
+*   Re-send a knodeRT capture (knodeRT -c) to a node
+*   Author: Aaron Hunter
+*   Date: 2025-12-17
+*
+*   By default the datagrams are sent with their original spacing, scaled by
+*   -x, so an incident can be reproduced against a bench node. With -f they
+*   are sent back to back to measure node throughput. On every loop after
+*   the first the sequence numbers of knode packets are advanced past the
+*   previous loop, so the node does not drop the repeats as stale.
+**/
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include "UDP_client.h"
+#include "capture.h"
+#include "histogram.h"
+
+#define NSEC_PER_SEC (1000*1000*1000)
+#define TRUE (1==1)
+#define FALSE (!TRUE)
+
+char ip_addr[80] = "127.0.0.1";
+char port[20] = "2345";
+int fast = FALSE;       // ignore the capture timing
+double speed = 1.0;     // replay speed factor
+int loops = 1;          // times to replay the capture
+
+static uint64_t now_ns(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+static void usage(const char *name){
+    fprintf(stderr, "Usage: %s [-s host] [-p port] [-f] [-x speed] [-l loops] capture.bin\n", name);
+}
+
+/**
+ * @brief Print a one line summary of the capture
+ */
+static void describe(const capture_t *cap){
+    uint64_t n = capture_records(cap);
+    uint64_t dropped = cap->hdr->count - n;
+
+    printf("capture: %llu records", (unsigned long long)n);
+    if (n > 0) {
+        printf(" over %.3f s", (capture_get(cap, n - 1)->rx_ns - capture_get(cap, 0)->rx_ns) / 1e9);
+    }
+    if (dropped > 0) {
+        printf(", %llu older records overwritten", (unsigned long long)dropped);
+    }
+    printf("\n");
+}
+
+int main(int argc, char *argv[]){
+    capture_t cap = {0};
+    histogram_t late;           // send time minus scheduled time
+    struct timespec sched_tmr = {0};
+    uint64_t n = {0};
+    uint64_t first_ns = {0};
+    uint64_t loop_ns = {0};     // capture length plus one mean gap
+    uint64_t start_ns = {0};
+    uint64_t due_ns = {0};
+    uint64_t sent = {0};
+    uint64_t errors = {0};
+    uint64_t bytes = {0};
+    uint8_t pkt[CAPTURE_DATA_SIZE];
+    size_t len = {0};
+    uint32_t seq_span = {0};   // added to the sequence numbers on every loop
+    double secs = {0};
+    int opt = {0}; // for getopt()
+
+    while ((opt = getopt(argc, argv, "hs:p:fx:l:")) != -1){
+        switch(opt){
+            case 's':
+                snprintf(ip_addr, sizeof(ip_addr), "%s", optarg);
+                break;
+            case 'p':
+                snprintf(port, sizeof(port), "%s", optarg);
+                break;
+            case 'f':
+                fast = TRUE;
+                break;
+            case 'x':
+                speed = atof(optarg);
+                if (speed <= 0) {
+                    fprintf(stderr, "Invalid speed: %s\n", optarg);
+                    return 1;
+                }
+                break;
+            case 'l':
+                loops = atoi(optarg);
+                if (loops < 1) {
+                    fprintf(stderr, "Invalid loop count: %s\n", optarg);
+                    return 1;
+                }
+                break;
+            case 'h':
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+    if (optind != argc - 1) {
+        usage(argv[0]);
+        return 1;
+    }
+    if (capture_open(&cap, argv[optind]) != 0) {
+        fprintf(stderr, "Failed to open capture %s: %s\n", argv[optind], strerror(errno));
+        return 1;
+    }
+    describe(&cap);
+    n = capture_records(&cap);
+    if (n == 0) return 0;
+    if (UDP_init(ip_addr, port) < 0) {
+        fprintf(stderr, "Failed UDP initialization, exiting...\n");
+        return 1;
+    }
+
+    // replay at RT priority when allowed, the timing is the point
+    struct sched_param param = {.sched_priority = 81};
+    if (pthread_setschedparam(pthread_self(), SCHED_FIFO, &param) != 0) {
+        fprintf(stderr, "Running without SCHED_FIFO, timing will be approximate\n");
+    }
+    mlockall(MCL_CURRENT | MCL_FUTURE);
+
+    hist_init(&late);
+    seq_span = capture_seq_span(&cap);
+    first_ns = capture_get(&cap, 0)->rx_ns;
+    loop_ns = capture_get(&cap, n - 1)->rx_ns - first_ns;
+    if (n > 1) loop_ns += loop_ns / (n - 1);
+    start_ns = now_ns();
+    for (int l = 0; l < loops; l++) {
+        for (uint64_t i = 0; i < n; i++) {
+            const capture_rec_t *r = capture_get(&cap, i);
+            if (fast == FALSE) {
+                due_ns = start_ns + (uint64_t)((l * loop_ns + (r->rx_ns - first_ns)) / speed);
+                sched_tmr.tv_sec = due_ns / NSEC_PER_SEC;
+                sched_tmr.tv_nsec = due_ns % NSEC_PER_SEC;
+                clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &sched_tmr, NULL);
+                hist_add(&late, now_ns() - due_ns);
+            }
+            // truncated records are sent as captured
+            len = capture_copy(r, pkt, l * seq_span);
+            if (UDP_send_protocol(pkt, len) == (int)len) {
+                sent++;
+                bytes += len;
+            } else {
+                errors++;
+            }
+        }
+    }
+    secs = (now_ns() - start_ns) / 1e9;
+
+    printf("sent %llu errors %llu in %.3f s, %.0f packets/s %.2f Mbit/s\n",
+           (unsigned long long)sent, (unsigned long long)errors, secs,
+           secs > 0 ? sent / secs : 0.0, secs > 0 ? bytes * 8 / secs / 1e6 : 0.0);
+    if (fast == FALSE) {
+        printf("send lateness p50 %.1f p99 %.1f max %.1f usec\n", hist_percentile(&late, 50) / 1e3,
+               hist_percentile(&late, 99) / 1e3, late.max / 1e3);
+    }
+    capture_close(&cap);
+    return 0;
+}
@@ -0,0 +1,163 @@
+/**
+ * @file capture.c
+ * @brief Memory mapped capture ring for received datagrams
+ * @author Aaron Hunter
+ * @date 2025-12-17
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <arpa/inet.h>
+#include "protocol.h"
+#include "capture.h"
+
+#define NSEC_PER_SEC (1000*1000*1000)
+
+static uint64_t clock_ns(clockid_t clk){
+    struct timespec ts;
+    clock_gettime(clk, &ts);
+    return (uint64_t)ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+static int map_file(capture_t *cap, int fd, size_t len, int prot){
+    void *p = mmap(NULL, len, prot, MAP_SHARED, fd, 0);
+
+    if (p == MAP_FAILED) return -1;
+    cap->hdr = (capture_hdr_t *)p;
+    cap->rec = (capture_rec_t *)((uint8_t *)p + sizeof(capture_hdr_t));
+    cap->map_len = len;
+    return 0;
+}
+
+int capture_create(capture_t *cap, const char *path, uint32_t capacity){
+    size_t len = sizeof(capture_hdr_t) + (size_t)capacity * sizeof(capture_rec_t);
+    int fd = {0};
+    int err = {0};
+
+    if (capacity == 0) {
+        errno = EINVAL;
+        return -1;
+    }
+    fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) return -1;
+    // allocate the blocks now, a write fault must never have to find space
+    err = posix_fallocate(fd, 0, len);
+    if (err == 0 && map_file(cap, fd, len, PROT_READ | PROT_WRITE) != 0) err = errno;
+    close(fd); // the mapping keeps the file open
+    if (err != 0) {
+        errno = err;
+        return -1;
+    }
+    // touch every page so none faults in on the RT thread
+    memset(cap->hdr, 0, len);
+    cap->hdr->magic = CAPTURE_MAGIC;
+    cap->hdr->version = CAPTURE_VERSION;
+    cap->hdr->rec_size = sizeof(capture_rec_t);
+    cap->hdr->capacity = capacity;
+    cap->hdr->start_ns = clock_ns(CLOCK_MONOTONIC);
+    cap->hdr->start_real_ns = clock_ns(CLOCK_REALTIME);
+    return 0;
+}
+
+int capture_open(capture_t *cap, const char *path){
+    capture_hdr_t hdr;
+    struct stat st;
+    int fd = open(path, O_RDONLY);
+    int err = {0};
+
+    if (fd < 0) return -1;
+    if (fstat(fd, &st) != 0 || read(fd, &hdr, sizeof(hdr)) != (ssize_t)sizeof(hdr)) {
+        err = errno;
+        close(fd);
+        errno = err;
+        return -1;
+    }
+    if (hdr.magic != CAPTURE_MAGIC || hdr.version != CAPTURE_VERSION
+        || hdr.rec_size != sizeof(capture_rec_t)
+        || (size_t)st.st_size < sizeof(hdr) + (size_t)hdr.capacity * sizeof(capture_rec_t)) {
+        close(fd);
+        errno = EINVAL;
+        return -1;
+    }
+    if (map_file(cap, fd, sizeof(hdr) + (size_t)hdr.capacity * sizeof(capture_rec_t), PROT_READ) != 0) {
+        err = errno;
+    }
+    close(fd);
+    errno = err;
+    return err == 0 ? 0 : -1;
+}
+
+void capture_write(capture_t *cap, uint64_t rx_ns, const uint8_t *data, size_t len){
+    uint64_t n = cap->hdr->count;
+    capture_rec_t *r = &cap->rec[n % cap->hdr->capacity];
+
+    r->rx_ns = rx_ns;
+    r->len = len > UINT16_MAX ? UINT16_MAX : (uint16_t)len;
+    r->caplen = len > CAPTURE_DATA_SIZE ? CAPTURE_DATA_SIZE : (uint16_t)len;
+    memcpy(r->data, data, r->caplen);
+    // publish the record after its contents, for a reader of the live file
+    __atomic_store_n(&cap->hdr->count, n + 1, __ATOMIC_RELEASE);
+}
+
+uint64_t capture_records(const capture_t *cap){
+    uint64_t n = __atomic_load_n(&cap->hdr->count, __ATOMIC_ACQUIRE);
+    return n < cap->hdr->capacity ? n : cap->hdr->capacity;
+}
+
+const capture_rec_t *capture_get(const capture_t *cap, uint64_t i){
+    uint64_t n = __atomic_load_n(&cap->hdr->count, __ATOMIC_ACQUIRE);
+    uint64_t first = n < cap->hdr->capacity ? 0 : n - cap->hdr->capacity;
+    return &cap->rec[(first + i) % cap->hdr->capacity];
+}
+
+int capture_seq(const capture_rec_t *r, uint32_t *seq){
+    knode_hdr_t hdr;
+
+    // classified by length like knode_decode(), a legacy command may start like a header
+    if (r->len == KNODE_LEGACY_SIZE || r->caplen < sizeof(hdr)) return 0;
+    memcpy(&hdr, r->data, sizeof(hdr));
+    if (hdr.version != KNODE_VERSION || hdr.type < KNODE_PKT_FULL || hdr.type > KNODE_PKT_DELTA_VAR) {
+        return 0;
+    }
+    *seq = ntohl(hdr.seq);
+    return 1;
+}
+
+uint32_t capture_seq_span(const capture_t *cap){
+    uint64_t n = capture_records(cap);
+    uint32_t seq = {0};
+    uint32_t seq_min = UINT32_MAX;
+    uint32_t seq_max = {0};
+
+    for (uint64_t i = 0; i < n; i++) {
+        if (capture_seq(capture_get(cap, i), &seq)) {
+            if (seq < seq_min) seq_min = seq;
+            if (seq > seq_max) seq_max = seq;
+        }
+    }
+    return seq_min <= seq_max ? seq_max - seq_min + 1 : 0;
+}
+
+size_t capture_copy(const capture_rec_t *r, uint8_t *buf, uint32_t seq_offset){
+    uint32_t seq = {0};
+
+    memcpy(buf, r->data, r->caplen);
+    if (seq_offset != 0 && capture_seq(r, &seq)) {
+        seq = htonl(seq + seq_offset);
+        memcpy(buf + offsetof(knode_hdr_t, seq), &seq, sizeof(seq));
+    }
+    return r->caplen;
+}
+
+void capture_close(capture_t *cap){
+    if (cap->hdr == NULL) return;
+    msync(cap->hdr, cap->map_len, MS_SYNC);
+    munmap(cap->hdr, cap->map_len);
+    cap->hdr = NULL;
+    cap->rec = NULL;
+}
@@ -0,0 +1,131 @@
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/**
+ * @file capture.h
+ * @brief Memory mapped capture ring for received datagrams
+ * @author Aaron Hunter
+ * @date 2025-12-17
+ * @details The capture file is a capture_hdr_t followed by a ring of
+ * fixed size capture_rec_t slots, all in host byte order. The file is
+ * sized and mapped when the capture is opened, so recording a datagram is a
+ * memcpy into locked memory with no system call. When the ring is full the
+ * oldest records are overwritten, count keeps the total so a reader can
+ * tell where the ring starts. Put the file on tmpfs (/dev/shm) so page
+ * writeback can never stall the RT thread, and copy it off afterwards.
+ */
+
+/************** defines *****************************/
+#define CAPTURE_MAGIC       0x5041434B  // "KCAP" little endian
+#define CAPTURE_VERSION     1
+#define CAPTURE_DATA_SIZE   112         // datagram bytes kept per record
+#define CAPTURE_RECORDS     65536       // default ring size, 8 MB
+
+/************** types *****************************/
+struct capture_hdr {
+    uint32_t magic;         // CAPTURE_MAGIC
+    uint16_t version;       // CAPTURE_VERSION
+    uint16_t rec_size;      // sizeof(capture_rec_t)
+    uint32_t capacity;      // records in the ring
+    uint32_t reserved;
+    uint64_t count;         // records written since the capture was opened
+    uint64_t start_ns;      // CLOCK_MONOTONIC time the capture was opened
+    uint64_t start_real_ns; // CLOCK_REALTIME at the same moment, to line up with logs
+    uint8_t pad[24];        // header is one 64 byte line
+};
+typedef struct capture_hdr capture_hdr_t;
+
+struct capture_rec {
+    uint64_t rx_ns;         // CLOCK_MONOTONIC receive time
+    uint16_t len;           // datagram length on the wire
+    uint16_t caplen;        // bytes kept in data, min(len, CAPTURE_DATA_SIZE)
+    uint32_t reserved;
+    uint8_t data[CAPTURE_DATA_SIZE];
+};
+typedef struct capture_rec capture_rec_t;
+
+struct capture {
+    capture_hdr_t *hdr;     // mapped file
+    capture_rec_t *rec;     // first slot of the ring
+    size_t map_len;         // bytes mapped
+};
+typedef struct capture capture_t;
+
+/**
+ * @brief Create a capture file and map it for writing
+ * @param cap Capture handle to fill in
+ * @param path File to create, truncated if it exists
+ * @param capacity Number of records in the ring
+ * @return int 0 on success, -1 with errno set on failure
+ */
+int capture_create(capture_t *cap, const char *path, uint32_t capacity);
+
+/**
+ * @brief Map an existing capture file for reading
+ * @param cap Capture handle to fill in
+ * @param path Capture file
+ * @return int 0 on success, -1 with errno set on failure
+ */
+int capture_open(capture_t *cap, const char *path);
+
+/**
+ * @brief Record a datagram
+ * @note Safe on the RT thread, no system calls and no allocation.
+ * @param cap Capture opened with capture_create()
+ * @param rx_ns Receive time
+ * @param data Datagram
+ * @param len Datagram length
+ */
+void capture_write(capture_t *cap, uint64_t rx_ns, const uint8_t *data, size_t len);
+
+/**
+ * @brief Number of records held in the ring
+ * @param cap Capture handle
+ * @return uint64_t records, at most the capacity
+ */
+uint64_t capture_records(const capture_t *cap);
+
+/**
+ * @brief Get a record by age
+ * @param cap Capture handle
+ * @param i Record index, 0 is the oldest held
+ * @return const capture_rec_t* the record
+ */
+const capture_rec_t *capture_get(const capture_t *cap, uint64_t i);
+
+/**
+ * @brief Sequence number of a captured knode command
+ * @param r Record
+ * @param seq Output sequence number
+ * @return int 1 if the record is a sequenced knode command, 0 otherwise
+ */
+int capture_seq(const capture_rec_t *r, uint32_t *seq);
+
+/**
+ * @brief Range of knode sequence numbers in a capture
+ * @param cap Capture handle
+ * @return uint32_t highest minus lowest sequence number plus one, 0 if none
+ */
+uint32_t capture_seq_span(const capture_t *cap);
+
+/**
+ * @brief Copy a captured datagram, advancing its sequence number
+ * @note Used to repeat a capture, pass loop * capture_seq_span() so the
+ * node does not drop the repeated commands as stale.
+ * @param r Record
+ * @param buf Output buffer, at least CAPTURE_DATA_SIZE bytes
+ * @param seq_offset Added to the sequence number of knode commands
+ * @return size_t bytes copied (r->caplen)
+ */
+size_t capture_copy(const capture_rec_t *r, uint8_t *buf, uint32_t seq_offset);
+
+/**
+ * @brief Flush and unmap a capture
+ * @param cap Capture handle
+ */
+void capture_close(capture_t *cap);
+
+#endif // CAPTURE_H
@@ -0,0 +1,165 @@
+/**
+ * @file conceal.c
+ * @brief Sequence tracking and loss concealment for the knode command stream
+ * @author Aaron Hunter
+ * @date 2025-12-04
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include "conceal.h"
+
+#define NSEC_PER_SEC (1000*1000*1000)
+#define SEQ_WINDOW   64 // number of sequence numbers tracked for duplicates
+#define SEQ_RESYNC_GAP (1<<20) // forward jumps larger than this are a sender restart
+
+/**
+ * @brief Difference a - b in nanoseconds
+ */
+static long diff_nsec(const struct timespec *a, const struct timespec *b){
+    return (a->tv_sec - b->tv_sec) * NSEC_PER_SEC + (a->tv_nsec - b->tv_nsec);
+}
+
+/**
+ * @brief Add nanoseconds to a timespec
+ */
+static void add_nsec(struct timespec *ts, long nsec){
+    ts->tv_sec += nsec / NSEC_PER_SEC;
+    ts->tv_nsec += nsec % NSEC_PER_SEC;
+    while (ts->tv_nsec >= NSEC_PER_SEC) {
+        ts->tv_sec += 1;
+        ts->tv_nsec -= NSEC_PER_SEC;
+    }
+}
+
+/**
+ * @brief Round and saturate to the int16_t range
+ */
+static int16_t saturate(float x){
+    if (x >= 32767.0f) return INT16_MAX;
+    if (x <= -32768.0f) return INT16_MIN;
+    return (int16_t)(x < 0 ? x - 0.5f : x + 0.5f);
+}
+
+seq_result_t seq_check(seq_track_t *st, uint32_t seq, knode_stats_t *stats){
+    int32_t d = {0}; // distance from the newest accepted sequence number
+
+    if (st->valid == 0) {
+        st->valid = 1;
+        st->last = seq;
+        st->seen = 1;
+        return SEQ_ACCEPT;
+    }
+    d = (int32_t)(seq - st->last);
+    if (d > 0 && d < SEQ_RESYNC_GAP) {
+        stats->seq_gaps += d - 1;
+        st->seen = (d < SEQ_WINDOW) ? (st->seen << d) | 1 : 1;
+        st->last = seq;
+        return SEQ_ACCEPT;
+    }
+    if (d >= SEQ_RESYNC_GAP || d <= -SEQ_WINDOW) {
+        // too old to be a reordered packet: the sender has restarted
+        stats->seq_resyncs++;
+        st->last = seq;
+        st->seen = 1;
+        return SEQ_ACCEPT;
+    }
+    if (st->seen & (1ULL << -d)) {
+        stats->seq_duplicates++;
+        return SEQ_DUPLICATE;
+    }
+    st->seen |= 1ULL << -d;
+    stats->seq_reordered++;
+    return SEQ_LATE;
+}
+
+void path_check(path_track_t *pt, uint32_t seq, int path, seq_result_t res, uint64_t rx_ns,
+                knode_stats_t *stats){
+    struct path_slot *slot = &pt->slot[seq & (PATH_TRACK_SEQS - 1)];
+
+    if (path < 0 || path >= STATS_MAX_PATHS) return;
+    pt->paths |= 1 << path;
+    if (res == SEQ_ACCEPT) {
+        // the slot's command never got a copy from every path
+        if (slot->mask != 0 && slot->seq != seq && (pt->paths & ~slot->mask) != 0) {
+            stats->path_only[slot->first]++;
+        }
+        slot->seq = seq;
+        slot->mask = 1 << path;
+        slot->first = path;
+        slot->rx_ns = rx_ns;
+        stats->path_wins[path]++;
+    } else if (res == SEQ_DUPLICATE && slot->seq == seq && slot->mask != 0 &&
+               !(slot->mask & (1 << path))) {
+        slot->mask |= 1 << path;
+        if (slot->rx_ns != 0 && rx_ns != 0) hist_add(&stats->path_lead_ns, rx_ns - slot->rx_ns);
+    }
+}
+
+void conceal_init(conceal_t *c, extrap_mode_t mode, int nvals, int max_periods){
+    memset(c, 0, sizeof(*c));
+    c->mode = mode;
+    c->nvals = nvals > CONCEAL_MAX_VALS ? CONCEAL_MAX_VALS : nvals;
+    c->max_periods = max_periods;
+}
+
+void conceal_push(conceal_t *c, const int16_t *vals, const struct timespec *t){
+    memmove(c->hist[1], c->hist[0], sizeof(c->hist[0]) * (CONCEAL_HIST - 1));
+    memcpy(c->hist[0], vals, sizeof(int16_t) * c->nvals);
+    if (c->count < CONCEAL_HIST) c->count++;
+    c->missed = 0;
+    c->t_last = *t;
+}
+
+int conceal_tick(conceal_t *c, int16_t *out, struct timespec *t_out,
+                 const struct timespec *now, long period_nsec, knode_stats_t *stats){
+    int k = c->missed + 1; // number of periods ahead of the last real command
+    int i = {0};
+    int j = {0};
+
+    if (c->mode == EXTRAP_HOLD || c->count == 0) return 0;
+    if (c->missed > c->max_periods) return 0; // already holding
+
+    // the k-th command is overdue half a period after its nominal arrival
+    if (diff_nsec(now, &c->t_last) < k * period_nsec + period_nsec / 2) return 0;
+
+    if (c->missed == c->max_periods) {
+        stats->conceal_expired++;
+        c->missed++;
+        return 0; // cap reached, hold the last extrapolated command
+    }
+
+    for (i = 0; i < c->nvals; i++) {
+        float pred = c->hist[0][i];
+        if (c->count >= 2 && c->mode == EXTRAP_DERIV) {
+            pred += ((float)c->hist[0][i] - (float)c->hist[1][i]) * k;
+        } else if (c->count >= 2) {
+            // least squares line over x = 0, -1, ... -(count-1)
+            float xm = -(c->count - 1) / 2.0f;
+            float ym = {0};
+            float sxy = {0};
+            float sxx = {0};
+            for (j = 0; j < c->count; j++) ym += c->hist[j][i];
+            ym /= c->count;
+            for (j = 0; j < c->count; j++) {
+                sxy += (-j - xm) * (c->hist[j][i] - ym);
+                sxx += (-j - xm) * (-j - xm);
+            }
+            pred = ym + (sxy / sxx) * (k - xm);
+        }
+        out[i] = saturate(pred);
+    }
+    *t_out = c->t_last;
+    add_nsec(t_out, k * period_nsec);
+    c->missed = k;
+    stats->conceal_frames++;
+    return 1;
+}
+
+extrap_mode_t conceal_parse_mode(const char *name){
+    if (strcmp(name, "hold") == 0) return EXTRAP_HOLD;
+    if (strcmp(name, "linear") == 0) return EXTRAP_LINEAR;
+    if (strcmp(name, "deriv") == 0) return EXTRAP_DERIV;
+    return (extrap_mode_t)-1;
+}
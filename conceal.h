@@ -0,0 +1,132 @@
+#ifndef CONCEAL_H
+#define CONCEAL_H
+
+#include <stdint.h>
+#include <time.h>
+#include "stats.h"
+
+/**
+ * @file conceal.h
+ * @brief Sequence tracking and loss concealment for the knode command stream
+ * @author Aaron Hunter
+ * @date 2025-12-04
+ * @details Sequence numbers classify every packet as new, duplicate or late.
+ * When the next command is overdue the concealer extrapolates from the last
+ * received commands, for at most max_periods RTC periods, then holds.
+ */
+
+/************** defines *****************************/
+#define CONCEAL_MAX_VALS 32 // maximum number of command words per frame
+#define CONCEAL_HIST     4  // number of received commands used for extrapolation
+#define PATH_TRACK_SEQS  64 // sequence numbers remembered for the path statistics, power of 2
+
+/************** types *****************************/
+typedef enum {
+    SEQ_ACCEPT = 0,     // newest packet so far, apply it
+    SEQ_DUPLICATE,      // already received, drop it
+    SEQ_LATE            // older than the last applied packet, drop it
+} seq_result_t;
+
+struct seq_track {
+    uint8_t valid;      // set once the first sequenced packet has arrived
+    uint32_t last;      // highest sequence number accepted
+    uint64_t seen;      // bit i is set if sequence number (last - i) was received
+};
+typedef struct seq_track seq_track_t;
+
+// copies received of one sequence number
+struct path_slot {
+    uint32_t seq;
+    uint8_t mask;       // 1 << path of every copy received, 0 for an unused slot
+    uint8_t first;      // path of the copy that was applied
+    uint64_t rx_ns;     // its kernel receive time, 0 if unknown
+};
+
+struct path_track {
+    uint8_t paths;      // 1 << path of every path seen from the sender
+    struct path_slot slot[PATH_TRACK_SEQS]; // by sequence number
+};
+typedef struct path_track path_track_t;
+
+typedef enum {
+    EXTRAP_HOLD = 0,    // keep the last command (no concealment)
+    EXTRAP_LINEAR,      // least squares line through the command history
+    EXTRAP_DERIV        // last command plus the last difference
+} extrap_mode_t;
+
+struct conceal {
+    extrap_mode_t mode;
+    int nvals;                  // number of command words per frame
+    int max_periods;            // cap on consecutive extrapolated frames
+    int count;                  // number of valid entries in hist
+    int missed;                 // periods concealed since the last real command
+    struct timespec t_last;     // receive time of the last real command
+    int16_t hist[CONCEAL_HIST][CONCEAL_MAX_VALS]; // hist[0] is the newest real command
+};
+typedef struct conceal conceal_t;
+
+/**
+ * @brief Classify a received sequence number and update the gap statistics
+ * @param st Pointer to the sequence tracking state
+ * @param seq Sequence number in host byte order
+ * @param stats Statistics to update
+ * @return seq_result_t SEQ_ACCEPT if the packet should be applied
+ */
+seq_result_t seq_check(seq_track_t *st, uint32_t seq, knode_stats_t *stats);
+
+/**
+ * @brief Count which path of a redundant sender delivered a command first
+ * @note An applied copy counts as a win for its path. A later copy of the
+ * same command on another path records how far behind it was, when both
+ * copies have a kernel receive time. A command
+ * still missing a copy from one of the sender's paths when its slot is
+ * reused, PATH_TRACK_SEQS sequence numbers later, counts as only arriving
+ * on the path it came on.
+ * @param pt Pointer to the path tracking state
+ * @param seq Sequence number in host byte order
+ * @param path Path from the packet header
+ * @param res What seq_check() made of the packet
+ * @param rx_ns Kernel receive time, 0 if the datagram has none
+ * @param stats Statistics to update
+ */
+void path_check(path_track_t *pt, uint32_t seq, int path, seq_result_t res, uint64_t rx_ns,
+                knode_stats_t *stats);
+
+/**
+ * @brief Initialize the concealer
+ * @param c Pointer to the concealer state
+ * @param mode Extrapolation policy
+ * @param nvals Number of command words per frame (<= CONCEAL_MAX_VALS)
+ * @param max_periods Maximum number of consecutive periods to extrapolate
+ */
+void conceal_init(conceal_t *c, extrap_mode_t mode, int nvals, int max_periods);
+
+/**
+ * @brief Record a real command
+ * @param c Pointer to the concealer state
+ * @param vals Command words in host byte order
+ * @param t Receive time (CLOCK_MONOTONIC)
+ */
+void conceal_push(conceal_t *c, const int16_t *vals, const struct timespec *t);
+
+/**
+ * @brief Check for an overdue command and extrapolate one if needed
+ * @param c Pointer to the concealer state
+ * @param out Extrapolated command words (nvals entries)
+ * @param t_out Nominal time of the extrapolated command
+ * @param now Current time (CLOCK_MONOTONIC)
+ * @param period_nsec Current estimate of the RTC period
+ * @param stats Statistics to update
+ * @return int 1 if out holds a new extrapolated command, 0 otherwise
+ */
+int conceal_tick(conceal_t *c, int16_t *out, struct timespec *t_out,
+                 const struct timespec *now, long period_nsec, knode_stats_t *stats);
+
+/**
+ * @brief Parse an extrapolation policy name
+ * @param name one of "hold", "linear" or "deriv"
+ * @return extrap_mode_t policy, or -1 if the name is not recognized
+ */
+extrap_mode_t conceal_parse_mode(const char *name);
+
+#endif // CONCEAL_H
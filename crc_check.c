@@ -76,8 +76,136 @@ uint16_t calc_crc16(uint16_t init_val, uint16_t data, uint16_t poly){
 }
 
 
+/**
+ * @brief builds the shift tables for incremental updates of an nwords message
+ * 
+ * @param tbl tables to fill in
+ * @param nwords number of 16 bit words covered by the crc (<= CRC16_MAX_WORDS)
+ * @param poly
+ */
+void crc16_shift_init(crc16_shift_t *tbl, int nwords, uint16_t poly){
+    int pos, q, v, step;
+    uint16_t crc;
+
+    if(nwords > CRC16_MAX_WORDS) nwords = CRC16_MAX_WORDS;
+    tbl->nwords = nwords;
+    for(pos=0; pos < nwords; pos++){
+        for(q=0; q < 4; q++){
+            for(v=0; v < 16; v++){
+                // word at pos goes through (nwords - pos) crc steps
+                crc = calc_crc16(0, (uint16_t)(v << (4*q)), poly);
+                for(step=pos+1; step < nwords; step++){
+                    crc = calc_crc16(crc, 0, poly);
+                }
+                tbl->nib[pos][q][v] = crc;
+            }
+        }
+    }
+}
+
+/**
+ * @brief returns the crc of a message after one of its words has changed
+ * 
+ * @param crc crc of the message before the change
+ * @param tbl shift tables from crc16_shift_init()
+ * @param pos index of the changed word
+ * @param old_word previous value of the word
+ * @param new_word new value of the word
+ * @return uint16_t 
+ */
+uint16_t crc16_update(uint16_t crc, const crc16_shift_t *tbl, int pos,
+                      uint16_t old_word, uint16_t new_word){
+    uint16_t diff = old_word ^ new_word;
+    const uint16_t (*nib)[16] = tbl->nib[pos];
+
+    return crc ^ nib[0][diff & 0xF] ^ nib[1][(diff >> 4) & 0xF]
+               ^ nib[2][(diff >> 8) & 0xF] ^ nib[3][diff >> 12];
+}
+
+
 #ifdef CRC_TESTING
-int main(int argc, char **argv)
+#include <stdlib.h>
+#include "timers.h"
+
+#define TEST_WORDS  26      // command words covered by the crc in knodeRT
+#define TEST_ITERS  100000  // randomized frames per test
+#define BENCH_ITERS 100000  // frames per benchmark run
+
+/**
+ * @brief full crc of a frame, as computed by append_crc()
+ */
+static uint16_t full_crc16(const uint16_t *words, int nwords, uint16_t poly){
+    uint16_t crc = 0xFFFF;
+    for(int i=0; i < nwords; i++){
+        crc = calc_crc16(crc, words[i], poly);
+    }
+    return crc;
+}
+
+/**
+ * @brief checks incremental updates against a full recompute on random frames
+ * @return int number of mismatches
+ */
+static int test_crc16_update(const crc16_shift_t *tbl, uint16_t poly){
+    uint16_t words[TEST_WORDS];
+    uint16_t crc, new_word;
+    int iter, k, nchanged, pos, fails = 0;
+
+    for(k=0; k < TEST_WORDS; k++) words[k] = rand();
+    crc = full_crc16(words, TEST_WORDS, poly);
+    for(iter=0; iter < TEST_ITERS; iter++){
+        nchanged = 1 + rand() % TEST_WORDS;
+        for(k=0; k < nchanged; k++){
+            pos = rand() % TEST_WORDS; // repeated positions are allowed
+            new_word = rand();
+            crc = crc16_update(crc, tbl, pos, words[pos], new_word);
+            words[pos] = new_word;
+        }
+        if(crc != full_crc16(words, TEST_WORDS, poly)){
+            fails++;
+            crc = full_crc16(words, TEST_WORDS, poly); // resync and carry on
+        }
+    }
+    return fails;
+}
+
+/**
+ * @brief times full and incremental crc updates for nchanged words per frame
+ */
+static void bench_crc16_update(const crc16_shift_t *tbl, uint16_t poly, int nchanged){
+    static uint16_t words[TEST_WORDS];
+    volatile uint16_t sink;
+    uint16_t crc = 0;
+    long int full_ns, incr_ns;
+    int iter, k, pos;
+
+    start_timer();
+    for(iter=0; iter < BENCH_ITERS; iter++){
+        for(k=0; k < nchanged; k++) words[(iter + k) % TEST_WORDS] += 1;
+        crc = full_crc16(words, TEST_WORDS, poly);
+    }
+    full_ns = stop_timer();
+    sink = crc;
+
+    start_timer();
+    for(iter=0; iter < BENCH_ITERS; iter++){
+        for(k=0; k < nchanged; k++){
+            pos = (iter + k) % TEST_WORDS;
+            crc = crc16_update(crc, tbl, pos, words[pos], words[pos] + 1);
+            words[pos] += 1;
+        }
+    }
+    incr_ns = stop_timer();
+    sink = crc;
+    (void)sink;
+    printf("%2d changed: full %6.1f ns/frame, incremental %6.1f ns/frame\n", nchanged,
+           (double)full_ns / BENCH_ITERS, (double)incr_ns / BENCH_ITERS);
+}
+
+/*
+ * Build with: cc -DCRC_TESTING -o crc_test crc_check.c timers.c
+ */
+int main(void)
 {
     uint32_t poly32 = 0x04C11DB7; // default 32 bit CRC polynomial
     // CRC-16-DNP
@@ -112,6 +240,15 @@ int main(int argc, char **argv)
     printf("%04X\n", calc_crc16(0xFFFF,data4.val,poly16)); // 0X7137
     printf("%04X\n", calc_crc16(0xFFFF,data5.val,poly16)); // 0XC2FF
 
+    // incremental crc over a knodeRT command frame
+    static crc16_shift_t shift;
+    crc16_shift_init(&shift, TEST_WORDS, poly16);
+    int fails = test_crc16_update(&shift, poly16);
+    printf("incremental crc: %d mismatches in %d frames\n", fails, TEST_ITERS);
+    for(int n=1; n <= 16; n *= 2){
+        bench_crc16_update(&shift, poly16, n);
+    }
+
 
     return(1);
 }
@@ -4,6 +4,20 @@
 
 #include<stdint.h>
 
+#define CRC16_MAX_WORDS 32 // longest message supported by the shift tables
+
+/**
+ * @brief Per-position shift tables for incremental CRC-16 updates
+ * @details calc_crc16() is linear over GF(2), so changing word i of an
+ * nwords message changes the final crc by T^(nwords-i)(old ^ new), where T
+ * is one calc_crc16() step with zero input. nib[i][q][v] holds that map
+ * applied to nibble q of the difference having value v.
+ */
+typedef struct crc16_shift {
+    int nwords;                               // message length in words
+    uint16_t nib[CRC16_MAX_WORDS][4][16];     // per-position nibble tables
+} crc16_shift_t;
+
 /**
  * @brief returns the remainder of binary division between initial value and crc polynomial
  * 
@@ -24,4 +38,26 @@ uint32_t calc_crc32(uint32_t init_val, uint32_t data, uint32_t poly);
  */
 uint16_t calc_crc16(uint16_t init_val, uint16_t data, uint16_t poly);
 
+/**
+ * @brief builds the shift tables for incremental updates of an nwords message
+ * 
+ * @param tbl tables to fill in
+ * @param nwords number of 16 bit words covered by the crc (<= CRC16_MAX_WORDS)
+ * @param poly
+ */
+void crc16_shift_init(crc16_shift_t *tbl, int nwords, uint16_t poly);
+
+/**
+ * @brief returns the crc of a message after one of its words has changed
+ * 
+ * @param crc crc of the message before the change
+ * @param tbl shift tables from crc16_shift_init()
+ * @param pos index of the changed word
+ * @param old_word previous value of the word
+ * @param new_word new value of the word
+ * @return uint16_t same value calc_crc16() gives over the whole new message
+ */
+uint16_t crc16_update(uint16_t crc, const crc16_shift_t *tbl, int pos,
+                      uint16_t old_word, uint16_t new_word);
+
 #endif //CRC_CHECK_H_
\ No newline at end of file
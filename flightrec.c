@@ -0,0 +1,170 @@
+/**
+ * @file flightrec.c
+ * @brief Flight recorder of the last knodeRT UDP loop periods
+ * @author Aaron Hunter
+ * @date 2025-12-27
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <syslog.h>
+#include "flightrec.h"
+
+#define NAME_SIZE 512
+#define NSEC_PER_SEC (1000*1000*1000)
+
+static uint64_t clock_ns(clockid_t id){
+    struct timespec ts = {0};
+
+    clock_gettime(id, &ts);
+    return (uint64_t)ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+/**
+ * @brief Write the frozen ring, oldest cycle first
+ * @return int 0 on success, -1 on failure
+ */
+static int write_dump(flightrec_t *fr, const char *path){
+    const flightrec_cycle_t *ring = fr->ring[!fr->active];
+    uint64_t end = fr->dump_end;
+    uint64_t first = fr->first[!fr->active];
+    flightrec_hdr_t hdr = {0};
+    FILE *fp = NULL;
+    int ret = 0;
+
+    if (end - first > fr->cycles) first = end - fr->cycles;
+    hdr.magic = FLIGHTREC_MAGIC;
+    hdr.version = FLIGHTREC_VERSION;
+    hdr.rec_size = sizeof(flightrec_cycle_t);
+    hdr.count = (uint32_t)(end - first);
+    hdr.buses = fr->buses;
+    hdr.reason = fr->reason;
+    hdr.perf_mask = fr->perf_mask;
+    hdr.trigger_period = fr->trigger_period;
+    hdr.period_ns = fr->period_ns;
+    hdr.threshold_ns = fr->threshold_ns;
+    hdr.mono_ns = clock_ns(CLOCK_MONOTONIC);
+    hdr.real_ns = clock_ns(CLOCK_REALTIME);
+
+    fp = fopen(path, "wb");
+    if (fp == NULL) return -1;
+    if (fwrite(&hdr, sizeof(hdr), 1, fp) != 1) ret = -1;
+    for (uint64_t p = first; p < end && ret == 0; p++) {
+        if (fwrite(&ring[p % fr->cycles], sizeof(flightrec_cycle_t), 1, fp) != 1) ret = -1;
+    }
+    if (fclose(fp) != 0) ret = -1;
+    return ret;
+}
+
+/**
+ * @brief Write each frozen ring handed over by the UDP loop
+ */
+static void *dump_thread(void *arg){
+    flightrec_t *fr = (flightrec_t *)arg;
+    char path[NAME_SIZE] = {0};
+
+    for (;;) {
+        while (sem_wait(&fr->dump_sem) != 0 && errno == EINTR) {
+        }
+        if (__atomic_load_n(&fr->dump_busy, __ATOMIC_ACQUIRE) == 0) {
+            if (__atomic_load_n(&fr->stop, __ATOMIC_ACQUIRE)) break;
+            continue;
+        }
+        snprintf(path, sizeof(path), "%s/flightrec_%d_%u.bin", fr->dir, (int)getpid(), fr->dumps);
+        if (write_dump(fr, path) == 0) {
+            syslog(LOG_NOTICE, "flight recorder: %s at period %llu, written to %s",
+                   fr->reason == FLIGHTREC_REASON_MISS ? "deadline miss" : "slow period",
+                   (unsigned long long)fr->trigger_period, path);
+        } else {
+            syslog(LOG_ERR, "flight recorder: failed to write %s: %s", path, strerror(errno));
+        }
+        __atomic_store_n(&fr->dump_busy, 0, __ATOMIC_RELEASE); // the ring is free again
+    }
+    return NULL;
+}
+
+int flightrec_init(flightrec_t *fr, uint32_t cycles, const char *dir, uint64_t period_ns,
+                   uint64_t threshold_ns){
+    memset(fr, 0, sizeof(*fr));
+    fr->cycles = cycles;
+    fr->dir = dir;
+    fr->period_ns = period_ns;
+    fr->threshold_ns = threshold_ns;
+    fr->post = -1;
+    for (int i = 0; i < 2; i++) {
+        fr->ring[i] = calloc(cycles, sizeof(flightrec_cycle_t));
+        if (fr->ring[i] == NULL) {
+            flightrec_close(fr);
+            return -1;
+        }
+        memset(fr->ring[i], 0, cycles * sizeof(flightrec_cycle_t)); // fault the pages in now
+    }
+    if (sem_init(&fr->dump_sem, 0, 0) != 0) {
+        flightrec_close(fr);
+        return -1;
+    }
+    if (pthread_create(&fr->dump_thread, NULL, dump_thread, fr) != 0) {
+        sem_destroy(&fr->dump_sem);
+        flightrec_close(fr);
+        return -1;
+    }
+    fr->cur = &fr->ring[0][0]; // set up, close has a thread to stop
+    return 0;
+}
+
+flightrec_cycle_t *flightrec_begin(flightrec_t *fr){
+    fr->cur = &fr->ring[fr->active][fr->period % fr->cycles];
+    memset(fr->cur, 0, sizeof(*fr->cur));
+    fr->cur->period = fr->period;
+    fr->cur->rx_len = -1;
+    return fr->cur;
+}
+
+void flightrec_end(flightrec_t *fr, int miss, uint64_t latency_ns){
+    flightrec_cycle_t *c = fr->cur;
+    int slow = (fr->threshold_ns > 0 && latency_ns > fr->threshold_ns);
+
+    if (miss) c->flags |= FLIGHTREC_MISS;
+    if (slow) c->flags |= FLIGHTREC_SLOW;
+    fr->period++;
+    if (fr->post > 0 && --fr->post == 0) {
+        // freeze this ring for the dump thread and record into the other one
+        fr->post = -1;
+        fr->dump_end = fr->period;
+        fr->active = !fr->active;
+        fr->first[fr->active] = fr->period;
+        fr->dumps++;
+        __atomic_store_n(&fr->dump_busy, 1, __ATOMIC_RELEASE);
+        sem_post(&fr->dump_sem);
+    }
+    if ((miss || slow) && fr->post < 0) {
+        if (__atomic_load_n(&fr->dump_busy, __ATOMIC_ACQUIRE) || fr->dumps >= FLIGHTREC_MAX_DUMPS) {
+            fr->suppressed++;
+        } else {
+            c->flags |= FLIGHTREC_TRIGGER;
+            fr->triggers++;
+            fr->reason = miss ? FLIGHTREC_REASON_MISS : FLIGHTREC_REASON_SLOW;
+            fr->trigger_period = c->period;
+            fr->post = FLIGHTREC_POST_CYCLES;
+        }
+    }
+}
+
+void flightrec_close(flightrec_t *fr){
+    if (fr->cur != NULL) {
+        __atomic_store_n(&fr->stop, 1, __ATOMIC_RELEASE);
+        sem_post(&fr->dump_sem);
+        pthread_join(fr->dump_thread, NULL);
+        sem_destroy(&fr->dump_sem);
+    }
+    for (int i = 0; i < 2; i++) {
+        free(fr->ring[i]);
+        fr->ring[i] = NULL;
+    }
+    fr->cur = NULL;
+    fr->cycles = 0;
+}
@@ -0,0 +1,159 @@
+#ifndef FLIGHTREC_H
+#define FLIGHTREC_H
+
+#include <stdint.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include "perfctr.h"
+
+/**
+ * @file flightrec.h
+ * @brief Flight recorder of the last knodeRT UDP loop periods
+ * @author Aaron Hunter
+ * @date 2025-12-27
+ * @details The UDP loop fills one flightrec_cycle_t per period with the
+ * time of every stage (wake-up, receive, decode, crc, handoff, SPI on each
+ * bus, collection) and the state that drove it, into a ring of the last
+ * cycles. Recording is a few stores and clock reads per period and never
+ * blocks. A deadline miss, or a period over the latency threshold,
+ * triggers a snapshot: the loop records FLIGHTREC_POST_CYCLES more periods
+ * so the SPI completions of the late frame are included, then freezes the
+ * ring and carries on in a second one. A low priority thread writes the
+ * frozen ring to <dir>/flightrec_<pid>_<n>.bin and hands it back. A trigger
+ * while the previous snapshot is still being written is only counted.
+ *
+ * A dump is a flightrec_hdr_t followed by the cycles, oldest first, all in
+ * host byte order. python/flightrec_trace.py converts dumps to a Chrome
+ * trace, keep it in step with these structures.
+ */
+
+/************** defines *****************************/
+#define FLIGHTREC_MAGIC     0x524c464b  // "KFLR" little endian
+#define FLIGHTREC_VERSION   1
+#define FLIGHTREC_CYCLES    1024        // default periods kept
+#define FLIGHTREC_POST_CYCLES 16        // periods recorded after the trigger
+#define FLIGHTREC_MAX_DUMPS 20          // snapshots written per run
+#define FLIGHTREC_MAX_BUSES 5
+
+// flightrec_cycle_t.flags
+#define FLIGHTREC_RX        0x01        // a datagram was received
+#define FLIGHTREC_CMD       0x02        // it was applied as a new command
+#define FLIGHTREC_SYNTH     0x04        // an interpolated or extrapolated frame was dispatched
+#define FLIGHTREC_MISS      0x08        // the period missed its deadline
+#define FLIGHTREC_SLOW      0x10        // the period exceeded the latency threshold
+#define FLIGHTREC_TRIGGER   0x20        // this period triggered the snapshot
+
+// flightrec_hdr_t.reason
+#define FLIGHTREC_REASON_MISS   1
+#define FLIGHTREC_REASON_SLOW   2
+
+/************** types *****************************/
+struct flightrec_bus {
+    uint64_t start_ns;          // start of the last transfer collected this period, 0 for none
+    uint64_t done_ns;           // its completion
+    uint32_t seq;               // command sequence number in the frame
+    uint8_t status;             // KNODE_TLM_* flags of the transfer
+    uint8_t pad[3];
+};
+
+struct flightrec_cycle {
+    uint64_t period;            // UDP loop period count
+    uint64_t wake_ns;           // end of the sleep before the period
+    uint64_t rx_ns;             // receive returned
+    uint64_t decode_ns;         // datagram decoded, 0 without one
+    uint64_t crc_ns;            // crc of the last frame computed, 0 without a frame
+    uint64_t handoff_ns;        // last frame handed to the SPI threads, or written with -e single
+    uint64_t collect_ns;        // SPI results collected
+    uint64_t end_ns;            // work done, the loop goes to sleep
+    uint64_t deadline_ns;       // end of the period
+    int32_t rx_len;             // datagram length, -1 without one
+    uint32_t seq;               // last accepted command sequence number
+    uint32_t frame;             // dispatch count of the last frame
+    uint16_t conceal_missed;    // periods concealed since the last real command
+    uint8_t flags;              // FLIGHTREC_*
+    uint8_t tlm_count;          // telemetry records waiting after the period
+    uint64_t perf[PERFCTR_COUNT]; // UDP thread counter deltas of the period, with -p
+    struct flightrec_bus bus[FLIGHTREC_MAX_BUSES];
+};
+typedef struct flightrec_cycle flightrec_cycle_t;
+
+struct flightrec_hdr {
+    uint32_t magic;             // FLIGHTREC_MAGIC
+    uint16_t version;           // FLIGHTREC_VERSION
+    uint16_t rec_size;          // sizeof(flightrec_cycle_t)
+    uint32_t count;             // cycles in the dump
+    uint32_t buses;             // SPI buses in use
+    uint32_t reason;            // FLIGHTREC_REASON_*
+    uint32_t perf_mask;         // performance counters recorded, 1 << PERFCTR_*
+    uint64_t trigger_period;    // period that triggered the snapshot
+    uint64_t period_ns;         // UDP loop period
+    uint64_t threshold_ns;      // latency threshold, 0 for deadline misses only
+    uint64_t mono_ns;           // CLOCK_MONOTONIC time of the dump
+    uint64_t real_ns;           // CLOCK_REALTIME at the same moment, to line up with logs
+};
+typedef struct flightrec_hdr flightrec_hdr_t;
+
+struct flightrec {
+    flightrec_cycle_t *ring[2]; // recording ring and the one frozen or free
+    int active;                 // ring being recorded
+    uint64_t first[2];          // first period recorded into each ring
+    uint32_t cycles;            // periods per ring
+    uint64_t period;            // periods recorded
+    flightrec_cycle_t *cur;     // slot of the period in progress
+    int post;                   // periods left before the freeze, -1 when not triggered
+    uint32_t reason;            // reason of the pending trigger
+    uint64_t trigger_period;
+    int dump_busy;              // frozen ring not written yet, shared with the dump thread
+    uint64_t triggers;          // snapshots triggered
+    uint64_t suppressed;        // triggers dropped while a snapshot was pending
+    uint32_t dumps;             // snapshots handed to the dump thread
+    // read by the dump thread
+    uint64_t dump_end;          // period after the last one in the frozen ring
+    const char *dir;
+    uint32_t buses;
+    uint32_t perf_mask;
+    uint64_t period_ns;
+    uint64_t threshold_ns;
+    int stop;                   // dump thread exits once the pending snapshot is written
+    sem_t dump_sem;
+    pthread_t dump_thread;
+};
+typedef struct flightrec flightrec_t;
+
+/**
+ * @brief Allocate the rings and start the dump thread
+ * @param fr Recorder to set up
+ * @param cycles Periods kept per snapshot
+ * @param dir Directory the snapshots are written to
+ * @param period_ns UDP loop period
+ * @param threshold_ns Period latency that triggers a snapshot, 0 for
+ * deadline misses only
+ * @return int 0 on success, -1 on failure
+ * @note Call from a non real time thread, the dump thread inherits its
+ * scheduling.
+ */
+int flightrec_init(flightrec_t *fr, uint32_t cycles, const char *dir, uint64_t period_ns,
+                   uint64_t threshold_ns);
+
+/**
+ * @brief Start recording a period
+ * @param fr Recorder
+ * @return flightrec_cycle_t* cleared slot for the period
+ */
+flightrec_cycle_t *flightrec_begin(flightrec_t *fr);
+
+/**
+ * @brief Finish the period, checking the deadline and the threshold
+ * @param fr Recorder
+ * @param miss TRUE if the period missed its deadline
+ * @param latency_ns Latency of the period checked against the threshold
+ */
+void flightrec_end(flightrec_t *fr, int miss, uint64_t latency_ns);
+
+/**
+ * @brief Stop the dump thread once the pending snapshot is written, free the rings
+ * @param fr Recorder, may never have been set up
+ */
+void flightrec_close(flightrec_t *fr);
+
+#endif // FLIGHTREC_H
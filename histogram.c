@@ -0,0 +1,75 @@
+/**
+ * @file histogram.c
+ * @brief Log-linear latency histogram
+ * @author Aaron Hunter
+ * @date 2025-12-12
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "histogram.h"
+
+/**
+ * @brief Bucket index of a value
+ */
+static int bucket_of(uint64_t val){
+    int msb = {0};
+
+    if (val < HIST_SUB_BUCKETS) return (int)val;
+    msb = 63 - __builtin_clzll(val);
+    return (msb - HIST_SUB_BITS + 1) * HIST_SUB_BUCKETS
+           + (int)((val >> (msb - HIST_SUB_BITS)) & (HIST_SUB_BUCKETS - 1));
+}
+
+/**
+ * @brief Largest value that falls into a bucket
+ */
+static uint64_t bucket_max(int idx){
+    int msb = idx / HIST_SUB_BUCKETS + HIST_SUB_BITS - 1;
+    uint64_t sub = idx % HIST_SUB_BUCKETS;
+
+    if (idx < HIST_SUB_BUCKETS) return (uint64_t)idx;
+    return ((HIST_SUB_BUCKETS + sub + 1) << (msb - HIST_SUB_BITS)) - 1;
+}
+
+void hist_init(histogram_t *h){
+    memset(h, 0, sizeof(*h));
+    h->min = UINT64_MAX;
+}
+
+void hist_add(histogram_t *h, uint64_t val){
+    h->count++;
+    h->sum += val;
+    if (val < h->min) h->min = val;
+    if (val > h->max) h->max = val;
+    h->bucket[bucket_of(val)]++;
+}
+
+uint64_t hist_percentile(const histogram_t *h, double pct){
+    uint64_t target = (uint64_t)(h->count * pct / 100.0);
+    uint64_t seen = {0};
+
+    if (h->count == 0) return 0;
+    if (target >= h->count) target = h->count - 1;
+    for (int i = 0; i < HIST_BUCKETS; i++) {
+        seen += h->bucket[i];
+        if (seen > target) {
+            uint64_t ub = bucket_max(i);
+            return ub < h->max ? ub : h->max;
+        }
+    }
+    return h->max;
+}
+
+void hist_json(FILE *fp, const histogram_t *h, double scale){
+    if (h->count == 0) {
+        fprintf(fp, "{\"count\": 0}");
+        return;
+    }
+    fprintf(fp, "{\"count\": %llu, \"min\": %.3f, \"mean\": %.3f, \"p50\": %.3f, "
+            "\"p90\": %.3f, \"p99\": %.3f, \"p999\": %.3f, \"max\": %.3f}",
+            (unsigned long long)h->count, h->min / scale, (double)h->sum / h->count / scale,
+            hist_percentile(h, 50) / scale, hist_percentile(h, 90) / scale,
+            hist_percentile(h, 99) / scale, hist_percentile(h, 99.9) / scale, h->max / scale);
+}
@@ -0,0 +1,62 @@
+#ifndef HISTOGRAM_H
+#define HISTOGRAM_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+/**
+ * @file histogram.h
+ * @brief Log-linear latency histogram
+ * @author Aaron Hunter
+ * @date 2025-12-12
+ * @details Values are bucketed by their most significant bit with
+ * HIST_SUB_BUCKETS linear steps per power of two, so the relative error of
+ * a percentile is below 1/HIST_SUB_BUCKETS. Recording is a few integer
+ * operations and never allocates, so it is safe on the RT threads.
+ */
+
+/************** defines *****************************/
+#define HIST_SUB_BITS    3
+#define HIST_SUB_BUCKETS (1 << HIST_SUB_BITS)
+#define HIST_BUCKETS     (64 * HIST_SUB_BUCKETS)
+
+/************** types *****************************/
+struct histogram {
+    uint64_t count;
+    uint64_t sum;
+    uint64_t min;
+    uint64_t max;
+    uint64_t bucket[HIST_BUCKETS];
+};
+typedef struct histogram histogram_t;
+
+/**
+ * @brief Clear a histogram
+ * @param h Pointer to the histogram
+ */
+void hist_init(histogram_t *h);
+
+/**
+ * @brief Record a value
+ * @param h Pointer to the histogram
+ * @param val Value to record, typically nanoseconds
+ */
+void hist_add(histogram_t *h, uint64_t val);
+
+/**
+ * @brief Estimate a percentile
+ * @param h Pointer to the histogram
+ * @param pct Percentile, 0 to 100
+ * @return uint64_t upper bound of the bucket holding the percentile
+ */
+uint64_t hist_percentile(const histogram_t *h, double pct);
+
+/**
+ * @brief Write a histogram summary as a JSON object
+ * @param fp Output stream
+ * @param h Pointer to the histogram
+ * @param scale Divisor applied to every value (e.g. 1000 for ns to usec)
+ */
+void hist_json(FILE *fp, const histogram_t *h, double scale);
+
+#endif // HISTOGRAM_H
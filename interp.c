@@ -0,0 +1,111 @@
+/**
+ * @file interp.c
+ * @brief Upsampling interpolator for the knode command stream
+ * @author Aaron Hunter
+ * @date 2025-12-02
+ * @details Generates intermediate frames between received commands so the
+ * SPI boards are updated on every node tick without raising the packet rate.
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include "interp.h"
+
+#define NSEC_PER_SEC (1000*1000*1000)
+#define PERIOD_MIN_NSEC (50*1000)       // reject inter-arrival times shorter than this
+#define PERIOD_MAX_NSEC (100*1000*1000) // and longer than this (stream restart)
+
+/**
+ * @brief Difference a - b in nanoseconds
+ */
+static long diff_nsec(const struct timespec *a, const struct timespec *b){
+    return (a->tv_sec - b->tv_sec) * NSEC_PER_SEC + (a->tv_nsec - b->tv_nsec);
+}
+
+/**
+ * @brief Round and saturate to the int16_t range
+ */
+static int16_t saturate(float x){
+    if (x >= 32767.0f) return INT16_MAX;
+    if (x <= -32768.0f) return INT16_MIN;
+    return (int16_t)(x < 0 ? x - 0.5f : x + 0.5f);
+}
+
+void interp_init(interp_t *ip, interp_mode_t mode, int nvals, long period_nsec){
+    memset(ip, 0, sizeof(*ip));
+    ip->mode = mode;
+    ip->nvals = nvals > INTERP_MAX_VALS ? INTERP_MAX_VALS : nvals;
+    ip->period_nsec = period_nsec;
+}
+
+void interp_push(interp_t *ip, const int16_t *vals, const struct timespec *t){
+    long dt = {0};
+
+    // update the input period estimate (EWMA, weight 1/8)
+    if (ip->count > 0) {
+        dt = diff_nsec(t, &ip->t_last);
+        if (dt >= PERIOD_MIN_NSEC && dt <= PERIOD_MAX_NSEC) {
+            ip->period_nsec += (dt - ip->period_nsec) / 8;
+        }
+    }
+    // shift the history and insert the newest command
+    memmove(ip->hist[1], ip->hist[0], sizeof(ip->hist[0]) * (INTERP_HIST - 1));
+    memcpy(ip->hist[0], vals, sizeof(int16_t) * ip->nvals);
+    if (ip->count < INTERP_HIST) ip->count++;
+    ip->t_last = *t;
+}
+
+int interp_sample(const interp_t *ip, int16_t *out, const struct timespec *t){
+    interp_mode_t mode = ip->mode;
+    float u = {0}; // phase within the current input period [0, 1]
+    int i = {0};
+
+    if (ip->count == 0) return 0;
+
+    // fall back to a lower order until enough history is available
+    if (mode == INTERP_CUBIC && ip->count < 4) mode = INTERP_LINEAR;
+    if (mode == INTERP_LINEAR && ip->count < 2) mode = INTERP_ZOH;
+
+    u = (float)diff_nsec(t, &ip->t_last) / (float)ip->period_nsec;
+    if (u < 0.0f) u = 0.0f;
+    if (u > 1.0f) u = 1.0f;
+
+    switch (mode) {
+        case INTERP_LINEAR:
+            // ramp from the previous command to the newest over one period
+            for (i = 0; i < ip->nvals; i++) {
+                float p0 = ip->hist[1][i];
+                float p1 = ip->hist[0][i];
+                out[i] = saturate(p0 + (p1 - p0) * u);
+            }
+            break;
+        case INTERP_CUBIC:
+            // Catmull-Rom segment hist[2] -> hist[1], hist[0] is the lookahead
+            for (i = 0; i < ip->nvals; i++) {
+                float p0 = ip->hist[3][i];
+                float p1 = ip->hist[2][i];
+                float p2 = ip->hist[1][i];
+                float p3 = ip->hist[0][i];
+                float a = -0.5f * p0 + 1.5f * p1 - 1.5f * p2 + 0.5f * p3;
+                float b = p0 - 2.5f * p1 + 2.0f * p2 - 0.5f * p3;
+                float c = -0.5f * p0 + 0.5f * p2;
+                out[i] = saturate(((a * u + b) * u + c) * u + p1);
+            }
+            break;
+        case INTERP_ZOH:
+        case INTERP_NONE:
+        default:
+            memcpy(out, ip->hist[0], sizeof(int16_t) * ip->nvals);
+            break;
+    }
+    return 1;
+}
+
+interp_mode_t interp_parse_mode(const char *name){
+    if (strcmp(name, "none") == 0) return INTERP_NONE;
+    if (strcmp(name, "zoh") == 0) return INTERP_ZOH;
+    if (strcmp(name, "linear") == 0) return INTERP_LINEAR;
+    if (strcmp(name, "cubic") == 0) return INTERP_CUBIC;
+    return (interp_mode_t)-1;
+}
@@ -0,0 +1,72 @@
+#ifndef INTERP_H
+#define INTERP_H
+
+#include <stdint.h>
+#include <time.h>
+
+/**
+ * @file interp.h
+ * @brief Upsampling interpolator for the knode command stream
+ * @author Aaron Hunter
+ * @date 2025-12-02
+ * @details The RTC sends commands at its own rate (1 kHz from rtc_sim) while
+ * knodeRT ticks every PERIOD_NSEC. The interpolator keeps the most recent
+ * commands and generates an intermediate frame on every node tick.
+ */
+
+/************** defines *****************************/
+#define INTERP_MAX_VALS 32  // maximum number of command words per frame
+#define INTERP_HIST     4   // number of received commands kept for interpolation
+
+/************** types *****************************/
+typedef enum {
+    INTERP_NONE = 0,    // pass-through: only send when a new command arrives
+    INTERP_ZOH,         // zero-order hold: resend the latest command every tick
+    INTERP_LINEAR,      // linear between the last two commands (one period delay)
+    INTERP_CUBIC        // Catmull-Rom with one sample lookahead (two period delay)
+} interp_mode_t;
+
+struct interp {
+    interp_mode_t mode;
+    int nvals;                  // number of command words per frame
+    int count;                  // number of valid entries in hist (saturates at INTERP_HIST)
+    long period_nsec;           // estimated input period
+    struct timespec t_last;     // receive time of the newest command
+    int16_t hist[INTERP_HIST][INTERP_MAX_VALS]; // hist[0] is the newest command
+};
+typedef struct interp interp_t;
+
+/**
+ * @brief Initialize the interpolator
+ * @param ip Pointer to the interpolator state
+ * @param mode Interpolation mode
+ * @param nvals Number of command words per frame (<= INTERP_MAX_VALS)
+ * @param period_nsec Nominal input period, used until it has been measured
+ */
+void interp_init(interp_t *ip, interp_mode_t mode, int nvals, long period_nsec);
+
+/**
+ * @brief Add a newly received command to the history
+ * @param ip Pointer to the interpolator state
+ * @param vals Command words in host byte order
+ * @param t Receive time of the command (CLOCK_MONOTONIC)
+ */
+void interp_push(interp_t *ip, const int16_t *vals, const struct timespec *t);
+
+/**
+ * @brief Generate the frame for the current node tick
+ * @param ip Pointer to the interpolator state
+ * @param out Output command words (nvals entries)
+ * @param t Current time (CLOCK_MONOTONIC)
+ * @return int 1 if a frame was generated, 0 if no command has been received yet
+ */
+int interp_sample(const interp_t *ip, int16_t *out, const struct timespec *t);
+
+/**
+ * @brief Parse an interpolation mode name
+ * @param name one of "none", "zoh", "linear" or "cubic"
+ * @return interp_mode_t mode, or -1 if the name is not recognized
+ */
+interp_mode_t interp_parse_mode(const char *name);
+
+#endif // INTERP_H
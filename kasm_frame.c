@@ -0,0 +1,38 @@
+/**
+ * @file kasm_frame.c
+ * @brief Board table and crc table of the KASM SPI frames
+ * @author Aaron Hunter
+ * @date 2025-12-30
+ */
+
+#include <string.h>
+#include "kasm_frame.h"
+
+// one calc_crc16() step with zero input, applied 8 times to a byte in the high half
+#define CRC_STEP(c)     ((((c) << 1) ^ ((((c) >> 15) & 1) * KASM_CRC_POLY)) & 0xFFFF)
+#define CRC_STEP8(c)    CRC_STEP(CRC_STEP(CRC_STEP(CRC_STEP(CRC_STEP(CRC_STEP(CRC_STEP(CRC_STEP(c))))))))
+#define CRC_ENTRY(b)    CRC_STEP8((b) << 8)
+#define CRC_ROW(b)      CRC_ENTRY((b) + 0), CRC_ENTRY((b) + 1), CRC_ENTRY((b) + 2), CRC_ENTRY((b) + 3), \
+                        CRC_ENTRY((b) + 4), CRC_ENTRY((b) + 5), CRC_ENTRY((b) + 6), CRC_ENTRY((b) + 7), \
+                        CRC_ENTRY((b) + 8), CRC_ENTRY((b) + 9), CRC_ENTRY((b) + 10), CRC_ENTRY((b) + 11), \
+                        CRC_ENTRY((b) + 12), CRC_ENTRY((b) + 13), CRC_ENTRY((b) + 14), CRC_ENTRY((b) + 15)
+
+const uint16_t kasm_crc_table[256] = {
+    CRC_ROW(0x00), CRC_ROW(0x10), CRC_ROW(0x20), CRC_ROW(0x30),
+    CRC_ROW(0x40), CRC_ROW(0x50), CRC_ROW(0x60), CRC_ROW(0x70),
+    CRC_ROW(0x80), CRC_ROW(0x90), CRC_ROW(0xA0), CRC_ROW(0xB0),
+    CRC_ROW(0xC0), CRC_ROW(0xD0), CRC_ROW(0xE0), CRC_ROW(0xF0)
+};
+
+#define KASM_BOARD_ENTRY(name, words) \
+    {#name, (words), KASM_FRAME_BYTES(words), kasm_pack_##name, kasm_unpack_##name, kasm_check_##name},
+const kasm_board_t kasm_boards[KASM_NUM_BOARDS] = {
+    KASM_BOARDS(KASM_BOARD_ENTRY)
+};
+
+int kasm_board_parse(const char *name){
+    for (int b = 0; b < KASM_NUM_BOARDS; b++) {
+        if (strcmp(name, kasm_boards[b].name) == 0) return b;
+    }
+    return -1;
+}
@@ -0,0 +1,121 @@
+#ifndef KASM_FRAME_H
+#define KASM_FRAME_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+/**
+ * @file kasm_frame.h
+ * @brief Layout of the SPI frames of every KASM board type
+ * @author Aaron Hunter
+ * @date 2025-12-30
+ * @details A KASM frame is the board's command words followed by a CRC-16
+ * word over them, all in host byte order:
+ *
+ *     word 0 .. words-1   command values
+ *     word words          crc
+ *
+ * KASM_BOARDS() is the one definition of the board types. Each entry
+ * X(name, words) generates, with the word count a constant:
+ *
+ *     size_t   kasm_pack_<name>(union CMD_DATA *f, const int16_t *vals)
+ *     void     kasm_unpack_<name>(int16_t *vals, const union CMD_DATA *f)
+ *     uint16_t kasm_crc_<name>(const union CMD_DATA *f)
+ *     uint16_t kasm_check_<name>(const union CMD_DATA *f)
+ *
+ * pack copies the command values and appends the crc, returning the frame
+ * length. check runs the crc over the words and the crc word, 0 for a good
+ * frame. The crc is the bitwise calc_crc16() with KASM_CRC_POLY and
+ * KASM_CRC_INIT, done a byte at a time from kasm_crc_table, which is
+ * computed by the preprocessor. kasm_boards[] lists the types for a board
+ * picked at run time, indexed by KASM_BOARD_<name>.
+ *
+ * A board with fewer words than KASM_MAX_WORDS takes the first words of the
+ * command. union CMD_DATA holds the largest frame, a shorter one leaves the
+ * rest unused. To add a board type add a line to KASM_BOARDS().
+ */
+
+/************** defines *****************************/
+#define KASM_CRC_POLY   0x3D65  // CRC-16-DNP polynomial
+#define KASM_CRC_INIT   0xFFFF  // initial value of the crc
+
+//  X(name, words)
+#define KASM_BOARDS(X) \
+    X(kasm26, 26)   /* KASM board, the original 54 byte frame */ \
+    X(kasm24, 24)   /* 3 DAC80508, the 24 DAC channels only */ \
+    X(kasm16, 16)   /* 2 DAC80508 */ \
+    X(kasm8, 8)     /* 1 DAC80508 */
+
+#define KASM_MAX_WORDS  26      // command words of the largest board
+#define KASM_CMD_SIZE   (KASM_MAX_WORDS * 2)        // command bytes of the largest frame
+#define KASM_FRAME_SIZE (KASM_CMD_SIZE + 2)         // largest frame, including crc16
+#define KASM_FRAME_BYTES(words) ((words) * 2 + 2)   // frame length of a board
+// the frame routines are inlined whatever the optimisation level, knodeRT builds without -O
+#define KASM_INLINE static inline __attribute__((always_inline))
+
+/************** types *****************************/
+union CMD_DATA {
+    unsigned char bytes[KASM_FRAME_SIZE];
+    int16_t values[KASM_FRAME_SIZE/2];
+};
+
+#define KASM_BOARD_ENUM(name, words) KASM_BOARD_##name,
+enum kasm_board_id {
+    KASM_BOARDS(KASM_BOARD_ENUM)
+    KASM_NUM_BOARDS
+};
+#undef KASM_BOARD_ENUM
+
+struct kasm_board {
+    const char *name;
+    int words;                  // command words
+    int bytes;                  // frame length, crc included
+    size_t (*pack)(union CMD_DATA *f, const int16_t *vals);
+    void (*unpack)(int16_t *vals, const union CMD_DATA *f);
+    uint16_t (*check)(const union CMD_DATA *f);
+};
+typedef struct kasm_board kasm_board_t;
+
+extern const uint16_t kasm_crc_table[256];  // crc of each byte shifted through the polynomial
+extern const kasm_board_t kasm_boards[KASM_NUM_BOARDS];
+
+/**
+ * @brief Find a board type by name
+ * @param name Board name, e.g. "kasm26"
+ * @return int KASM_BOARD_* index, -1 if there is no such board
+ */
+int kasm_board_parse(const char *name);
+
+// shift word w through crc, high byte first, as calc_crc16(crc, w, KASM_CRC_POLY)
+#define KASM_CRC_WORD(crc, w) do { \
+        uint16_t w_ = (uint16_t)(w); \
+        (crc) = (uint16_t)((crc) << 8) ^ kasm_crc_table[(((crc) >> 8) ^ (w_ >> 8)) & 0xFF]; \
+        (crc) = (uint16_t)((crc) << 8) ^ kasm_crc_table[(((crc) >> 8) ^ w_) & 0xFF]; \
+    } while (0)
+
+#define KASM_BOARD_FUNCS(name, words) \
+KASM_INLINE uint16_t kasm_crc_##name(const union CMD_DATA *f){ \
+    uint16_t crc = KASM_CRC_INIT; \
+    for (int i = 0; i < (words); i++) KASM_CRC_WORD(crc, f->values[i]); \
+    return crc; \
+} \
+KASM_INLINE uint16_t kasm_check_##name(const union CMD_DATA *f){ \
+    uint16_t crc = KASM_CRC_INIT; \
+    for (int i = 0; i <= (words); i++) KASM_CRC_WORD(crc, f->values[i]); \
+    return crc; \
+} \
+KASM_INLINE size_t kasm_pack_##name(union CMD_DATA *f, const int16_t *vals){ \
+    uint16_t crc = KASM_CRC_INIT; \
+    memcpy(f->values, vals, (words) * 2); \
+    for (int i = 0; i < (words); i++) KASM_CRC_WORD(crc, f->values[i]); \
+    f->values[(words)] = (int16_t)crc; \
+    return KASM_FRAME_BYTES(words); \
+} \
+KASM_INLINE void kasm_unpack_##name(int16_t *vals, const union CMD_DATA *f){ \
+    memcpy(vals, f->values, (words) * 2); \
+}
+KASM_BOARDS(KASM_BOARD_FUNCS)
+#undef KASM_BOARD_FUNCS
+
+#endif // KASM_FRAME_H
@@ -0,0 +1,260 @@
+/**
+*   kasm_top.c
+*   Live view of the statistics a knodeRT publishes with -m
+*   Author: Aaron Hunter
+*   Date: 2025-12-24
+*
+*   Maps the statistics segment read only and redraws the counters, their
+*   rates, the stage latencies and the CPU use of the RT threads every
+*   interval. The node never waits for the viewer: the segment is a seqlock
+*   copy, so kasm_top can be started, stopped or left running on a loaded
+*   node without changing its timing. The percentiles are taken over the
+*   last interval from the difference of two histogram copies, the max is
+*   the largest value since the node started. With knodeRT -p the
+*   performance counters of the RT threads are shown per period, next to
+*   their mean over the periods that missed the deadline.
+**/
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <signal.h>
+#include "stats.h"
+#include "histogram.h"
+
+#define NSEC_PER_SEC (1000*1000*1000)
+#define TRUE (1==1)
+#define FALSE (!TRUE)
+#define STALE_NSEC (1000*1000*1000) // no update for this long marks the node stopped
+
+double interval = 1.0;  // seconds between redraws
+int iterations = 0;     // redraws before exiting, 0 runs until interrupted
+int batch = FALSE;      // append to the output instead of clearing the screen
+
+// counters shown with their rates, in knode_stats_t order
+static const struct {
+    const char *name;
+    size_t offset;
+} counters[] = {
+    {"rx packets",      offsetof(knode_stats_t, rx_packets)},
+    {"rx bad",          offsetof(knode_stats_t, rx_bad_size)},
+    {"rx spin",         offsetof(knode_stats_t, rx_spin)},
+    {"rx xdp",          offsetof(knode_stats_t, rx_xdp)},
+    {"rx shm",          offsetof(knode_stats_t, rx_shm)},
+    {"shm overruns",    offsetof(knode_stats_t, shm_overruns)},
+    {"rx delta",        offsetof(knode_stats_t, rx_delta)},
+    {"delta dropped",   offsetof(knode_stats_t, delta_dropped)},
+    {"seq gaps",        offsetof(knode_stats_t, seq_gaps)},
+    {"seq reordered",   offsetof(knode_stats_t, seq_reordered)},
+    {"seq duplicates",  offsetof(knode_stats_t, seq_duplicates)},
+    {"seq resyncs",     offsetof(knode_stats_t, seq_resyncs)},
+    {"conceal frames",  offsetof(knode_stats_t, conceal_frames)},
+    {"conceal expired", offsetof(knode_stats_t, conceal_expired)},
+    {"deadline misses", offsetof(knode_stats_t, deadline_misses)},
+    {"spi errors",      offsetof(knode_stats_t, spi_errors)},
+    {"crc errors",      offsetof(knode_stats_t, crc_errors)},
+    {"spi coalesced",   offsetof(knode_stats_t, spi_coalesced)},
+    {"tlm sent",        offsetof(knode_stats_t, tlm_sent)},
+    {"tlm dropped",     offsetof(knode_stats_t, tlm_dropped)},
+    {"dl overruns",     offsetof(knode_stats_t, dl_overruns)},
+    {"fr snapshots",    offsetof(knode_stats_t, fr_snapshots)},
+    {"fr suppressed",   offsetof(knode_stats_t, fr_suppressed)},
+    {"maint reads",     offsetof(knode_stats_t, maint_done)},
+    {"maint deferred",  offsetof(knode_stats_t, maint_deferred)},
+    {"maint errors",    offsetof(knode_stats_t, maint_errors)},
+    {"maint alarms",    offsetof(knode_stats_t, maint_alarms)},
+    {"path 0 wins",     offsetof(knode_stats_t, path_wins[0])},
+    {"path 1 wins",     offsetof(knode_stats_t, path_wins[1])},
+    {"path 0 only",     offsetof(knode_stats_t, path_only[0])},
+    {"path 1 only",     offsetof(knode_stats_t, path_only[1])},
+};
+
+// latency histograms, microseconds
+static const struct {
+    const char *name;
+    size_t offset;
+} stages[] = {
+    {"queue",       offsetof(knode_stats_t, queue_ns)},
+    {"spi",         offsetof(knode_stats_t, spi_ns)},
+    {"bus skew",    offsetof(knode_stats_t, bus_skew_ns)},
+    {"loop",        offsetof(knode_stats_t, loop_ns)},
+    {"wake late",   offsetof(knode_stats_t, wake_late_ns)},
+    {"path lead",   offsetof(knode_stats_t, path_lead_ns)},
+};
+
+static volatile sig_atomic_t running = TRUE;
+
+static void stop(int sig){
+    (void)sig;
+    running = FALSE;
+}
+
+static uint64_t counter(const knode_stats_t *s, size_t offset){
+    return *(const uint64_t *)((const uint8_t *)s + offset);
+}
+
+static const histogram_t *hist(const knode_stats_t *s, size_t offset){
+    return (const histogram_t *)((const uint8_t *)s + offset);
+}
+
+/**
+ * @brief Histogram of the values recorded between two copies
+ * @note The interval max is unknown, the lifetime max caps the percentiles.
+ */
+static void hist_interval(histogram_t *d, const histogram_t *cur, const histogram_t *prev){
+    d->count = cur->count - prev->count;
+    d->sum = cur->sum - prev->sum;
+    d->min = cur->min;
+    d->max = cur->max;
+    for (int i = 0; i < HIST_BUCKETS; i++) {
+        d->bucket[i] = cur->bucket[i] - prev->bucket[i];
+    }
+}
+
+static void usage(const char *name){
+    fprintf(stderr, "Usage: %s [-d interval s] [-n iterations] [-b] segment\n", name);
+}
+
+/**
+ * @brief Draw one screen
+ * @param name Segment name
+ * @param pid Node that publishes into the segment
+ * @param cur Statistics now
+ * @param prev Statistics one interval ago
+ * @param secs Time between the two copies on the node clock
+ * @param age_ns Time since the node last published
+ */
+static void draw(const char *name, uint32_t pid, const knode_stats_t *cur,
+                 const knode_stats_t *prev, double secs, uint64_t age_ns){
+    histogram_t d;
+
+    if (batch == FALSE) printf("\033[H\033[2J");
+    printf("knodeRT pid %u  segment %s  interval %.2f s", pid, name, secs);
+    if (age_ns > STALE_NSEC) {
+        printf("  not updating for %.1f s", age_ns / 1e9);
+    }
+    printf("\n\n%-16s %14s %12s\n", "counter", "total", "per sec");
+    for (size_t i = 0; i < sizeof(counters) / sizeof(counters[0]); i++) {
+        uint64_t now = counter(cur, counters[i].offset);
+        uint64_t then = counter(prev, counters[i].offset);
+        printf("%-16s %14llu %12.1f\n", counters[i].name, (unsigned long long)now,
+               secs > 0 ? (now - then) / secs : 0.0);
+    }
+
+    printf("\n%-16s %10s %10s %10s %10s %10s\n", "stage usec", "per sec", "p50", "p99", "p99.9", "max");
+    for (size_t i = 0; i < sizeof(stages) / sizeof(stages[0]); i++) {
+        const histogram_t *h = hist(cur, stages[i].offset);
+        hist_interval(&d, h, hist(prev, stages[i].offset));
+        printf("%-16s %10.1f %10.1f %10.1f %10.1f %10.1f\n", stages[i].name,
+               secs > 0 ? d.count / secs : 0.0, hist_percentile(&d, 50) / 1e3,
+               hist_percentile(&d, 99) / 1e3, hist_percentile(&d, 99.9) / 1e3,
+               h->count > 0 ? h->max / 1e3 : 0.0);
+    }
+
+    printf("\n%-16s", "thread cpu %");
+    for (uint32_t i = 0; i < cur->threads && i < STATS_MAX_THREADS; i++) {
+        double pct = secs > 0 ? (cur->thread_cpu_ns[i] - prev->thread_cpu_ns[i]) / (secs * 1e7) : 0.0;
+        if (i == 0) {
+            printf(" udp %5.1f", pct);
+        } else {
+            printf("  spi%u %5.1f", i - 1, pct);
+        }
+    }
+    printf("\n");
+
+    if (cur->perf_mask != 0) {
+        uint64_t periods = cur->loop_ns.count - prev->loop_ns.count;
+        printf("\n%-16s %12s %12s %12s %12s %12s\n", "perf", "udp/period", "udp max", "udp/missed",
+               "spi per sec", "spi max");
+        for (int i = 0; i < PERFCTR_COUNT; i++) {
+            if (!(cur->perf_mask & (1u << i))) continue;
+            printf("%-16s %12.1f %12llu %12.1f %12.1f %12llu\n", perfctr_names[i],
+                   periods > 0 ? (double)(cur->perf_udp[i] - prev->perf_udp[i]) / periods : 0.0,
+                   (unsigned long long)cur->perf_udp_max[i],
+                   cur->deadline_misses > 0 ? (double)cur->perf_udp_miss[i] / cur->deadline_misses : 0.0,
+                   secs > 0 ? (cur->perf_spi[i] - prev->perf_spi[i]) / secs : 0.0,
+                   (unsigned long long)cur->perf_spi_max[i]);
+        }
+    }
+    if (batch == TRUE) printf("\n");
+    fflush(stdout);
+}
+
+int main(int argc, char *argv[]){
+    const stats_shm_t *shm = NULL;
+    knode_stats_t *cur = NULL;
+    knode_stats_t *prev = NULL;
+    knode_stats_t *tmp = NULL;
+    uint64_t cur_ns = {0};
+    uint64_t prev_ns = {0};
+    struct timespec now = {0};
+    struct timespec sleep_tmr = {0};
+    int opt = {0}; // for getopt()
+
+    while ((opt = getopt(argc, argv, "hd:n:b")) != -1){
+        switch(opt){
+            case 'd':
+                interval = atof(optarg);
+                if (interval <= 0) {
+                    fprintf(stderr, "Invalid interval: %s\n", optarg);
+                    return 1;
+                }
+                break;
+            case 'n':
+                iterations = atoi(optarg);
+                break;
+            case 'b':
+                batch = TRUE;
+                break;
+            case 'h':
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+    if (optind != argc - 1) {
+        usage(argv[0]);
+        return 1;
+    }
+    shm = stats_shm_attach(argv[optind]);
+    if (shm == NULL) {
+        fprintf(stderr, "Failed to open statistics segment %s: %s\n", argv[optind],
+                errno == EPROTO ? "not a knodeRT statistics segment of this version" : strerror(errno));
+        return 1;
+    }
+    // two copies of about 20 KB, kept off the stack
+    cur = calloc(1, sizeof(knode_stats_t));
+    prev = calloc(1, sizeof(knode_stats_t));
+    if (cur == NULL || prev == NULL) {
+        fprintf(stderr, "Out of memory\n");
+        return 1;
+    }
+    signal(SIGINT, stop);
+    signal(SIGTERM, stop);
+
+    if (stats_shm_read(shm, prev, &prev_ns) != 0) {
+        fprintf(stderr, "Statistics segment stays busy\n");
+        return 1;
+    }
+    sleep_tmr.tv_sec = (time_t)interval;
+    sleep_tmr.tv_nsec = (long)((interval - sleep_tmr.tv_sec) * NSEC_PER_SEC);
+    for (int n = 0; running == TRUE && (iterations == 0 || n < iterations); n++) {
+        nanosleep(&sleep_tmr, NULL);
+        if (running == FALSE) break;
+        if (stats_shm_read(shm, cur, &cur_ns) != 0) continue; // node busy, try next interval
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        draw(argv[optind], shm->node_pid, cur, prev, (cur_ns - prev_ns) / 1e9,
+             (uint64_t)now.tv_sec * NSEC_PER_SEC + now.tv_nsec - cur_ns);
+        tmp = prev;
+        prev = cur;
+        cur = tmp;
+        prev_ns = cur_ns;
+    }
+    free(cur);
+    free(prev);
+    return 0;
+}
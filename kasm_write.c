@@ -8,7 +8,7 @@
 
 #include "wiringPi.h"
 #include "wiringPiSPI.h"
-#include "crc_check.h"
+#include "kasm_frame.h"
 #include "timers.h"
 
 #define	TRUE	(1==1)
@@ -17,22 +17,17 @@
 #define SPI_DEV     1   // spi device number
 #define	SPI_CHAN	2   // which chip select
 #define SPEED       5   // in megahertz
-#define BUF_SIZE    54 // bytes, including crc16
-#define CRC_INDX    26  // index of the crc value in the data structure
+#define MHZ         1000000 // 1 MHz
+#define BUF_SIZE    KASM_FRAME_SIZE // bytes, including crc16
+#define CRC_INDX    KASM_MAX_WORDS  // index of the crc value in the data structure
 
 #define MAX_VAL     24000
 #define MIN_VAL     -24000
 
-union CMD_DATA {
-    unsigned char bytes[BUF_SIZE];
-    int16_t values[BUF_SIZE/2];
-} cmd_data;
+union CMD_DATA cmd_data;
 
 union CMD_DATA* cmd_data_ptr = &cmd_data;
 
-uint16_t poly16 = 0x3D65; // CRC-16-DNP 
-uint16_t init_val = 0xFFFF; // initial value for CRC calculations
-
 
 int main (int argc, char *argv[])
 {
@@ -74,22 +69,14 @@ int main (int argc, char *argv[])
    
     start_timer(); // start the timer
     // compute CRC and append to cmd_data.values
-    crc = init_val; // set the initial value to crc
-    for(i=0;i<(BUF_SIZE/2 -1);i++){
-        crc = calc_crc16(crc, cmd_data.values[i],poly16);
-        // printf("CRC: %x \n", crc);
-    }
+    crc = kasm_crc_kasm26(&cmd_data);
     stop_timer(); // stop the timer
     
     // printf("CRC %x \n", crc);
     cmd_data.values[CRC_INDX]=crc;
 
     // verify crc calculation
-        crc = init_val; // set the initial value to crc
-    for(i=0;i<(BUF_SIZE/2);i++){
-        crc = calc_crc16(crc, cmd_data.values[i],poly16);
-        // printf("CRC: %x \n", crc);
-    }
+    crc = kasm_check_kasm26(&cmd_data);
     if(crc == 0){
         printf("CRC verified\n");
     } else {
@@ -103,7 +90,7 @@ int main (int argc, char *argv[])
     wiringPiSetup();  // init wiringpi
     
     // Init SPI port
-    if ((Fd = wiringPiSPIxSetupMode (SPI_DEV, SPI_CHAN, SPEED*100000,SPI_MODE_0)) < 0){
+    if ((Fd = wiringPiSPIxSetupMode (SPI_DEV, SPI_CHAN, SPEED*MHZ,SPI_MODE_0)) < 0){
         fprintf (stderr, "Can't open the SPI bus: %s\n", strerror (errno)) ;
         exit (EXIT_FAILURE) ;
     }
@@ -24,6 +24,7 @@
 #include "wiringPi.h"
 #include "wiringPiSPI.h"
 #include "crc_check.h"
+#include "kasm_frame.h"
 #include "timers.h"
 
 
@@ -38,8 +39,8 @@
 #define	SPI_CHAN	2   // which chip select
 #define SPEED       5   // in megahertz
 #define MHZ         1000000
-#define SPI_BUF_SIZE    54 // bytes, including crc16
-#define CRC_INDX    26  // index of the crc value in the data structure
+#define SPI_BUF_SIZE    KASM_FRAME_SIZE // bytes, including crc16
+#define CRC_INDX    KASM_MAX_WORDS  // index of the crc value in the data structure
 
 #define MAX_VAL     24000
 #define MIN_VAL     -24000
@@ -47,10 +48,7 @@
 /********** module variables *****************/
 uint8_t cmd_data_avail = FALSE; // flag to indicate if command data is available
 
-union CMD_DATA {
-    unsigned char bytes[SPI_BUF_SIZE];
-    int16_t values[SPI_BUF_SIZE/2];
-} cmd_data, buf_data;
+union CMD_DATA cmd_data, buf_data;
 
 long int elapsed_time_nsec = {0}; // We only measure time < 1 sec 
 int spi_fd = {0}; // file descriptor for SPI
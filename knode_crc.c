@@ -0,0 +1,48 @@
+/**
+ * @file knode_crc.c
+ * @brief CRC of the knode SPI frames
+ * @author Aaron Hunter
+ * @date 2025-12-19
+ * @details Kept apart from knode_thr.c so the benchmarks can link the same
+ * code knodeRT runs.
+ */
+
+#include <stdint.h>
+#include "crc_check.h"
+#include "knode_thr.h"
+
+uint16_t poly16 = {KASM_CRC_POLY}; // CRC-16-DNP polynomial
+uint16_t init_val = {KASM_CRC_INIT}; // initial value for CRC calculations
+
+/**
+ * @brief Compute and append the crc value to a kasm26 frame
+ * @return uint16_t crc value
+ */
+uint16_t append_crc(union CMD_DATA * data ){
+    uint16_t crc = kasm_crc_kasm26(data);
+    data->values[CRC_INDX]=crc; // append the crc value to the command data
+    return crc;
+}
+
+/**
+ * @brief Update the crc of a frame from the previous frame's crc
+ * @return uint16_t crc value, identical to append_crc(data)
+ */
+uint16_t append_crc_incr(union CMD_DATA * data, const union CMD_DATA * old,
+                         const uint8_t * changed, int n_changed, const crc16_shift_t * tbl){
+    uint16_t crc = old->values[CRC_INDX]; // start from the previous crc
+    for(int k=0;k<n_changed;k++){
+        int i = changed[k];
+        crc = crc16_update(crc, tbl, i, old->values[i], data->values[i]);
+    }
+    data->values[CRC_INDX]=crc; // append the crc value to the command data
+    return crc;
+}
+
+/**
+ * @brief verify the crc value of a kasm26 frame
+ * @return uint16_t crc value (0 indicates success)
+ */
+uint16_t verify_crc(union CMD_DATA * data){
+    return kasm_check_kasm26(data);
+}
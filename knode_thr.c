@@ -7,6 +7,7 @@
  * It receives commands over UDP, processes them, and sends them to the KASM PCB via SPI.
  */
 
+#define _GNU_SOURCE // CPU affinity
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
@@ -23,22 +24,51 @@
 #include <pthread.h>
 #include <sched.h>
 #include <sys/mman.h>
+#include <signal.h>
 
+#ifdef SPI_SIM
+#include "spi_sim.h"
+#else
 #include "wiringPi.h"
 #include "wiringPiSPI.h"
+#endif
 #include "crc_check.h"
 #include "timers.h"
+#include "interp.h"
+#include "conceal.h"
+#include "stats.h"
+#include "protocol.h"
+#include "capture.h"
+#include "vclock.h"
+#include "rtcpu.h"
+#include "shm_cmd.h"
+#include "perfctr.h"
+#include "flightrec.h"
+#include "spi_clock.h"
+#ifdef HAVE_XDP
+#include "xdp_rx.h"
+#endif
 #include "knode_thr.h"
 
 
 /*************** defines **********************/
 #define UDP_BUF_SIZE 500
-#define CMD_SIZE 52 // 52 bytes for 26 int16_t values
+#define CMD_SIZE KASM_CMD_SIZE // 52 bytes for 26 int16_t values
+#define CMD_VALS (CMD_SIZE/2) // number of int16_t command values
 
 #define	TRUE	(1==1)
 #define	FALSE	(!TRUE)
 #define REALTIME TRUE
-#define NUM_THREADS 3
+#define NUM_THREADS 3 // default number of SPI buses
+#define MAX_THREADS 5 // SPI buses the node can drive
+#define RT_PRIORITY 80 // default SCHED_FIFO priority of the UDP and SPI threads
+#define DL_CALIBRATE_PERIODS 1000 // UDP loop periods timed before it enters SCHED_DEADLINE
+#define DL_RUNTIME_MARGIN 2 // SCHED_DEADLINE runtime per worst measured loop time
+#define RT_STACK_SIZE (256*1024) // stack of the UDP and SPI threads, locked by mlockall
+#define RT_STACK_PREFAULT (128*1024) // stack touched before the RT loop starts
+#define WARMUP_CYCLES 1000 // default passes over the packet and CRC kernels at startup
+#define WARMUP_SPI_CYCLES 8 // no-op transfers per bus at startup
+#define RX_SPIN_USEC 50 // default spin or busy poll budget per receive
 
 
 #define SPI_DEV0    0   
@@ -49,37 +79,172 @@
 #define	SPI_CHAN	0   // only use channel 0 for all SPI devices
 #define SPEED       5   // in megahertz
 #define MHZ         1000000 // 1 MHz
-#define CRC_INDX    26  // index of the crc value in the data structure
+#define CAL_FRAMES  512 // test frames per clock in the SPI clock calibration
+#define CAL_MARGIN_PCT 80 // calibrated clock is at most this share of the fastest clock that passed
+#define CAL_ACK "outputs-off" // -k argument confirming the boards cannot act on a test frame
+#define MAINT_DACS  3   // DAC80508 per KASM board read by the health check
+#define MAINT_GUARD_NSEC (20*1000) // slack kept between a maintenance read and the next control frame
+#define MAINT_XFER_DECAY 64 // the transfer time estimate loses 1/this per frame below its max
 
 #define MAX_VAL     24000
 #define MIN_VAL     -24000
 
 #define PERIOD_NSEC  (400*1000) // 400 usec interval
+#define RTC_PERIOD_NSEC (1000*1000) // nominal RTC command interval (rtc_sim)
+#define CONCEAL_PERIODS 3 // default cap on extrapolated RTC periods
+#define CONCEAL_MAX_PERIODS 100 // largest cap accepted by -n
+#define STATS_INTERVAL_SEC 10 // interval between statistics reports
+#define TLM_FLUSH_NSEC (2*1000*1000) // longest time a telemetry record is held back
 #define NSEC_PER_SEC (1000*1000*1000)
+#define VIRTUAL_DRAIN_NSEC (100*1000*1000) // virtual run time after the last captured datagram
+#define FLIGHTREC_DIR "/dev/shm" // default directory of the flight recorder snapshots
+#define FR_MAX_THRESHOLD_USEC (1000*1000) // largest -T
+#define MAINT_MAX_INTERVAL_MSEC (3600*1000) // largest -g
+
+// apply_packet() results
+#define PKT_DROPPED     0   // malformed, late, or a delta without its base
+#define PKT_APPLIED     1   // new command in rx_frame
+#define PKT_DUPLICATE   2   // command already applied, e.g. the second copy from a redundant sender
 
 /********** module variables *****************/
-uint8_t running = TRUE; // set flag to false to terminate the threads and exit the program
+volatile sig_atomic_t running = TRUE; // set flag to false to terminate the threads and exit the program
 uint8_t main_run = TRUE;
 
 
-union CMD_DATA cmd_data[NUM_THREADS];
-thread_cfg_t thread_cfgs[NUM_THREADS];
+union CMD_DATA cmd_data[MAX_THREADS];
+thread_cfg_t thread_cfgs[MAX_THREADS];
+int num_threads = NUM_THREADS; // SPI buses in use
+handoff_t handoff = HANDOFF_CONDVAR; // how frames reach the SPI threads
+engine_t engine = ENGINE_THREADS; // what drives the SPI buses
+rx_mode_t rx_mode = RX_BLOCK; // how the UDP loop waits for datagrams
+long rx_spin_nsec = RX_SPIN_USEC * 1000; // spin before blocking, RX_SPIN and RX_BUSYPOLL
+int sched_policy = REALTIME==TRUE ? SCHED_FIFO : SCHED_OTHER; // policy of the UDP and SPI threads
+const char *stats_file = NULL; // write the final statistics here as JSON
+const char *stats_shm_name = NULL; // publish the live statistics into this shared memory segment
+clockid_t rt_clock[STATS_MAX_THREADS]; // CPU time clocks of the UDP thread, then the SPI threads
+int rt_nclocks = {0};
+uint8_t perf_enabled = FALSE; // read the performance counters of every RT thread each cycle
+uint8_t spi_records = FALSE; // check the SPI readback and keep its record, for telemetry, -m or the recorder
+
+// flight recorder of the last UDP loop periods
+const char *fr_dir = FLIGHTREC_DIR; // snapshots go here, NULL disables the recorder
+uint32_t fr_cycles = FLIGHTREC_CYCLES;
+uint64_t fr_threshold_ns = {0}; // period latency that triggers a snapshot, 0 for misses only
+flightrec_t flightrec;
+flightrec_cycle_t *fr_cycle = NULL; // period being recorded, NULL without the recorder
+
+// board type of each bus (-B), frames for the types other than kasm26
+int bus_board[MAX_THREADS] = {KASM_BOARD_kasm26};
+uint8_t bus_board_set = FALSE;
+uint32_t board_mask = {0}; // 1 << KASM_BOARD_* of the boards in use, kasm26 excluded
+union CMD_DATA board_frame[KASM_NUM_BOARDS]; // last frame packed for each board type
+
+// SPI clock of each bus, calibrated with -k and loaded with -K
+uint8_t spi_calibrate = FALSE; // find the fastest reliable clock of every bus, then exit
+const char *spi_clock_file = NULL;
+spi_clock_t spi_clocks[SPI_CLOCK_MAX_BUSES];
+int spi_nclocks = {0};
+// clocks tried by the calibration, slowest first
+static const uint32_t cal_ladder_hz[] = {
+    1000000, 2000000, 4000000, 5000000, 8000000, 10000000, 12500000, 16000000, 20000000,
+    25000000, 32000000
+};
+#define CAL_STEPS ((int)(sizeof(cal_ladder_hz) / sizeof(cal_ladder_hz[0])))
+
+// maintenance register reads in the idle SPI time (maint.h)
+uint64_t maint_interval_ns = {0}; // health check interval, 0 disables it
+uint64_t maint_next_ns = {0}; // time of the next health check
+uint16_t maint_tag = {0}; // tag of the last read queued
+uint32_t maint_devid[MAX_THREADS][MAINT_DACS]; // first DEVICE_ID read, | 0x10000 once known
+knode_reg_rec_t reg_recs[KNODE_REG_MAX_RECS]; // register reads waiting for the telemetry
+int reg_count = {0};
+
+// CPU and priority of each RT thread, slot 0 is the UDP thread, 1 + i SPI thread i
+int rt_cpus[RTCPU_MAX_CPUS];
+int rt_ncpus = -1; // -1 uses the isolated CPUs, 0 leaves the threads unpinned
+rtcpu_layout_t rt_layout = LAYOUT_SPREAD;
+int rt_prio[MAX_THREADS + 1];
+uint64_t dl_runtime_ns = {0}; // SCHED_DEADLINE runtime of the UDP loop, 0 sizes it from the loop time
+volatile sig_atomic_t dl_overrun_count = {0}; // SIGXCPU from the deadline scheduler
+
+// startup: every RT thread warms up, then the port is opened
+int warmup_cycles = WARMUP_CYCLES;
+pthread_barrier_t ready_barrier; // RT threads warmed up, main opens the port
+pthread_barrier_t go_barrier; // port open, the UDP loop starts
+uint64_t start_ns = {0}; // process start
+uint64_t first_rx_ns = {0}; // receive time of the first command
+uint32_t first_frame = {0}; // frame carrying the first command
 
 long int elapsed_time_nsec = {0}; // We only measure time < 1 sec 
 int spi_fd = {0}; // file descriptor for SPI
 int udp_fd = {0}; // file descriptor for UDP
-
-
-// checksum parameters
-uint16_t poly16 = {0x3D65}; // CRC-16-DNP polynomial
-uint16_t init_val = {0xFFFF}; // initial value for CRC calculations
+const char *shm_name = NULL; // take commands from this shared memory segment instead of UDP
+shm_cmd_t shm_cmd;
+#ifdef HAVE_XDP
+const char *xdp_ifname = NULL; // take the command port off this interface with AF_XDP
+int xdp_queue = {0}; // receive queue redirected to the AF_XDP socket
+xdp_rx_t xdp_rx;
+#endif
+
+// upsampling of the RTC command stream to the node tick rate
+interp_mode_t interp_mode = INTERP_NONE;
+long rtc_period_nsec = RTC_PERIOD_NSEC;
+interp_t interp;
+
+// loss concealment and sequence tracking
+extrap_mode_t extrap_mode = EXTRAP_HOLD;
+int conceal_periods = CONCEAL_PERIODS;
+conceal_t conceal;
+seq_track_t seq_track;
+path_track_t path_track; // which copy of a redundant sender arrived first
+uint64_t rx_stamp_ns = {0}; // kernel receive time (CLOCK_REALTIME) of the last datagram, 0 if it had none
+
+// last received command, the base for delta packets
+int16_t rx_frame[CMD_VALS];
+uint32_t rx_seq = {0};
+uint8_t rx_chain = FALSE; // rx_frame matches packet rx_seq of the sender
+uint64_t rx_time_ns = {0}; // receive time of rx_frame
+uint8_t rx_fresh = FALSE; // rx_frame has not been handed to the SPI threads yet
+
+// telemetry back to the sender of the commands
+int tlm_batch = 0; // records per telemetry datagram, 0 disables telemetry
+knode_tlm_rec_t tlm_recs[KNODE_TLM_MAX_RECS];
+int tlm_count = {0};
+uint64_t tlm_wait_ns = {0}; // dispatch time of a frame whose records are not all collected, 0 if none
+uint32_t tlm_seq = {0}; // telemetry datagram counter
+struct sockaddr_storage tlm_peer; // where the last command came from
+socklen_t tlm_peer_len = {0};
+
+// recording of every received datagram
+const char *capture_file = NULL;
+uint32_t capture_capacity = CAPTURE_RECORDS;
+capture_t capture;
+
+// virtual time run fed from a capture instead of the socket
+const char *virtual_file = NULL;
+int virtual_loops = 1; // times the capture is replayed
+capture_t virtual_cap;
+uint64_t virtual_next = {0}; // index of the next datagram over all loops
+uint64_t virtual_loop_ns = {0}; // capture length plus one mean gap
+uint32_t virtual_span = {0}; // sequence numbers per loop
+uint64_t virtual_frames = {0}; // frames handed to the SPI buses
+uint64_t virtual_digest = 0xcbf29ce484222325ULL; // FNV-1a over every frame
+
+// checksum of the last frame
 uint16_t crc={0}; // variable for CRC calculation
+crc16_shift_t crc_shift; // tables for incremental CRC updates
+
+// last frame handed to the SPI threads, crc included
+union CMD_DATA spi_frame;
+uint8_t spi_frame_valid = FALSE;
+uint32_t spi_frame_id = {0}; // frames dispatched, 0 is never a frame
+uint32_t skew_frame = {0}; // last frame counted in the bus skew
 
 // condition variable for thread synchronization
-pthread_cond_t cond_var[NUM_THREADS];
+pthread_cond_t cond_var[MAX_THREADS];
 
 // mutexes for thread synchronization
-pthread_mutex_t mutex[NUM_THREADS];
+pthread_mutex_t mutex[MAX_THREADS];
 pthread_mutexattr_t mattr;
 
 /********** functions *********************/
@@ -142,6 +307,11 @@ int init_UDP(char *port){
         return -1;
     }
 
+    // kernel receive times, for the lead of a redundant sender's first copy
+    s = 1;
+    if (setsockopt(sfd, SOL_SOCKET, SO_TIMESTAMPNS, &s, sizeof(s)) != 0) {
+        fprintf(stderr, "No kernel receive timestamps, the path lead is not measured: %s\n", strerror(errno));
+    }
     return sfd;
 }
 
@@ -160,6 +330,407 @@ static void getinfo()
 }
 
 
+/**
+ * @brief Touch the stack so its pages are mapped before the RT loop
+ */
+static void prefault_stack(void){
+    volatile unsigned char stack[RT_STACK_PREFAULT];
+
+    for (int i = 0; i < RT_STACK_PREFAULT; i += 1024) {
+        stack[i] = 0;
+    }
+    (void)stack[0];
+}
+
+/**
+ * @brief Clock no-op frames through a bus
+ * @note The frames carry an inverted crc, so the KASM board drops them. The
+ * telemetry and statistics are left alone.
+ * @param cfg Bus to write
+ */
+static void warm_spi(const thread_cfg_t *cfg){
+    static const int16_t zero[KASM_MAX_WORDS] = {0};
+    const kasm_board_t *b = &kasm_boards[cfg->board];
+    union CMD_DATA noop;
+
+    for (int c = 0; c < warmup_cycles && c < WARMUP_SPI_CYCLES; c++) {
+        b->pack(&noop, zero);
+        noop.values[b->words] ^= 0xFFFF;
+        wiringPiSPIxDataRW(cfg->spi_dev, cfg->spi_channel, noop.bytes, b->bytes);
+        b->check(&noop);
+    }
+}
+
+/**
+ * @brief Clock the calibration test frames through a bus at one clock
+ * @note Like warm_spi() the frames carry an inverted crc, so the KASM board
+ * drops them. At a clock the bus cannot sustain, a bit error may turn one
+ * into a valid command, so -k needs CAL_ACK. The readback passes when it
+ * checks with the board's crc once its crc word is inverted back. The frames
+ * have the length of the board's frames. The test patterns are the same at
+ * every clock.
+ * @param cfg Bus to test, reopened at hz
+ * @param hz Clock to test
+ * @return int frames that failed, CAL_FRAMES if the bus does not open at hz
+ */
+static int cal_step(const thread_cfg_t *cfg, uint32_t hz){
+    const kasm_board_t *b = &kasm_boards[cfg->board];
+    int16_t vals[KASM_MAX_WORDS];
+    union CMD_DATA frame;
+    uint32_t x = 0x2545F491; // xorshift32 state
+    int bad = {0};
+
+    wiringPiSPIxClose(cfg->spi_dev, cfg->spi_channel);
+    if (wiringPiSPIxSetupMode(cfg->spi_dev, cfg->spi_channel, hz, SPI_MODE_0) < 0) return CAL_FRAMES;
+    for (int n = 0; n < CAL_FRAMES; n++) {
+        for (int w = 0; w < b->words; w++) {
+            switch (n % 5) {
+                case 0: // all low
+                    vals[w] = 0;
+                    break;
+                case 1: // all high
+                    vals[w] = -1;
+                    break;
+                case 2: // alternating bits, every line toggles each clock
+                    vals[w] = (int16_t)((w & 1) ? 0x5555 : 0xAAAA);
+                    break;
+                case 3: // walking one
+                    vals[w] = (int16_t)(1u << ((w + n) % 16));
+                    break;
+                default: // pseudo random
+                    x ^= x << 13;
+                    x ^= x >> 17;
+                    x ^= x << 5;
+                    vals[w] = (int16_t)x;
+                    break;
+            }
+        }
+        b->pack(&frame, vals);
+        frame.values[b->words] ^= 0xFFFF;
+        if (wiringPiSPIxDataRW(cfg->spi_dev, cfg->spi_channel, frame.bytes, b->bytes) == -1) {
+            bad++;
+            continue;
+        }
+        frame.values[b->words] ^= 0xFFFF;
+        if (b->check(&frame) != 0) bad++;
+    }
+    return bad;
+}
+
+/**
+ * @brief Find the clock of every bus and save it to the clock file
+ * @note Each bus steps up cal_ladder_hz until a clock loses a frame. It then
+ * runs at the fastest step at or below CAL_MARGIN_PCT of the last clock that
+ * passed, or that clock if there is no slower step.
+ * @return int 0 on success, 1 if a bus failed at every clock or the file
+ * could not be written
+ */
+static int calibrate_spi(void){
+    spi_clock_t clk[MAX_THREADS];
+    int n = {0};
+    int ret = {0};
+
+    printf("Calibrating the SPI clocks, %d test frames per clock\n", CAL_FRAMES);
+    for (int i = 0; i < num_threads; i++) {
+        const thread_cfg_t *cfg = &thread_cfgs[i];
+        uint32_t pass_hz = {0};
+        uint32_t hz = {0};
+        int bad = {0};
+
+        printf("bus %d (spidev%d.%d):", i, cfg->spi_dev, cfg->spi_channel);
+        for (int k = 0; k < CAL_STEPS; k++) {
+            bad = cal_step(cfg, cal_ladder_hz[k]);
+            if (bad != 0) {
+                printf(" %g MHz %d/%d bad", cal_ladder_hz[k] / 1e6, bad, CAL_FRAMES);
+                break;
+            }
+            printf(" %g", cal_ladder_hz[k] / 1e6);
+            pass_hz = cal_ladder_hz[k];
+        }
+        wiringPiSPIxClose(cfg->spi_dev, cfg->spi_channel);
+        if (pass_hz == 0) {
+            printf(", fails at every clock\n");
+            ret = 1;
+            continue;
+        }
+        for (int k = 0; k < CAL_STEPS; k++) {
+            if ((uint64_t)cal_ladder_hz[k] * 100 <= (uint64_t)pass_hz * CAL_MARGIN_PCT) hz = cal_ladder_hz[k];
+        }
+        if (hz == 0) hz = pass_hz;
+        printf(", runs at %g MHz\n", hz / 1e6);
+        clk[n].dev = cfg->spi_dev;
+        clk[n].chan = cfg->spi_channel;
+        clk[n].hz = hz;
+        clk[n].pass_hz = pass_hz;
+        n++;
+    }
+    if (spi_clock_file != NULL && n > 0) {
+        if (spi_clock_save(spi_clock_file, clk, n) != 0) {
+            fprintf(stderr, "Failed to write %s: %s\n", spi_clock_file, strerror(errno));
+            return 1;
+        }
+        printf("Saved to %s\n", spi_clock_file);
+    }
+    return ret;
+}
+
+/**
+ * @brief Pack the frames of the board types in use other than kasm26
+ * @note The kasm26 frame is spi_frame, with its incremental crc.
+ * @param frames Output frames, indexed by KASM_BOARD_*
+ * @param vals Command values in host byte order (CMD_VALS entries)
+ */
+static void pack_boards(union CMD_DATA *frames, const int16_t *vals){
+    for (int b = 0; b < KASM_NUM_BOARDS; b++) {
+        if (board_mask & (1u << b)) kasm_boards[b].pack(&frames[b], vals);
+    }
+}
+
+/**
+ * @brief Frame to write to a bus
+ */
+static inline const union CMD_DATA *bus_frame(const thread_cfg_t *cfg){
+    return cfg->board == KASM_BOARD_kasm26 ? &spi_frame : &board_frame[cfg->board];
+}
+
+/**
+ * @brief Run the UDP loop kernels on scratch data
+ * @note Decodes every packet type, builds frames with the full and
+ * incremental crc and the frames of the other boards in use, and runs the
+ * interpolator, without touching the node state.
+ */
+static void warm_kernels(void){
+    uint8_t pkt[UDP_BUF_SIZE];
+    int16_t vals[CMD_VALS] = {0};
+    int16_t prev[CMD_VALS] = {0};
+    int16_t out[CMD_VALS] = {0};
+    uint8_t changed[CMD_VALS];
+    union CMD_DATA frame;
+    union CMD_DATA last;
+    union CMD_DATA boards[KASM_NUM_BOARDS];
+    interp_t ip;
+    struct timespec t = {0};
+    uint32_t seq = {0};
+    size_t len = {0};
+    int n_changed = {0};
+
+    interp_init(&ip, interp_mode == INTERP_NONE ? INTERP_LINEAR : interp_mode, CMD_VALS, rtc_period_nsec);
+    memset(last.bytes, 0, SPI_BUF_SIZE);
+    append_crc(&last);
+    for (int c = 0; c < warmup_cycles; c++) {
+        for (int i = 0; i < CMD_VALS; i++) {
+            vals[i] = (int16_t)(prev[i] + ((c * 31 + i * 7) % 64) - 32);
+        }
+        len = knode_encode_full(pkt, c, vals);
+        knode_decode(pkt, len, out, &seq);
+        len = knode_encode_delta(pkt, c, vals, prev, c & 1);
+        memcpy(out, prev, CMD_SIZE);
+        knode_decode(pkt, len, out, &seq);
+        knode_decode(pkt, CMD_SIZE, out, &seq); // legacy
+        t.tv_nsec = (c % 1000) * 1000;
+        interp_push(&ip, vals, &t);
+        interp_sample(&ip, out, &t);
+
+        memcpy(frame.values, out, CMD_SIZE);
+        n_changed = 0;
+        for (int i = 0; i < CMD_VALS; i++) {
+            if (frame.values[i] != last.values[i]) changed[n_changed++] = i;
+        }
+        append_crc_incr(&frame, &last, changed, n_changed, &crc_shift);
+        verify_crc(&frame);
+        pack_boards(boards, out);
+        last = frame;
+        memcpy(prev, vals, CMD_SIZE);
+    }
+}
+
+/**
+ * @brief Current time in ns, virtual in a -V run
+ */
+static uint64_t clock_now_ns(void){
+    struct timespec ts = {0};
+
+    vclock_gettime(&ts);
+    return (uint64_t)ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+/**
+ * @brief Add the counter deltas of one SPI thread cycle to its bus
+ * @note Called with the bus mutex held.
+ */
+static void add_perf(thread_cfg_t *cfg, const uint64_t *perf){
+    for (int i = 0; i < PERFCTR_COUNT; i++) {
+        cfg->perf[i] += perf[i];
+        if (perf[i] > cfg->perf_max[i]) cfg->perf_max[i] = perf[i];
+    }
+}
+
+/**
+ * @brief Send one frame over SPI and leave its telemetry record
+ * @param cfg Bus to write
+ * @param TXRX_buffer Frame, overwritten with the MISO data
+ * @param seq Sequence number of the command in the frame
+ * @param rx_ns Receive time of that command
+ * @param status KNODE_TLM_FRESH / KNODE_TLM_SYNTH for the frame
+ * @param frame Dispatch count of the frame
+ * @param perf Performance counter deltas of the SPI thread cycle, NULL without -p
+ * @return uint64_t time the transfer started
+ */
+static uint64_t spi_transfer(thread_cfg_t *cfg, unsigned char *TXRX_buffer, uint32_t seq,
+                         uint64_t rx_ns, uint8_t status, uint32_t frame, const uint64_t *perf){
+    struct timespec tmr={0};
+    struct timespec start_tmr={0};
+    union CMD_DATA sent; // frame that was clocked out, for the echo check
+    union CMD_DATA miso; // data returned by the KASM PCB
+    uint64_t start_ns = {0};
+    uint64_t xfer_ns = {0};
+
+    memcpy(sent.bytes, TXRX_buffer, cfg->frame_len);
+    vclock_gettime(&start_tmr);
+    // send SPI data, TXRX_buffer is overwritten with the MISO data
+    if (wiringPiSPIxDataRW (cfg->spi_dev,cfg->spi_channel, TXRX_buffer, cfg->frame_len) == -1){
+        syslog(LOG_ERR, "SPI failure: %s", strerror (errno)) ;
+    } else {
+        status |= KNODE_TLM_SPI_OK;
+    }
+    vclock_gettime(&tmr);
+    syslog(LOG_INFO,"SPI[%d] time: %ld.%09ld",cfg->thread_id, tmr.tv_sec, tmr.tv_nsec);
+    start_ns = (uint64_t)start_tmr.tv_sec * NSEC_PER_SEC + start_tmr.tv_nsec;
+    xfer_ns = (uint64_t)tmr.tv_sec * NSEC_PER_SEC + tmr.tv_nsec - start_ns;
+    cfg->xfer_ns = xfer_ns > cfg->xfer_ns ? xfer_ns : cfg->xfer_ns - cfg->xfer_ns / MAINT_XFER_DECAY;
+    if (spi_records == FALSE) {
+        pthread_mutex_lock(&mutex[cfg->thread_id]);
+        if (!(status & KNODE_TLM_SPI_OK)) cfg->spi_errors++;
+        if (perf != NULL) add_perf(cfg, perf);
+        cfg->done_frame = frame;
+        cfg->done_ns = (uint64_t)tmr.tv_sec * NSEC_PER_SEC + tmr.tv_nsec;
+        pthread_mutex_unlock(&mutex[cfg->thread_id]);
+        return start_ns;
+    }
+
+    // parse the readback and leave a record for the telemetry and the live statistics
+    if (status & KNODE_TLM_SPI_OK) {
+        memcpy(miso.bytes, TXRX_buffer, cfg->frame_len);
+        if (kasm_boards[cfg->board].check(&miso) == 0) status |= KNODE_TLM_CRC_OK;
+        if (memcmp(miso.bytes, sent.bytes, cfg->frame_len) == 0) status |= KNODE_TLM_ECHO_OK;
+    }
+    pthread_mutex_lock(&mutex[cfg->thread_id]);
+    if (!(status & KNODE_TLM_SPI_OK)) {
+        cfg->spi_errors++;
+    } else if (!(status & KNODE_TLM_CRC_OK)) {
+        cfg->crc_errors++;
+    }
+    if (perf != NULL) add_perf(cfg, perf);
+    if (cfg->tlm_pending == TRUE) cfg->tlm_dropped++; // the UDP thread has not taken the last one
+    cfg->tlm.seq = seq;
+    cfg->tlm.bus = cfg->thread_id;
+    cfg->tlm.status = status;
+    cfg->tlm.rx_ns = rx_ns;
+    cfg->tlm.start_ns = start_ns;
+    cfg->tlm.spi_ns = (uint64_t)tmr.tv_sec * NSEC_PER_SEC + tmr.tv_nsec;
+    cfg->tlm_pending = (tlm_batch > 0);
+    cfg->stage_pending = TRUE;
+    cfg->done_frame = frame;
+    cfg->done_ns = cfg->tlm.spi_ns;
+    pthread_mutex_unlock(&mutex[cfg->thread_id]);
+    return start_ns;
+}
+
+/**
+ * @brief Clock a maintenance frame through a bus and time it
+ * @param cfg Bus, its maint_xfer_ns is updated
+ * @param f Frame, replaced by the readback
+ * @return int as wiringPiSPIxDataRW()
+ */
+static int maint_xfer(thread_cfg_t *cfg, union CMD_DATA *f){
+    uint64_t start_ns = clock_now_ns();
+    int ret = wiringPiSPIxDataRW(cfg->spi_dev, cfg->spi_channel, f->bytes, SPI_BUF_SIZE);
+    uint64_t xfer_ns = clock_now_ns() - start_ns;
+
+    cfg->maint_xfer_ns = xfer_ns > cfg->maint_xfer_ns ? xfer_ns
+                         : cfg->maint_xfer_ns - cfg->maint_xfer_ns / MAINT_XFER_DECAY;
+    return ret;
+}
+
+/**
+ * @brief Read one register over a bus, a request then a poll for the response
+ * @param cfg Bus
+ * @param req Register to read
+ * @param res Output result
+ */
+static void maint_read(thread_cfg_t *cfg, const maint_req_t *req, maint_result_t *res){
+    union CMD_DATA f;
+    maint_frame_t m = {.op = MAINT_OP_READ, .dac = req->dac, .reg = req->reg, .tag = req->tag};
+
+    res->dac = req->dac;
+    res->reg = req->reg;
+    res->tag = req->tag;
+    res->value = 0;
+    maint_encode(&f, &m);
+    if (maint_xfer(cfg, &f) == -1) {
+        res->status = MAINT_ERR_SPI;
+    } else {
+        m.op = MAINT_OP_POLL;
+        maint_encode(&f, &m);
+        if (maint_xfer(cfg, &f) == -1) {
+            res->status = MAINT_ERR_SPI;
+        } else if (maint_decode(&f, &m) != 0 || m.op != (MAINT_OP_RESP | MAINT_OP_READ) ||
+                   m.tag != req->tag || m.dac != req->dac || m.reg != req->reg) {
+            res->status = MAINT_ERR_FRAME;
+        } else if (m.status != 0) {
+            res->status = MAINT_ERR_BOARD;
+        } else {
+            res->status = MAINT_OK;
+            res->value = m.value;
+        }
+    }
+    res->done_ns = clock_now_ns();
+}
+
+/**
+ * @brief Run a waiting maintenance read in the idle time after a control frame
+ * @note A read is two transfers. It only starts when no frame is waiting,
+ * when both transfers end before the next frame is due, one period after the
+ * start of the frame that was just written, and when a control frame handed
+ * over just as the read starts would still be written within its period.
+ * Otherwise the slot is passed up and counted, and the read waits for the
+ * next one. Maintenance frames are always SPI_BUF_SIZE bytes, longer than
+ * the control frames of a short board, so their transfers are timed on
+ * their own. Until the first read the time is the recent longest control
+ * transfer scaled up to SPI_BUF_SIZE bytes.
+ * @param cfg Bus, written by the calling thread
+ * @param frame_ns Start of the control frame transfer that was just done
+ */
+static void maint_slot(thread_cfg_t *cfg, uint64_t frame_ns){
+    maint_req_t req;
+    maint_result_t res;
+    uint64_t maint_ns = cfg->maint_xfer_ns;
+    uint64_t cost = {0};
+
+    if (maint_ns == 0) maint_ns = cfg->xfer_ns * SPI_BUF_SIZE / cfg->frame_len;
+    cost = 2 * maint_ns + MAINT_GUARD_NSEC;
+
+    pthread_mutex_lock(&mutex[cfg->thread_id]);
+    if (maint_pending(&cfg->maint) == 0) {
+        pthread_mutex_unlock(&mutex[cfg->thread_id]);
+        return;
+    }
+    if (cfg->data_ready == TRUE || cost + cfg->xfer_ns > PERIOD_NSEC ||
+        clock_now_ns() + cost > frame_ns + PERIOD_NSEC) {
+        cfg->maint_deferred++;
+        pthread_mutex_unlock(&mutex[cfg->thread_id]);
+        return;
+    }
+    maint_pop_req(&cfg->maint, &req);
+    pthread_mutex_unlock(&mutex[cfg->thread_id]);
+
+    maint_read(cfg, &req, &res);
+    pthread_mutex_lock(&mutex[cfg->thread_id]);
+    // never full, the UDP thread takes the results every period
+    maint_push_result(&cfg->maint, &res);
+    pthread_mutex_unlock(&mutex[cfg->thread_id]);
+}
+
 /**
 * @brief SPI write thread
 * @param thr_cfg Pointer to thread configuration structure
@@ -171,95 +742,930 @@ static void getinfo()
 void * send_SPI_thread(void *thr_cfg){
     unsigned char TXRX_buffer[SPI_BUF_SIZE] = {0}; // buffer for SPI
     thread_cfg_t *cfg = (thread_cfg_t *)thr_cfg;
+    perfctr_t perf = {.leader = -1};
+    uint64_t perf_delta[PERFCTR_COUNT] = {0};
     memset(cmd_data[cfg->thread_id].bytes, 0, SPI_BUF_SIZE); // clear the SPI buffer
 
-    struct timespec tmr={0};
-    pthread_mutex_lock(&mutex[cfg->thread_id]);
+    prefault_stack();
+    warm_spi(cfg);
+    if (perf_enabled == TRUE) perfctr_open(&perf);
+    pthread_barrier_wait(&ready_barrier);
+
+    uint32_t seq = {0};
+    uint32_t frame = {0};
+    uint64_t rx_ns = {0};
+    uint8_t status = {0};
+    uint64_t start_ns = {0};
     while(TRUE){
+        if (handoff == HANDOFF_SPIN) {
+            // poll the flag, the mutex is only taken once a frame is there
+            while(__atomic_load_n(&cfg->data_ready, __ATOMIC_ACQUIRE) == FALSE){
+                sched_yield();
+            }
+        }
+        pthread_mutex_lock(&mutex[cfg->thread_id]);
         // check the predicate
         while(cfg->data_ready == FALSE){
             pthread_cond_wait(&cond_var[cfg->thread_id], &mutex[cfg->thread_id]); // wait for signal
         }
-        // send SPI data
-        memcpy(TXRX_buffer, cmd_data[cfg->thread_id].bytes, SPI_BUF_SIZE); 
-        if (wiringPiSPIxDataRW (cfg->spi_dev,cfg->spi_channel, TXRX_buffer, sizeof(TXRX_buffer)) == -1){
-            syslog(LOG_ERR, "SPI failure: %s", strerror (errno)) ;
-        } 
-        clock_gettime(CLOCK_MONOTONIC, &tmr);
-        syslog(LOG_INFO,"SPI[%d] time: %ld.%09ld",cfg->thread_id, tmr.tv_sec, tmr.tv_nsec);
+        memcpy(TXRX_buffer, cmd_data[cfg->thread_id].bytes, cfg->frame_len);
+        seq = cfg->seq;
+        rx_ns = cfg->rx_ns;
+        status = cfg->flags;
+        frame = cfg->frame;
         cfg->data_ready = FALSE; // reset the flag
         pthread_mutex_unlock(&mutex[cfg->thread_id]); // unlock the data
+        if (perf.leader != -1) {
+            perfctr_delta(&perf, perf_delta); // the last cycle: wait, pickup and transfer
+        }
+        start_ns = spi_transfer(cfg, TXRX_buffer, seq, rx_ns, status, frame, perf.leader != -1 ? perf_delta : NULL);
+        maint_slot(cfg, start_ns);
     }
     pthread_exit(NULL); // Return NULL to indicate thread completion
 }
 
+/**
+ * @brief Hand a frame to every SPI thread, or write it to every bus with ENGINE_SINGLE
+ * @note The crc is updated incrementally from the previous frame, so only
+ * the words that changed are fed through the CRC shift tables. Buses with a
+ * board other than kasm26 get a frame of their own, packed in full.
+ * @param vals Command values in host byte order (CMD_VALS entries)
+ * @param flags KNODE_TLM_SYNTH for interpolated or extrapolated frames
+ */
+static void dispatch_frame(const int16_t *vals, uint8_t flags){
+    union CMD_DATA next;
+    uint8_t changed[CMD_VALS];
+    int n_changed = {0};
+    uint64_t start_ns = {0};
+
+    memcpy(next.values, vals, CMD_SIZE);
+    if (spi_frame_valid == TRUE) {
+        for (int i = 0; i < CMD_VALS; i++) {
+            if (vals[i] != spi_frame.values[i]) changed[n_changed++] = i;
+        }
+        crc = append_crc_incr(&next, &spi_frame, changed, n_changed, &crc_shift);
+    } else {
+        crc = append_crc(&next); // compute the crc and append to the command data
+        spi_frame_valid = TRUE;
+    }
+    pack_boards(board_frame, vals);
+    if (fr_cycle != NULL) fr_cycle->crc_ns = clock_now_ns();
+    spi_frame = next;
+    if (++spi_frame_id == 0) spi_frame_id = 1;
+    if (tlm_batch > 0 && tlm_wait_ns == 0) tlm_wait_ns = clock_now_ns();
+    if (rx_fresh == TRUE) {
+        flags |= KNODE_TLM_FRESH; // first frame since the command arrived
+        rx_fresh = FALSE;
+        if (first_frame == 0) {
+            first_frame = spi_frame_id;
+            first_rx_ns = rx_time_ns;
+        }
+    }
+
+    if (vclock_is_virtual()) {
+        for(int i=0;i<SPI_BUF_SIZE;i++){
+            virtual_digest = (virtual_digest ^ spi_frame.bytes[i]) * 0x100000001b3ULL;
+        }
+        virtual_frames++;
+    }
+    if (engine == ENGINE_SINGLE) {
+        // no SPI threads, write every bus in turn, always in the same order
+        for(int thr=0;thr<num_threads;thr++){
+            memcpy(cmd_data[thr].bytes, bus_frame(&thread_cfgs[thr])->bytes, thread_cfgs[thr].frame_len);
+            uint64_t t = spi_transfer(&thread_cfgs[thr], cmd_data[thr].bytes, rx_seq, rx_time_ns, flags, spi_frame_id, NULL);
+            if (thr == 0) start_ns = t;
+        }
+        if (fr_cycle != NULL) {
+            fr_cycle->handoff_ns = clock_now_ns();
+            fr_cycle->frame = spi_frame_id;
+        }
+        // maintenance only once every bus has its frame
+        for(int thr=0;thr<num_threads;thr++){
+            maint_slot(&thread_cfgs[thr], start_ns);
+        }
+        return;
+    }
+    for(int thr=0;thr<num_threads;thr++){
+        pthread_mutex_lock(&mutex[thr]); // lock the mutex
+        memcpy(cmd_data[thr].bytes, bus_frame(&thread_cfgs[thr])->bytes, thread_cfgs[thr].frame_len);
+        thread_cfgs[thr].seq = rx_seq;
+        thread_cfgs[thr].rx_ns = rx_time_ns;
+        thread_cfgs[thr].flags = flags;
+        thread_cfgs[thr].frame = spi_frame_id;
+        if (thread_cfgs[thr].data_ready == TRUE) {
+            knode_stats.spi_coalesced++; // the bus never saw the previous frame
+        }
+        __atomic_store_n(&thread_cfgs[thr].data_ready, TRUE, __ATOMIC_RELEASE); // set the data ready flag
+        if (handoff == HANDOFF_CONDVAR) {
+            pthread_cond_signal(&cond_var[thr]); // signal SPI thread that new data is available
+        }
+        pthread_mutex_unlock(&mutex[thr]); // unlock the mutex
+    }
+    if (fr_cycle != NULL) {
+        fr_cycle->handoff_ns = clock_now_ns();
+        fr_cycle->frame = spi_frame_id;
+    }
+}
+
+/**
+ * @brief Check the result of a maintenance read and keep it for the telemetry
+ * @note A failed read, a STATUS reference alarm or a DEVICE_ID that differs
+ * from the first one read on that DAC is logged and counted.
+ * @param bus SPI thread index
+ * @param res Result from the bus
+ */
+static void maint_check(int bus, const maint_result_t *res){
+    uint32_t *id = NULL;
+
+    knode_stats.maint_done++;
+    if (res->status != MAINT_OK) {
+        knode_stats.maint_errors++;
+        syslog(LOG_WARNING, "bus %d dac %d register 0x%02x read failed: status %d",
+               bus, res->dac, res->reg, res->status);
+    } else if (res->reg == DAC80508_REG_STATUS && (res->value & DAC80508_STATUS_REF_ALARM)) {
+        knode_stats.maint_alarms++;
+        syslog(LOG_WARNING, "bus %d dac %d reference alarm, STATUS 0x%04x", bus, res->dac, res->value);
+    } else if (res->reg == DAC80508_REG_DEVICE_ID && res->dac < MAINT_DACS) {
+        id = &maint_devid[bus][res->dac];
+        if (*id == 0) {
+            syslog(LOG_INFO, "bus %d dac %d DEVICE_ID 0x%04x", bus, res->dac, res->value);
+        } else if ((*id & 0xFFFF) != res->value) {
+            knode_stats.maint_alarms++;
+            syslog(LOG_WARNING, "bus %d dac %d DEVICE_ID changed from 0x%04x to 0x%04x",
+                   bus, res->dac, *id & 0xFFFF, res->value);
+        }
+        *id = 0x10000 | res->value;
+    }
+    if (tlm_batch == 0) return;
+    if (reg_count < KNODE_REG_MAX_RECS) {
+        reg_recs[reg_count++] = (knode_reg_rec_t){
+            .bus = (uint8_t)bus, .dac = res->dac, .reg = res->reg, .status = res->status,
+            .value = res->value, .tag = res->tag, .done_ns = res->done_ns};
+    } else {
+        knode_stats.tlm_dropped++;
+    }
+}
+
+/**
+ * @brief Queue the health check reads on every bus when they are due
+ * @note STATUS and DEVICE_ID of every DAC. A bus that still has reads of
+ * the previous check waiting is skipped, so a bus with no idle time does not
+ * pile up requests.
+ * @param now_ns Current time
+ */
+static void maint_health(uint64_t now_ns){
+    static const uint8_t regs[] = {DAC80508_REG_STATUS, DAC80508_REG_DEVICE_ID};
+    maint_req_t req;
+
+    if (maint_interval_ns == 0 || (int64_t)(now_ns - maint_next_ns) < 0) return;
+    maint_next_ns = now_ns + maint_interval_ns;
+    for(int thr=0;thr<num_threads;thr++){
+        pthread_mutex_lock(&mutex[thr]);
+        if (maint_pending(&thread_cfgs[thr].maint) == 0) {
+            for (int dac = 0; dac < MAINT_DACS; dac++) {
+                for (size_t r = 0; r < sizeof(regs); r++) {
+                    req = (maint_req_t){.dac = (uint8_t)dac, .reg = regs[r], .tag = ++maint_tag};
+                    maint_push_req(&thread_cfgs[thr].maint, &req);
+                }
+            }
+        }
+        pthread_mutex_unlock(&mutex[thr]);
+    }
+}
+
+/**
+ * @brief Collect the telemetry records and the bus skew from the SPI buses
+ * @note The skew of a frame is counted once every bus has completed it and
+ * none has moved on to the next frame yet, so frames may be skipped. The
+ * first command latency runs to the first transfer on every bus at or after
+ * its frame. The stage latencies and the flight recorder are sampled from
+ * the last transfer on each bus, and need spi_records.
+ */
+static void collect_spi(void){
+    maint_result_t res[MAINT_QUEUE];
+    int nres = {0};
+    uint32_t frame = {0};
+    uint64_t first_ns = UINT64_MAX;
+    uint64_t last_ns = {0};
+    int same = TRUE;
+    int all_done = TRUE; // every bus has written the last frame
+    int first_done = (first_frame != 0 && knode_stats.first_cmd_ns == 0);
+
+    for(int thr=0;thr<num_threads;thr++){
+        pthread_mutex_lock(&mutex[thr]);
+        if (thread_cfgs[thr].tlm_pending == TRUE) {
+            if (tlm_count < KNODE_TLM_MAX_RECS) {
+                tlm_recs[tlm_count++] = thread_cfgs[thr].tlm;
+            } else {
+                knode_stats.tlm_dropped++;
+            }
+            thread_cfgs[thr].tlm_pending = FALSE;
+        }
+        knode_stats.tlm_dropped += thread_cfgs[thr].tlm_dropped;
+        thread_cfgs[thr].tlm_dropped = 0;
+        if (thread_cfgs[thr].stage_pending == TRUE) {
+            const knode_tlm_rec_t *rec = &thread_cfgs[thr].tlm;
+            if (fr_cycle != NULL && thr < FLIGHTREC_MAX_BUSES) {
+                fr_cycle->bus[thr].start_ns = rec->start_ns;
+                fr_cycle->bus[thr].done_ns = rec->spi_ns;
+                fr_cycle->bus[thr].seq = rec->seq;
+                fr_cycle->bus[thr].status = rec->status;
+            }
+            if (rec->status & KNODE_TLM_FRESH) {
+                hist_add(&knode_stats.queue_ns, rec->start_ns - rec->rx_ns);
+            }
+            hist_add(&knode_stats.spi_ns, rec->spi_ns - rec->start_ns);
+            thread_cfgs[thr].stage_pending = FALSE;
+        }
+        for (int i = 0; i < PERFCTR_COUNT; i++) {
+            knode_stats.perf_spi[i] += thread_cfgs[thr].perf[i];
+            if (thread_cfgs[thr].perf_max[i] > knode_stats.perf_spi_max[i]) {
+                knode_stats.perf_spi_max[i] = thread_cfgs[thr].perf_max[i];
+            }
+            thread_cfgs[thr].perf[i] = 0;
+            thread_cfgs[thr].perf_max[i] = 0;
+        }
+        knode_stats.spi_errors += thread_cfgs[thr].spi_errors;
+        knode_stats.crc_errors += thread_cfgs[thr].crc_errors;
+        thread_cfgs[thr].spi_errors = 0;
+        thread_cfgs[thr].crc_errors = 0;
+        for (nres = 0; nres < MAINT_QUEUE && maint_pop_result(&thread_cfgs[thr].maint, &res[nres]) == 0; nres++);
+        knode_stats.maint_deferred += thread_cfgs[thr].maint_deferred;
+        thread_cfgs[thr].maint_deferred = 0;
+        if (thr == 0) {
+            frame = thread_cfgs[thr].done_frame;
+        } else if (thread_cfgs[thr].done_frame != frame) {
+            same = FALSE;
+        }
+        if ((int32_t)(thread_cfgs[thr].done_frame - first_frame) < 0) first_done = FALSE;
+        if (thread_cfgs[thr].done_frame != spi_frame_id) all_done = FALSE;
+        if (thread_cfgs[thr].done_ns < first_ns) first_ns = thread_cfgs[thr].done_ns;
+        if (thread_cfgs[thr].done_ns > last_ns) last_ns = thread_cfgs[thr].done_ns;
+        pthread_mutex_unlock(&mutex[thr]);
+        for (int i = 0; i < nres; i++) {
+            maint_check(thr, &res[i]); // may log, outside the bus lock
+        }
+    }
+    if (all_done == TRUE) tlm_wait_ns = 0;
+    if (num_threads > 1 && same == TRUE && frame != 0 && frame != skew_frame) {
+        hist_add(&knode_stats.bus_skew_ns, last_ns - first_ns);
+        skew_frame = frame;
+    }
+    if (first_done == TRUE) {
+        knode_stats.first_cmd_ns = last_ns - first_rx_ns;
+        syslog(LOG_NOTICE, "first command on every bus %llu ns after it was received",
+               (unsigned long long)knode_stats.first_cmd_ns);
+    }
+}
+
+/**
+ * @brief Send a telemetry datagram to the peer, or into the shared memory segment
+ * @param pkt Datagram
+ * @param len Datagram length
+ * @param recs Records in it, counted as dropped if the send fails
+ */
+static void tlm_send(const uint8_t *pkt, size_t len, int recs){
+    if (shm_name != NULL) {
+        shm_cmd_send(&shm_cmd, pkt, len); // never refused, slow readers overrun
+        knode_stats.tlm_sent++;
+    } else if (sendto(udp_fd, pkt, len, MSG_DONTWAIT, (struct sockaddr *)&tlm_peer, tlm_peer_len) != (ssize_t)len) {
+        knode_stats.tlm_dropped += recs;
+    } else {
+        knode_stats.tlm_sent++;
+    }
+}
+
+/**
+ * @brief Send the results of the maintenance reads, as soon as there are any
+ */
+static void send_reg_telemetry(void){
+    uint8_t pkt[knode_reg_size(KNODE_REG_MAX_RECS)];
+    size_t len = {0};
+
+    if (reg_count == 0 || (tlm_peer_len == 0 && shm_name == NULL)) return;
+    len = knode_encode_reg(pkt, tlm_seq++, reg_recs, reg_count);
+    tlm_send(pkt, len, reg_count);
+    reg_count = 0;
+}
+
+/**
+ * @brief Send the collected telemetry records
+ * @note Records are batched, a datagram goes out when tlm_batch records are
+ * ready or the oldest record is TLM_FLUSH_NSEC old.
+ * @param now Current time (CLOCK_MONOTONIC)
+ */
+static void send_telemetry(const struct timespec *now){
+    uint8_t pkt[knode_tlm_size(KNODE_TLM_MAX_RECS)];
+    uint64_t now_ns = (uint64_t)now->tv_sec * NSEC_PER_SEC + now->tv_nsec;
+    struct timespec tx_tmr = {0};
+    size_t len = {0};
+
+    if (tlm_count == 0 || (tlm_peer_len == 0 && shm_name == NULL)) return;
+    if (tlm_count < tlm_batch && (int64_t)(now_ns - tlm_recs[0].spi_ns) < TLM_FLUSH_NSEC) return;
+
+    vclock_gettime(&tx_tmr);
+    len = knode_encode_tlm(pkt, tlm_seq++, (uint64_t)tx_tmr.tv_sec * NSEC_PER_SEC + tx_tmr.tv_nsec,
+                           tlm_recs, tlm_count);
+    tlm_send(pkt, len, tlm_count);
+    tlm_count = 0;
+}
+
+/**
+ * @brief Shorten the receive wait so a partial telemetry batch still goes out in time
+ * @note The loop only sends telemetry between receives, and in hold mode it
+ * waits up to timeout_ms for a command. The oldest record, or a frame still
+ * on the buses, is due TLM_FLUSH_NSEC after it was written.
+ * @param timeout_ms Receive timeout of the loop, 0 for none
+ * @return int timeout to use, in ms
+ */
+static int tlm_timeout_ms(int timeout_ms){
+    uint64_t oldest_ns = UINT64_MAX;
+    int64_t left_ns = {0};
+
+    if (timeout_ms == 0 || tlm_batch == 0 || (tlm_peer_len == 0 && shm_name == NULL)) return timeout_ms;
+    if (tlm_count > 0) oldest_ns = tlm_recs[0].spi_ns;
+    if (tlm_wait_ns != 0 && tlm_wait_ns < oldest_ns) oldest_ns = tlm_wait_ns;
+    if (oldest_ns == UINT64_MAX) return timeout_ms;
+    left_ns = (int64_t)(oldest_ns + TLM_FLUSH_NSEC - clock_now_ns());
+    if (left_ns <= 0) return 1; // recheck soon, send_telemetry() flushes once the records are in
+    left_ns = (left_ns + 999999) / 1000000;
+    return left_ns < timeout_ms ? (int)left_ns : timeout_ms;
+}
+
+/**
+ * @brief Set up the socket for RX_BUSYPOLL
+ * @param timeout_ms Receive timeout, 0 for none
+ * @return int 0 on success, 1 on failure
+ * @note The busy poll budget is capped by net.core.busy_read unless the
+ * process has CAP_NET_ADMIN. Loopback has no device queue to poll.
+ */
+static int init_busy_poll(int timeout_ms){
+    int usec = (int)(rx_spin_nsec / 1000);
+    int one = 1;
+    struct timeval tv = {0};
+
+    if (setsockopt(udp_fd, SOL_SOCKET, SO_BUSY_POLL, &usec, sizeof(usec)) != 0) {
+        fprintf(stderr, "SO_BUSY_POLL failed: %s\n", strerror(errno));
+        return 1;
+    }
+#ifdef SO_PREFER_BUSY_POLL
+    if (setsockopt(udp_fd, SOL_SOCKET, SO_PREFER_BUSY_POLL, &one, sizeof(one)) != 0) {
+        fprintf(stderr, "SO_PREFER_BUSY_POLL not set: %s\n", strerror(errno)); // before Linux 5.11
+    }
+#else
+    (void)one;
+#endif
+    tv.tv_sec = timeout_ms / 1000;
+    tv.tv_usec = (timeout_ms % 1000) * 1000;
+    if (setsockopt(udp_fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv)) != 0) {
+        fprintf(stderr, "SO_RCVTIMEO failed: %s\n", strerror(errno));
+        return 1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Descriptors to poll for datagrams, the UDP socket and the AF_XDP socket
+ * @param fds At least 2 entries
+ * @return int number of descriptors
+ */
+static int rx_pollfds(struct pollfd *fds){
+    int n = {0};
+
+    fds[n++] = (struct pollfd){udp_fd, POLLIN, 0};
+#ifdef HAVE_XDP
+    if (xdp_ifname != NULL) {
+        fds[n++] = (struct pollfd){xdp_rx_fd(&xdp_rx), POLLIN, 0};
+    }
+#endif
+    return n;
+}
+
+/**
+ * @brief Receive a datagram from the UDP socket with its kernel receive time
+ * @note Sets rx_stamp_ns, 0 when the datagram carries no timestamp.
+ * @param buf Receive buffer of UDP_BUF_SIZE bytes
+ * @param flags recvmsg() flags
+ * @param peer Sender address
+ * @param peer_len Size of peer, set to the address length
+ * @return ssize_t as recvfrom()
+ */
+static ssize_t sock_recv(uint8_t *buf, int flags, struct sockaddr_storage *peer, socklen_t *peer_len){
+    struct iovec iov = {.iov_base = buf, .iov_len = UDP_BUF_SIZE};
+    union {
+        char buf[CMSG_SPACE(sizeof(struct timespec))];
+        struct cmsghdr align;
+    } ctrl;
+    struct msghdr msg = {.msg_name = peer, .msg_namelen = *peer_len, .msg_iov = &iov, .msg_iovlen = 1,
+                         .msg_control = ctrl.buf, .msg_controllen = sizeof(ctrl.buf)};
+    ssize_t nread = recvmsg(udp_fd, &msg, flags);
+
+    rx_stamp_ns = 0;
+    if (nread < 0) return nread;
+    *peer_len = msg.msg_namelen;
+    for (struct cmsghdr *c = CMSG_FIRSTHDR(&msg); c != NULL; c = CMSG_NXTHDR(&msg, c)) {
+        if (c->cmsg_level == SOL_SOCKET && c->cmsg_type == SCM_TIMESTAMPNS) {
+            struct timespec ts;
+            memcpy(&ts, CMSG_DATA(c), sizeof(ts));
+            rx_stamp_ns = (uint64_t)ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+        }
+    }
+    return nread;
+}
+
+/**
+ * @brief Take a datagram from the AF_XDP ring, else from the UDP socket
+ * @param buf Receive buffer of UDP_BUF_SIZE bytes
+ * @param pkt Set to the datagram, buf or a UMEM frame held until the next call
+ * @param flags recvfrom() flags, MSG_DONTWAIT is added with AF_XDP as the
+ * datagram that woke poll() may be on either socket
+ * @param peer Sender address
+ * @param peer_len Size of peer, set to the address length
+ * @return ssize_t datagram length, -1 on error
+ */
+static ssize_t rx_take(uint8_t *buf, const uint8_t **pkt, int flags,
+                       struct sockaddr_storage *peer, socklen_t *peer_len){
+#ifdef HAVE_XDP
+    if (xdp_ifname != NULL) {
+        ssize_t nread = xdp_rx_next(&xdp_rx, pkt, (struct sockaddr_in *)peer);
+        rx_stamp_ns = 0; // AF_XDP frames carry no receive time
+        knode_stats.rx_bad_size += xdp_rx.dropped;
+        xdp_rx.dropped = 0;
+        if (nread >= 0) {
+            *peer_len = sizeof(struct sockaddr_in);
+            knode_stats.rx_xdp++;
+            return nread;
+        }
+        flags |= MSG_DONTWAIT;
+    }
+#endif
+    *pkt = buf;
+    return sock_recv(buf, flags, peer, peer_len);
+}
+
+/**
+ * @brief Wait for a datagram with RX_SPIN or RX_BUSYPOLL
+ * @param buf Receive buffer of UDP_BUF_SIZE bytes
+ * @param pkt Set to the datagram, see rx_take()
+ * @param timeout_ms Longest wait, 0 returns at once after the spin
+ * @param peer Sender address
+ * @param peer_len Size of peer, set to the address length
+ * @return ssize_t datagram length, -1 with errno EAGAIN on timeout, EINTR
+ * when stopped, otherwise a receive error
+ */
+static ssize_t spin_recv(uint8_t *buf, const uint8_t **pkt, int timeout_ms,
+                         struct sockaddr_storage *peer, socklen_t *peer_len){
+    struct pollfd fds[2];
+    int nfds = rx_pollfds(fds);
+    struct timespec now = {0};
+    uint64_t until_ns = {0};
+    uint64_t now_ns = {0};
+    ssize_t nread = {0};
+
+    if (rx_mode == RX_BUSYPOLL) {
+        // the kernel polls the device queue for the budget, then sleeps
+        *pkt = buf;
+        return sock_recv(buf, timeout_ms == 0 ? MSG_DONTWAIT : 0, peer, peer_len);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    until_ns = (uint64_t)now.tv_sec * NSEC_PER_SEC + now.tv_nsec + rx_spin_nsec;
+    do {
+        nread = rx_take(buf, pkt, MSG_DONTWAIT, peer, peer_len);
+        if (nread >= 0) {
+            knode_stats.rx_spin++;
+            return nread;
+        }
+        if (errno != EAGAIN && errno != EWOULDBLOCK) return -1;
+        if (running == FALSE) {
+            errno = EINTR;
+            return -1;
+        }
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        now_ns = (uint64_t)now.tv_sec * NSEC_PER_SEC + now.tv_nsec;
+    } while (now_ns < until_ns);
+
+    // budget spent, fall back to sleeping
+    if (timeout_ms == 0) {
+        errno = EAGAIN;
+        return -1;
+    }
+    switch (poll(fds, nfds, timeout_ms)) {
+        case -1:
+            return -1;
+        case 0:
+            errno = EAGAIN;
+            return -1;
+        default:
+            break;
+    }
+    return rx_take(buf, pkt, 0, peer, peer_len);
+}
+
+/**
+ * @brief Wait for a command from the shared memory segment
+ * @param buf Receive buffer of UDP_BUF_SIZE bytes
+ * @param timeout_ms Longest wait, 0 returns at once
+ * @return ssize_t command length, -1 with errno EAGAIN if none arrived
+ * @note With RX_SPIN the ring is polled for the spin budget before the
+ * thread sleeps on the futex.
+ */
+static ssize_t shm_recv(uint8_t *buf, int timeout_ms){
+    struct timespec now = {0};
+    uint64_t until_ns = {0};
+    uint64_t now_ns = {0};
+    ssize_t nread = shm_cmd_recv(&shm_cmd, buf, UDP_BUF_SIZE, NULL);
+
+    if (nread < 0 && rx_mode == RX_SPIN) {
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        until_ns = (uint64_t)now.tv_sec * NSEC_PER_SEC + now.tv_nsec + rx_spin_nsec;
+        do {
+            nread = shm_cmd_recv(&shm_cmd, buf, UDP_BUF_SIZE, NULL);
+            if (nread >= 0) {
+                knode_stats.rx_spin++;
+                break;
+            }
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            now_ns = (uint64_t)now.tv_sec * NSEC_PER_SEC + now.tv_nsec;
+        } while (now_ns < until_ns && running == TRUE);
+    }
+    if (nread < 0 && timeout_ms > 0 && shm_cmd_wait(&shm_cmd, timeout_ms) == 1) {
+        nread = shm_cmd_recv(&shm_cmd, buf, UDP_BUF_SIZE, NULL);
+    }
+    if (nread >= 0) {
+        knode_stats.rx_shm++;
+    }
+    knode_stats.shm_overruns = shm_cmd.overruns;
+    return nread;
+}
+
+/**
+ * @brief Decode a received packet and apply it to rx_frame
+ * @param pkt Received packet
+ * @param len Packet length in bytes
+ * @param rx_ns Kernel receive time, for the path lead of a redundant sender, 0 if unknown
+ * @return int PKT_APPLIED if rx_frame holds a new command, PKT_DUPLICATE if
+ * the command was already applied, PKT_DROPPED otherwise
+ */
+static int apply_packet(const uint8_t *pkt, ssize_t len, uint64_t rx_ns){
+    int16_t vals[CMD_VALS];
+    uint32_t seq = {0};
+    int type = {0};
+    seq_result_t res = SEQ_ACCEPT;
+
+    memcpy(vals, rx_frame, CMD_SIZE); // base for delta packets
+    type = knode_decode(pkt, len, vals, &seq);
+    if (type < 0) {
+        knode_stats.rx_bad_size++;
+        syslog(LOG_ERR, "Received malformed packet of %zd bytes", len);
+        return PKT_DROPPED;
+    }
+    if (type != KNODE_PKT_LEGACY) {
+        res = seq_check(&seq_track, seq, &knode_stats);
+        path_check(&path_track, seq, knode_get_path(pkt, len), res, rx_ns, &knode_stats);
+        if (res == SEQ_DUPLICATE) return PKT_DUPLICATE;
+        if (res != SEQ_ACCEPT) return PKT_DROPPED;
+    }
+    switch (type) {
+        case KNODE_PKT_FULL:
+            rx_chain = TRUE; // keyframe
+            break;
+        case KNODE_PKT_DELTA:
+        case KNODE_PKT_DELTA_VAR:
+            knode_stats.rx_delta++;
+            if (rx_chain == FALSE || seq != rx_seq + 1) {
+                // base was missed, wait for the next keyframe: differences are
+                // meaningless without it, and absolute values of the changed words
+                // alone would leave stale words the sender has since changed
+                rx_chain = FALSE;
+                knode_stats.delta_dropped++;
+                return PKT_DROPPED;
+            }
+            break;
+        default:
+            rx_chain = FALSE; // legacy packets carry no sequence number
+            break;
+    }
+    memcpy(rx_frame, vals, CMD_SIZE);
+    rx_seq = seq;
+    knode_stats.rx_packets++;
+    syslog(LOG_DEBUG, "Received %zd bytes, type %d, seq %u", len, type, seq);
+    return PKT_APPLIED;
+}
+
+/**
+ * @brief Take the next captured datagram in virtual time, in place of poll() and recvfrom()
+ * @note Like poll(), waits up to timeout_ms for the datagram to be due.
+ * Ends the run VIRTUAL_DRAIN_NSEC after the last datagram.
+ * @param buf Output datagram, at least CAPTURE_DATA_SIZE bytes
+ * @param timeout_ms Longest wait, 0 to return at once
+ * @param now Current time, updated if the clock moved while waiting
+ * @return ssize_t datagram length, 0 if none is due
+ */
+static ssize_t virtual_recv(uint8_t *buf, int timeout_ms, struct timespec *now){
+    uint64_t n = capture_records(&virtual_cap);
+    uint64_t loop = virtual_next / n;
+    uint64_t first_ns = capture_get(&virtual_cap, 0)->rx_ns;
+    uint64_t now_ns = (uint64_t)now->tv_sec * NSEC_PER_SEC + now->tv_nsec;
+    uint64_t due_ns = {0};
+    struct timespec wake = {0};
+    const capture_rec_t *r = NULL;
+
+    if (loop >= (uint64_t)virtual_loops) {
+        due_ns = first_ns + virtual_loops * virtual_loop_ns + VIRTUAL_DRAIN_NSEC;
+        if (now_ns >= due_ns) running = FALSE;
+    } else {
+        r = capture_get(&virtual_cap, virtual_next % n);
+        due_ns = r->rx_ns + loop * virtual_loop_ns;
+    }
+    if (due_ns > now_ns) {
+        if (timeout_ms == 0) return 0;
+        if (due_ns > now_ns + (uint64_t)timeout_ms * 1000 * 1000) {
+            due_ns = now_ns + (uint64_t)timeout_ms * 1000 * 1000;
+        }
+        wake.tv_sec = due_ns / NSEC_PER_SEC;
+        wake.tv_nsec = due_ns % NSEC_PER_SEC;
+        vclock_sleep_until(&wake);
+        *now = wake;
+        return virtual_recv(buf, 0, now);
+    }
+    if (r == NULL) return 0;
+    virtual_next++;
+    return capture_copy(r, buf, loop * virtual_span);
+}
+
+/**
+ * @brief Copy the statistics into the -m segment for kasm_top
+ * @note Reads the CPU time of every RT thread, about a microsecond in all,
+ * so it runs every STATS_PUBLISH_NSEC rather than every period.
+ * @param now_ns Current time (CLOCK_MONOTONIC)
+ */
+static void publish_stats(uint64_t now_ns){
+    struct timespec cpu_tmr = {0};
+
+    knode_stats.dl_overruns = dl_overrun_count;
+    knode_stats.threads = (uint32_t)rt_nclocks;
+    for (int i = 0; i < rt_nclocks; i++) {
+        if (clock_gettime(rt_clock[i], &cpu_tmr) == 0) {
+            knode_stats.thread_cpu_ns[i] = (uint64_t)cpu_tmr.tv_sec * NSEC_PER_SEC + cpu_tmr.tv_nsec;
+        }
+    }
+    stats_publish(&knode_stats, now_ns);
+}
+
+/**
+ * @brief Move the UDP loop to SCHED_DEADLINE
+ * @note The runtime is -D, or DL_RUNTIME_MARGIN times the longest loop
+ * time measured so far. Deadline and period are the loop period. If the
+ * kernel refuses the reservation the loop stays SCHED_FIFO.
+ */
+static void enter_deadline(void){
+    uint64_t runtime = dl_runtime_ns;
+
+    if (runtime == 0) {
+        runtime = knode_stats.loop_ns.max * DL_RUNTIME_MARGIN;
+    }
+    if (runtime > PERIOD_NSEC) {
+        syslog(LOG_WARNING, "SCHED_DEADLINE runtime %llu ns capped to the period",
+               (unsigned long long)runtime);
+        runtime = PERIOD_NSEC;
+    }
+    if (rtcpu_set_deadline(runtime, PERIOD_NSEC, PERIOD_NSEC) != 0) {
+        syslog(LOG_ERR, "sched_setattr SCHED_DEADLINE runtime %llu ns failed: %s, staying SCHED_FIFO",
+               (unsigned long long)runtime, strerror(errno));
+        fprintf(stderr, "SCHED_DEADLINE refused: %s, staying SCHED_FIFO\n", strerror(errno));
+        sched_policy = SCHED_FIFO;
+        return;
+    }
+    knode_stats.dl_runtime_ns = runtime;
+    syslog(LOG_NOTICE, "UDP loop SCHED_DEADLINE runtime %llu ns period %d ns",
+           (unsigned long long)runtime, PERIOD_NSEC);
+}
+
 /**
  * @brief Receive data over UDP
+ * @note With interpolation enabled the socket is polled without blocking and
+ * a frame is generated on every tick, otherwise frames are only sent when a
+ * new command arrives. Sequenced packets are checked for gaps, duplicates
+ * and reordering, delta packets are applied on top of the last command, and
+ * overdue commands are extrapolated by the concealer.
  * @return 0 on success, -1 on failure
  */
 void * recv_UDP(void *data){
-
+    (void)data;
     ssize_t nread;
     socklen_t peer_addrlen;
     struct sockaddr_storage peer_addr;
-    union CMD_DATA buf_data;
+    uint8_t buf_data[UDP_BUF_SIZE];
+    const uint8_t *pkt = buf_data; // received datagram, buf_data or an AF_XDP frame
+    int16_t frame[CMD_VALS] = {0}; // decoded or interpolated command values
+    struct timespec extrap_tmr={0}; // nominal time of an extrapolated command
+    struct timespec stats_tmr={0}; // time of the next statistics report
     struct timespec prd_tmr={0};
     struct timespec curr_tmr={0};
     long int delta_time_nsec = {0};
+    uint64_t start_ns = {0}; // time the loop started working on this period
+    uint64_t now_ns = {0};
+    uint64_t publish_ns = {0}; // time of the next -m update
+    perfctr_t perf = {.leader = -1};
+    uint64_t perf_delta[PERFCTR_COUNT] = {0}; // counts of the last period
+    uint64_t wake_ns = {0}; // end of the last sleep
+    uint64_t wake_late_ns = {0}; // how late that was
+    struct timespec publish_tmr = {0};
     int timeout_ms = 1000; // 1 second timeout for polling
 
-    memset(buf_data.bytes, 0, SPI_BUF_SIZE); // init the UDP buffer
+    if (interp_mode != INTERP_NONE || extrap_mode != EXTRAP_HOLD) {
+        timeout_ms = 0; // tick at the node rate whether or not data arrived
+    }
+    interp_init(&interp, interp_mode, CMD_VALS, rtc_period_nsec);
+    conceal_init(&conceal, extrap_mode, CMD_VALS, conceal_periods);
+    memset(buf_data, 0, UDP_BUF_SIZE); // init the UDP buffer
+    hist_init(&knode_stats.loop_ns);
+    hist_init(&knode_stats.wake_late_ns);
+    hist_init(&knode_stats.bus_skew_ns);
+    hist_init(&knode_stats.queue_ns);
+    hist_init(&knode_stats.spi_ns);
+    hist_init(&knode_stats.path_lead_ns);
+    vclock_gettime(&stats_tmr);
 
     peer_addrlen = sizeof(peer_addr);
     // set up polling
-    struct pollfd fds[1]; //monitor UDP for incoming data
-    fds[0].fd = udp_fd;
-    fds[0].events = POLLIN; // look for new data
+    struct pollfd fds[2]; //monitor UDP for incoming data
+    int nfds = {0};
     int poll_ret = {0};
     getinfo();
+
+    // warm up on this CPU, then wait for main to open the port
+    prefault_stack();
+    warm_kernels();
+    if (engine == ENGINE_SINGLE && !vclock_is_virtual()) {
+        for(int thr=0;thr<num_threads;thr++){
+            warm_spi(&thread_cfgs[thr]);
+        }
+    }
+    if (perf_enabled == TRUE) {
+        knode_stats.perf_mask = perfctr_open(&perf);
+        if (knode_stats.perf_mask == 0) {
+            syslog(LOG_WARNING, "No performance counters available: %s", strerror(errno));
+        }
+        flightrec.perf_mask = knode_stats.perf_mask;
+    }
+    syslog(LOG_INFO, "UDP thread ready");
+    pthread_barrier_wait(&ready_barrier);
+    pthread_barrier_wait(&go_barrier);
+    if (perf.leader != -1) {
+        perfctr_delta(&perf, perf_delta); // the first period starts here
+    }
+    nfds = rx_pollfds(fds);
     while(running == TRUE){
-        poll_ret = poll(fds, 1, timeout_ms);
-        clock_gettime(CLOCK_MONOTONIC, &prd_tmr);
-        if(poll_ret < 0) exit(EXIT_FAILURE); // error
-        if(poll_ret == 0) {
-            syslog(LOG_WARNING, "UDP poll timeout after %d ms", timeout_ms);
+        int wait_ms = tlm_timeout_ms(timeout_ms);
+
+        rx_stamp_ns = 0; // set by a socket receive
+
+        if (fr_dir != NULL) {
+            fr_cycle = flightrec_begin(&flightrec);
+            fr_cycle->wake_ns = wake_ns;
+        }
+        if (vclock_is_virtual()) {
+            vclock_gettime(&prd_tmr);
+            nread = virtual_recv(buf_data, wait_ms, &prd_tmr);
+            poll_ret = (nread > 0);
+            peer_addrlen = 0; // no telemetry peer
+        } else if (shm_name != NULL) {
+            nread = shm_recv(buf_data, wait_ms);
+            clock_gettime(CLOCK_MONOTONIC, &prd_tmr);
+            poll_ret = (nread >= 0);
+            peer_addrlen = 0; // telemetry goes back through the segment
+        } else if (rx_mode != RX_BLOCK) {
+            nread = spin_recv(buf_data, &pkt, wait_ms, &peer_addr, &peer_addrlen);
+            clock_gettime(CLOCK_MONOTONIC, &prd_tmr);
+            if(nread < 0 && errno == EINTR) continue; // stop signal
+            poll_ret = (nread >= 0 || (errno != EAGAIN && errno != EWOULDBLOCK));
         } else {
-            // Receive data from the UDP socket
-            nread = recvfrom(udp_fd, buf_data.bytes, CMD_SIZE, 0,
-                            (struct sockaddr *)&peer_addr, &peer_addrlen);
-            if (nread == -1)
-            {
-                syslog(LOG_ERR, "Error receiving UDP data: %s\n", strerror(errno));
+            poll_ret = poll(fds, nfds, wait_ms);
+            clock_gettime(CLOCK_MONOTONIC, &prd_tmr);
+            if(poll_ret < 0 && errno == EINTR) continue; // stop signal
+            if(poll_ret < 0) exit(EXIT_FAILURE); // error
+            if(poll_ret > 0) {
+                // Receive data from the UDP socket
+                nread = rx_take(buf_data, &pkt, 0, &peer_addr, &peer_addrlen);
+                if (nread < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                    poll_ret = 0; // AF_XDP frame dropped as malformed
+                }
             }
+        }
+        start_ns = (uint64_t)prd_tmr.tv_sec * NSEC_PER_SEC + prd_tmr.tv_nsec;
+        if (fr_cycle != NULL) {
+            fr_cycle->rx_ns = start_ns;
+            if (poll_ret > 0 && nread >= 0) {
+                fr_cycle->rx_len = (int32_t)nread;
+                fr_cycle->flags |= FLIGHTREC_RX;
+            }
+        }
+        if(poll_ret == 0) {
+            if (wait_ms == timeout_ms && timeout_ms > 0 && running == TRUE) {
+                syslog(LOG_WARNING, "UDP poll timeout after %d ms", timeout_ms);
+            }
+        } else {
+            uint64_t pkt_ns = (uint64_t)prd_tmr.tv_sec * NSEC_PER_SEC + prd_tmr.tv_nsec;
+            for (int copies = 1; ; copies++) {
+                int rx = PKT_DROPPED;
 
-            if (nread == CMD_SIZE) {
-                syslog(LOG_DEBUG, "Received %zd bytes", nread);
-                for(int thr=0;thr<NUM_THREADS;thr++){
-                    pthread_mutex_lock(&mutex[thr]); // lock the mutex
-                    for (size_t i = 0; i < nread / 2; i++) {
-                        cmd_data[thr].values[i] = ntohs(buf_data.values[i]);
-                        syslog(LOG_DEBUG, "Received value %zu: %d\n", i, buf_data.values[i]);
+                if (nread >= 0 && capture_file != NULL) {
+                    capture_write(&capture, pkt_ns, pkt, nread);
+                }
+                if (nread == -1)
+                {
+                    syslog(LOG_ERR, "Error receiving UDP data: %s\n", strerror(errno));
+                }
+                else if ((rx = apply_packet(pkt, nread, rx_stamp_ns)) == PKT_APPLIED) {
+                    if (fr_cycle != NULL) {
+                        fr_cycle->decode_ns = clock_now_ns();
+                        fr_cycle->flags |= FLIGHTREC_CMD;
                     }
-                    crc = append_crc(&cmd_data[thr]); // compute the crc and append to the command data
-                    thread_cfgs[thr].data_ready = TRUE; // set the data ready flag
-                    pthread_cond_signal(&cond_var[thr]); // signal SPI thread that new data is available
-                    pthread_mutex_unlock(&mutex[thr]); // unlock the mutex
+                    memcpy(frame, rx_frame, CMD_SIZE);
+                    rx_time_ns = pkt_ns;
+                    rx_fresh = TRUE;
+                    memcpy(&tlm_peer, &peer_addr, peer_addrlen);
+                    tlm_peer_len = peer_addrlen;
+                    conceal_push(&conceal, frame, &prd_tmr);
+                    interp_push(&interp, frame, &prd_tmr);
+                    if (interp_mode == INTERP_NONE) {
+                        dispatch_frame(frame, 0);
+                    }
+                }
+                peer_addrlen = sizeof(peer_addr);
+#ifdef HAVE_XDP
+                if (xdp_ifname != NULL) {
+                    xdp_rx_release(&xdp_rx); // decoded, give the frame back
                 }
+#endif
+                // the losing copy of a redundant sender can sit in front of the next command
+                if (rx != PKT_DUPLICATE || copies >= KNODE_MAX_PATHS || vclock_is_virtual()) break;
+                if (shm_name != NULL) {
+                    nread = shm_recv(buf_data, 0);
+                    rx_stamp_ns = 0;
+                } else {
+                    nread = rx_take(buf_data, &pkt, MSG_DONTWAIT, &peer_addr, &peer_addrlen);
+                }
+                if (nread < 0) break;
+                pkt_ns = clock_now_ns();
             }
-            else {
-                syslog(LOG_ERR, "Received %zd bytes, expected %d bytes", nread, CMD_SIZE);
+        }
+        // fill in an overdue command
+        if (conceal_tick(&conceal, frame, &extrap_tmr, &prd_tmr, interp.period_nsec, &knode_stats)) {
+            syslog(LOG_DEBUG, "Extrapolated command %d", conceal.missed);
+            interp_push(&interp, frame, &extrap_tmr);
+            if (interp_mode == INTERP_NONE) {
+                dispatch_frame(frame, KNODE_TLM_SYNTH);
+                if (fr_cycle != NULL) fr_cycle->flags |= FLIGHTREC_SYNTH;
             }
         }
+        // generate the intermediate frame for this tick
+        if (interp_mode != INTERP_NONE && interp_sample(&interp, frame, &prd_tmr)) {
+            dispatch_frame(frame, KNODE_TLM_SYNTH);
+            if (fr_cycle != NULL) fr_cycle->flags |= FLIGHTREC_SYNTH;
+        }
+        collect_spi();
+        maint_health(start_ns);
+        if (fr_cycle != NULL) fr_cycle->collect_ns = clock_now_ns();
+        if (tlm_batch > 0) {
+            send_telemetry(&prd_tmr);
+            send_reg_telemetry();
+        }
         // Calculate next wake-up time
         prd_tmr.tv_nsec += PERIOD_NSEC;
         normalize_timespec(&prd_tmr);
         // Get the current time for logging
-        clock_gettime(CLOCK_MONOTONIC, &curr_tmr);
+        vclock_gettime(&curr_tmr);
+        now_ns = (uint64_t)curr_tmr.tv_sec * NSEC_PER_SEC + curr_tmr.tv_nsec;
+        hist_add(&knode_stats.loop_ns, now_ns - start_ns);
+        if (perf.leader != -1) {
+            // one read per period, so a delta covers the wait as well as the work
+            perfctr_delta(&perf, perf_delta);
+            for (int i = 0; i < PERFCTR_COUNT; i++) {
+                knode_stats.perf_udp[i] += perf_delta[i];
+                if (perf_delta[i] > knode_stats.perf_udp_max[i]) knode_stats.perf_udp_max[i] = perf_delta[i];
+            }
+        }
         // Compute the difference between current time and next period time
         delta_time_nsec = (prd_tmr.tv_sec - curr_tmr.tv_sec) * NSEC_PER_SEC +
                             (prd_tmr.tv_nsec - curr_tmr.tv_nsec);
         if (delta_time_nsec < 0) {
             syslog(LOG_ERR, "Missed deadline by %ld ns", -delta_time_nsec);
+            knode_stats.deadline_misses++;
+            if (perf.leader != -1) {
+                syslog(LOG_ERR, "Missed period: cycles %llu instructions %llu cache misses %llu"
+                       " ctx switches %llu page faults %llu migrations %llu",
+                       (unsigned long long)perf_delta[PERFCTR_CYCLES],
+                       (unsigned long long)perf_delta[PERFCTR_INSTRUCTIONS],
+                       (unsigned long long)perf_delta[PERFCTR_CACHE_MISSES],
+                       (unsigned long long)perf_delta[PERFCTR_CTX_SWITCHES],
+                       (unsigned long long)perf_delta[PERFCTR_PAGE_FAULTS],
+                       (unsigned long long)perf_delta[PERFCTR_MIGRATIONS]);
+                for (int i = 0; i < PERFCTR_COUNT; i++) {
+                    knode_stats.perf_udp_miss[i] += perf_delta[i];
+                }
+            }
             // If we missed the deadline 
             // set period timer to current time plus one period
             prd_tmr.tv_sec = curr_tmr.tv_sec;
@@ -267,23 +1673,68 @@ void * recv_UDP(void *data){
             prd_tmr.tv_nsec += PERIOD_NSEC;
             normalize_timespec(&prd_tmr);
         }
+        if (fr_cycle != NULL) {
+            fr_cycle->end_ns = now_ns;
+            fr_cycle->deadline_ns = (uint64_t)prd_tmr.tv_sec * NSEC_PER_SEC + prd_tmr.tv_nsec;
+            fr_cycle->seq = rx_seq;
+            fr_cycle->conceal_missed = (uint16_t)conceal.missed;
+            fr_cycle->tlm_count = (uint8_t)tlm_count;
+            memcpy(fr_cycle->perf, perf_delta, sizeof(perf_delta));
+            if (fr_cycle->frame == 0) fr_cycle->frame = spi_frame_id;
+            flightrec_end(&flightrec, delta_time_nsec < 0, now_ns - start_ns + wake_late_ns);
+            knode_stats.fr_snapshots = flightrec.dumps;
+            knode_stats.fr_suppressed = flightrec.suppressed;
+        }
+        if (sched_policy == SCHED_DEADLINE && knode_stats.dl_runtime_ns == 0 &&
+            (dl_runtime_ns > 0 || knode_stats.loop_ns.count >= DL_CALIBRATE_PERIODS)) {
+            enter_deadline();
+        }
+        if (curr_tmr.tv_sec >= stats_tmr.tv_sec) {
+            knode_stats.dl_overruns = dl_overrun_count;
+            stats_log(&knode_stats);
+            stats_tmr.tv_sec = curr_tmr.tv_sec + STATS_INTERVAL_SEC;
+        }
+        if (stats_shm_name != NULL) {
+            clock_gettime(CLOCK_MONOTONIC, &publish_tmr); // real time, also in a virtual run
+            if ((uint64_t)publish_tmr.tv_sec * NSEC_PER_SEC + publish_tmr.tv_nsec >= publish_ns) {
+                publish_ns = (uint64_t)publish_tmr.tv_sec * NSEC_PER_SEC + publish_tmr.tv_nsec;
+                publish_stats(publish_ns);
+                publish_ns += STATS_PUBLISH_NSEC;
+            }
+        }
         syslog(LOG_DEBUG, "Sleep until: %ld.%09ld", prd_tmr.tv_sec, prd_tmr.tv_nsec);
-        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &prd_tmr, NULL);
+        vclock_sleep_until(&prd_tmr);
+        vclock_gettime(&curr_tmr);
+        delta_time_nsec = (curr_tmr.tv_sec - prd_tmr.tv_sec) * NSEC_PER_SEC +
+                            (curr_tmr.tv_nsec - prd_tmr.tv_nsec);
+        hist_add(&knode_stats.wake_late_ns, delta_time_nsec > 0 ? delta_time_nsec : 0);
+        wake_ns = (uint64_t)curr_tmr.tv_sec * NSEC_PER_SEC + curr_tmr.tv_nsec;
+        wake_late_ns = delta_time_nsec > 0 ? delta_time_nsec : 0;
     }
+    fr_cycle = NULL;
+    knode_stats.dl_overruns = dl_overrun_count;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &curr_tmr);
+    knode_stats.udp_cpu_ns = (uint64_t)curr_tmr.tv_sec * NSEC_PER_SEC + curr_tmr.tv_nsec;
+    perfctr_close(&perf);
+    clock_gettime(CLOCK_MONOTONIC, &publish_tmr);
+    publish_stats((uint64_t)publish_tmr.tv_sec * NSEC_PER_SEC + publish_tmr.tv_nsec);
+    stats_log(&knode_stats);
     pthread_exit(NULL); // Return NULL to indicate thread completion
 }
 
 /**
  * @brief Initialize the SPI devices and thread configs
- * @param port Port number for UDP server
- * @return uint8_t 0 on success, 1 on failure
+ * @return int 0 on success, 1 on failure
  */
-int init(char *port){
+int init(void){
 
     // initialize the thread configurations
-    for(int i=0; i< NUM_THREADS; i++){
+    for(int i=0; i< num_threads; i++){
         thread_cfgs[i].thread_id = i;
         thread_cfgs[i].spi_channel = SPI_CHAN;
+        thread_cfgs[i].board = bus_board[i];
+        thread_cfgs[i].frame_len = kasm_boards[bus_board[i]].bytes;
+        if (bus_board[i] != KASM_BOARD_kasm26) board_mask |= 1u << bus_board[i];
         thread_cfgs[i].data_ready = FALSE;
         switch(i){
             case 0:
@@ -306,72 +1757,270 @@ int init(char *port){
                 break;
         }
     }
+    // Tables for incremental crc updates over the command words
+    crc16_shift_init(&crc_shift, CRC_INDX, poly16);
+
     // Initialize the wiringPi library
     if (wiringPiSetup() == -1) {
         fprintf(stderr, "Failed to initialize wiringPi: %s\n", strerror(errno));
         return 1;
     }
 
+    // Calibrated clocks, the calibration itself starts from the default
+    if (spi_clock_file != NULL && spi_calibrate == FALSE) {
+        spi_nclocks = spi_clock_load(spi_clock_file, spi_clocks, SPI_CLOCK_MAX_BUSES);
+        if (spi_nclocks < 0) {
+            fprintf(stderr, "Failed to read SPI clocks from %s: %s\n", spi_clock_file, strerror(errno));
+            return 1;
+        }
+    }
+
     // Initialize the SPI buses
-    for(int i=0; i< NUM_THREADS; i++){
-        if ((spi_fd = wiringPiSPIxSetupMode (thread_cfgs[i].spi_dev, thread_cfgs[i].spi_channel, SPEED*MHZ,SPI_MODE_0)) < 0){
+    for(int i=0; i< num_threads; i++){
+        thread_cfgs[i].spi_hz = spi_clock_find(spi_clocks, spi_nclocks, thread_cfgs[i].spi_dev,
+                                               thread_cfgs[i].spi_channel);
+        if (thread_cfgs[i].spi_hz == 0) thread_cfgs[i].spi_hz = SPEED*MHZ;
+        if ((spi_fd = wiringPiSPIxSetupMode (thread_cfgs[i].spi_dev, thread_cfgs[i].spi_channel, thread_cfgs[i].spi_hz,SPI_MODE_0)) < 0){
             fprintf (stderr, "Failed to open the SPI bus: %s\n", strerror (errno)) ;
             return 1;
         }
     }
-    // Initialize the UDP server
-    udp_fd = init_UDP(port);
-    if (udp_fd == -1) {
-        fprintf(stderr, "Failed to initialize UDP server \n");
+    if (spi_nclocks > 0) {
+        printf("SPI clocks from %s:", spi_clock_file);
+        for(int i=0; i< num_threads; i++){
+            printf(" %g", thread_cfgs[i].spi_hz / 1e6);
+        }
+        printf(" MHz\n");
+    }
+    if (bus_board_set == TRUE) {
+        printf("SPI boards:");
+        for(int i=0; i< num_threads; i++){
+            printf(" %s (%d bytes)", kasm_boards[thread_cfgs[i].board].name, thread_cfgs[i].frame_len);
+        }
+        printf("\n");
+    }
+    // Map the capture ring before the RT threads start
+    if (capture_file != NULL && capture_create(&capture, capture_file, capture_capacity) != 0) {
+        fprintf(stderr, "Failed to create capture %s: %s\n", capture_file, strerror(errno));
         return 1;
     }
+    return 0;
+}
+
+/**
+ * @brief Open the capture for a virtual time run and start the virtual clock
+ * @return int 0 on success, 1 on failure
+ */
+static int init_virtual(void){
+    uint64_t n = {0};
+    uint64_t first_ns = {0};
+
+#ifndef SPI_SIM
+    fprintf(stderr, "Virtual time needs the simulated SPI board, build knodeRT_sim\n");
+    return 1;
+#endif
+    if (capture_open(&virtual_cap, virtual_file) != 0) {
+        fprintf(stderr, "Failed to open capture %s: %s\n", virtual_file, strerror(errno));
+        return 1;
+    }
+    n = capture_records(&virtual_cap);
+    if (n == 0) {
+        fprintf(stderr, "Capture %s is empty\n", virtual_file);
+        return 1;
+    }
+    first_ns = capture_get(&virtual_cap, 0)->rx_ns;
+    virtual_loop_ns = capture_get(&virtual_cap, n - 1)->rx_ns - first_ns;
+    if (n > 1) virtual_loop_ns += virtual_loop_ns / (n - 1);
+    virtual_span = capture_seq_span(&virtual_cap);
+    vclock_init(TRUE, first_ns);
+    // the loop never sleeps in virtual time, keep it off the RT scheduler
+    sched_policy = SCHED_OTHER;
+    engine = ENGINE_SINGLE; // SPI threads would make the run order nondeterministic
+    return 0;
+}
+
+/**
+ * @brief Print the command line usage
+ * @param name Program name
+ */
+static void usage(const char *name){
+    fprintf(stderr, "Usage: %s [-i none|zoh|linear|cubic] [-r rtc period usec]"
+            " [-x hold|linear|deriv] [-n max periods] [-t telemetry batch] [-g health msec]\n"
+            "          [-b SPI buses] [-e threads|single] [-H condvar|spin] [-s fifo|other|deadline] [-D runtime usec]\n"
+            "          [-j stats.json] [-m stats shm] [-p] [-F dir|none] [-T usec] [-c capture file] [-C capture records] [-a cpus|auto|none] [-L spread|packed]\n"
+            "          [-P udp prio[,spi prio,...]] [-W warm-up cycles] [-R block|spin|busypoll]\n"
+            "          [-S spin usec] [-X ifname[:queue]] [-K clock file] [-B board[,board...]] <port> \n"
+            "       %s [-b SPI buses] [-B board[,board...]] -k " CAL_ACK " [-K clock file]   (calibrate the SPI clocks, board outputs off)\n"
+            "       %s [options] -M shm segment   (commands from local controllers)\n"
+            "       %s [options] -V capture file [-l loops]   (virtual time, knodeRT_sim)\n"
+            "The flight recorder is on by default (-F %s) and needs the SPI readback records, -F none turns it off.\n",
+            name, name, name, name, FLIGHTREC_DIR);
+}
+
+/**
+ * @brief Parse a whole decimal option value
+ * @param str Option argument
+ * @param lo Smallest value accepted
+ * @param hi Largest value accepted
+ * @param val Output value, left alone on failure
+ * @return int 0 on success, 1 if str is not a number from lo to hi
+ */
+static int parse_long(const char *str, long lo, long hi, long *val){
+    char *end = NULL;
+    long v = {0};
+
+    errno = 0;
+    v = strtol(str, &end, 10);
+    if (end == str || *end != '\0' || errno != 0 || v < lo || v > hi) return 1;
+    *val = v;
+    return 0;
+}
 
+/**
+ * @brief Parse the thread priorities, the last one repeats for the remaining threads
+ * @param list Comma separated SCHED_FIFO priorities, UDP thread first
+ * @return int 0 on success, 1 on failure
+ */
+static int parse_prio(const char *list){
+    const char *p = list;
+    char *end = NULL;
+    long prio = {0};
+    int lo = sched_get_priority_min(SCHED_FIFO);
+    int hi = sched_get_priority_max(SCHED_FIFO);
+
+    for (int k = 0; k <= MAX_THREADS; k++) {
+        if (*p != '\0') {
+            prio = strtol(p, &end, 10);
+            if (end == p || prio < lo || prio > hi || (*end != ',' && *end != '\0')) {
+                fprintf(stderr, "Priorities must be %d to %d: %s\n", lo, hi, list);
+                return 1;
+            }
+            p = *end == ',' ? end + 1 : end;
+        }
+        rt_prio[k] = (int)prio;
+    }
     return 0;
 }
 
 /**
- * @brief Compute and append the crc value to the command data
- * @return uint16_t crc value
+ * @brief Parse the board type of each bus, the last one repeats for the remaining buses
+ * @param list Comma separated KASM_BOARDS() names, bus 0 first
+ * @return int 0 on success, 1 on failure
  */
-uint16_t append_crc(union CMD_DATA * data ){
-    uint8_t i = {0}; // loop index
-    crc = init_val; // set crc to the initial value
-    // compute crc and append to data->values
-    for(i=0;i<(SPI_BUF_SIZE/2 -1);i++){
-        crc = calc_crc16(crc, data->values[i],poly16);
+static int parse_boards(const char *list){
+    const char *p = list;
+    char name[16];
+    int board = {0};
+
+    for (int k = 0; k < MAX_THREADS; k++) {
+        if (*p != '\0') {
+            size_t len = strcspn(p, ",");
+            snprintf(name, sizeof(name), "%.*s", (int)len, p);
+            board = len < sizeof(name) ? kasm_board_parse(name) : -1;
+            if (board < 0) {
+                fprintf(stderr, "Unknown board in %s, the boards are:", list);
+                for (int b = 0; b < KASM_NUM_BOARDS; b++) fprintf(stderr, " %s", kasm_boards[b].name);
+                fprintf(stderr, "\n");
+                return 1;
+            }
+            p += p[len] == ',' ? len + 1 : len;
+        }
+        bus_board[k] = board;
     }
-    data->values[i]=crc; // append the crc value to the command data
-    return crc;
+    bus_board_set = TRUE;
+    return 0;
 }
 
 /**
- * @brief verify the crc value
- * @return uint16_t crc value (0 indicates success)
+ * @brief Thread attributes for an RT thread
+ * @param attr Attributes to initialize
+ * @param prio SCHED_FIFO priority, unused for SCHED_OTHER
+ * @note SCHED_DEADLINE threads start SCHED_FIFO, the UDP loop switches itself
+ * @param cpu CPU to pin the thread to, -1 for none
+ * @return int 0 on success, 1 on failure
  */
-uint16_t verify_crc(union CMD_DATA * data){
-    uint8_t i = {0}; // loop index
-    crc = init_val; // set the initial value to crc
-    // verify crc calculation
-    for(i=0;i<(SPI_BUF_SIZE/2);i++){
-        crc = calc_crc16(crc, data->values[i],poly16);
+static int thread_attr(pthread_attr_t *attr, int prio, int cpu){
+    struct sched_param param = {0};
+    cpu_set_t set;
+    int ret = pthread_attr_init(attr);
+
+    if (ret != 0){
+        syslog(LOG_ERR, "pthread_attr_init error: %d, meaning: %s\n", ret, strerror(ret));
+        return 1;
     }
-    return crc;
+    // mlockall locks the whole stack, keep it small and prefault it in the thread
+    ret = pthread_attr_setstacksize(attr, RT_STACK_SIZE);
+    if (ret != 0){
+        syslog(LOG_ERR, "pthread_attr_setstacksize error: %d, meaning: %s\n", ret, strerror(ret));
+        return 1;
+    }
+    if (sched_policy != SCHED_OTHER) {
+        ret = pthread_attr_setschedpolicy(attr, SCHED_FIFO);
+        if (ret != 0){
+            syslog(LOG_ERR, "pthread_attr_setschedpolicy error: %d, meaning: %s\n", ret, strerror(ret));
+            return 1;
+        }
+        param.sched_priority = prio;
+        ret = pthread_attr_setschedparam(attr, &param);
+        if (ret != 0){
+            syslog(LOG_ERR, "pthread_attr_setschedparam error: %d, meaning: %s\n", ret, strerror(ret));
+            return 1;
+        }
+        // Make sure threads created using the thread_attr_ takes the value
+        // from the attribute instead of inherit from the parent thread.
+        ret = pthread_attr_setinheritsched(attr, PTHREAD_EXPLICIT_SCHED);
+        if (ret != 0){
+            syslog(LOG_ERR, "pthread_attr_setinheritsched error: %d, meaning: %s\n", ret, strerror(ret));
+            return 1;
+        }
+    }
+    if (cpu >= 0) {
+        CPU_ZERO(&set);
+        CPU_SET(cpu, &set);
+        ret = pthread_attr_setaffinity_np(attr, sizeof(set), &set);
+        if (ret != 0){
+            syslog(LOG_ERR, "pthread_attr_setaffinity_np error: %d, meaning: %s\n", ret, strerror(ret));
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Signal handler, stops the UDP thread
+ */
+static void stop(int sig){
+    (void)sig;
+    running = FALSE;
 }
 
+/**
+ * @brief Signal handler, counts SCHED_DEADLINE runtime overruns
+ */
+static void dl_overrun(int sig){
+    (void)sig;
+    dl_overrun_count++;
+}
 
 /********************** main ******************************/
 
 int main (int argc, char *argv[])
 {
+    struct timespec start_tmr = {0};
+    clock_gettime(CLOCK_MONOTONIC, &start_tmr);
+    start_ns = (uint64_t)start_tmr.tv_sec * NSEC_PER_SEC + start_tmr.tv_nsec;
+
     // Lock the memory
-    mlockall(MCL_CURRENT | MCL_FUTURE);
+    if (mlockall(MCL_CURRENT | MCL_FUTURE) != 0) {
+        fprintf(stderr, "mlockall failed, pages may fault in the RT loop: %s\n", strerror(errno));
+    }
 
 
     // Set mutex to priority inheritance
     pthread_mutexattr_init(&mattr);
     pthread_mutexattr_setprotocol(&mattr, PTHREAD_PRIO_INHERIT);
     // Initialize the condition variables and mutexes
-    for(int i=0;i<NUM_THREADS;i++){
+    for(int i=0;i<MAX_THREADS;i++){
         // cond_var[i] = PTHREAD_COND_INITIALIZER;
         pthread_cond_init(&cond_var[i], NULL);
         pthread_mutex_init(&mutex[i], &mattr);
@@ -379,80 +2028,422 @@ int main (int argc, char *argv[])
 
 
 
+    for (int k = 0; k <= MAX_THREADS; k++) {
+        rt_prio[k] = RT_PRIORITY;
+    }
+
     char* port = NULL; // port number
     pthread_t udp_thread; // thread for UDP server
-    pthread_t spi_thread[NUM_THREADS]; // thread for SPI communication
-
-    // check command line argument
-    if (argc != 2) {
-        fprintf(stderr, "Usage: %s <port> \n", argv[0]);
+    pthread_t spi_thread[MAX_THREADS]; // thread for SPI communication
+
+    // check command line arguments
+    int opt = {0}; // for getopt()
+    long val = {0}; // numeric option value
+    while ((opt = getopt(argc, argv, "hi:r:x:n:t:g:b:e:H:s:D:j:m:pF:T:k:K:B:c:C:V:l:a:L:P:W:R:S:X:M:")) != -1){
+        switch(opt){
+            case 'i':
+                interp_mode = interp_parse_mode(optarg);
+                if ((int)interp_mode < 0) {
+                    fprintf(stderr, "Unknown interpolation mode: %s\n", optarg);
+                    return 1;
+                }
+                break;
+            case 'r':
+                rtc_period_nsec = atol(optarg) * 1000;
+                if (rtc_period_nsec <= 0) {
+                    fprintf(stderr, "Invalid RTC period: %s\n", optarg);
+                    return 1;
+                }
+                break;
+            case 'x':
+                extrap_mode = conceal_parse_mode(optarg);
+                if ((int)extrap_mode < 0) {
+                    fprintf(stderr, "Unknown extrapolation policy: %s\n", optarg);
+                    return 1;
+                }
+                break;
+            case 'n':
+                if (parse_long(optarg, 0, CONCEAL_MAX_PERIODS, &val) != 0) {
+                    fprintf(stderr, "Extrapolation cap must be 0 to %d periods: %s\n",
+                            CONCEAL_MAX_PERIODS, optarg);
+                    return 1;
+                }
+                conceal_periods = (int)val;
+                break;
+            case 't':
+                tlm_batch = atoi(optarg);
+                if (tlm_batch < 0 || tlm_batch > KNODE_TLM_MAX_RECS) {
+                    fprintf(stderr, "Telemetry batch must be 0 to %d\n", KNODE_TLM_MAX_RECS);
+                    return 1;
+                }
+                break;
+            case 'b':
+                num_threads = atoi(optarg);
+                if (num_threads < 1 || num_threads > MAX_THREADS) {
+                    fprintf(stderr, "SPI buses must be 1 to %d\n", MAX_THREADS);
+                    return 1;
+                }
+                break;
+            case 'e':
+                if (strcmp(optarg, "threads") == 0) {
+                    engine = ENGINE_THREADS;
+                } else if (strcmp(optarg, "single") == 0) {
+                    engine = ENGINE_SINGLE;
+                } else {
+                    fprintf(stderr, "Unknown SPI engine: %s\n", optarg);
+                    return 1;
+                }
+                break;
+            case 'H':
+                if (strcmp(optarg, "condvar") == 0) {
+                    handoff = HANDOFF_CONDVAR;
+                } else if (strcmp(optarg, "spin") == 0) {
+                    handoff = HANDOFF_SPIN;
+                } else {
+                    fprintf(stderr, "Unknown handoff scheme: %s\n", optarg);
+                    return 1;
+                }
+                break;
+            case 's':
+                if (strcmp(optarg, "fifo") == 0) {
+                    sched_policy = SCHED_FIFO;
+                } else if (strcmp(optarg, "other") == 0) {
+                    sched_policy = SCHED_OTHER;
+                } else if (strcmp(optarg, "deadline") == 0) {
+                    sched_policy = SCHED_DEADLINE;
+                } else {
+                    fprintf(stderr, "Unknown scheduling mode: %s\n", optarg);
+                    return 1;
+                }
+                break;
+            case 'j':
+                stats_file = optarg;
+                break;
+            case 'm':
+                stats_shm_name = optarg;
+                break;
+            case 'p':
+                perf_enabled = TRUE;
+                break;
+            case 'F':
+                fr_dir = strcmp(optarg, "none") == 0 ? NULL : optarg;
+                break;
+            case 'T':
+                if (parse_long(optarg, 0, FR_MAX_THRESHOLD_USEC, &val) != 0) {
+                    fprintf(stderr, "Snapshot threshold must be 0 to %d usec: %s\n", FR_MAX_THRESHOLD_USEC, optarg);
+                    return 1;
+                }
+                fr_threshold_ns = (uint64_t)val * 1000;
+                break;
+            case 'g':
+                if (parse_long(optarg, 0, MAINT_MAX_INTERVAL_MSEC, &val) != 0) {
+                    fprintf(stderr, "Health check interval must be 0 to %d msec: %s\n", MAINT_MAX_INTERVAL_MSEC, optarg);
+                    return 1;
+                }
+                maint_interval_ns = (uint64_t)val * 1000 * 1000;
+                break;
+            case 'k':
+                // a bit error can turn the inverted crc of a test frame into a valid one
+                if (strcmp(optarg, CAL_ACK) != 0) {
+                    fprintf(stderr, "-k clocks test frames into the boards above their known good clock.\n"
+                            "Disable the board outputs or disconnect the actuators, then run -k %s\n", CAL_ACK);
+                    return 1;
+                }
+                spi_calibrate = TRUE;
+                break;
+            case 'K':
+                spi_clock_file = optarg;
+                break;
+            case 'B':
+                if (parse_boards(optarg) != 0) return 1;
+                break;
+            case 'c':
+                capture_file = optarg;
+                break;
+            case 'V':
+                virtual_file = optarg;
+                break;
+            case 'l':
+                virtual_loops = atoi(optarg);
+                if (virtual_loops < 1) {
+                    fprintf(stderr, "Invalid loop count: %s\n", optarg);
+                    return 1;
+                }
+                break;
+            case 'C':
+                capture_capacity = strtoul(optarg, NULL, 0);
+                if (capture_capacity == 0) {
+                    fprintf(stderr, "Invalid capture size: %s\n", optarg);
+                    return 1;
+                }
+                break;
+            case 'a':
+                if (strcmp(optarg, "auto") == 0) {
+                    rt_ncpus = -1;
+                } else if (strcmp(optarg, "none") == 0) {
+                    rt_ncpus = 0;
+                } else {
+                    rt_ncpus = rtcpu_parse_list(optarg, rt_cpus, RTCPU_MAX_CPUS);
+                    if (rt_ncpus <= 0) {
+                        fprintf(stderr, "Invalid CPU list: %s\n", optarg);
+                        return 1;
+                    }
+                }
+                break;
+            case 'L':
+                rt_layout = rtcpu_parse_layout(optarg);
+                if ((int)rt_layout < 0) {
+                    fprintf(stderr, "Unknown thread layout: %s\n", optarg);
+                    return 1;
+                }
+                break;
+            case 'D':
+                dl_runtime_ns = strtoull(optarg, NULL, 0) * 1000;
+                if (dl_runtime_ns == 0 || dl_runtime_ns > PERIOD_NSEC) {
+                    fprintf(stderr, "SCHED_DEADLINE runtime must be 1 to %d usec\n", PERIOD_NSEC / 1000);
+                    return 1;
+                }
+                break;
+            case 'R':
+                if (strcmp(optarg, "block") == 0) {
+                    rx_mode = RX_BLOCK;
+                } else if (strcmp(optarg, "spin") == 0) {
+                    rx_mode = RX_SPIN;
+                } else if (strcmp(optarg, "busypoll") == 0) {
+                    rx_mode = RX_BUSYPOLL;
+                } else {
+                    fprintf(stderr, "Unknown receive mode: %s\n", optarg);
+                    return 1;
+                }
+                break;
+            case 'S':
+                rx_spin_nsec = atol(optarg) * 1000;
+                if (rx_spin_nsec <= 0) {
+                    fprintf(stderr, "Invalid spin budget: %s\n", optarg);
+                    return 1;
+                }
+                break;
+            case 'M':
+                shm_name = optarg;
+                break;
+            case 'X':
+#ifdef HAVE_XDP
+                {
+                    char *colon = strchr(optarg, ':');
+                    xdp_ifname = optarg;
+                    if (colon != NULL) {
+                        *colon = '\0';
+                        xdp_queue = atoi(colon + 1);
+                    }
+                }
+                break;
+#else
+                fprintf(stderr, "Built without AF_XDP, rebuild with make XDP=1\n");
+                return 1;
+#endif
+            case 'W':
+                warmup_cycles = atoi(optarg);
+                if (warmup_cycles < 0) {
+                    fprintf(stderr, "Invalid warm-up cycles: %s\n", optarg);
+                    return 1;
+                }
+                break;
+            case 'P':
+                if (parse_prio(optarg) != 0) return 1;
+                break;
+            case 'h':
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+    if (dl_runtime_ns > 0 && sched_policy != SCHED_DEADLINE) {
+        fprintf(stderr, "-D needs -s deadline\n");
+        return 1;
+    }
+    if (shm_name != NULL && (rx_mode == RX_BUSYPOLL || virtual_file != NULL)) {
+        fprintf(stderr, "-M does not combine with -R busypoll or -V\n");
+        return 1;
+    }
+#ifdef HAVE_XDP
+    if (xdp_ifname != NULL && (rx_mode == RX_BUSYPOLL || virtual_file != NULL || shm_name != NULL)) {
+        fprintf(stderr, "-X does not combine with -R busypoll, -V or -M\n");
+        return 1;
+    }
+#endif
+    if (spi_calibrate == TRUE) {
+        if (optind != argc || virtual_file != NULL || shm_name != NULL) {
+            usage(argv[0]);
+            return 1;
+        }
+        capture_file = NULL;
+        if (init() != 0) return 1;
+        return calibrate_spi();
+    }
+    if (virtual_file != NULL && optind == argc) {
+        if (init_virtual() != 0) return 1;
+        printf("Starting KASM node in virtual time on %s\n", virtual_file);
+    } else if (shm_name != NULL && optind == argc) {
+        printf("Starting KASM node on shared memory %s\n", shm_name);
+    } else if (optind != argc - 1 || virtual_file != NULL || shm_name != NULL) {
+        usage(argv[0]);
         return 1;
     } else{
-        port = argv[1]; // port number
+        port = argv[optind]; // port number
         printf("Starting KASM node on port %s\n", port);
     }
 
+    spi_records = (tlm_batch > 0 || stats_shm_name != NULL || fr_dir != NULL);
+
     // Initialize SPI, UDP, and wiringPi
-    if(init(port) != 0){
+    if(init() != 0){
         fprintf(stderr, "Failed initialization, exiting...\n");
         return 1;
     }
 
-    openlog(NULL, LOG_PID, LOG_LOCAL6); // Open syslog for logging
+    openlog(NULL, LOG_PID | LOG_NDELAY, LOG_LOCAL6); // Open syslog for logging, connect now
     int mask = LOG_MASK(LOG_INFO) | LOG_MASK(LOG_ERR) | LOG_MASK(LOG_NOTICE);
     // int mask = LOG_MASK(LOG_ERR);
+    if (virtual_file != NULL) {
+        mask &= ~LOG_MASK(LOG_INFO); // per transfer logging would dominate the run
+    }
 
     setlogmask(mask);
 
-    //TODO convert this to an init function 
-    // Initialize the pthread attributes
-    pthread_attr_t attr;
-    int ret = pthread_attr_init(&attr);
-    if (ret != 0){
-        syslog(LOG_ERR, "pthread_attr_init error: %d, meaning: %s\n", ret, strerror(ret));
-        return 1;
+    // place the RT threads on the isolated CPUs unless told otherwise
+    pthread_attr_t attr[MAX_THREADS + 1];
+    int cpu = {0};
+    int ret = {0};
+    if (rt_ncpus < 0) {
+        rt_ncpus = rtcpu_isolated(rt_cpus, RTCPU_MAX_CPUS);
     }
-
-    // Set the scheduler policy
-    ret = pthread_attr_setschedpolicy(&attr, SCHED_FIFO);
-    if (ret != 0){
-        syslog(LOG_ERR, "pthread_attr_setschedpolicy error: %d, meaning: %s\n", ret, strerror(ret));
-        return 1;
+    if (virtual_file == NULL) {
+        rtcpu_check_nic(rt_cpus, rt_ncpus);
+        for (int k = 0; k <= (engine == ENGINE_THREADS ? num_threads : 0); k++) {
+            cpu = rtcpu_slot(rt_cpus, rt_ncpus, rt_layout, k);
+            if (k == 0 && sched_policy == SCHED_DEADLINE) {
+                cpu = -1; // the deadline scheduler only admits threads free to run on every CPU
+            }
+            if (thread_attr(&attr[k], rt_prio[k], cpu) != 0) return 1;
+            if (k == 0) printf("threads: udp"); else printf(", spi%d", k - 1);
+            if (cpu >= 0) printf(" cpu %d", cpu);
+            if (k == 0 && sched_policy == SCHED_DEADLINE) printf(" deadline");
+            else if (sched_policy != SCHED_OTHER) printf(" prio %d", rt_prio[k]);
+        }
+        printf("\n");
     }
 
-    // Set the scheduler priority
-    struct sched_param param;
-    param.sched_priority = 80;
-    ret = pthread_attr_setschedparam(&attr, &param);
-    if (ret != 0){
-        syslog(LOG_ERR, "pthread_attr_setschedparam error: %d, meaning: %s\n", ret, strerror(ret));
-        return 1;
+    syslog(LOG_INFO, "Starting knode\n");
+    signal(SIGINT, stop);
+    signal(SIGTERM, stop);
+    if (sched_policy == SCHED_DEADLINE) {
+        signal(SIGXCPU, dl_overrun); // runtime overrun, the default action kills the process
+    }
+    struct timespec wall_start = {0};
+    struct timespec wall_end = {0};
+    // the dump thread is created here so it inherits the normal scheduling of main
+    if (fr_dir != NULL) {
+        if (flightrec_init(&flightrec, fr_cycles, fr_dir, PERIOD_NSEC, fr_threshold_ns) != 0) {
+            fprintf(stderr, "Failed to set up the flight recorder\n");
+            return 1;
+        }
+        flightrec.buses = (uint32_t)num_threads;
+    }
+    pthread_barrier_init(&ready_barrier, NULL, engine == ENGINE_THREADS ? num_threads + 2 : 2);
+    pthread_barrier_init(&go_barrier, NULL, 2);
+    if (virtual_file != NULL) {
+        pthread_create(&udp_thread, NULL, recv_UDP, NULL); // frames go to SPI from this thread
+    } else {
+        ret = pthread_create(&udp_thread, &attr[0], recv_UDP, NULL); // create the UDP thread
+        for(int i=0;i<num_threads && ret == 0 && engine == ENGINE_THREADS;i++){
+            ret = pthread_create(&spi_thread[i], &attr[1 + i], send_SPI_thread, &thread_cfgs[i]); // create the SPI threads
+        }
+        if (ret != 0) {
+            fprintf(stderr, "Failed to start the RT threads: %s\n", strerror(ret));
+            return 1;
+        }
+    }
+    // CPU time clocks for kasm_top, read by the UDP thread
+    if (pthread_getcpuclockid(udp_thread, &rt_clock[0]) == 0) {
+        rt_nclocks = 1;
+        for(int i=0;i<num_threads && virtual_file == NULL && engine == ENGINE_THREADS;i++){
+            if (pthread_getcpuclockid(spi_thread[i], &rt_clock[rt_nclocks]) != 0) break;
+            rt_nclocks++;
+        }
     }
 
-    // Make sure threads created using the thread_attr_ takes the value
-    // from the attribute instead of inherit from the parent thread.
-    ret = pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
-    if (ret != 0){
-        syslog(LOG_ERR, "pthread_attr_setinheritsched error: %d, meaning: %s\n", ret, strerror(ret));
+    // the port is only opened once every RT thread has warmed up
+    pthread_barrier_wait(&ready_barrier);
+    if (stats_shm_name != NULL && stats_shm_create(stats_shm_name) != 0) {
+        fprintf(stderr, "Failed to create statistics segment %s: %s\n", stats_shm_name, strerror(errno));
         return 1;
     }
-
-    syslog(LOG_INFO, "Starting knode\n");
-    if(REALTIME==TRUE){
-        pthread_create(&udp_thread, &attr, recv_UDP, NULL); // create the UDP thread
-        for(int i=0;i<NUM_THREADS;i++){
-            pthread_create(&spi_thread[i],&attr, send_SPI_thread, &thread_cfgs[i]); // create the SPI threads
+    if (shm_name != NULL) {
+        if (shm_cmd_create(&shm_cmd, shm_name) != 0) {
+            fprintf(stderr, "Failed to create shared memory segment %s: %s\n", shm_name, strerror(errno));
+            return 1;
         }
-    } else {
-        pthread_create(&udp_thread, NULL, recv_UDP, NULL); // create the UDP thread
-        for(int i=0;i<NUM_THREADS;i++){
-            pthread_create(&spi_thread[i], NULL, send_SPI_thread, &thread_cfgs[i]); // create the SPI threads
+    } else if (virtual_file == NULL) {
+        udp_fd = init_UDP(port);
+        if (udp_fd == -1) {
+            fprintf(stderr, "Failed to initialize UDP server \n");
+            return 1;
+        }
+        if (rx_mode == RX_BUSYPOLL &&
+            init_busy_poll(interp_mode != INTERP_NONE || extrap_mode != EXTRAP_HOLD ? 0 : 1000) != 0) {
+            return 1;
+        }
+#ifdef HAVE_XDP
+        // the UDP socket stays open for everything the XDP program passes up
+        if (xdp_ifname != NULL) {
+            if (xdp_rx_open(&xdp_rx, xdp_ifname, xdp_queue, (uint16_t)atoi(port)) != 0) {
+                return 1;
+            }
+            printf("AF_XDP on %s queue %d, %s mode, %s\n", xdp_ifname, xdp_queue,
+                   xdp_rx.drv_mode ? "driver" : "generic", xdp_rx.zerocopy ? "zero-copy" : "copy");
         }
+#endif
     }
+    clock_gettime(CLOCK_MONOTONIC, &wall_start);
+    knode_stats.ready_ns = (uint64_t)wall_start.tv_sec * NSEC_PER_SEC + wall_start.tv_nsec - start_ns;
+    printf("ready after %.1f ms\n", knode_stats.ready_ns / 1e6);
+    syslog(LOG_NOTICE, "ready after %llu ns", (unsigned long long)knode_stats.ready_ns);
+    pthread_barrier_wait(&go_barrier);
 
+    // the SPI threads wait for frames forever, they end with the process
     pthread_join(udp_thread, NULL);
-    for(int i=0;i<NUM_THREADS;i++){
-        pthread_join(spi_thread[i], NULL);
+    clock_gettime(CLOCK_MONOTONIC, &wall_end);
+    struct timespec cpu_tmr = {0};
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &cpu_tmr);
+    knode_stats.cpu_ns = (uint64_t)cpu_tmr.tv_sec * NSEC_PER_SEC + cpu_tmr.tv_nsec;
+    knode_stats.wall_ns = (uint64_t)(wall_end.tv_sec - wall_start.tv_sec) * NSEC_PER_SEC +
+                          wall_end.tv_nsec - wall_start.tv_nsec;
+    if (virtual_file != NULL) {
+        double wall = (wall_end.tv_sec - wall_start.tv_sec) + (wall_end.tv_nsec - wall_start.tv_nsec) / 1e9;
+        double virt = (virtual_loops * virtual_loop_ns + VIRTUAL_DRAIN_NSEC) / 1e9;
+        printf("virtual: %llu datagrams, %llu frames, %.3f s in %.3f s (%.0fx), %.0f ns per frame, digest %016llx\n",
+               (unsigned long long)virtual_next, (unsigned long long)virtual_frames, virt, wall,
+               wall > 0 ? virt / wall : 0.0, virtual_frames > 0 ? wall * 1e9 / virtual_frames : 0.0,
+               (unsigned long long)virtual_digest);
+        capture_close(&virtual_cap);
+    }
+    if (capture_file != NULL) {
+        capture_close(&capture);
+    }
+    if (fr_dir != NULL) {
+        flightrec_close(&flightrec); // waits for a snapshot still being written
+    }
+    if (shm_name != NULL) {
+        shm_cmd_close(&shm_cmd);
+    }
+#ifdef HAVE_XDP
+    if (xdp_ifname != NULL) {
+        xdp_rx_close(&xdp_rx);
+    }
+#endif
+    if (stats_file != NULL && stats_write_json(stats_file, &knode_stats) != 0) {
+        fprintf(stderr, "Failed to write %s: %s\n", stats_file, strerror(errno));
+        return 1;
     }
     return 0;
 
@@ -2,6 +2,11 @@
 #define KNODE_THR_H
 
 #include<stdint.h>
+#include "crc_check.h"
+#include "protocol.h"
+#include "perfctr.h"
+#include "maint.h"
+#include "kasm_frame.h"
 
 
 
@@ -14,32 +19,64 @@
  */
 
 /************** defines *****************************/
-#define SPI_BUF_SIZE    54 // bytes, including crc16
+#define SPI_BUF_SIZE    KASM_FRAME_SIZE // bytes of the largest frame, including crc16
+#define CRC_INDX        KASM_MAX_WORDS  // index of the crc value in a kasm26 frame
 
 /************** types *****************************/
-union CMD_DATA {
-    unsigned char bytes[SPI_BUF_SIZE];
-    int16_t values[SPI_BUF_SIZE/2];
-};
 
 struct thread_cfg {
     int thread_id;
     int spi_dev;
     int spi_channel;
+    uint32_t spi_hz;        // SPI clock of the bus
+    int board;              // KASM_BOARD_* type of the board on the bus
+    int frame_len;          // bytes of its frames, crc included
     uint8_t data_ready;
+    // guarded by the thread's mutex
+    uint32_t seq;           // sequence number of the command in cmd_data
+    uint32_t frame;         // dispatch count of the frame in cmd_data
+    uint64_t rx_ns;         // receive time of that command
+    uint8_t flags;          // KNODE_TLM_FRESH / KNODE_TLM_SYNTH for the frame
+    knode_tlm_rec_t tlm;    // telemetry for the last SPI transfer
+    uint8_t tlm_pending;    // tlm has not been collected yet
+    uint64_t tlm_dropped;   // records overwritten before they were collected, since the last collection
+    uint8_t stage_pending;  // tlm has not been counted in the stage latencies yet
+    uint64_t spi_errors;    // failed transfers since the last collection
+    uint64_t crc_errors;    // readbacks with a bad crc since the last collection
+    uint64_t perf[PERFCTR_COUNT];     // SPI thread counter totals since the last collection (-p)
+    uint64_t perf_max[PERFCTR_COUNT]; // largest count in one cycle since the last collection
+    uint32_t done_frame;    // dispatch count of the last frame written to the bus
+    uint64_t done_ns;       // time that transfer completed
+    maint_queue_t maint;    // maintenance register reads and their results
+    uint64_t maint_deferred; // idle slots a waiting read did not fit in, since the last collection
+    // only touched by the thread that writes the bus
+    uint64_t xfer_ns;       // recent longest control frame transfer, decays slowly
+    uint64_t maint_xfer_ns; // recent longest maintenance transfer, full SPI_BUF_SIZE frames, 0 before the first
 };
 typedef struct thread_cfg thread_cfg_t;
 
-/**
- * @brief Normalize timer to account for seconds rollover
- * @param timespec_t ts Pointer to timespec structure to normalize
- */
-static void normalize_timespec(struct timespec *ts);
+/************** checksum parameters (knode_crc.c) *****************************/
+extern uint16_t poly16;     // CRC-16-DNP polynomial
+extern uint16_t init_val;   // initial value for CRC calculations
 
-/**
-* @brief get thread info
-*/
- static void getinfo();
+// how the UDP thread hands a frame to the SPI threads
+typedef enum {
+    HANDOFF_CONDVAR = 0,    // SPI threads sleep on a condition variable
+    HANDOFF_SPIN            // SPI threads poll data_ready, yielding between polls
+} handoff_t;
+
+// what writes the frames to the SPI buses
+typedef enum {
+    ENGINE_THREADS = 0,     // one SPI thread per bus, fed by the UDP thread
+    ENGINE_SINGLE           // the UDP thread writes every bus in turn itself
+} engine_t;
+
+// how the UDP loop waits for a datagram
+typedef enum {
+    RX_BLOCK = 0,           // poll() until a datagram or the timeout
+    RX_SPIN,                // non-blocking recvfrom for the spin budget, then poll()
+    RX_BUSYPOLL             // blocking recvfrom on a SO_BUSY_POLL socket
+} rx_mode_t;
 
 
 /**
@@ -73,12 +110,11 @@ int init_UDP(char *port);
 void * recv_UDP(void *);
 
 /**
- * @brief Initialize the SPI bus and wiringPi
- * 
- * @param port Port number for UDP server
- * @return uint8_t 0 on success, 1 on failure
+ * @brief Initialize the SPI buses, wiringPi and the capture ring
+ * @note The UDP port is opened by main once the RT threads have warmed up
+ * @return int 0 on success, 1 on failure
  */
-int init(char *port);
+int init(void);
 
 /**
  * @brief Compute and append the crc value to the command data
@@ -86,6 +122,18 @@ int init(char *port);
  */
 uint16_t append_crc(union CMD_DATA * data);
 
+/**
+ * @brief Update the crc of a frame from the previous frame's crc
+ * @param data New frame, crc is written to its last word
+ * @param old Previous frame, including its crc
+ * @param changed Indices of the words that differ between old and data
+ * @param n_changed Number of entries in changed
+ * @param tbl Shift tables from crc16_shift_init() for the frame length
+ * @return uint16_t crc value, identical to append_crc(data)
+ */
+uint16_t append_crc_incr(union CMD_DATA * data, const union CMD_DATA * old,
+                         const uint8_t * changed, int n_changed, const crc16_shift_t * tbl);
+
 
 /**
  * @brief Verify the crc value
@@ -0,0 +1,70 @@
+/**
+ * @file maint.c
+ * @brief Low priority maintenance transactions on the KASM SPI buses
+ * @author Aaron Hunter
+ * @date 2025-12-29
+ */
+
+#include <string.h>
+#include "knode_thr.h"
+#include "maint.h"
+
+// frame words
+enum {
+    W_OP = 0,
+    W_DAC,
+    W_REG,
+    W_VALUE,
+    W_TAG,
+    W_STATUS
+};
+
+void maint_encode(union CMD_DATA *f, const maint_frame_t *m){
+    memset(f->bytes, 0, SPI_BUF_SIZE);
+    f->values[W_OP] = (int16_t)m->op;
+    f->values[W_DAC] = m->dac;
+    f->values[W_REG] = m->reg;
+    f->values[W_VALUE] = (int16_t)m->value;
+    f->values[W_TAG] = (int16_t)m->tag;
+    f->values[W_STATUS] = (int16_t)m->status;
+    append_crc(f);
+    f->values[CRC_INDX] ^= MAINT_CRC_KEY;
+}
+
+int maint_decode(const union CMD_DATA *f, maint_frame_t *m){
+    union CMD_DATA c = *f;
+
+    c.values[CRC_INDX] ^= MAINT_CRC_KEY;
+    if (verify_crc(&c) != 0) return -1;
+    m->op = (uint16_t)c.values[W_OP];
+    m->dac = (uint8_t)c.values[W_DAC];
+    m->reg = (uint8_t)c.values[W_REG];
+    m->value = (uint16_t)c.values[W_VALUE];
+    m->tag = (uint16_t)c.values[W_TAG];
+    m->status = (uint16_t)c.values[W_STATUS];
+    return 0;
+}
+
+int maint_push_req(maint_queue_t *q, const maint_req_t *r){
+    if (q->req_tail - q->req_head >= MAINT_QUEUE) return -1;
+    q->req[q->req_tail++ % MAINT_QUEUE] = *r;
+    return 0;
+}
+
+int maint_pop_req(maint_queue_t *q, maint_req_t *r){
+    if (q->req_tail == q->req_head) return -1;
+    *r = q->req[q->req_head++ % MAINT_QUEUE];
+    return 0;
+}
+
+int maint_push_result(maint_queue_t *q, const maint_result_t *r){
+    if (q->res_tail - q->res_head >= MAINT_QUEUE) return -1;
+    q->res[q->res_tail++ % MAINT_QUEUE] = *r;
+    return 0;
+}
+
+int maint_pop_result(maint_queue_t *q, maint_result_t *r){
+    if (q->res_tail == q->res_head) return -1;
+    *r = q->res[q->res_head++ % MAINT_QUEUE];
+    return 0;
+}
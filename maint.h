@@ -0,0 +1,129 @@
+#ifndef MAINT_H
+#define MAINT_H
+
+#include <stdint.h>
+
+/**
+ * @file maint.h
+ * @brief Low priority maintenance transactions on the KASM SPI buses
+ * @author Aaron Hunter
+ * @date 2025-12-29
+ * @details A maintenance transaction reads one register of one DAC80508 on
+ * a KASM board. It takes two SPI transfers of a normal 54 byte frame: a
+ * read request, then a poll whose MISO data carries the response. A
+ * maintenance frame has its crc xored with MAINT_CRC_KEY, so the board
+ * tells it from a control frame (valid crc) and a no-op (inverted crc):
+ *
+ *     word 0  op       MAINT_OP_READ or MAINT_OP_POLL, MAINT_OP_RESP set in the response
+ *     word 1  dac      DAC80508 on the board
+ *     word 2  reg      DAC80508_REG_*
+ *     word 3  value    register contents in the response
+ *     word 4  tag      copied from the request into the response
+ *     word 5  status   0 in the response if the board could read the register
+ *
+ * The remaining words are zero. knodeRT queues the transactions per bus
+ * and only runs one in the idle time after a control frame, when it will
+ * be done before the next frame is due.
+ */
+
+/************** defines *****************************/
+#define MAINT_CRC_KEY       0xA5A5  // xored into the crc of a maintenance frame
+#define MAINT_OP_READ       0x0001  // read register reg of DAC dac
+#define MAINT_OP_POLL       0x0002  // clock out the response to the last request
+#define MAINT_OP_RESP       0x8000  // set by the board in a response
+#define MAINT_QUEUE         16      // requests and results kept per bus, power of 2
+
+// maint_result_t.status
+#define MAINT_OK            0
+#define MAINT_ERR_SPI       1       // a transfer failed
+#define MAINT_ERR_FRAME     2       // the poll did not return a valid response to the request
+#define MAINT_ERR_BOARD     3       // the board could not read the register
+
+/************** types *****************************/
+union CMD_DATA; // knode_thr.h
+
+struct maint_frame {
+    uint16_t op;
+    uint8_t dac;
+    uint8_t reg;
+    uint16_t value;
+    uint16_t tag;
+    uint16_t status;
+};
+typedef struct maint_frame maint_frame_t;
+
+struct maint_req {
+    uint8_t dac;
+    uint8_t reg;
+    uint16_t tag;
+};
+typedef struct maint_req maint_req_t;
+
+struct maint_result {
+    uint8_t dac;
+    uint8_t reg;
+    uint8_t status;             // MAINT_OK or MAINT_ERR_*
+    uint16_t value;             // register contents when status is MAINT_OK
+    uint16_t tag;
+    uint64_t done_ns;           // time the response was read
+};
+typedef struct maint_result maint_result_t;
+
+// requests to one bus and their results, guarded by the bus mutex
+struct maint_queue {
+    maint_req_t req[MAINT_QUEUE];
+    uint32_t req_head;          // next request to run
+    uint32_t req_tail;          // next free request slot
+    maint_result_t res[MAINT_QUEUE];
+    uint32_t res_head;
+    uint32_t res_tail;
+};
+typedef struct maint_queue maint_queue_t;
+
+/**
+ * @brief Build a maintenance frame
+ * @param f Frame to fill in, crc included
+ * @param m Frame contents
+ */
+void maint_encode(union CMD_DATA *f, const maint_frame_t *m);
+
+/**
+ * @brief Read a maintenance frame
+ * @param f Frame, from either side of the bus
+ * @param m Output frame contents
+ * @return int 0 if f is a maintenance frame, -1 otherwise
+ */
+int maint_decode(const union CMD_DATA *f, maint_frame_t *m);
+
+/**
+ * @brief Queue a request
+ * @return int 0 on success, -1 if the queue is full
+ */
+int maint_push_req(maint_queue_t *q, const maint_req_t *r);
+
+/**
+ * @brief Take the oldest request
+ * @return int 0 on success, -1 if there is none
+ */
+int maint_pop_req(maint_queue_t *q, maint_req_t *r);
+
+/**
+ * @brief Queue a result
+ * @return int 0 on success, -1 if the queue is full
+ */
+int maint_push_result(maint_queue_t *q, const maint_result_t *r);
+
+/**
+ * @brief Take the oldest result
+ * @return int 0 on success, -1 if there is none
+ */
+int maint_pop_result(maint_queue_t *q, maint_result_t *r);
+
+/**
+ * @brief Number of requests waiting
+ */
+static inline uint32_t maint_pending(const maint_queue_t *q){
+    return q->req_tail - q->req_head;
+}
+
+#endif // MAINT_H
@@ -0,0 +1,691 @@
+/**
+*   microbench.c
+*   Microbenchmarks of the knodeRT per packet kernels
+*   Author: Aaron Hunter
+*   Date: 2025-12-19
+*
+*   Every kernel is timed in repeats of N calls, N sized so a repeat takes
+*   about -t usec, after warm-up repeats that are thrown away. The process is
+*   pinned to one CPU. Times are read from the cycle counter where there is
+*   one (TSC on x86, the generic timer on ARM) and converted to ns with a
+*   calibration against CLOCK_MONOTONIC. Each result is the per call time
+*   over the repeats: min, median, mean and standard deviation, including
+*   the cost of the indirect call, which the "empty" kernel measures.
+*
+*   The frame routines kasm_frame.h generates are checked against the same
+*   routines written out by hand, here with the board's word count as a
+*   literal: the results must be identical, and the generated ones no slower
+*   than the hand-written ones. Each pair runs in turn GEN_ROUNDS times, and
+*   the median of the ratios must stay under GEN_SLACK, the noise floor of
+*   the same comparison of a hand-written kernel with itself. microbench
+*   exits with 2 when a generated kernel is slower.
+**/
+#define _GNU_SOURCE // CPU affinity
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+#include <arpa/inet.h>
+#include <sys/mman.h>
+#include <sys/utsname.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+#include "crc_check.h"
+#include "protocol.h"
+#include "knode_thr.h"
+#include "kasm_frame.h"
+
+#ifndef MICROBENCH_REV
+#define MICROBENCH_REV "unknown" // set by the Makefile from git describe
+#endif
+#define NSEC_PER_SEC (1000*1000*1000)
+#define TRUE (1==1)
+#define FALSE (!TRUE)
+
+#define NUM_INPUTS      64      // frames cycled through, power of two
+#define REPEATS         31      // timed repeats per kernel
+#define WARMUP          5       // repeats thrown away first
+#define REPEAT_USEC     200     // target length of one repeat
+#define MAX_REPEATS     1001
+#define CMD_VALS        (SPI_BUF_SIZE/2 - 1)
+// the ratio of a hand-written kernel to itself stayed within 0.992 to 1.022 over 60 runs
+#define GEN_SLACK       1.03    // generated kernels may be this much slower than hand-written ones, the noise floor
+#define GEN_ROUNDS      15      // interleaved runs of a generated kernel and its twin
+
+struct bench {
+    const char *name;
+    void (*fn)(uint64_t i);     // one call of the kernel, i counts calls
+    void (*setup)(void);        // optional, before warm-up
+    void (*teardown)(void);     // optional, after the last repeat
+};
+typedef struct bench bench_t;
+
+struct result {
+    double min, median, mean, stddev; // ticks per call
+};
+typedef struct result result_t;
+
+/********** module variables *****************/
+int cpu = -1;                   // CPU to pin to, -1 for the last one
+int repeats = REPEATS;
+long repeat_usec = REPEAT_USEC;
+const char *filter = NULL;      // only run kernels containing this
+const char *json_file = NULL;
+double tick_hz = {0};           // ticks per second
+
+// inputs
+union CMD_DATA frames[NUM_INPUTS];          // crc included
+uint8_t changed_idx[CMD_VALS];              // 0, 1, 2, ... for the incremental crc
+uint8_t pkt_legacy[NUM_INPUTS][KNODE_MAX_PKT];
+uint8_t pkt_full[NUM_INPUTS][KNODE_MAX_PKT];
+uint8_t pkt_delta[NUM_INPUTS][KNODE_MAX_PKT];
+uint8_t pkt_varint[NUM_INPUTS][KNODE_MAX_PKT];
+size_t len_full[NUM_INPUTS], len_delta[NUM_INPUTS], len_varint[NUM_INPUTS];
+crc16_shift_t crc_shift;
+union CMD_DATA out_frame;
+uint8_t out_pkt[KNODE_MAX_PKT];
+volatile uint64_t sink;         // keeps results alive
+
+// handoff partner thread
+pthread_t partner;
+pthread_mutex_t hmutex;
+pthread_cond_t hcond_go, hcond_done;
+volatile int hstop = FALSE;
+uint8_t hready = FALSE;         // frame handed over, cleared by the partner
+int hspin_yield = FALSE;        // yield while spinning, when sharing one CPU
+
+
+/**
+ * @brief Read the tick counter
+ */
+static inline uint64_t ticks(void){
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#elif defined(__aarch64__)
+    uint64_t v;
+    __asm__ volatile("isb; mrs %0, cntvct_el0" : "=r"(v));
+    return v;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+#endif
+}
+
+static const char *tick_source(void){
+#if defined(__x86_64__) || defined(__i386__)
+    return "rdtsc";
+#elif defined(__aarch64__)
+    return "cntvct_el0";
+#else
+    return "clock_monotonic";
+#endif
+}
+
+static uint64_t mono_ns(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+/**
+ * @brief Measure the tick rate against CLOCK_MONOTONIC
+ */
+static double calibrate(void){
+    uint64_t t0 = mono_ns(), c0 = ticks();
+    while (mono_ns() - t0 < 100*1000*1000);
+    return (ticks() - c0) * 1e9 / (mono_ns() - t0);
+}
+
+/********** kernels *****************/
+static void k_empty(uint64_t i){
+    (void)i;
+}
+
+static void k_clock_gettime(uint64_t i){
+    struct timespec ts;
+    (void)i;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    sink = ts.tv_nsec;
+}
+
+static void k_memcpy_frame(uint64_t i){
+    memcpy(out_frame.bytes, frames[i & (NUM_INPUTS - 1)].bytes, SPI_BUF_SIZE);
+}
+
+static void k_crc16_word(uint64_t i){
+    sink = calc_crc16(init_val, (uint16_t)i, poly16);
+}
+
+static void k_crc32_frame(uint64_t i){
+    const union CMD_DATA *f = &frames[i & (NUM_INPUTS - 1)];
+    uint32_t crc = 0xFFFFFFFF;
+    uint32_t w = {0};
+    for (int k = 0; k < CMD_VALS / 2; k++) {
+        memcpy(&w, &f->bytes[4*k], sizeof(w));
+        crc = calc_crc32(crc, w, 0x04C11DB7);
+    }
+    sink = crc;
+}
+
+static void k_append_crc(uint64_t i){
+    out_frame = frames[i & (NUM_INPUTS - 1)];
+    sink = append_crc(&out_frame);
+}
+
+static void append_crc_incr_n(uint64_t i, int n){
+    const union CMD_DATA *old = &frames[i & (NUM_INPUTS - 1)];
+    out_frame = frames[(i + 1) & (NUM_INPUTS - 1)];
+    sink = append_crc_incr(&out_frame, old, changed_idx, n, &crc_shift);
+}
+
+static void k_append_crc_incr_1(uint64_t i){ append_crc_incr_n(i, 1); }
+static void k_append_crc_incr_4(uint64_t i){ append_crc_incr_n(i, 4); }
+static void k_append_crc_incr_26(uint64_t i){ append_crc_incr_n(i, CMD_VALS); }
+
+static void k_verify_crc(uint64_t i){
+    sink = verify_crc(&frames[i & (NUM_INPUTS - 1)]);
+}
+
+/**
+ * @brief The kasm26 and kasm8 frame routines written out by hand
+ */
+static uint16_t hand_crc_26(const union CMD_DATA *f){
+    uint16_t crc = KASM_CRC_INIT;
+    for (int k = 0; k < 26; k++) {
+        uint16_t w = (uint16_t)f->values[k];
+        crc = (uint16_t)(crc << 8) ^ kasm_crc_table[((crc >> 8) ^ (w >> 8)) & 0xFF];
+        crc = (uint16_t)(crc << 8) ^ kasm_crc_table[((crc >> 8) ^ w) & 0xFF];
+    }
+    return crc;
+}
+
+static uint16_t hand_check_26(const union CMD_DATA *f){
+    uint16_t crc = KASM_CRC_INIT;
+    for (int k = 0; k < 27; k++) {
+        uint16_t w = (uint16_t)f->values[k];
+        crc = (uint16_t)(crc << 8) ^ kasm_crc_table[((crc >> 8) ^ (w >> 8)) & 0xFF];
+        crc = (uint16_t)(crc << 8) ^ kasm_crc_table[((crc >> 8) ^ w) & 0xFF];
+    }
+    return crc;
+}
+
+static uint16_t hand_crc_8(const union CMD_DATA *f){
+    uint16_t crc = KASM_CRC_INIT;
+    for (int k = 0; k < 8; k++) {
+        uint16_t w = (uint16_t)f->values[k];
+        crc = (uint16_t)(crc << 8) ^ kasm_crc_table[((crc >> 8) ^ (w >> 8)) & 0xFF];
+        crc = (uint16_t)(crc << 8) ^ kasm_crc_table[((crc >> 8) ^ w) & 0xFF];
+    }
+    return crc;
+}
+
+static void k_pack_kasm26(uint64_t i){
+    sink = kasm_pack_kasm26(&out_frame, frames[i & (NUM_INPUTS - 1)].values);
+}
+
+static void k_pack_hand26(uint64_t i){
+    memcpy(out_frame.values, frames[i & (NUM_INPUTS - 1)].values, 52);
+    out_frame.values[26] = (int16_t)hand_crc_26(&out_frame);
+    sink = 54;
+}
+
+static void k_check_kasm26(uint64_t i){
+    sink = kasm_check_kasm26(&frames[i & (NUM_INPUTS - 1)]);
+}
+
+static void k_check_hand26(uint64_t i){
+    sink = hand_check_26(&frames[i & (NUM_INPUTS - 1)]);
+}
+
+static void k_pack_kasm8(uint64_t i){
+    sink = kasm_pack_kasm8(&out_frame, frames[i & (NUM_INPUTS - 1)].values);
+}
+
+static void k_pack_hand8(uint64_t i){
+    memcpy(out_frame.values, frames[i & (NUM_INPUTS - 1)].values, 16);
+    out_frame.values[8] = (int16_t)hand_crc_8(&out_frame);
+    sink = 18;
+}
+
+static void k_unpack_kasm26(uint64_t i){
+    int16_t vals[KASM_MAX_WORDS];
+    kasm_unpack_kasm26(vals, &frames[i & (NUM_INPUTS - 1)]);
+    sink = vals[i % KASM_MAX_WORDS];
+}
+
+static void k_ntohs_frame(uint64_t i){
+    const union CMD_DATA *f = &frames[i & (NUM_INPUTS - 1)];
+    for (int k = 0; k < CMD_VALS; k++) {
+        out_frame.values[k] = ntohs(f->values[k]);
+    }
+}
+
+static void decode(const uint8_t *pkt, size_t len){
+    uint32_t seq = {0};
+    sink = knode_decode(pkt, len, out_frame.values, &seq);
+}
+
+static void k_decode_legacy(uint64_t i){ decode(pkt_legacy[i & (NUM_INPUTS - 1)], KNODE_LEGACY_SIZE); }
+static void k_decode_full(uint64_t i){ decode(pkt_full[i & (NUM_INPUTS - 1)], len_full[i & (NUM_INPUTS - 1)]); }
+static void k_decode_delta(uint64_t i){ decode(pkt_delta[i & (NUM_INPUTS - 1)], len_delta[i & (NUM_INPUTS - 1)]); }
+static void k_decode_varint(uint64_t i){ decode(pkt_varint[i & (NUM_INPUTS - 1)], len_varint[i & (NUM_INPUTS - 1)]); }
+
+static void k_encode_full(uint64_t i){
+    sink = knode_encode_full(out_pkt, i, frames[i & (NUM_INPUTS - 1)].values);
+}
+
+static void encode_delta(uint64_t i, int varint){
+    sink = knode_encode_delta(out_pkt, i, frames[(i + 1) & (NUM_INPUTS - 1)].values,
+                              frames[i & (NUM_INPUTS - 1)].values, varint);
+}
+
+static void k_encode_delta(uint64_t i){ encode_delta(i, FALSE); }
+static void k_encode_varint(uint64_t i){ encode_delta(i, TRUE); }
+
+/**
+ * @brief Build the next SPI frame the way dispatch_frame() does
+ */
+static void k_pack_frame(uint64_t i){
+    const union CMD_DATA *old = &frames[i & (NUM_INPUTS - 1)];
+    const union CMD_DATA *next = &frames[(i + 1) & (NUM_INPUTS - 1)];
+    uint8_t changed[CMD_VALS];
+    int n_changed = {0};
+
+    memcpy(out_frame.values, next->values, CMD_VALS * 2);
+    for (int k = 0; k < CMD_VALS; k++) {
+        if (next->values[k] != old->values[k]) changed[n_changed++] = k;
+    }
+    sink = append_crc_incr(&out_frame, old, changed, n_changed, &crc_shift);
+}
+
+static void k_mutex_pi(uint64_t i){
+    (void)i;
+    pthread_mutex_lock(&hmutex);
+    pthread_mutex_unlock(&hmutex);
+}
+
+// condition variable handoff, one round trip per call
+static void *partner_condvar(void *arg){
+    (void)arg;
+    pthread_mutex_lock(&hmutex);
+    while (hstop == FALSE) {
+        while (hready == FALSE && hstop == FALSE) pthread_cond_wait(&hcond_go, &hmutex);
+        hready = FALSE;
+        pthread_cond_signal(&hcond_done);
+    }
+    pthread_mutex_unlock(&hmutex);
+    return NULL;
+}
+
+static void k_handoff_condvar(uint64_t i){
+    (void)i;
+    pthread_mutex_lock(&hmutex);
+    hready = TRUE;
+    pthread_cond_signal(&hcond_go);
+    while (hready == TRUE) pthread_cond_wait(&hcond_done, &hmutex);
+    pthread_mutex_unlock(&hmutex);
+}
+
+// polled flag handoff, as knodeRT -H spin, one round trip per call
+static void *partner_spin(void *arg){
+    (void)arg;
+    while (hstop == FALSE) {
+        if (__atomic_load_n(&hready, __ATOMIC_ACQUIRE) == TRUE) {
+            __atomic_store_n(&hready, FALSE, __ATOMIC_RELEASE);
+        } else if (hspin_yield == TRUE) {
+            sched_yield();
+        }
+    }
+    return NULL;
+}
+
+static void k_handoff_spin(uint64_t i){
+    (void)i;
+    __atomic_store_n(&hready, TRUE, __ATOMIC_RELEASE);
+    while (__atomic_load_n(&hready, __ATOMIC_ACQUIRE) == TRUE) {
+        if (hspin_yield == TRUE) sched_yield();
+    }
+}
+
+/**
+ * @brief Start the partner on the next CPU, or on ours if there is only one
+ */
+static void start_partner(void *(*fn)(void *)){
+    cpu_set_t set;
+    int ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+
+    hstop = FALSE;
+    hready = FALSE;
+    hspin_yield = (ncpu < 2);
+    pthread_create(&partner, NULL, fn, NULL);
+    CPU_ZERO(&set);
+    CPU_SET(ncpu < 2 ? cpu : (cpu + 1) % ncpu, &set);
+    pthread_setaffinity_np(partner, sizeof(set), &set);
+}
+
+static void stop_partner(void){
+    pthread_mutex_lock(&hmutex);
+    hstop = TRUE;
+    pthread_cond_signal(&hcond_go);
+    pthread_mutex_unlock(&hmutex);
+    pthread_join(partner, NULL);
+}
+
+static void setup_condvar(void){ start_partner(partner_condvar); }
+static void setup_spin(void){ start_partner(partner_spin); }
+
+static const bench_t benches[] = {
+    {"empty", k_empty, NULL, NULL},
+    {"clock_gettime", k_clock_gettime, NULL, NULL},
+    {"memcpy_frame", k_memcpy_frame, NULL, NULL},
+    {"crc16_word", k_crc16_word, NULL, NULL},
+    {"crc32_frame", k_crc32_frame, NULL, NULL},
+    {"append_crc", k_append_crc, NULL, NULL},
+    {"append_crc_incr_1", k_append_crc_incr_1, NULL, NULL},
+    {"append_crc_incr_4", k_append_crc_incr_4, NULL, NULL},
+    {"append_crc_incr_26", k_append_crc_incr_26, NULL, NULL},
+    {"verify_crc", k_verify_crc, NULL, NULL},
+    {"pack_kasm26", k_pack_kasm26, NULL, NULL},
+    {"pack_hand26", k_pack_hand26, NULL, NULL},
+    {"check_kasm26", k_check_kasm26, NULL, NULL},
+    {"check_hand26", k_check_hand26, NULL, NULL},
+    {"pack_kasm8", k_pack_kasm8, NULL, NULL},
+    {"pack_hand8", k_pack_hand8, NULL, NULL},
+    {"unpack_kasm26", k_unpack_kasm26, NULL, NULL},
+    {"ntohs_frame", k_ntohs_frame, NULL, NULL},
+    {"decode_legacy", k_decode_legacy, NULL, NULL},
+    {"decode_full", k_decode_full, NULL, NULL},
+    {"decode_delta", k_decode_delta, NULL, NULL},
+    {"decode_varint", k_decode_varint, NULL, NULL},
+    {"encode_full", k_encode_full, NULL, NULL},
+    {"encode_delta", k_encode_delta, NULL, NULL},
+    {"encode_varint", k_encode_varint, NULL, NULL},
+    {"pack_frame", k_pack_frame, NULL, NULL},
+    {"mutex_pi", k_mutex_pi, NULL, NULL},
+    {"handoff_condvar", k_handoff_condvar, setup_condvar, stop_partner},
+    {"handoff_spin", k_handoff_spin, setup_spin, stop_partner},
+};
+#define NUM_BENCHES (sizeof(benches) / sizeof(benches[0]))
+
+// generated kernel and its hand-written twin
+static const char *const gen_pairs[][2] = {
+    {"pack_kasm26", "pack_hand26"},
+    {"check_kasm26", "check_hand26"},
+    {"pack_kasm8", "pack_hand8"},
+};
+#define NUM_GEN_PAIRS (sizeof(gen_pairs) / sizeof(gen_pairs[0]))
+
+/**
+ * @brief Check the generated frame routines against the hand-written ones and calc_crc16()
+ * @return int 0 if every input gives the same frame, 1 otherwise
+ */
+static int check_generated(void){
+    union CMD_DATA gen, hand;
+
+    for (int n = 0; n < NUM_INPUTS; n++) {
+        const int16_t *vals = frames[n].values;
+        uint16_t crc = init_val;
+
+        for (int k = 0; k < 26; k++) crc = calc_crc16(crc, vals[k], poly16);
+        kasm_pack_kasm26(&gen, vals);
+        memcpy(hand.values, vals, 52);
+        hand.values[26] = (int16_t)hand_crc_26(&hand);
+        if (memcmp(gen.bytes, hand.bytes, 54) != 0 || (uint16_t)gen.values[26] != crc ||
+            kasm_check_kasm26(&gen) != 0 || hand_check_26(&gen) != 0) return 1;
+        crc = init_val;
+        for (int k = 0; k < 8; k++) crc = calc_crc16(crc, vals[k], poly16);
+        kasm_pack_kasm8(&gen, vals);
+        memcpy(hand.values, vals, 16);
+        hand.values[8] = (int16_t)hand_crc_8(&hand);
+        if (memcmp(gen.bytes, hand.bytes, 18) != 0 || (uint16_t)gen.values[8] != crc ||
+            kasm_check_kasm8(&gen) != 0) return 1;
+    }
+    return 0;
+}
+
+static int bench_index(const char *name){
+    for (size_t b = 0; b < NUM_BENCHES; b++) {
+        if (strcmp(benches[b].name, name) == 0) return (int)b;
+    }
+    return -1;
+}
+
+/**
+ * @brief Random walk of command frames and their encodings
+ */
+static void init_inputs(void){
+    int16_t vals[CMD_VALS];
+
+    for (int k = 0; k < CMD_VALS; k++) {
+        vals[k] = (rand() % 0xFFFF) >> 8;
+        changed_idx[k] = k;
+    }
+    for (int n = 0; n < NUM_INPUTS; n++) {
+        for (int k = 0; k < 4; k++) {
+            vals[rand() % CMD_VALS] += rand() % 201 - 100;
+        }
+        memcpy(frames[n].values, vals, sizeof(vals));
+        append_crc(&frames[n]);
+    }
+    for (int n = 0; n < NUM_INPUTS; n++) {
+        const int16_t *prev = frames[(n + NUM_INPUTS - 1) % NUM_INPUTS].values;
+        for (int k = 0; k < CMD_VALS; k++) {
+            int16_t v = htons(frames[n].values[k]);
+            memcpy(&pkt_legacy[n][2*k], &v, sizeof(v));
+        }
+        len_full[n] = knode_encode_full(pkt_full[n], n, frames[n].values);
+        len_delta[n] = knode_encode_delta(pkt_delta[n], n, frames[n].values, prev, FALSE);
+        len_varint[n] = knode_encode_delta(pkt_varint[n], n, frames[n].values, prev, TRUE);
+    }
+    crc16_shift_init(&crc_shift, CRC_INDX, poly16);
+}
+
+static int cmp_double(const void *a, const void *b){
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+/**
+ * @brief Time one kernel
+ */
+static void run(const bench_t *b, result_t *r){
+    double per_call[MAX_REPEATS];
+    uint64_t calls = 1;
+    uint64_t i = {0};
+    uint64_t t0 = {0};
+    uint64_t target = (uint64_t)(repeat_usec * 1e-6 * tick_hz);
+
+    if (b->setup) b->setup();
+    // size a repeat, doubling the calls until it takes the target time
+    while (TRUE) {
+        t0 = ticks();
+        for (uint64_t n = 0; n < calls; n++) b->fn(i++);
+        if (ticks() - t0 >= target || calls >= (1ULL << 30)) break;
+        calls *= 2;
+    }
+    for (int w = 0; w < WARMUP; w++) {
+        for (uint64_t n = 0; n < calls; n++) b->fn(i++);
+    }
+    for (int rep = 0; rep < repeats; rep++) {
+        t0 = ticks();
+        for (uint64_t n = 0; n < calls; n++) b->fn(i++);
+        per_call[rep] = (double)(ticks() - t0) / calls;
+    }
+    if (b->teardown) b->teardown();
+
+    r->mean = 0;
+    for (int rep = 0; rep < repeats; rep++) r->mean += per_call[rep];
+    r->mean /= repeats;
+    r->stddev = 0;
+    for (int rep = 0; rep < repeats; rep++) r->stddev += (per_call[rep] - r->mean) * (per_call[rep] - r->mean);
+    r->stddev = repeats > 1 ? sqrt(r->stddev / (repeats - 1)) : 0;
+    qsort(per_call, repeats, sizeof(double), cmp_double);
+    r->min = per_call[0];
+    r->median = per_call[repeats / 2];
+}
+
+/**
+ * @brief Time a generated kernel against its hand-written twin
+ * @note The two run in turn GEN_ROUNDS times and the result is the median
+ * of the per round ratios, so a burst of interference on the host hits both
+ * sides of a ratio or only a few of the ratios.
+ * @return double generated over hand-written time per call
+ */
+static double gen_ratio(const bench_t *g, const bench_t *h){
+    result_t rg, rh;
+    double ratio[GEN_ROUNDS];
+
+    for (int k = 0; k < GEN_ROUNDS; k++) {
+        run(g, &rg);
+        run(h, &rh);
+        ratio[k] = rg.median / rh.median;
+    }
+    qsort(ratio, GEN_ROUNDS, sizeof(double), cmp_double);
+    return ratio[GEN_ROUNDS / 2];
+}
+
+/**
+ * @brief CPU model from /proc/cpuinfo
+ */
+static void cpu_model(char *buf, size_t len){
+    char line[256];
+    FILE *fp = fopen("/proc/cpuinfo", "r");
+
+    snprintf(buf, len, "unknown");
+    if (fp == NULL) return;
+    while (fgets(line, sizeof(line), fp)) {
+        char *colon = strchr(line, ':');
+        if (colon == NULL) continue;
+        if (strncmp(line, "model name", 10) == 0 || strncmp(line, "Model", 5) == 0) {
+            colon += 2;
+            colon[strcspn(colon, "\n")] = '\0';
+            // quotes would break the JSON
+            for (char *c = colon; *c; c++) if (*c == '"' || *c == '\\') *c = ' ';
+            snprintf(buf, len, "%s", colon);
+            if (line[0] == 'M') break; // Pi board model beats the core name
+        }
+    }
+    fclose(fp);
+}
+
+static void usage(const char *name){
+    fprintf(stderr, "Usage: %s [-c cpu] [-r repeats] [-t repeat usec] [-f name filter] [-o results.json]\n", name);
+}
+
+/********************** main ******************************/
+
+int main(int argc, char *argv[]){
+    result_t results[NUM_BENCHES];
+    int ran[NUM_BENCHES] = {0};
+    struct utsname uts;
+    char model[128];
+    cpu_set_t set;
+    pthread_mutexattr_t mattr;
+    FILE *fp = NULL;
+    int opt = {0}; // for getopt()
+    int first = TRUE;
+    int gen_slow = FALSE;           // a generated frame routine lost to its hand-written twin
+
+    while ((opt = getopt(argc, argv, "hc:r:t:f:o:")) != -1){
+        switch(opt){
+            case 'c':
+                cpu = atoi(optarg);
+                break;
+            case 'r':
+                repeats = atoi(optarg);
+                if (repeats < 1 || repeats > MAX_REPEATS) {
+                    fprintf(stderr, "Repeats must be 1 to %d\n", MAX_REPEATS);
+                    return 1;
+                }
+                break;
+            case 't':
+                repeat_usec = atol(optarg);
+                break;
+            case 'f':
+                filter = optarg;
+                break;
+            case 'o':
+                json_file = optarg;
+                break;
+            case 'h':
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+
+    if (cpu < 0) cpu = sysconf(_SC_NPROCESSORS_ONLN) - 1;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    if (sched_setaffinity(0, sizeof(set), &set) != 0) {
+        perror("Failed to pin to the CPU");
+        return 1;
+    }
+    mlockall(MCL_CURRENT | MCL_FUTURE);
+    pthread_mutexattr_init(&mattr);
+    pthread_mutexattr_setprotocol(&mattr, PTHREAD_PRIO_INHERIT); // as knodeRT
+    pthread_mutex_init(&hmutex, &mattr);
+    pthread_cond_init(&hcond_go, NULL);
+    pthread_cond_init(&hcond_done, NULL);
+
+    init_inputs();
+    if (check_generated() != 0) {
+        fprintf(stderr, "Generated frame routines differ from the hand-written ones\n");
+        return 1;
+    }
+    tick_hz = calibrate();
+    uname(&uts);
+    cpu_model(model, sizeof(model));
+    printf("%s on %s, cpu %d, %s at %.1f MHz, %d repeats\n", model, uts.machine, cpu,
+           tick_source(), tick_hz / 1e6, repeats);
+    printf("%-20s %10s %10s %10s %12s\n", "kernel", "median ns", "min ns", "stddev ns", "median ticks");
+    for (size_t b = 0; b < NUM_BENCHES; b++) {
+        if (filter != NULL && strstr(benches[b].name, filter) == NULL) continue;
+        run(&benches[b], &results[b]);
+        ran[b] = TRUE;
+        printf("%-20s %10.2f %10.2f %10.2f %12.2f\n", benches[b].name,
+               results[b].median * 1e9 / tick_hz, results[b].min * 1e9 / tick_hz,
+               results[b].stddev * 1e9 / tick_hz, results[b].median);
+    }
+    for (size_t k = 0; k < NUM_GEN_PAIRS; k++) {
+        int g = bench_index(gen_pairs[k][0]);
+        int h = bench_index(gen_pairs[k][1]);
+        double ratio = {0};
+
+        if (ran[g] == FALSE || ran[h] == FALSE) continue;
+        ratio = gen_ratio(&benches[g], &benches[h]);
+        printf("%s / %s = %.3f%s\n", gen_pairs[k][0], gen_pairs[k][1], ratio,
+               ratio > GEN_SLACK ? ", generated is SLOWER" : "");
+        if (ratio > GEN_SLACK) gen_slow = TRUE;
+    }
+
+    if (json_file == NULL) return gen_slow == TRUE ? 2 : 0;
+    fp = fopen(json_file, "w");
+    if (fp == NULL) {
+        perror("Failed to open JSON output");
+        return 1;
+    }
+    fprintf(fp, "{\"tool\": \"microbench\", \"version\": \"%s\", \"arch\": \"%s\", \"cpu_model\": \"%s\", "
+            "\"cpu\": %d, \"tick_source\": \"%s\", \"tick_hz\": %.0f, \"repeats\": %d, \"repeat_us\": %ld,\n"
+            " \"results\": [\n", MICROBENCH_REV, uts.machine, model, cpu, tick_source(), tick_hz,
+            repeats, repeat_usec);
+    for (size_t b = 0; b < NUM_BENCHES; b++) {
+        double s = 1e9 / tick_hz;
+        if (ran[b] == FALSE) continue;
+        fprintf(fp, "%s  {\"name\": \"%s\", \"median_ns\": %.3f, \"min_ns\": %.3f, \"mean_ns\": %.3f, "
+                "\"stddev_ns\": %.3f, \"median_ticks\": %.3f}", first ? "" : ",\n", benches[b].name,
+                results[b].median * s, results[b].min * s, results[b].mean * s, results[b].stddev * s,
+                results[b].median);
+        first = FALSE;
+    }
+    fprintf(fp, "\n]}\n");
+    fclose(fp);
+    return gen_slow == TRUE ? 2 : 0;
+}
@@ -0,0 +1,97 @@
+/**
+ * @file perfctr.c
+ * @brief Per thread performance counters for the knodeRT real time loops
+ * @author Aaron Hunter
+ * @date 2025-12-26
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#include "perfctr.h"
+
+const char *perfctr_names[PERFCTR_COUNT] = {
+    "cycles", "instructions", "cache_misses", "ctx_switches", "page_faults", "migrations"
+};
+
+static const struct {
+    uint32_t type;
+    uint64_t config;
+} events[PERFCTR_COUNT] = {
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+    {PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES},
+    {PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS},
+    {PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CPU_MIGRATIONS},
+};
+
+/**
+ * @brief Open one event on the calling thread, in the group of leader
+ * @return int file descriptor, -1 on failure
+ */
+static int open_event(int idx, int leader, int exclude_kernel){
+    struct perf_event_attr attr;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = events[idx].type;
+    attr.config = events[idx].config;
+    attr.read_format = PERF_FORMAT_GROUP;
+    attr.disabled = (leader == -1); // the group starts when the leader is enabled
+    attr.exclude_kernel = exclude_kernel;
+    attr.exclude_hv = 1;
+    return (int)syscall(SYS_perf_event_open, &attr, 0, -1, leader, PERF_FLAG_FD_CLOEXEC);
+}
+
+uint32_t perfctr_open(perfctr_t *p){
+    int exclude_kernel = 0;
+
+    memset(p, 0, sizeof(*p));
+    p->leader = -1;
+    for (int i = 0; i < PERFCTR_COUNT; i++) {
+        p->fd[i] = open_event(i, p->leader, exclude_kernel);
+        if (p->fd[i] < 0 && (errno == EACCES || errno == EPERM) && exclude_kernel == 0) {
+            exclude_kernel = 1; // perf_event_paranoid 2 or higher, user space only
+            p->fd[i] = open_event(i, p->leader, exclude_kernel);
+        }
+        if (p->fd[i] < 0) continue; // not offered here, count the rest
+        if (p->leader == -1) p->leader = p->fd[i];
+        p->mask |= 1u << i;
+    }
+    if (p->leader == -1) return 0;
+    if (ioctl(p->leader, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP) != 0 ||
+        ioctl(p->leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP) != 0) {
+        perfctr_close(p);
+        return 0;
+    }
+    return p->mask;
+}
+
+int perfctr_delta(perfctr_t *p, uint64_t delta[PERFCTR_COUNT]){
+    uint64_t buf[1 + PERFCTR_COUNT] = {0}; // nr, then the values in group order
+    int k = 1;
+
+    memset(delta, 0, PERFCTR_COUNT * sizeof(delta[0]));
+    if (p->leader == -1) return -1;
+    if (read(p->leader, buf, sizeof(buf)) < (ssize_t)sizeof(uint64_t)) return -1;
+    for (int i = 0; i < PERFCTR_COUNT && k <= (int)buf[0]; i++) {
+        if (!(p->mask & (1u << i))) continue;
+        delta[i] = buf[k] - p->last[i];
+        p->last[i] = buf[k++];
+    }
+    return 0;
+}
+
+void perfctr_close(perfctr_t *p){
+    for (int i = 0; i < PERFCTR_COUNT; i++) {
+        if (p->mask & (1u << i)) close(p->fd[i]);
+        p->fd[i] = -1;
+    }
+    p->leader = -1;
+    p->mask = 0;
+}
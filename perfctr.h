@@ -0,0 +1,66 @@
+#ifndef PERFCTR_H
+#define PERFCTR_H
+
+#include <stdint.h>
+
+/**
+ * @file perfctr.h
+ * @brief Per thread performance counters for the knodeRT real time loops
+ * @author Aaron Hunter
+ * @date 2025-12-26
+ * @details Opens the CPU cycles, instructions, cache misses, context
+ * switches, page faults and CPU migrations of the calling thread as one
+ * perf_event group, so a single read() returns all of them at the same
+ * instant. Counters the CPU or kernel does not offer (no PMU in a VM, or
+ * kernel.perf_event_paranoid too high) are left out and the rest still
+ * count. Kernel time is excluded when the paranoid level requires it, in
+ * which case the hardware counters only see user space.
+ */
+
+/************** defines *****************************/
+#define PERFCTR_COUNT 6
+
+// counter index, and bit in perfctr_t.mask
+enum {
+    PERFCTR_CYCLES = 0,
+    PERFCTR_INSTRUCTIONS,
+    PERFCTR_CACHE_MISSES,
+    PERFCTR_CTX_SWITCHES,
+    PERFCTR_PAGE_FAULTS,
+    PERFCTR_MIGRATIONS
+};
+
+/************** types *****************************/
+struct perfctr {
+    int fd[PERFCTR_COUNT];      // event file descriptors, -1 if not opened
+    int leader;                 // group leader fd, -1 when nothing is open
+    uint32_t mask;              // counters that are open, 1 << PERFCTR_*
+    uint64_t last[PERFCTR_COUNT]; // totals at the previous read
+};
+typedef struct perfctr perfctr_t;
+
+extern const char *perfctr_names[PERFCTR_COUNT];
+
+/**
+ * @brief Open the counters of the calling thread and start them
+ * @param p Counters to open
+ * @return uint32_t mask of the counters opened, 0 if none could be
+ */
+uint32_t perfctr_open(perfctr_t *p);
+
+/**
+ * @brief Read the counters and return the change since the previous read
+ * @param p Open counters
+ * @param delta Output, one entry per counter, 0 for counters not open
+ * @return int 0 on success, -1 if the read failed
+ * @note One read() system call, about a microsecond.
+ */
+int perfctr_delta(perfctr_t *p, uint64_t delta[PERFCTR_COUNT]);
+
+/**
+ * @brief Close the counters
+ * @param p Counters, may be partly open
+ */
+void perfctr_close(perfctr_t *p);
+
+#endif // PERFCTR_H
@@ -0,0 +1,247 @@
+/**
+ * @file protocol.c
+ * @brief Encoding and decoding of knode command packets
+ * @author Aaron Hunter
+ * @date 2025-12-08
+ * @details Shared by the UDP client and knodeRT, see protocol.h for the
+ * packet formats.
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include <arpa/inet.h>
+#include <endian.h>
+#include "protocol.h"
+
+#define MASK_SIZE 4 // bytes in the changed word mask
+
+/**
+ * @brief Fill in the packet header
+ */
+static void put_hdr(uint8_t *buf, uint8_t type, uint32_t seq){
+    knode_hdr_t hdr;
+
+    hdr.version = KNODE_VERSION;
+    hdr.type = type;
+    hdr.path = 0;
+    hdr.reserved = 0;
+    hdr.seq = htonl(seq);
+    memcpy(buf, &hdr, sizeof(hdr));
+}
+
+/**
+ * @brief Store an int16_t in network byte order at an unaligned address
+ */
+static void put16(uint8_t *buf, int16_t val){
+    buf[0] = (uint16_t)val >> 8;
+    buf[1] = (uint16_t)val & 0xFF;
+}
+
+/**
+ * @brief Load an int16_t in network byte order from an unaligned address
+ */
+static int16_t get16(const uint8_t *buf){
+    return (int16_t)((buf[0] << 8) | buf[1]);
+}
+
+size_t knode_encode_full(uint8_t *buf, uint32_t seq, const int16_t *vals){
+    uint8_t *p = buf + sizeof(knode_hdr_t);
+
+    put_hdr(buf, KNODE_PKT_FULL, seq);
+    for (int i = 0; i < KNODE_NUM_VALS; i++, p += 2) {
+        put16(p, vals[i]);
+    }
+    return p - buf;
+}
+
+size_t knode_encode_delta(uint8_t *buf, uint32_t seq, const int16_t *vals,
+                          const int16_t *base, int varint){
+    uint8_t *p = buf + sizeof(knode_hdr_t) + MASK_SIZE;
+    uint32_t mask = {0};
+    int pad = {0}; // unchanged word sent anyway, see below
+
+    // A packet of exactly KNODE_LEGACY_SIZE bytes would be taken for a bare
+    // legacy command. Varint deltas get one non-minimal varint, absolute
+    // deltas repeat the first unchanged word.
+    if (varint == 0) {
+        int n = {0};
+        for (int i = 0; i < KNODE_NUM_VALS; i++) n += (vals[i] != base[i]);
+        if (sizeof(knode_hdr_t) + MASK_SIZE + 2 * n == KNODE_LEGACY_SIZE) pad = 1;
+    }
+    put_hdr(buf, varint ? KNODE_PKT_DELTA_VAR : KNODE_PKT_DELTA, seq);
+    for (int i = 0; i < KNODE_NUM_VALS; i++) {
+        if (vals[i] == base[i]) {
+            if (pad == 0) continue;
+            pad = 0;
+        }
+        mask |= 1UL << i;
+        if (varint) {
+            int32_t diff = (int32_t)vals[i] - base[i];
+            uint32_t zz = ((uint32_t)diff << 1) ^ (uint32_t)(diff >> 31); // zigzag
+            while (zz >= 0x80) {
+                *p++ = (zz & 0x7F) | 0x80;
+                zz >>= 7;
+            }
+            *p++ = zz;
+        } else {
+            put16(p, vals[i]);
+            p += 2;
+        }
+    }
+    if (varint && p - buf == KNODE_LEGACY_SIZE) {
+        p[-1] |= 0x80; // continue the last varint with a zero group
+        *p++ = 0;
+    }
+    mask = htonl(mask);
+    memcpy(buf + sizeof(knode_hdr_t), &mask, MASK_SIZE);
+    return p - buf;
+}
+
+int knode_decode(const uint8_t *buf, size_t len, int16_t *vals, uint32_t *seq){
+    const uint8_t *p = buf;
+    const uint8_t *end = buf + len;
+    knode_hdr_t hdr;
+    uint32_t mask = {0};
+
+    if (len == KNODE_LEGACY_SIZE) {
+        for (int i = 0; i < KNODE_NUM_VALS; i++, p += 2) {
+            vals[i] = get16(p);
+        }
+        return KNODE_PKT_LEGACY;
+    }
+    if (len < sizeof(hdr)) return -1;
+    memcpy(&hdr, buf, sizeof(hdr));
+    if (hdr.version != KNODE_VERSION) return -1;
+    *seq = ntohl(hdr.seq);
+    p += sizeof(hdr);
+
+    switch (hdr.type) {
+        case KNODE_PKT_FULL:
+            if (len != sizeof(knode_full_t)) return -1;
+            for (int i = 0; i < KNODE_NUM_VALS; i++, p += 2) {
+                vals[i] = get16(p);
+            }
+            return KNODE_PKT_FULL;
+        case KNODE_PKT_DELTA:
+        case KNODE_PKT_DELTA_VAR:
+            if (end - p < MASK_SIZE) return -1;
+            memcpy(&mask, p, MASK_SIZE);
+            mask = ntohl(mask);
+            if (mask >> KNODE_NUM_VALS) return -1;
+            p += MASK_SIZE;
+            for (int i = 0; i < KNODE_NUM_VALS; i++) {
+                if ((mask & (1UL << i)) == 0) continue;
+                if (hdr.type == KNODE_PKT_DELTA) {
+                    if (end - p < 2) return -1;
+                    vals[i] = get16(p);
+                    p += 2;
+                } else {
+                    uint32_t zz = {0};
+                    int shift = {0};
+                    do {
+                        if (p == end || shift > 28) return -1;
+                        zz |= (uint32_t)(*p & 0x7F) << shift;
+                        shift += 7;
+                    } while (*p++ & 0x80);
+                    vals[i] = (int16_t)(vals[i] + (int32_t)((zz >> 1) ^ -(zz & 1)));
+                }
+            }
+            return (p == end) ? hdr.type : -1;
+        default:
+            return -1;
+    }
+}
+
+size_t knode_encode_tlm(uint8_t *buf, uint32_t seq, uint64_t tx_ns,
+                        const knode_tlm_rec_t *recs, int n){
+    uint8_t *p = buf + sizeof(knode_hdr_t);
+    knode_tlm_rec_t rec;
+    uint16_t count = htons((uint16_t)n);
+
+    put_hdr(buf, KNODE_PKT_TLM, seq);
+    memcpy(p, &count, sizeof(count));
+    memset(p + 2, 0, 2);
+    tx_ns = htobe64(tx_ns);
+    memcpy(p + 4, &tx_ns, sizeof(tx_ns));
+    p += 12;
+    for (int i = 0; i < n; i++, p += sizeof(rec)) {
+        rec = recs[i];
+        rec.seq = htonl(rec.seq);
+        rec.reserved = 0;
+        rec.rx_ns = htobe64(rec.rx_ns);
+        rec.start_ns = htobe64(rec.start_ns);
+        rec.spi_ns = htobe64(rec.spi_ns);
+        memcpy(p, &rec, sizeof(rec));
+    }
+    return p - buf;
+}
+
+int knode_decode_tlm(const uint8_t *buf, size_t len, uint64_t *tx_ns, knode_tlm_rec_t *recs){
+    knode_hdr_t hdr;
+    uint16_t count = {0};
+
+    if (len < knode_tlm_size(0)) return -1;
+    memcpy(&hdr, buf, sizeof(hdr));
+    if (hdr.version != KNODE_VERSION || hdr.type != KNODE_PKT_TLM) return -1;
+    memcpy(&count, buf + sizeof(hdr), sizeof(count));
+    count = ntohs(count);
+    if (count > KNODE_TLM_MAX_RECS || len != knode_tlm_size(count)) return -1;
+    memcpy(tx_ns, buf + sizeof(hdr) + 4, sizeof(*tx_ns));
+    *tx_ns = be64toh(*tx_ns);
+    memcpy(recs, buf + knode_tlm_size(0), count * sizeof(knode_tlm_rec_t));
+    for (int i = 0; i < count; i++) {
+        recs[i].seq = ntohl(recs[i].seq);
+        recs[i].rx_ns = be64toh(recs[i].rx_ns);
+        recs[i].start_ns = be64toh(recs[i].start_ns);
+        recs[i].spi_ns = be64toh(recs[i].spi_ns);
+    }
+    return count;
+}
+
+size_t knode_encode_reg(uint8_t *buf, uint32_t seq, const knode_reg_rec_t *recs, int n){
+    uint8_t *p = buf + sizeof(knode_hdr_t);
+    knode_reg_rec_t rec;
+    uint16_t count = htons((uint16_t)n);
+
+    put_hdr(buf, KNODE_PKT_REG, seq);
+    memcpy(p, &count, sizeof(count));
+    memset(p + 2, 0, 2);
+    p += 4;
+    for (int i = 0; i < n; i++, p += sizeof(rec)) {
+        rec = recs[i];
+        rec.value = htons(rec.value);
+        rec.tag = htons(rec.tag);
+        rec.done_ns = htobe64(rec.done_ns);
+        memcpy(p, &rec, sizeof(rec));
+    }
+    return p - buf;
+}
+
+int knode_decode_reg(const uint8_t *buf, size_t len, knode_reg_rec_t *recs){
+    knode_hdr_t hdr;
+    uint16_t count = {0};
+
+    if (len < knode_reg_size(0)) return -1;
+    memcpy(&hdr, buf, sizeof(hdr));
+    if (hdr.version != KNODE_VERSION || hdr.type != KNODE_PKT_REG) return -1;
+    memcpy(&count, buf + sizeof(hdr), sizeof(count));
+    count = ntohs(count);
+    if (count > KNODE_REG_MAX_RECS || len != knode_reg_size(count)) return -1;
+    memcpy(recs, buf + knode_reg_size(0), count * sizeof(knode_reg_rec_t));
+    for (int i = 0; i < count; i++) {
+        recs[i].value = ntohs(recs[i].value);
+        recs[i].tag = ntohs(recs[i].tag);
+        recs[i].done_ns = be64toh(recs[i].done_ns);
+    }
+    return count;
+}
+
+int knode_get_path(const uint8_t *buf, size_t len){
+    if (len == KNODE_LEGACY_SIZE || len < sizeof(knode_hdr_t)) return -1;
+    return buf[offsetof(knode_hdr_t, path)];
+}
+
+void knode_set_path(uint8_t *buf, size_t len, uint8_t path){
+    if (len == KNODE_LEGACY_SIZE || len < sizeof(knode_hdr_t)) return;
+    buf[offsetof(knode_hdr_t, path)] = path;
+}
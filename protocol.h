@@ -2,6 +2,7 @@
 #define PROTOCOL_H
 
 #include <stdint.h>
+#include <stddef.h>
 
 /* --- DAC80508 Register Map --- */
 #define DAC80508_REG_NOP           0x00
@@ -20,6 +21,7 @@
 #define DAC80508_REG_DAC5          0x0D
 #define DAC80508_REG_DAC6          0x0E
 #define DAC80508_REG_DAC7          0x0F
+#define DAC80508_STATUS_REF_ALARM  0x0001 // STATUS: reference below its minimum, outputs held at zero
 #define NUM_CHANNELS 8
 #define PROTOCOL_VERSION 0
 #define PROTOCOL_END_1 0xDE
@@ -39,5 +41,188 @@ typedef struct command{
     uint8_t end_2;
 } command_t;
 
+/* --- knode command packets ---
+ * Sequenced packets start with a knode_hdr_t followed by the payload.
+ * All multi-byte fields are in network byte order. A bare 52 byte packet
+ * (26 int16_t values, no header) is still accepted as a legacy command.
+ *
+ * KNODE_PKT_FULL carries all command words and acts as a keyframe.
+ * KNODE_PKT_DELTA carries a uint32_t mask of the changed words followed by
+ * their new values (int16_t each), in word order.
+ * KNODE_PKT_DELTA_VAR carries the same mask followed by the change of each
+ * word from the previous packet, zigzag and LEB128 varint coded. It is only
+ * valid on top of the packet with sequence number seq - 1.
+ *
+ * A sequenced packet is never KNODE_LEGACY_SIZE bytes long, the decoder
+ * takes every packet of that length for a legacy command.
+ *
+ * A redundant sender sends every sequenced packet on KNODE_MAX_PATHS paths,
+ * for example two NICs, or twice with a short offset. The copies are
+ * identical except for the path field of the header. The node applies the
+ * first copy to arrive and drops the others as duplicates. A sender without
+ * redundancy leaves the path at 0.
+ */
+#define KNODE_VERSION       1
+#define KNODE_PKT_LEGACY    0x00  // bare 52 byte command, no header
+#define KNODE_PKT_FULL      0x01  // all KNODE_NUM_VALS command words
+#define KNODE_PKT_DELTA     0x02  // changed words, absolute values
+#define KNODE_PKT_DELTA_VAR 0x03  // changed words, varint coded differences
+#define KNODE_NUM_VALS      26    // command words per frame
+#define KNODE_LEGACY_SIZE   (KNODE_NUM_VALS * 2)
+#define KNODE_MAX_PKT       96    // largest encoded packet (varint delta, all words)
+#define KNODE_MAX_PATHS     2     // copies a redundant sender sends of every packet
+
+typedef struct __attribute__((packed)) knode_hdr {
+    uint8_t version;    // KNODE_VERSION
+    uint8_t type;       // KNODE_PKT_*
+    uint8_t path;       // copy of a redundant sender, 0 to KNODE_MAX_PATHS - 1
+    uint8_t reserved;   // must be zero
+    uint32_t seq;       // sequence number, incremented for every command
+} knode_hdr_t;
+
+typedef struct __attribute__((packed)) knode_full {
+    knode_hdr_t hdr;
+    int16_t values[KNODE_NUM_VALS];
+} knode_full_t;
+
+/* --- knode telemetry ---
+ * knodeRT reports every SPI transfer back to the peer that sent the command.
+ * A telemetry datagram is a knode_hdr_t (type KNODE_PKT_TLM, seq counts
+ * datagrams) followed by a uint16_t record count, two reserved bytes, the
+ * uint64_t node time the datagram was sent and that many knode_tlm_rec_t,
+ * all in network byte order. The send time lets the receiver take the
+ * batching delay out of its round trip measurement.
+ */
+#define KNODE_PKT_TLM       0x10  // telemetry datagram from the node
+#define KNODE_TLM_MAX_RECS  16    // records per telemetry datagram
+
+#define KNODE_TLM_SPI_OK    0x01  // SPI transfer completed
+#define KNODE_TLM_CRC_OK    0x02  // MISO data carries a valid crc
+#define KNODE_TLM_ECHO_OK   0x04  // MISO data echoes the frame that was sent
+#define KNODE_TLM_FRESH     0x08  // first transfer of this command on this bus
+#define KNODE_TLM_SYNTH     0x10  // frame was interpolated or extrapolated
+
+typedef struct __attribute__((packed)) knode_tlm_rec {
+    uint32_t seq;       // sequence number of the last applied command
+    uint8_t bus;        // SPI thread index
+    uint8_t status;     // KNODE_TLM_* flags
+    uint16_t reserved;
+    uint64_t rx_ns;     // node CLOCK_MONOTONIC time the command was received
+    uint64_t start_ns;  // node CLOCK_MONOTONIC time the SPI thread picked up the frame
+    uint64_t spi_ns;    // node CLOCK_MONOTONIC time the SPI transfer completed
+} knode_tlm_rec_t;
+
+/**
+ * @brief Encode a telemetry datagram
+ * @param buf Output buffer, at least knode_tlm_size(n) bytes
+ * @param seq Datagram sequence number
+ * @param tx_ns Node CLOCK_MONOTONIC time the datagram is sent
+ * @param recs Records in host byte order
+ * @param n Number of records (<= KNODE_TLM_MAX_RECS)
+ * @return size_t encoded length in bytes
+ */
+size_t knode_encode_tlm(uint8_t *buf, uint32_t seq, uint64_t tx_ns,
+                        const knode_tlm_rec_t *recs, int n);
+
+/**
+ * @brief Decode a telemetry datagram
+ * @param buf Received datagram
+ * @param len Datagram length in bytes
+ * @param tx_ns Output node time the datagram was sent
+ * @param recs Output records in host byte order (KNODE_TLM_MAX_RECS entries)
+ * @return int number of records, or -1 if the datagram is not telemetry
+ */
+int knode_decode_tlm(const uint8_t *buf, size_t len, uint64_t *tx_ns, knode_tlm_rec_t *recs);
+
+#define knode_tlm_size(n) (sizeof(knode_hdr_t) + 12 + (n) * sizeof(knode_tlm_rec_t))
+
+/* --- knode register telemetry ---
+ * Results of the maintenance register reads knodeRT runs in the idle SPI
+ * time (maint.h), sent to the telemetry peer as they complete. The datagram
+ * is a knode_hdr_t (type KNODE_PKT_REG, seq counts telemetry datagrams of
+ * both types) followed by a uint16_t record count, two reserved bytes and
+ * that many knode_reg_rec_t, all in network byte order.
+ */
+#define KNODE_PKT_REG       0x11  // register telemetry datagram from the node
+#define KNODE_REG_MAX_RECS  16    // records per register telemetry datagram
+
+typedef struct __attribute__((packed)) knode_reg_rec {
+    uint8_t bus;        // SPI thread index
+    uint8_t dac;        // DAC80508 on the board
+    uint8_t reg;        // DAC80508_REG_*
+    uint8_t status;     // 0 if value was read, MAINT_ERR_* otherwise
+    uint16_t value;     // register contents
+    uint16_t tag;       // transaction tag
+    uint64_t done_ns;   // node CLOCK_MONOTONIC time the register was read
+} knode_reg_rec_t;
+
+/**
+ * @brief Encode a register telemetry datagram
+ * @param buf Output buffer, at least knode_reg_size(n) bytes
+ * @param seq Datagram sequence number
+ * @param recs Records in host byte order
+ * @param n Number of records (<= KNODE_REG_MAX_RECS)
+ * @return size_t encoded length in bytes
+ */
+size_t knode_encode_reg(uint8_t *buf, uint32_t seq, const knode_reg_rec_t *recs, int n);
+
+/**
+ * @brief Decode a register telemetry datagram
+ * @param buf Received datagram
+ * @param len Datagram length in bytes
+ * @param recs Output records in host byte order (KNODE_REG_MAX_RECS entries)
+ * @return int number of records, or -1 if the datagram is not register telemetry
+ */
+int knode_decode_reg(const uint8_t *buf, size_t len, knode_reg_rec_t *recs);
+
+#define knode_reg_size(n) (sizeof(knode_hdr_t) + 4 + (n) * sizeof(knode_reg_rec_t))
+
+/**
+ * @brief Encode a keyframe
+ * @param buf Output buffer, at least KNODE_MAX_PKT bytes
+ * @param seq Sequence number
+ * @param vals Command words in host byte order
+ * @return size_t encoded length in bytes
+ */
+size_t knode_encode_full(uint8_t *buf, uint32_t seq, const int16_t *vals);
+
+/**
+ * @brief Encode the words that changed since the previous packet
+ * @param buf Output buffer, at least KNODE_MAX_PKT bytes
+ * @param seq Sequence number
+ * @param vals Command words in host byte order
+ * @param base Command words of the previous packet (seq - 1)
+ * @param varint Non-zero to send varint coded differences instead of values
+ * @return size_t encoded length in bytes
+ */
+size_t knode_encode_delta(uint8_t *buf, uint32_t seq, const int16_t *vals,
+                          const int16_t *base, int varint);
+
+/**
+ * @brief Decode a knode packet
+ * @param buf Received packet
+ * @param len Packet length in bytes
+ * @param vals On entry the last applied command words (the delta base),
+ *        on return the decoded command words, host byte order
+ * @param seq Output sequence number, not set for legacy packets
+ * @return int KNODE_PKT_* type, or -1 if the packet is malformed
+ */
+int knode_decode(const uint8_t *buf, size_t len, int16_t *vals, uint32_t *seq);
+
+/**
+ * @brief Path of a sequenced packet
+ * @param buf Packet
+ * @param len Packet length in bytes
+ * @return int path from the header, -1 for a legacy packet or one too short for a header
+ */
+int knode_get_path(const uint8_t *buf, size_t len);
+
+/**
+ * @brief Set the path of a sequenced packet
+ * @param buf Packet, a legacy packet or one too short for a header is left alone
+ * @param len Packet length in bytes
+ * @param path Path to send the packet on
+ */
+void knode_set_path(uint8_t *buf, size_t len, uint8_t path);
 
 #endif //PROTOCOL_H
\ No newline at end of file
@@ -0,0 +1,198 @@
+"""Convert knodeRT flight recorder snapshots (flightrec.h) to a Chrome trace.
+
+The output is Chrome trace-event JSON, which chrome://tracing and the
+Perfetto UI (ui.perfetto.dev) both open. Every snapshot becomes one process
+with a track for the UDP loop and one per SPI bus. The UDP track shows the
+stages of each period, the bus tracks show each SPI transfer and the gap
+from the handoff by the UDP loop to the start of the transfer. Deadline
+misses and the snapshot trigger are marked, and the performance counters
+(knodeRT -p) become counter tracks.
+"""
+import argparse
+import bisect
+import json
+import os
+import struct
+import sys
+
+# --- Layout of flightrec.h ---
+FLIGHTREC_MAGIC = 0x524c464b
+FLIGHTREC_VERSION = 1
+HDR = struct.Struct('<IHHIIIIQQQQQ')
+CYCLE = struct.Struct('<9QiIIHBB')
+PERF = struct.Struct('<6Q')
+BUS = struct.Struct('<QQIB3x')
+MAX_BUSES = 5
+
+FLAG_RX = 0x01
+FLAG_CMD = 0x02
+FLAG_SYNTH = 0x04
+FLAG_MISS = 0x08
+FLAG_SLOW = 0x10
+FLAG_TRIGGER = 0x20
+
+PERF_NAMES = ['cycles', 'instructions', 'cache_misses', 'ctx_switches', 'page_faults', 'migrations']
+REASONS = {1: 'deadline miss', 2: 'slow period'}
+TLM_STATUS = {0x01: 'spi_ok', 0x02: 'crc_ok', 0x04: 'echo_ok', 0x08: 'fresh', 0x10: 'synth'}
+
+UDP_TID = 0
+
+
+def parse_arguments():
+    """Configures and parses command-line arguments."""
+    parser = argparse.ArgumentParser(
+        description="Convert knodeRT flight recorder snapshots to Chrome trace JSON."
+    )
+
+    parser.add_argument(
+        'snapshots',
+        nargs='+',
+        help="flightrec_<pid>_<n>.bin files written by knodeRT -F."
+    )
+
+    parser.add_argument(
+        '-o','--output',
+        type=str,
+        default='-',
+        help="Output file. Default is stdout."
+    )
+
+    return parser.parse_args()
+
+
+def read_snapshot(path):
+    """Returns the header fields and the list of cycles of one snapshot."""
+    with open(path, 'rb') as f:
+        data = f.read()
+    if len(data) < HDR.size:
+        raise ValueError(f"{path}: too short for a flight recorder header")
+    (magic, version, rec_size, count, buses, reason, perf_mask, trigger_period,
+     period_ns, threshold_ns, mono_ns, real_ns) = HDR.unpack_from(data, 0)
+    if magic != FLIGHTREC_MAGIC or version != FLIGHTREC_VERSION:
+        raise ValueError(f"{path}: not a version {FLIGHTREC_VERSION} flight recorder snapshot")
+    if rec_size < CYCLE.size + PERF.size + MAX_BUSES * BUS.size or len(data) < HDR.size + count * rec_size:
+        raise ValueError(f"{path}: truncated or unknown record layout")
+    hdr = dict(buses=buses, reason=reason, perf_mask=perf_mask, trigger_period=trigger_period,
+               period_ns=period_ns, threshold_ns=threshold_ns, mono_ns=mono_ns, real_ns=real_ns)
+
+    cycles = []
+    for i in range(count):
+        off = HDR.size + i * rec_size
+        (period, wake_ns, rx_ns, decode_ns, crc_ns, handoff_ns, collect_ns, end_ns, deadline_ns,
+         rx_len, seq, frame, conceal_missed, flags, tlm_count) = CYCLE.unpack_from(data, off)
+        off += CYCLE.size
+        perf = PERF.unpack_from(data, off)
+        off += PERF.size
+        bus = [BUS.unpack_from(data, off + b * BUS.size) for b in range(MAX_BUSES)]
+        cycles.append(dict(period=period, wake_ns=wake_ns, rx_ns=rx_ns, decode_ns=decode_ns,
+                           crc_ns=crc_ns, handoff_ns=handoff_ns, collect_ns=collect_ns,
+                           end_ns=end_ns, deadline_ns=deadline_ns, rx_len=rx_len, seq=seq,
+                           frame=frame, conceal_missed=conceal_missed, flags=flags,
+                           tlm_count=tlm_count, perf=perf, bus=bus))
+    return hdr, cycles
+
+
+def us(ns):
+    """Trace timestamps are microseconds."""
+    return ns / 1000.0
+
+
+def span(events, pid, tid, name, start_ns, end_ns, args=None):
+    """Appends a complete event, skipping stages that did not happen."""
+    if start_ns == 0 or end_ns == 0 or end_ns < start_ns:
+        return
+    ev = dict(name=name, ph='X', pid=pid, tid=tid, ts=us(start_ns), dur=us(end_ns - start_ns))
+    if args:
+        ev['args'] = args
+    events.append(ev)
+
+
+def flag_names(flags):
+    names = [('rx', FLAG_RX), ('cmd', FLAG_CMD), ('synth', FLAG_SYNTH), ('miss', FLAG_MISS),
+             ('slow', FLAG_SLOW), ('trigger', FLAG_TRIGGER)]
+    return ' '.join(n for n, bit in names if flags & bit)
+
+
+def status_names(status):
+    return ' '.join(n for bit, n in TLM_STATUS.items() if status & bit)
+
+
+def convert(path, pid, events):
+    """Appends the events of one snapshot as process pid."""
+    hdr, cycles = read_snapshot(path)
+    buses = min(hdr['buses'], MAX_BUSES)
+
+    events.append(dict(name='process_name', ph='M', pid=pid,
+                       args=dict(name=f"knodeRT {os.path.basename(path)} "
+                                      f"({REASONS.get(hdr['reason'], 'unknown')} at period {hdr['trigger_period']})")))
+    events.append(dict(name='thread_name', ph='M', pid=pid, tid=UDP_TID, args=dict(name='udp loop')))
+    events.append(dict(name='thread_sort_index', ph='M', pid=pid, tid=UDP_TID, args=dict(sort_index=0)))
+    for b in range(buses):
+        events.append(dict(name='thread_name', ph='M', pid=pid, tid=1 + b, args=dict(name=f"spi bus {b}")))
+        events.append(dict(name='thread_sort_index', ph='M', pid=pid, tid=1 + b, args=dict(sort_index=1 + b)))
+
+    handoffs = []  # (time, frame) of every frame handed to the SPI buses, the handoff starts after the crc
+    prev_deadline = 0
+    for c in cycles:
+        # the UDP loop, stage by stage in the order the loop runs them
+        args = dict(period=c['period'], seq=c['seq'], frame=c['frame'], flags=flag_names(c['flags']),
+                    rx_len=c['rx_len'], conceal_missed=c['conceal_missed'], tlm_count=c['tlm_count'])
+        span(events, pid, UDP_TID, 'period', c['wake_ns'] or c['rx_ns'], c['end_ns'], args)
+        span(events, pid, UDP_TID, 'wake late', prev_deadline, c['wake_ns'])
+        span(events, pid, UDP_TID, 'receive', c['wake_ns'], c['rx_ns'])
+        t = c['rx_ns']
+        for name, key in [('decode', 'decode_ns'), ('crc', 'crc_ns'), ('handoff', 'handoff_ns'),
+                          ('collect', 'collect_ns'), ('telemetry', 'end_ns')]:
+            if c[key] != 0 and c[key] >= t:
+                span(events, pid, UDP_TID, name, t, c[key])
+                t = c[key]
+        if c['crc_ns'] != 0:
+            handoffs.append((c['crc_ns'], c['frame']))
+        if c['flags'] & FLAG_MISS:
+            events.append(dict(name='deadline miss', ph='i', s='p', pid=pid, tid=UDP_TID, ts=us(c['end_ns']),
+                               args=dict(late_ns=c['end_ns'] - prev_deadline - hdr['period_ns'] if prev_deadline else 0)))
+        if c['flags'] & FLAG_TRIGGER:
+            events.append(dict(name='snapshot trigger', ph='i', s='g', pid=pid, tid=UDP_TID, ts=us(c['end_ns'])))
+        prev_deadline = c['deadline_ns']
+
+        # performance counter deltas of the period
+        for i, name in enumerate(PERF_NAMES):
+            if hdr['perf_mask'] & (1 << i) and c['end_ns'] != 0:
+                events.append(dict(name=name, ph='C', pid=pid, ts=us(c['end_ns']), args={name: c['perf'][i]}))
+
+    # SPI transfers, with the wait from the handoff that fed them
+    handoffs.sort()
+    for c in cycles:
+        for b in range(buses):
+            start_ns, done_ns, seq, status = c['bus'][b]
+            if start_ns == 0:
+                continue
+            span(events, pid, 1 + b, 'spi', start_ns, done_ns, dict(seq=seq, status=status_names(status)))
+            k = bisect.bisect_right(handoffs, (start_ns, 0xffffffff))
+            if k > 0 and start_ns - handoffs[k - 1][0] < hdr['period_ns'] * 4:
+                span(events, pid, 1 + b, 'wakeup', handoffs[k - 1][0], start_ns, dict(frame=handoffs[k - 1][1]))
+    return len(cycles)
+
+
+def main():
+    args = parse_arguments()
+    events = []
+
+    for pid, path in enumerate(args.snapshots, start=1):
+        try:
+            n = convert(path, pid, events)
+        except (OSError, ValueError) as e:
+            print(f"Error: {e}", file=sys.stderr)
+            sys.exit(1)
+        print(f"{path}: {n} periods", file=sys.stderr)
+
+    trace = dict(traceEvents=events, displayTimeUnit='ns')
+    if args.output == '-':
+        json.dump(trace, sys.stdout)
+    else:
+        with open(args.output, 'w') as f:
+            json.dump(trace, f)
+
+
+if __name__ == "__main__":
+    main()
@@ -1,25 +1,123 @@
 /**
 *   rtc_sim.c
-*   Simulated RTC UDP packets sent to KASM Pi node for latency testing
+*   Simulated RTC UDP packets sent to KASM Pi nodes for latency and load testing
 *   Author: Aaron Hunter
 *   Date: 2025-11-19
 *
+*   Drives any number of knode endpoints at a configurable rate and burst
+*   pattern. Payloads are generated before the run and sent with sendmmsg,
+*   so the send loop only patches sequence numbers. Per target it reports the
+*   achieved rate, the send time jitter and its own deadline misses.
+*
+*   With -L it also collects the knodeRT telemetry and breaks the latency of
+*   every command down by hop: network (send to node receive), queue (receive
+*   to SPI thread pickup), SPI transfer and return (telemetry send to client
+*   receive). The send time is taken from the client clock and the others
+*   from the node clock, so the network hop and the total are only
+*   meaningful when both run on the same host.
+*
+*   A target shm:<segment> writes the same packets into the shared memory
+*   segment of a knodeRT -M on this host instead (shm_cmd.h).
 **/
+#define _GNU_SOURCE // sendmmsg
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
+#include <stddef.h>
 #include <time.h>
 #include <pthread.h>
 #include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
 #include <sched.h>
+#include <poll.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
 #include <sys/mman.h> // necessary for mlockall
 #include "UDP_client.h"
+#include "protocol.h"
+#include "histogram.h"
+#include "shm_cmd.h"
 
-#define PERIOD_NSEC  (1000*1000) // 500 usec interval
+#define PERIOD_NSEC  (1000*1000) // default 1 msec interval
 #define NSEC_PER_SEC (1000*1000*1000)
 #define TRUE (1==1)
 #define FALSE (!TRUE)
 #define REALTIME TRUE
 
+#define MAX_TARGETS  64     // knode endpoints
+#define MAX_THREADS  8      // sender threads
+#define MAX_BURST    64     // packets per target per period
+#define NUM_PAYLOADS 1024   // precomputed payloads per target, sent cyclically
+#define KEYFRAME_INTERVAL 100 // packets between delta keyframes
+#define SEND_RING    4096   // send times kept for telemetry matching, power of two
+#define TLM_BUF_SIZE 1024   // telemetry datagram buffer
+#define LINGER_NSEC  (50*1000*1000) // wait for the last telemetry after sending stops
+
+typedef enum {
+    FMT_LEGACY = 0, // bare 52 byte command
+    FMT_COMMAND,    // protocol.h command_t
+    FMT_SEQ,        // sequenced knode keyframes
+    FMT_DELTA       // varint delta packets with periodic keyframes
+} payload_fmt_t;
+
+static const char *fmt_names[] = {"legacy", "command", "seq", "delta"};
+
+struct target {
+    char host[80];
+    char port[20];
+    int fd;                             // connected UDP socket, -1 for shared memory
+    shm_cmd_t shm;                      // knodeRT -M segment, target shm:<name>
+    uint8_t (*payload)[KNODE_MAX_PKT];  // NUM_PAYLOADS precomputed packets
+    size_t len[NUM_PAYLOADS];           // length of each packet
+    int seq_off;                        // byte offset of the sequence number, -1 if none
+    uint32_t seq;                       // next sequence number
+    size_t next;                        // index of the next payload
+    uint64_t sent;                      // packets sent
+    uint64_t errors;                    // packets the socket refused
+    uint64_t misses;                    // sends later than one full period
+    uint64_t first_ns;                  // time of the first send
+    uint64_t last_ns;                   // time of the last send
+    uint64_t prev_ns;                   // previous send, for the interval
+    histogram_t jitter;                 // send time minus scheduled time
+    histogram_t interval;               // time between consecutive sends
+    // latency breakdown from the node telemetry (-L)
+    uint64_t *send_ns;                  // send time by sequence number, SEND_RING entries
+    uint64_t tlm_recs;                  // fresh telemetry records matched to a send
+    uint64_t tlm_bad;                   // records without SPI, crc or echo ok
+    uint64_t late;                      // commands applied later than the deadline
+    histogram_t net;                    // send to node receive
+    histogram_t queue;                  // node receive to SPI thread pickup
+    histogram_t spi;                    // SPI transfer
+    histogram_t ret;                    // telemetry send to client receive
+    histogram_t total;                  // send to SPI transfer complete
+};
+typedef struct target target_t;
+
+struct sender {
+    int id;
+    pthread_t thread;
+};
+
+/********** module variables *****************/
+volatile sig_atomic_t running = TRUE;
+target_t targets[MAX_TARGETS];
+int num_targets = {0};
+int num_threads = 1;
+long period_nsec = PERIOD_NSEC;
+int burst = 1;              // packets per target per period
+int burst_on = 1;           // periods sending ...
+int burst_off = 0;          // ... followed by periods idle
+int num_changed = CMD_SIZE/2; // command words changed per packet
+int duration_sec = 0;       // 0 runs until interrupted
+payload_fmt_t payload_fmt = FMT_LEGACY;
+const char *json_file = NULL;
+int latency = FALSE;        // collect node telemetry
+long deadline_nsec = 0;     // send to SPI complete budget, defaults to the period
+volatile sig_atomic_t receiving = TRUE;
+
 
 static void normalize_timespec(struct timespec *ts) {
     while (ts->tv_nsec >= NSEC_PER_SEC) {
@@ -28,6 +126,10 @@ static void normalize_timespec(struct timespec *ts) {
     }
 }
 
+static uint64_t timespec_ns(const struct timespec *ts) {
+    return (uint64_t)ts->tv_sec * NSEC_PER_SEC + ts->tv_nsec;
+}
+
 static void getinfo()
 {
     struct sched_param param;
@@ -42,67 +144,444 @@ static void getinfo()
               param.sched_priority, policy, SCHED_FIFO);
 }
 
+static void stop(int sig) {
+    (void)sig;
+    running = FALSE;
+}
+
+/**
+ * @brief Generate the payloads for one target
+ * @note Command words follow a random walk, num_changed of them per packet.
+ * Payload 0 is always a keyframe, so the sequence can be sent cyclically.
+ */
+static int build_payloads(target_t *t) {
+    int16_t vals[KNODE_NUM_VALS];
+    int16_t prev[KNODE_NUM_VALS];
+    command_t cmd;
+
+    t->payload = calloc(NUM_PAYLOADS, KNODE_MAX_PKT);
+    if (t->payload == NULL) return -1;
+    t->seq_off = (payload_fmt == FMT_SEQ || payload_fmt == FMT_DELTA)
+                 ? (int)offsetof(knode_hdr_t, seq) : -1;
+
+    for (int i = 0; i < KNODE_NUM_VALS; i++) {
+        vals[i] = (rand() % 0xFFFF)>>8; // generate small random values
+    }
+    for (int n = 0; n < NUM_PAYLOADS; n++) {
+        memcpy(prev, vals, sizeof(vals));
+        for (int k = 0; k < num_changed; k++) {
+            int i = (num_changed == KNODE_NUM_VALS) ? k : rand() % KNODE_NUM_VALS;
+            vals[i] += rand() % 201 - 100;
+        }
+        switch (payload_fmt) {
+            case FMT_LEGACY:
+                for (int i = 0; i < KNODE_NUM_VALS; i++) {
+                    int16_t v = htons(vals[i]);
+                    memcpy(t->payload[n] + 2*i, &v, sizeof(v));
+                }
+                t->len[n] = CMD_SIZE;
+                break;
+            case FMT_COMMAND:
+                memset(&cmd, 0, sizeof(cmd));
+                cmd.version = PROTOCOL_VERSION;
+                cmd.timestamp = htonl((uint32_t)(n * (period_nsec / 1000)));
+                for (int i = 0; i < NUM_CHANNELS; i++) {
+                    cmd.frame[i].reg = i + DAC80508_REG_DAC0;
+                    cmd.frame[i].data = htons(vals[i] + DAC_ZERO_CODE);
+                }
+                cmd.end_1 = PROTOCOL_END_1;
+                cmd.end_2 = PROTOCOL_END_2;
+                memcpy(t->payload[n], &cmd, sizeof(cmd));
+                t->len[n] = sizeof(cmd);
+                break;
+            case FMT_SEQ:
+                t->len[n] = knode_encode_full(t->payload[n], 0, vals);
+                break;
+            case FMT_DELTA:
+                if (n % KEYFRAME_INTERVAL == 0) {
+                    t->len[n] = knode_encode_full(t->payload[n], 0, vals);
+                } else {
+                    t->len[n] = knode_encode_delta(t->payload[n], 0, vals, prev, TRUE);
+                }
+                break;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Send one burst to a target
+ */
+static void send_burst(target_t *t, uint64_t sched_ns) {
+    struct mmsghdr msgs[MAX_BURST];
+    struct iovec iov[MAX_BURST];
+    struct timespec now = {0};
+    uint64_t now_ns = {0};
+    uint32_t seq = {0};
+    int sent = {0};
+
+    memset(msgs, 0, sizeof(struct mmsghdr) * burst);
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    now_ns = timespec_ns(&now);
+    for (int b = 0; b < burst; b++) {
+        uint8_t *pkt = t->payload[t->next];
+        if (t->send_ns != NULL) {
+            __atomic_store_n(&t->send_ns[(t->seq + b) & (SEND_RING - 1)], now_ns, __ATOMIC_RELAXED);
+        }
+        if (t->seq_off >= 0) {
+            seq = htonl(t->seq + b);
+            memcpy(pkt + t->seq_off, &seq, sizeof(seq));
+        }
+        iov[b].iov_base = pkt;
+        iov[b].iov_len = t->len[t->next];
+        msgs[b].msg_hdr.msg_iov = &iov[b];
+        msgs[b].msg_hdr.msg_iovlen = 1;
+        t->next = (t->next + 1) % NUM_PAYLOADS;
+    }
+
+    if (t->shm.seg != NULL) {
+        for (int b = 0; b < burst; b++) {
+            sent += (shm_cmd_send(&t->shm, iov[b].iov_base, iov[b].iov_len) >= 0);
+        }
+    } else {
+        sent = sendmmsg(t->fd, msgs, burst, MSG_DONTWAIT);
+        if (sent < 0) sent = 0;
+    }
+
+    __atomic_store_n(&t->seq, t->seq + burst, __ATOMIC_RELAXED); // lost sends still consume their sequence numbers
+    t->sent += sent;
+    t->errors += burst - sent;
+    if (t->first_ns == 0) t->first_ns = now_ns;
+    if (t->prev_ns != 0) hist_add(&t->interval, now_ns - t->prev_ns);
+    t->prev_ns = now_ns;
+    t->last_ns = now_ns;
+    hist_add(&t->jitter, now_ns > sched_ns ? now_ns - sched_ns : 0);
+    if (now_ns > sched_ns + period_nsec) t->misses++;
+}
 
 void *rtc_sim_thread(void *arg){
-    union CMD_DATA cmd_data;
+    struct sender *s = (struct sender *)arg;
     struct timespec prd_tmr={0};
+    struct timespec curr_tmr={0};
+    uint64_t cycle = {0};
 
-    getinfo(); 
+    getinfo();
     clock_gettime(CLOCK_MONOTONIC, &prd_tmr);
-    
-    while (1) {
-        // populate the buffer with random values
-        for(int i = 0; i < CMD_SIZE/2; i++){
-            int16_t value = (rand() % 0xFFFF)>>8; // generate small random values
-            cmd_data.values[i] = htons(value);
-        }
-        // Send RTC data over UDP
-        int sent = UDP_send(cmd_data);
-        if (sent == 0){
-            fprintf(stderr, "RTC sim: Failed to send UDP packet\n");
+
+    while (running == TRUE) {
+        // on/off burst pattern
+        if (cycle % (burst_on + burst_off) < (uint64_t)burst_on) {
+            for (int i = s->id; i < num_targets; i += num_threads) {
+                send_burst(&targets[i], timespec_ns(&prd_tmr));
+            }
         }
+        cycle++;
         // Calculate next wake-up time
-        prd_tmr.tv_nsec += PERIOD_NSEC;
+        prd_tmr.tv_nsec += period_nsec;
         normalize_timespec(&prd_tmr);
+        clock_gettime(CLOCK_MONOTONIC, &curr_tmr);
+        if (timespec_ns(&curr_tmr) > timespec_ns(&prd_tmr) + period_nsec) {
+            // more than a period behind: skip ahead instead of bursting to catch up
+            prd_tmr = curr_tmr;
+        }
         clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &prd_tmr, NULL);
     }
     return NULL;
 }
 
+/**
+ * @brief Match one telemetry record to the command it reports
+ * @note Only the first transfer of each command on each bus is counted,
+ * later ones are repeats of the same command (interpolation, concealment).
+ */
+static void add_tlm(target_t *t, const knode_tlm_rec_t *rec, uint64_t tlm_tx_ns, uint64_t rx_ns) {
+    uint64_t sent_ns = {0};
+
+    if ((rec->status & KNODE_TLM_FRESH) == 0) return;
+    if ((rec->status & (KNODE_TLM_SPI_OK | KNODE_TLM_CRC_OK | KNODE_TLM_ECHO_OK))
+        != (KNODE_TLM_SPI_OK | KNODE_TLM_CRC_OK | KNODE_TLM_ECHO_OK)) {
+        t->tlm_bad++;
+    }
+    // the sender may have wrapped the ring since this command went out
+    if (__atomic_load_n(&t->seq, __ATOMIC_RELAXED) - rec->seq >= SEND_RING) return;
+    sent_ns = __atomic_load_n(&t->send_ns[rec->seq & (SEND_RING - 1)], __ATOMIC_RELAXED);
+    if (sent_ns == 0 || rec->spi_ns < sent_ns) return;
+
+    t->tlm_recs++;
+    hist_add(&t->net, rec->rx_ns > sent_ns ? rec->rx_ns - sent_ns : 0);
+    hist_add(&t->queue, rec->start_ns - rec->rx_ns);
+    hist_add(&t->spi, rec->spi_ns - rec->start_ns);
+    hist_add(&t->ret, rx_ns > tlm_tx_ns ? rx_ns - tlm_tx_ns : 0);
+    hist_add(&t->total, rec->spi_ns - sent_ns);
+    if (rec->spi_ns - sent_ns > (uint64_t)deadline_nsec) t->late++;
+}
+
+/**
+ * @brief Receive the telemetry of every target
+ * @note Runs at normal priority, the senders must not wait for it.
+ */
+void *tlm_thread(void *arg){
+    (void)arg;
+    struct pollfd fds[MAX_TARGETS];
+    uint8_t buf[TLM_BUF_SIZE];
+    knode_tlm_rec_t recs[KNODE_TLM_MAX_RECS];
+    struct timespec now = {0};
+    uint64_t tx_ns = {0};
+    ssize_t nread = {0};
+    int timeout_ms = 10;
+    int n = {0};
+
+    for (int i = 0; i < num_targets; i++) {
+        fds[i].fd = targets[i].fd; // poll skips the shared memory targets
+        fds[i].events = POLLIN;
+        if (targets[i].shm.seg != NULL) timeout_ms = 1; // their rings are checked between polls
+    }
+    while (receiving == TRUE) {
+        for (int i = 0; i < num_targets; i++) {
+            if (targets[i].shm.seg == NULL) continue;
+            while ((nread = shm_cmd_recv(&targets[i].shm, buf, sizeof(buf), NULL)) > 0) {
+                clock_gettime(CLOCK_MONOTONIC, &now);
+                n = knode_decode_tlm(buf, nread, &tx_ns, recs);
+                for (int r = 0; r < n; r++) {
+                    add_tlm(&targets[i], &recs[r], tx_ns, timespec_ns(&now));
+                }
+            }
+        }
+        if (poll(fds, num_targets, timeout_ms) <= 0) continue;
+        for (int i = 0; i < num_targets; i++) {
+            if ((fds[i].revents & POLLIN) == 0) continue;
+            while ((nread = recv(fds[i].fd, buf, sizeof(buf), MSG_DONTWAIT)) > 0) {
+                clock_gettime(CLOCK_MONOTONIC, &now);
+                n = knode_decode_tlm(buf, nread, &tx_ns, recs);
+                for (int r = 0; r < n; r++) {
+                    add_tlm(&targets[i], &recs[r], tx_ns, timespec_ns(&now));
+                }
+            }
+        }
+    }
+    return NULL;
+}
+
+/**
+ * @brief Print the per target results, and write them as JSON if requested
+ */
+static void report(void) {
+    FILE *fp = NULL;
+
+    for (int i = 0; i < num_targets; i++) {
+        target_t *t = &targets[i];
+        double secs = (t->last_ns - t->first_ns) / 1e9;
+        printf("%s:%s sent %llu errors %llu rate %.1f Hz misses %llu jitter p50 %.1f p99 %.1f max %.1f usec\n",
+               t->host, t->port, (unsigned long long)t->sent, (unsigned long long)t->errors,
+               secs > 0 ? (t->sent - burst) / secs : 0.0, (unsigned long long)t->misses,
+               hist_percentile(&t->jitter, 50) / 1e3, hist_percentile(&t->jitter, 99) / 1e3,
+               t->jitter.max / 1e3);
+        if (latency == FALSE) continue;
+        printf("  telemetry %llu bad %llu late %llu total p50 %.1f p99 %.1f max %.1f usec"
+               " (net %.1f queue %.1f spi %.1f return %.1f p99)\n",
+               (unsigned long long)t->tlm_recs, (unsigned long long)t->tlm_bad,
+               (unsigned long long)t->late, hist_percentile(&t->total, 50) / 1e3,
+               hist_percentile(&t->total, 99) / 1e3, t->total.max / 1e3,
+               hist_percentile(&t->net, 99) / 1e3, hist_percentile(&t->queue, 99) / 1e3,
+               hist_percentile(&t->spi, 99) / 1e3, hist_percentile(&t->ret, 99) / 1e3);
+    }
+    if (json_file == NULL) return;
+    fp = fopen(json_file, "w");
+    if (fp == NULL) {
+        perror("Failed to open JSON output");
+        return;
+    }
+    fprintf(fp, "{\"tool\": \"rtc_sim\", \"format\": \"%s\", \"period_ns\": %ld, \"burst\": %d, "
+            "\"burst_on\": %d, \"burst_off\": %d, \"threads\": %d, \"targets\": [\n",
+            fmt_names[payload_fmt], period_nsec, burst, burst_on, burst_off, num_threads);
+    for (int i = 0; i < num_targets; i++) {
+        target_t *t = &targets[i];
+        double secs = (t->last_ns - t->first_ns) / 1e9;
+        fprintf(fp, "  {\"target\": \"%s:%s\", \"sent\": %llu, \"errors\": %llu, \"rate_hz\": %.1f, "
+                "\"misses\": %llu,\n   \"jitter_us\": ", t->host, t->port,
+                (unsigned long long)t->sent, (unsigned long long)t->errors,
+                secs > 0 ? (t->sent - burst) / secs : 0.0, (unsigned long long)t->misses);
+        hist_json(fp, &t->jitter, 1e3);
+        fprintf(fp, ",\n   \"interval_us\": ");
+        hist_json(fp, &t->interval, 1e3);
+        if (latency == TRUE) {
+            fprintf(fp, ",\n   \"deadline_us\": %.1f, \"tlm_records\": %llu, \"tlm_bad\": %llu, \"late\": %llu",
+                    deadline_nsec / 1e3, (unsigned long long)t->tlm_recs,
+                    (unsigned long long)t->tlm_bad, (unsigned long long)t->late);
+            fprintf(fp, ",\n   \"total_us\": ");
+            hist_json(fp, &t->total, 1e3);
+            fprintf(fp, ",\n   \"net_us\": ");
+            hist_json(fp, &t->net, 1e3);
+            fprintf(fp, ",\n   \"queue_us\": ");
+            hist_json(fp, &t->queue, 1e3);
+            fprintf(fp, ",\n   \"spi_us\": ");
+            hist_json(fp, &t->spi, 1e3);
+            fprintf(fp, ",\n   \"return_us\": ");
+            hist_json(fp, &t->ret, 1e3);
+        }
+        fprintf(fp, "}%s\n", i + 1 < num_targets ? "," : "");
+    }
+    fprintf(fp, "]}\n");
+    fclose(fp);
+}
+
+static void usage(const char *name) {
+    fprintf(stderr, "Usage: %s [-r rate Hz] [-b burst] [-B on,off periods] [-f legacy|command|seq|delta]\n"
+            "          [-c changed words] [-T threads] [-d seconds] [-o results.json]\n"
+            "          [-L] [-D deadline usec] host:port|shm:segment ...\n", name);
+}
+
+/**
+ * @brief Parse a host:port target
+ */
+static int add_target(const char *spec) {
+    const char *colon = strrchr(spec, ':');
+    target_t *t = &targets[num_targets];
+
+    if (num_targets >= MAX_TARGETS || colon == NULL || colon == spec
+        || (size_t)(colon - spec) >= sizeof(t->host) || strlen(colon + 1) >= sizeof(t->port)) {
+        return -1;
+    }
+    memcpy(t->host, spec, colon - spec);
+    t->host[colon - spec] = '\0';
+    strcpy(t->port, colon + 1);
+    hist_init(&t->jitter);
+    hist_init(&t->interval);
+    hist_init(&t->net);
+    hist_init(&t->queue);
+    hist_init(&t->spi);
+    hist_init(&t->ret);
+    hist_init(&t->total);
+    num_targets++;
+    return 0;
+}
 
 
 /********************** main ******************************/
 
 int main (int argc, char *argv[])
 {
-    char ip_addr[] = "127.0.0.1"; // IP address
-    char port[] = "2345"; // port number
     int res = {0}; // return value
+    int opt = {0}; // for getopt()
+    double rate = {0};
+    struct sender senders[MAX_THREADS];
+    pthread_t tlm_tid;
+
+    // check command line arguments
+    while ((opt = getopt(argc, argv, "hr:b:B:f:c:T:d:o:LD:")) != -1){
+        switch(opt){
+            case 'r':
+                rate = atof(optarg);
+                if (rate <= 0) {
+                    fprintf(stderr, "Invalid rate: %s\n", optarg);
+                    return 1;
+                }
+                period_nsec = (long)(NSEC_PER_SEC / rate);
+                break;
+            case 'b':
+                burst = atoi(optarg);
+                if (burst < 1 || burst > MAX_BURST) {
+                    fprintf(stderr, "Burst must be 1 to %d\n", MAX_BURST);
+                    return 1;
+                }
+                break;
+            case 'B':
+                if (sscanf(optarg, "%d,%d", &burst_on, &burst_off) != 2 || burst_on < 1 || burst_off < 0) {
+                    fprintf(stderr, "Invalid burst pattern: %s\n", optarg);
+                    return 1;
+                }
+                break;
+            case 'f':
+                for (res = 0; res <= FMT_DELTA && strcmp(optarg, fmt_names[res]) != 0; res++);
+                if (res > FMT_DELTA) {
+                    fprintf(stderr, "Unknown payload format: %s\n", optarg);
+                    return 1;
+                }
+                payload_fmt = (payload_fmt_t)res;
+                break;
+            case 'c':
+                num_changed = atoi(optarg);
+                if (num_changed < 0 || num_changed > KNODE_NUM_VALS) {
+                    fprintf(stderr, "Changed words must be 0 to %d\n", KNODE_NUM_VALS);
+                    return 1;
+                }
+                break;
+            case 'T':
+                num_threads = atoi(optarg);
+                if (num_threads < 1 || num_threads > MAX_THREADS) {
+                    fprintf(stderr, "Threads must be 1 to %d\n", MAX_THREADS);
+                    return 1;
+                }
+                break;
+            case 'd':
+                duration_sec = atoi(optarg);
+                break;
+            case 'o':
+                json_file = optarg;
+                break;
+            case 'L':
+                latency = TRUE;
+                break;
+            case 'D':
+                deadline_nsec = atol(optarg) * 1000;
+                if (deadline_nsec <= 0) {
+                    fprintf(stderr, "Invalid deadline: %s\n", optarg);
+                    return 1;
+                }
+                break;
+            case 'h':
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+    for (int i = optind; i < argc; i++) {
+        if (add_target(argv[i]) != 0) {
+            fprintf(stderr, "Invalid target: %s\n", argv[i]);
+            return 1;
+        }
+    }
+    if (num_targets == 0) {
+        add_target("127.0.0.1:2345"); // the original rtc_sim target
+    }
+    if (num_threads > num_targets) num_threads = num_targets;
+    if (latency == TRUE && payload_fmt != FMT_SEQ && payload_fmt != FMT_DELTA) {
+        fprintf(stderr, "Latency collection needs sequenced packets (-f seq or delta)\n");
+        return 1;
+    }
+    if (deadline_nsec == 0) deadline_nsec = period_nsec;
+
+    // Initialize UDP and precompute the payloads
+    for (int i = 0; i < num_targets; i++) {
+        printf("Starting RTC simulation on %s:%s\n", targets[i].host, targets[i].port);
+        if (strcmp(targets[i].host, UDP_SHM_HOST) == 0) {
+            targets[i].fd = -1;
+            if (shm_cmd_open(&targets[i].shm, targets[i].port) != 0) {
+                fprintf(stderr, "Failed to open shared memory %s: %s\n", targets[i].port, strerror(errno));
+                return 1;
+            }
+        } else {
+            targets[i].fd = UDP_init(targets[i].host, targets[i].port);
+        }
+        if (targets[i].fd < 0 && targets[i].shm.seg == NULL){
+            fprintf(stderr, "Failed UDP initialization, exiting...\n");
+            return 1;
+        }
+        if (latency == TRUE) {
+            targets[i].send_ns = calloc(SEND_RING, sizeof(uint64_t));
+        }
+        if (build_payloads(&targets[i]) != 0 || (latency == TRUE && targets[i].send_ns == NULL)) {
+            fprintf(stderr, "Failed to allocate payloads, exiting...\n");
+            return 1;
+        }
+    }
+    printf("UDP client initalized\n");
 
     // Lock the memory
     if (REALTIME==TRUE) {
         res = mlockall(MCL_CURRENT|MCL_FUTURE);
     }
 
-    // check command line arguments
-    // if (argc != 3) {
-    //     fprintf(stderr, "Usage: %s <host> <port> \n", argv[0]);
-    //     return 1;
-    // } else{
-    //     *ip_addr = argv[1]; 
-    //     *port = argv[2];
-    // }
-
-    // Initialize UDP
-    printf("Starting RTC simulation on port %s:%s\n", ip_addr, port);
-    res = UDP_init(ip_addr, port);
-    if (res < 0){
-        fprintf(stderr, "Failed UDP initialization, exiting...\n",res);
-        return 1;
-    } else {
-        printf("UDP client initalized\n");
-    }
-
     // Initialize the pthread attributes
     pthread_attr_t attr;
     int ret = pthread_attr_init(&attr);
@@ -139,18 +618,44 @@ int main (int argc, char *argv[])
         return 1;
     }
 
-    // Finally, create RTC simulation thread
-    pthread_t rtc_thread;
-    if (REALTIME == TRUE){
-        ret = pthread_create(&rtc_thread, &attr, rtc_sim_thread, NULL);
-    } else {
-        ret = pthread_create(&rtc_thread, NULL, rtc_sim_thread, NULL);
+    signal(SIGINT, stop);
+    signal(SIGTERM, stop);
+
+    if (latency == TRUE) {
+        ret = pthread_create(&tlm_tid, NULL, tlm_thread, NULL);
+        if (ret != 0){
+            fprintf(stderr, "Failed to create thread due to error: %d, meaning: %s\n", ret, strerror(ret));
+            return 1;
+        }
     }
-    if (ret != 0){
-        fprintf(stderr, "Failed to create thread due to error: %d, meaning: %s\n", ret, strerror(ret));
-        return 1;
+
+    // Finally, create the RTC simulation threads
+    for (int i = 0; i < num_threads; i++) {
+        senders[i].id = i;
+        if (REALTIME == TRUE){
+            ret = pthread_create(&senders[i].thread, &attr, rtc_sim_thread, &senders[i]);
+        } else {
+            ret = pthread_create(&senders[i].thread, NULL, rtc_sim_thread, &senders[i]);
+        }
+        if (ret != 0){
+            fprintf(stderr, "Failed to create thread due to error: %d, meaning: %s\n", ret, strerror(ret));
+            return 1;
+        }
+    }
+    if (duration_sec > 0) {
+        struct timespec end = {duration_sec, 0};
+        while (running == TRUE && nanosleep(&end, &end) != 0);
+        running = FALSE;
+    }
+    for (int i = 0; i < num_threads; i++) {
+        pthread_join(senders[i].thread, NULL);
     }
-    pthread_join(rtc_thread, NULL);
+    if (latency == TRUE) {
+        struct timespec linger = {0, LINGER_NSEC};
+        nanosleep(&linger, NULL);
+        receiving = FALSE;
+        pthread_join(tlm_tid, NULL);
+    }
+    report();
+    return 0;
 }
-
-    
@@ -0,0 +1,244 @@
+/**
+ * @file rtcpu.c
+ * @brief CPU placement and scheduling of the knodeRT real time threads
+ * @author Aaron Hunter
+ * @date 2025-12-20
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <dirent.h>
+#include <glob.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <sys/syscall.h>
+#include "rtcpu.h"
+
+#define MAX_CPU_NUM 1024 // highest CPU number handled + 1
+#define MAX_NICS    8
+#define LINE_SIZE   1024
+#define SCHED_DEADLINE_POLICY 6     // SCHED_DEADLINE in linux/sched.h
+#define SCHED_FLAG_DL_OVERRUN 0x04  // SIGXCPU on runtime overrun
+
+// struct sched_attr of the sched_setattr system call
+struct dl_attr {
+    uint32_t size;
+    uint32_t sched_policy;
+    uint64_t sched_flags;
+    int32_t sched_nice;
+    uint32_t sched_priority;
+    uint64_t sched_runtime;
+    uint64_t sched_deadline;
+    uint64_t sched_period;
+};
+
+int rtcpu_parse_list(const char *list, int *cpus, int max){
+    const char *p = list;
+    char *end = NULL;
+    long first = {0};
+    long last = {0};
+    int n = {0};
+
+    while (*p != '\0' && *p != '\n') {
+        first = strtol(p, &end, 10);
+        if (end == p || first < 0 || first >= MAX_CPU_NUM) return -1;
+        last = first;
+        p = end;
+        if (*p == '-') {
+            p++;
+            last = strtol(p, &end, 10);
+            if (end == p || last < first || last >= MAX_CPU_NUM) return -1;
+            p = end;
+        }
+        for (long c = first; c <= last; c++) {
+            if (n == max) return -1;
+            cpus[n++] = (int)c;
+        }
+        if (*p == ',') {
+            p++;
+        } else if (*p != '\0' && *p != '\n') {
+            return -1;
+        }
+    }
+    return n;
+}
+
+rtcpu_layout_t rtcpu_parse_layout(const char *name){
+    if (strcmp(name, "spread") == 0) return LAYOUT_SPREAD;
+    if (strcmp(name, "packed") == 0) return LAYOUT_PACKED;
+    return (rtcpu_layout_t)-1;
+}
+
+/**
+ * @brief Read a CPU list from a sysfs or procfs file
+ * @return int number of CPUs, 0 if the file is missing, empty or not a list
+ */
+static int read_list(const char *path, int *cpus, int max){
+    char line[LINE_SIZE] = {0};
+    FILE *fp = fopen(path, "r");
+    int n = {0};
+
+    if (fp == NULL) return 0;
+    if (fgets(line, sizeof(line), fp) != NULL) {
+        n = rtcpu_parse_list(line, cpus, max); // nohz_full reads "(null)" when unset
+    }
+    fclose(fp);
+    return n < 0 ? 0 : n;
+}
+
+int rtcpu_isolated(int *cpus, int max){
+    static const char *files[] = {"/sys/devices/system/cpu/isolated", "/sys/devices/system/cpu/nohz_full"};
+    unsigned char isolated[MAX_CPU_NUM] = {0};
+    int list[RTCPU_MAX_CPUS] = {0};
+    int n = {0};
+
+    for (unsigned f = 0; f < sizeof(files) / sizeof(files[0]); f++) {
+        int k = read_list(files[f], list, RTCPU_MAX_CPUS);
+        for (int i = 0; i < k; i++) isolated[list[i]] = 1;
+    }
+    for (int c = 0; c < MAX_CPU_NUM && n < max; c++) {
+        if (isolated[c]) cpus[n++] = c;
+    }
+    return n;
+}
+
+int rtcpu_slot(const int *cpus, int n, rtcpu_layout_t layout, int slot){
+    if (n <= 0) return -1;
+    if (layout == LAYOUT_PACKED) return cpus[0];
+    return cpus[slot % n];
+}
+
+/**
+ * @brief Check whether a CPU is in the list
+ */
+static int in_list(const int *cpus, int n, int cpu){
+    for (int i = 0; i < n; i++) {
+        if (cpus[i] == cpu) return 1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Physical network interfaces, the ones backed by a device
+ * @return int number of names
+ */
+static int list_nics(char names[][32], int max){
+    DIR *dir = opendir("/sys/class/net");
+    struct dirent *de = NULL;
+    char path[300] = {0};
+    int n = {0};
+
+    if (dir == NULL) return 0;
+    while ((de = readdir(dir)) != NULL && n < max) {
+        if (de->d_name[0] == '.' || strlen(de->d_name) >= sizeof(names[0])) continue;
+        snprintf(path, sizeof(path), "/sys/class/net/%s/device", de->d_name);
+        if (access(path, F_OK) != 0) continue; // lo, bridges, tunnels
+        strcpy(names[n++], de->d_name);
+    }
+    closedir(dir);
+    return n;
+}
+
+/**
+ * @brief Find an interface name as an interrupt action, "eth0" or "eth0-rx-0"
+ */
+static int names_nic(const char *line, const char *nic){
+    size_t len = strlen(nic);
+
+    for (const char *p = strstr(line, nic); p != NULL; p = strstr(p + 1, nic)) {
+        if (p > line && !isspace((unsigned char)p[-1]) && p[-1] != ',') continue;
+        if (isalnum((unsigned char)p[len])) continue;
+        return 1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Check whether a hex CPU mask such as "00000000,0000000c" has a CPU of the list
+ */
+static int mask_hits(const char *mask, const int *cpus, int n){
+    int bit = {0};
+
+    for (int i = (int)strlen(mask) - 1; i >= 0; i--) {
+        int v = {0};
+        if (mask[i] == ',' || isspace((unsigned char)mask[i])) continue;
+        if (!isxdigit((unsigned char)mask[i])) return 0;
+        v = isdigit((unsigned char)mask[i]) ? mask[i] - '0' : tolower((unsigned char)mask[i]) - 'a' + 10;
+        for (int b = 0; b < 4; b++, bit++) {
+            if ((v & (1 << b)) && in_list(cpus, n, bit)) return 1;
+        }
+    }
+    return 0;
+}
+
+int rtcpu_check_nic(const int *cpus, int n){
+    char nics[MAX_NICS][32] = {{0}};
+    char line[LINE_SIZE] = {0};
+    char path[300] = {0};
+    int irq_cpus[RTCPU_MAX_CPUS] = {0};
+    int n_nics = list_nics(nics, MAX_NICS);
+    int overlaps = {0};
+    FILE *fp = NULL;
+    glob_t g = {0};
+
+    if (n <= 0 || n_nics == 0) return 0;
+
+    // interrupts of the interfaces
+    fp = fopen("/proc/interrupts", "r");
+    while (fp != NULL && fgets(line, sizeof(line), fp) != NULL) {
+        char *end = NULL;
+        long irq = strtol(line, &end, 10);
+        int k = {0};
+        if (end == line || *end != ':') continue; // header, NMI, LOC, ...
+        for (int i = 0; i < n_nics; i++) {
+            if (!names_nic(end, nics[i])) continue;
+            snprintf(path, sizeof(path), "/proc/irq/%ld/effective_affinity_list", irq);
+            k = read_list(path, irq_cpus, RTCPU_MAX_CPUS);
+            if (k == 0) {
+                snprintf(path, sizeof(path), "/proc/irq/%ld/smp_affinity_list", irq);
+                k = read_list(path, irq_cpus, RTCPU_MAX_CPUS);
+            }
+            for (int c = 0; c < k; c++) {
+                if (in_list(cpus, n, irq_cpus[c])) {
+                    fprintf(stderr, "warning: %s interrupt %ld can run on RT cpu %d,"
+                            " move it with /proc/irq/%ld/smp_affinity_list\n", nics[i], irq, irq_cpus[c], irq);
+                    overlaps++;
+                    break;
+                }
+            }
+            break;
+        }
+    }
+    if (fp != NULL) fclose(fp);
+
+    // receive packet steering moves the softirq work off the interrupt CPU
+    for (int i = 0; i < n_nics; i++) {
+        snprintf(path, sizeof(path), "/sys/class/net/%s/queues/rx-*/rps_cpus", nics[i]);
+        if (glob(path, 0, NULL, &g) != 0) continue;
+        for (size_t q = 0; q < g.gl_pathc; q++) {
+            fp = fopen(g.gl_pathv[q], "r");
+            if (fp == NULL) continue;
+            if (fgets(line, sizeof(line), fp) != NULL && mask_hits(line, cpus, n)) {
+                fprintf(stderr, "warning: %s steers receive processing onto RT cpus\n", g.gl_pathv[q]);
+                overlaps++;
+            }
+            fclose(fp);
+        }
+        globfree(&g);
+    }
+    return overlaps;
+}
+
+int rtcpu_set_deadline(uint64_t runtime_ns, uint64_t deadline_ns, uint64_t period_ns){
+    struct dl_attr attr = {0};
+
+    attr.size = sizeof(attr);
+    attr.sched_policy = SCHED_DEADLINE_POLICY;
+    attr.sched_flags = SCHED_FLAG_DL_OVERRUN;
+    attr.sched_runtime = runtime_ns;
+    attr.sched_deadline = deadline_ns;
+    attr.sched_period = period_ns;
+    return (int)syscall(SYS_sched_setattr, 0, &attr, 0);
+}
@@ -0,0 +1,83 @@
+#ifndef RTCPU_H
+#define RTCPU_H
+
+/**
+ * @file rtcpu.h
+ * @brief CPU placement and scheduling of the knodeRT real time threads
+ * @author Aaron Hunter
+ * @date 2025-12-20
+ * @details The UDP thread and the SPI threads are placed on an ordered list
+ * of CPUs, by default the cores the kernel keeps free for them (isolcpus=,
+ * nohz_full=). Slot 0 is the UDP thread, slot 1 + i is SPI thread i.
+ * rtcpu_check_nic() warns when the network interrupts or their receive
+ * softirq work (RPS) can land on one of those CPUs. rtcpu_set_deadline()
+ * moves the calling thread to SCHED_DEADLINE, which glibc has no wrapper for.
+ */
+
+#include <stdint.h>
+
+#define RTCPU_MAX_CPUS 64 // longest CPU list
+
+// how the threads are spread over the CPU list
+typedef enum {
+    LAYOUT_SPREAD = 0,  // thread k on cpus[k % n]
+    LAYOUT_PACKED       // every thread on cpus[0]
+} rtcpu_layout_t;
+
+/**
+ * @brief Parse a CPU list such as "2-3,5"
+ * @param list Kernel style list, CPUs are kept in the given order
+ * @param cpus Output CPU numbers
+ * @param max Size of cpus
+ * @return int number of CPUs, -1 if the list is malformed or too long
+ */
+int rtcpu_parse_list(const char *list, int *cpus, int max);
+
+/**
+ * @brief Parse the layout name
+ * @param name "spread" or "packed"
+ * @return rtcpu_layout_t layout, or -1 if unknown
+ */
+rtcpu_layout_t rtcpu_parse_layout(const char *name);
+
+/**
+ * @brief CPUs isolated from the scheduler or the tick
+ * @param cpus Output CPU numbers, ascending, isolcpus= and nohz_full= merged
+ * @param max Size of cpus
+ * @return int number of CPUs, 0 if the kernel isolates none
+ */
+int rtcpu_isolated(int *cpus, int max);
+
+/**
+ * @brief CPU of a thread slot
+ * @param cpus CPU list
+ * @param n Number of CPUs in the list, 0 leaves every thread unpinned
+ * @param layout Placement of the threads on the list
+ * @param slot 0 for the UDP thread, 1 + i for SPI thread i
+ * @return int CPU number, -1 for unpinned
+ */
+int rtcpu_slot(const int *cpus, int n, rtcpu_layout_t layout, int slot);
+
+/**
+ * @brief Warn about network interrupts on the real time CPUs
+ * @param cpus CPU list
+ * @param n Number of CPUs in the list
+ * @return int number of interrupts and receive queues that may run there
+ * @note Interrupts are found in /proc/interrupts by interface name, RPS
+ * masks in /sys/class/net. Warnings go to stderr.
+ */
+int rtcpu_check_nic(const int *cpus, int n);
+
+/**
+ * @brief Run the calling thread under SCHED_DEADLINE
+ * @param runtime_ns CPU time reserved every period
+ * @param deadline_ns Relative deadline, runtime <= deadline <= period
+ * @param period_ns Activation period
+ * @return int 0 on success, -1 with errno set on failure
+ * @note The kernel sends SIGXCPU when the thread overruns its runtime. Admission
+ * fails with EPERM if the thread is pinned to part of the root domain, and
+ * with EBUSY if the reservation does not fit the RT bandwidth limit.
+ */
+int rtcpu_set_deadline(uint64_t runtime_ns, uint64_t deadline_ns, uint64_t period_ns);
+
+#endif // RTCPU_H
@@ -0,0 +1,193 @@
+/**
+ * @file shm_cmd.c
+ * @brief Shared memory command transport between local controllers and knodeRT
+ * @author Aaron Hunter
+ * @date 2025-12-23
+ */
+
+#include <stdio.h>
+#include <limits.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include "shm_cmd.h"
+#include "shm_seg.h"
+
+#define SEG_MODE 0660 // controllers of the node's group may send commands
+#define SEQ_DONE(pos) (2 * (pos) + 2) // slot seq once position pos is complete
+
+/**
+ * @brief Map the open segment file
+ * @return int 0 on success, -1 on failure
+ */
+static int map_seg(shm_cmd_t *s, int fd){
+    s->seg = mmap(NULL, sizeof(shm_cmd_seg_t), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, 0);
+    close(fd);
+    if (s->seg == MAP_FAILED) {
+        s->seg = NULL;
+        return -1;
+    }
+    return 0;
+}
+
+int shm_cmd_create(shm_cmd_t *s, const char *name){
+    int fd = shm_seg_open(name, O_RDWR | O_CREAT, SEG_MODE);
+    shm_cmd_seg_t *seg = NULL;
+
+    memset(s, 0, sizeof(*s));
+    if (fd < 0) return -1;
+    if (ftruncate(fd, sizeof(shm_cmd_seg_t)) != 0) {
+        close(fd);
+        return -1;
+    }
+    if (map_seg(s, fd) != 0) return -1;
+    seg = s->seg;
+    // a segment of an earlier run keeps its positions, its controllers stay attached
+    if (seg->magic != SHM_CMD_MAGIC || seg->version != SHM_CMD_VERSION ||
+        seg->slots != SHM_CMD_SLOTS || seg->slot_size != sizeof(shm_cmd_slot_t)) {
+        memset(seg, 0, sizeof(*seg));
+        seg->version = SHM_CMD_VERSION;
+        seg->slots = SHM_CMD_SLOTS;
+        seg->slot_size = sizeof(shm_cmd_slot_t);
+        __atomic_store_n(&seg->magic, SHM_CMD_MAGIC, __ATOMIC_RELEASE);
+    }
+    seg->node_pid = (uint32_t)getpid();
+    s->tx = &seg->tlm;
+    s->rx = &seg->cmd;
+    s->tail = __atomic_load_n(&s->rx->head, __ATOMIC_ACQUIRE);
+    return 0;
+}
+
+int shm_cmd_open(shm_cmd_t *s, const char *name){
+    int fd = shm_seg_open(name, O_RDWR, SEG_MODE);
+    struct stat st = {0};
+
+    memset(s, 0, sizeof(*s));
+    if (fd < 0) return -1;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(shm_cmd_seg_t)) {
+        close(fd);
+        errno = EPROTO;
+        return -1;
+    }
+    if (map_seg(s, fd) != 0) return -1;
+    if (__atomic_load_n(&s->seg->magic, __ATOMIC_ACQUIRE) != SHM_CMD_MAGIC ||
+        s->seg->version != SHM_CMD_VERSION || s->seg->slots != SHM_CMD_SLOTS ||
+        s->seg->slot_size != sizeof(shm_cmd_slot_t)) {
+        shm_cmd_close(s);
+        errno = EPROTO;
+        return -1;
+    }
+    s->tx = &s->seg->cmd;
+    s->rx = &s->seg->tlm;
+    s->tail = __atomic_load_n(&s->rx->head, __ATOMIC_ACQUIRE);
+    return 0;
+}
+
+void shm_cmd_close(shm_cmd_t *s){
+    if (s->seg != NULL) munmap(s->seg, sizeof(shm_cmd_seg_t));
+    s->seg = NULL;
+    s->tx = s->rx = NULL;
+}
+
+ssize_t shm_cmd_send(shm_cmd_t *s, const uint8_t *msg, size_t len){
+    shm_cmd_ring_t *r = s->tx;
+    struct timespec now = {0};
+    uint64_t pos = {0};
+    shm_cmd_slot_t *slot = NULL;
+
+    if (len > SHM_CMD_MSG_MAX) {
+        errno = EMSGSIZE;
+        return -1;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    pos = __atomic_fetch_add(&r->head, 1, __ATOMIC_RELAXED);
+    slot = &r->slot[pos & (SHM_CMD_SLOTS - 1)];
+    __atomic_store_n(&slot->seq, SEQ_DONE(pos) - 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE); // readers see the odd seq before the new data
+    slot->send_ns = (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec;
+    slot->len = (uint32_t)len;
+    memcpy(slot->data, msg, len);
+    __atomic_store_n(&slot->seq, SEQ_DONE(pos), __ATOMIC_RELEASE);
+
+    __atomic_fetch_add(&r->wake, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&r->waiters, __ATOMIC_SEQ_CST) != 0) {
+        syscall(SYS_futex, &r->wake, FUTEX_WAKE, INT_MAX, NULL, NULL, 0); // every controller reads telemetry
+    }
+    return (ssize_t)len;
+}
+
+/**
+ * @brief Move the read position to the oldest message still in the ring
+ */
+static void skip_lapped(shm_cmd_t *s){
+    uint64_t head = __atomic_load_n(&s->rx->head, __ATOMIC_ACQUIRE);
+
+    if (head - s->tail > SHM_CMD_SLOTS) {
+        s->overruns += head - SHM_CMD_SLOTS - s->tail;
+        s->tail = head - SHM_CMD_SLOTS;
+    } else {
+        s->overruns++; // overwritten while it was copied
+        s->tail++;
+    }
+}
+
+ssize_t shm_cmd_recv(shm_cmd_t *s, uint8_t *buf, size_t size, uint64_t *send_ns){
+    for (;;) {
+        const shm_cmd_slot_t *slot = &s->rx->slot[s->tail & (SHM_CMD_SLOTS - 1)];
+        uint64_t seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+        uint64_t ns = {0};
+        uint32_t len = {0};
+
+        if (seq < SEQ_DONE(s->tail)) {
+            errno = EAGAIN; // not written yet, or still being written
+            return -1;
+        }
+        if (seq == SEQ_DONE(s->tail)) {
+            len = slot->len;
+            ns = slot->send_ns;
+            if (len > SHM_CMD_MSG_MAX) len = SHM_CMD_MSG_MAX; // torn, caught below
+            if (len > size) len = (uint32_t)size;
+            memcpy(buf, slot->data, len);
+            __atomic_thread_fence(__ATOMIC_ACQUIRE); // copy before the second seq read
+            if (__atomic_load_n(&slot->seq, __ATOMIC_RELAXED) == seq) {
+                s->tail++;
+                if (send_ns != NULL) *send_ns = ns;
+                return (ssize_t)len;
+            }
+        }
+        skip_lapped(s);
+    }
+}
+
+/**
+ * @brief Check whether the next message is written, or lapped
+ */
+static int rx_ready(const shm_cmd_t *s){
+    const shm_cmd_slot_t *slot = &s->rx->slot[s->tail & (SHM_CMD_SLOTS - 1)];
+
+    return __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) >= SEQ_DONE(s->tail);
+}
+
+int shm_cmd_wait(shm_cmd_t *s, int timeout_ms){
+    shm_cmd_ring_t *r = s->rx;
+    struct timespec ts = {timeout_ms / 1000, (timeout_ms % 1000) * 1000000L};
+    uint32_t wake = __atomic_load_n(&r->wake, __ATOMIC_SEQ_CST);
+    long ret = {0};
+
+    if (rx_ready(s)) return 1;
+    __atomic_fetch_add(&r->waiters, 1, __ATOMIC_SEQ_CST);
+    // a message written since wake was read changes it, and the futex returns at once
+    if (!rx_ready(s)) {
+        ret = syscall(SYS_futex, &r->wake, FUTEX_WAIT, wake, &ts, NULL, 0);
+    }
+    __atomic_fetch_sub(&r->waiters, 1, __ATOMIC_SEQ_CST);
+    if (rx_ready(s)) return 1;
+    if (ret != 0 && errno == EINTR) return -1;
+    return 0;
+}
@@ -0,0 +1,132 @@
+#ifndef SHM_CMD_H
+#define SHM_CMD_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/types.h>
+#include "protocol.h"
+
+/**
+ * @file shm_cmd.h
+ * @brief Shared memory command transport between local controllers and knodeRT
+ * @author Aaron Hunter
+ * @date 2025-12-23
+ * @details A controller on the same host as knodeRT can write its command
+ * packets into a POSIX shared memory segment instead of sending them over
+ * loopback UDP. The segment holds two rings of shm_cmd_slot_t: commands
+ * from the controllers to the node, and telemetry datagrams from the node
+ * back to the controllers. The messages are the same knode packets as on
+ * the UDP path (protocol.h), so sequencing, deltas and telemetry work
+ * unchanged.
+ *
+ * Any number of writers claim ring positions with an atomic increment of
+ * head. Each slot is a seqlock: its seq is 2 * pos + 1 while position pos
+ * is written and 2 * pos + 2 once it is complete. A reader keeps its own
+ * position, so readers never write to the segment. A reader that falls a
+ * whole ring behind skips to the oldest message still there and counts
+ * the rest as overruns. Writers bump the ring's wake word and wake the
+ * sleeping readers with a futex, and only make that system call when a
+ * reader is waiting.
+ *
+ * knodeRT creates the segment and never removes it, so controllers keep
+ * working across node restarts. Remove it with rm /dev/shm/<name>.
+ */
+
+/************** defines *****************************/
+#define SHM_CMD_MAGIC       0x4d48534b  // "KSHM" little endian
+#define SHM_CMD_VERSION     1
+#define SHM_CMD_SLOTS       64          // messages per ring, power of two
+#define SHM_CMD_MSG_MAX     knode_tlm_size(KNODE_TLM_MAX_RECS) // largest message, a full telemetry datagram
+
+/************** types *****************************/
+struct shm_cmd_slot {
+    uint64_t seq;               // seqlock, 2 * pos + 2 when position pos is complete
+    uint64_t send_ns;           // writer CLOCK_MONOTONIC time
+    uint32_t len;               // message length
+    uint8_t data[SHM_CMD_MSG_MAX];
+} __attribute__((aligned(64)));
+typedef struct shm_cmd_slot shm_cmd_slot_t;
+
+struct shm_cmd_ring {
+    uint64_t head __attribute__((aligned(64))); // next position to write
+    uint32_t wake;              // futex word, bumped on every message
+    uint32_t waiters;           // readers asleep on wake
+    shm_cmd_slot_t slot[SHM_CMD_SLOTS];
+};
+typedef struct shm_cmd_ring shm_cmd_ring_t;
+
+struct shm_cmd_seg {
+    uint32_t magic;             // SHM_CMD_MAGIC, written last
+    uint16_t version;           // SHM_CMD_VERSION
+    uint16_t slots;             // SHM_CMD_SLOTS
+    uint32_t slot_size;         // sizeof(shm_cmd_slot_t)
+    uint32_t node_pid;          // knodeRT process that created or last reused the segment
+    shm_cmd_ring_t cmd;         // controllers to node
+    shm_cmd_ring_t tlm;         // node to controllers
+};
+typedef struct shm_cmd_seg shm_cmd_seg_t;
+
+struct shm_cmd {
+    shm_cmd_seg_t *seg;         // mapped segment
+    shm_cmd_ring_t *tx;         // ring this side writes
+    shm_cmd_ring_t *rx;         // ring this side reads
+    uint64_t tail;              // next position to read from rx
+    uint64_t overruns;          // messages overwritten before they were read
+};
+typedef struct shm_cmd shm_cmd_t;
+
+/**
+ * @brief Create or reuse the segment as the node
+ * @param s Transport to fill in
+ * @param name Segment name, a leading '/' is added if missing
+ * @return int 0 on success, -1 on failure with errno set
+ * @note Commands written before the call are skipped.
+ */
+int shm_cmd_create(shm_cmd_t *s, const char *name);
+
+/**
+ * @brief Open the segment of a running or previously run node as a controller
+ * @param s Transport to fill in
+ * @param name Segment name, a leading '/' is added if missing
+ * @return int 0 on success, -1 on failure with errno set, EPROTO if the
+ * segment is not a knodeRT segment of this version
+ */
+int shm_cmd_open(shm_cmd_t *s, const char *name);
+
+/**
+ * @brief Unmap the segment, it stays in /dev/shm
+ * @param s Open transport
+ */
+void shm_cmd_close(shm_cmd_t *s);
+
+/**
+ * @brief Write a message for the other side, commands from a controller,
+ * telemetry from the node
+ * @param s Open transport
+ * @param msg Message
+ * @param len Message length, at most SHM_CMD_MSG_MAX
+ * @return ssize_t len, -1 with errno EMSGSIZE if the message is too long
+ * @note Never blocks. Wakes the reader only if it is asleep.
+ */
+ssize_t shm_cmd_send(shm_cmd_t *s, const uint8_t *msg, size_t len);
+
+/**
+ * @brief Take the next message from the other side without blocking
+ * @param s Open transport
+ * @param buf Output message
+ * @param size Size of buf, a longer message is truncated like a datagram
+ * @param send_ns Set to the writer's send time, may be NULL
+ * @return ssize_t bytes stored in buf, -1 with errno EAGAIN if there is none
+ */
+ssize_t shm_cmd_recv(shm_cmd_t *s, uint8_t *buf, size_t size, uint64_t *send_ns);
+
+/**
+ * @brief Sleep until a message from the other side is ready
+ * @param s Open transport
+ * @param timeout_ms Longest wait
+ * @return int 1 if a message is ready, 0 on timeout, -1 with errno EINTR
+ * if a signal interrupted the wait
+ */
+int shm_cmd_wait(shm_cmd_t *s, int timeout_ms);
+
+#endif // SHM_CMD_H
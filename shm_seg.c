@@ -0,0 +1,23 @@
+/**
+ * @file shm_seg.c
+ * @brief Opening the POSIX shared memory segments of knodeRT by name
+ * @author Aaron Hunter
+ * @date 2025-12-31
+ */
+
+#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "shm_seg.h"
+
+int shm_seg_open(const char *name, int flags, mode_t mode){
+    char path[SHM_SEG_NAME_SIZE] = {0};
+
+    if (snprintf(path, sizeof(path), "%s%s", name[0] == '/' ? "" : "/", name) >= (int)sizeof(path)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    return shm_open(path, flags, mode);
+}
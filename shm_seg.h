@@ -0,0 +1,28 @@
+#ifndef SHM_SEG_H
+#define SHM_SEG_H
+
+#include <sys/types.h>
+
+/**
+ * @file shm_seg.h
+ * @brief Opening the POSIX shared memory segments of knodeRT by name
+ * @author Aaron Hunter
+ * @date 2025-12-31
+ * @details The command segment (shm_cmd.h) and the statistics segment
+ * (stats.h) are both named on the command line, with or without the
+ * leading '/' that shm_open() wants, and live in /dev/shm.
+ */
+
+/************** defines *****************************/
+#define SHM_SEG_NAME_SIZE 256   // longest segment name, '/' included
+
+/**
+ * @brief Open a segment file, with a leading '/' on the name
+ * @param name Segment name, e.g. "kasm" or "/kasm"
+ * @param flags shm_open() flags
+ * @param mode Permissions of a segment created with O_CREAT
+ * @return int file descriptor, -1 on failure
+ */
+int shm_seg_open(const char *name, int flags, mode_t mode);
+
+#endif // SHM_SEG_H
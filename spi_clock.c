@@ -0,0 +1,71 @@
+/**
+ * @file spi_clock.c
+ * @brief Per bus SPI clock table found by the knodeRT clock calibration
+ * @author Aaron Hunter
+ * @date 2025-12-28
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include "spi_clock.h"
+
+int spi_clock_load(const char *path, spi_clock_t *clk, int max){
+    FILE *f = fopen(path, "r");
+    char line[128];
+    int n = {0};
+
+    if (f == NULL) return -1;
+    while (fgets(line, sizeof(line), f) != NULL) {
+        spi_clock_t c = {0};
+        char *p = line + strspn(line, " \t");
+
+        if (*p == '#' || *p == '\n' || *p == '\0') continue;
+        if (sscanf(p, "dev %d chan %d hz %u pass_hz %u", &c.dev, &c.chan, &c.hz, &c.pass_hz) != 4
+            || c.hz == 0) {
+            fclose(f);
+            errno = EINVAL;
+            return -1;
+        }
+        if (n < max) clk[n++] = c;
+    }
+    fclose(f);
+    return n;
+}
+
+int spi_clock_save(const char *path, const spi_clock_t *clk, int n){
+    spi_clock_t old[SPI_CLOCK_MAX_BUSES];
+    char tmp[256];
+    int nold = spi_clock_load(path, old, SPI_CLOCK_MAX_BUSES);
+    FILE *f = NULL;
+
+    if (snprintf(tmp, sizeof(tmp), "%s.tmp", path) >= (int)sizeof(tmp)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    f = fopen(tmp, "w");
+    if (f == NULL) return -1;
+    fprintf(f, "# SPI clocks from knodeRT -k, loaded with -K\n");
+    // buses calibrated before and not this time keep their line
+    for (int i = 0; i < nold; i++) {
+        if (spi_clock_find(clk, n, old[i].dev, old[i].chan) != 0) continue;
+        fprintf(f, "dev %d chan %d hz %u pass_hz %u\n", old[i].dev, old[i].chan, old[i].hz,
+                old[i].pass_hz);
+    }
+    for (int i = 0; i < n; i++) {
+        fprintf(f, "dev %d chan %d hz %u pass_hz %u\n", clk[i].dev, clk[i].chan, clk[i].hz,
+                clk[i].pass_hz);
+    }
+    if (fclose(f) != 0 || rename(tmp, path) != 0) {
+        remove(tmp);
+        return -1;
+    }
+    return 0;
+}
+
+uint32_t spi_clock_find(const spi_clock_t *clk, int n, int dev, int chan){
+    for (int i = 0; i < n; i++) {
+        if (clk[i].dev == dev && clk[i].chan == chan) return clk[i].hz;
+    }
+    return 0;
+}
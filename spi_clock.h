@@ -0,0 +1,63 @@
+#ifndef SPI_CLOCK_H
+#define SPI_CLOCK_H
+
+#include <stdint.h>
+
+/**
+ * @file spi_clock.h
+ * @brief Per bus SPI clock table found by the knodeRT clock calibration
+ * @author Aaron Hunter
+ * @date 2025-12-28
+ * @details knodeRT -k steps each bus up a ladder of clocks and keeps the
+ * fastest one whose readback passes the crc check, less a margin. The
+ * results are kept in a text file, one bus per line:
+ *
+ *     dev 1 chan 0 hz 16000000 pass_hz 20000000
+ *
+ * where hz is the clock to run at and pass_hz the fastest clock that passed.
+ * Lines starting with # are comments. knodeRT -K loads the file at startup,
+ * buses without a line run at the default clock.
+ */
+
+/************** defines *****************************/
+#define SPI_CLOCK_MAX_BUSES 16  // lines kept from a clock file
+
+/************** types *****************************/
+struct spi_clock {
+    int dev;                    // SPI device number
+    int chan;                   // chip select
+    uint32_t hz;                // clock to run the bus at
+    uint32_t pass_hz;           // fastest clock that passed the calibration
+};
+typedef struct spi_clock spi_clock_t;
+
+/**
+ * @brief Read a clock file
+ * @param path File written by spi_clock_save()
+ * @param clk Output table
+ * @param max Entries in clk
+ * @return int entries read, -1 if the file cannot be read or a line is malformed
+ */
+int spi_clock_load(const char *path, spi_clock_t *clk, int max);
+
+/**
+ * @brief Write the clocks of the calibrated buses to a clock file
+ * @param path File to write, entries for other buses already in it are kept
+ * @param clk Calibrated buses
+ * @param n Entries in clk
+ * @return int 0 on success, -1 on failure
+ * @note The file is replaced with rename(), a reader never sees half of it.
+ */
+int spi_clock_save(const char *path, const spi_clock_t *clk, int n);
+
+/**
+ * @brief Find the clock of a bus
+ * @param clk Table from spi_clock_load()
+ * @param n Entries in clk
+ * @param dev SPI device number
+ * @param chan Chip select
+ * @return uint32_t clock in Hz, 0 if the bus is not in the table
+ */
+uint32_t spi_clock_find(const spi_clock_t *clk, int n, int dev, int chan);
+
+#endif // SPI_CLOCK_H
@@ -0,0 +1,108 @@
+/**
+ * @file spi_sim.c
+ * @brief Simulated KASM board behind the wiringPi SPI calls
+ * @author Aaron Hunter
+ * @date 2025-12-15
+ * @details The transfer time is spun rather than slept, as the spidev
+ * driver polls for frames this short, so the SPI threads load the CPU the
+ * same way they do on the Pi. In virtual time (vclock.h) transfers are
+ * instant, so a run is limited by the CPU only. Maintenance frames
+ * (maint.h) are answered from a fixed set of register values.
+ */
+
+#include <errno.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include "vclock.h"
+#include "knode_thr.h"
+#include "maint.h"
+#include "spi_sim.h"
+
+#define NSEC_PER_SEC (1000*1000*1000)
+
+static int spi_speed[SPI_SIM_MAX_DEV][SPI_SIM_MAX_CHAN]; // Hz, 0 if not opened
+static uint32_t spi_count[SPI_SIM_MAX_DEV][SPI_SIM_MAX_CHAN]; // transfers, for the marginal errors
+static maint_frame_t spi_req[SPI_SIM_MAX_DEV][SPI_SIM_MAX_CHAN]; // latched register read request
+static uint8_t spi_req_valid[SPI_SIM_MAX_DEV][SPI_SIM_MAX_CHAN];
+
+static uint64_t now_ns(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+/**
+ * @brief Answer a maintenance frame like the board firmware
+ * @note A read request is latched and echoed, the poll after it clocks out
+ * the response. Control frames and no-ops are left to the echo.
+ */
+static void board_maint(int number, int channel, unsigned char *data){
+    union CMD_DATA f;
+    maint_frame_t m;
+
+    memcpy(f.bytes, data, SPI_BUF_SIZE);
+    if (maint_decode(&f, &m) != 0) return;
+    if (m.op == MAINT_OP_READ) {
+        spi_req[number][channel] = m;
+        spi_req_valid[number][channel] = 1;
+        return;
+    }
+    if (m.op != MAINT_OP_POLL || spi_req_valid[number][channel] == 0) return;
+    spi_req_valid[number][channel] = 0;
+    m = spi_req[number][channel];
+    m.op = MAINT_OP_RESP | MAINT_OP_READ;
+    m.value = 0;
+    m.status = (m.dac >= SPI_SIM_DACS); // no such DAC
+    if (m.reg == DAC80508_REG_DEVICE_ID) m.value = SPI_SIM_DEVICE_ID;
+    maint_encode(&f, &m);
+    memcpy(data, f.bytes, SPI_BUF_SIZE);
+}
+
+int wiringPiSetup(void){
+    return 0;
+}
+
+int wiringPiSPIxSetupMode(int number, int channel, int speed, int mode){
+    (void)mode;
+    if (number < 0 || number >= SPI_SIM_MAX_DEV || channel < 0 || channel >= SPI_SIM_MAX_CHAN
+        || speed <= 0) {
+        errno = ENODEV;
+        return -1;
+    }
+    spi_speed[number][channel] = speed;
+    return number * SPI_SIM_MAX_CHAN + channel + 3; // past stdin/out/err, like a real fd
+}
+
+int wiringPiSPIxDataRW(int number, int channel, unsigned char *data, int len){
+    uint64_t end = {0};
+    int64_t limit = SPI_SIM_LIMIT_HZ - (int64_t)number * SPI_SIM_LIMIT_STEP_HZ;
+
+    if (number < 0 || number >= SPI_SIM_MAX_DEV || channel < 0 || channel >= SPI_SIM_MAX_CHAN
+        || spi_speed[number][channel] == 0) {
+        errno = EBADF;
+        return -1;
+    }
+    // the board echoes the frame, with a bit error when the wiring cannot keep up
+    if (len == SPI_BUF_SIZE) board_maint(number, channel, data);
+    spi_count[number][channel]++;
+    if (len > 0 && (spi_speed[number][channel] > limit ||
+        ((int64_t)spi_speed[number][channel] * 100 > limit * SPI_SIM_MARGINAL_PCT &&
+         spi_count[number][channel] % SPI_SIM_MARGINAL_RATE == 0))) {
+        data[len / 2] ^= 0x10;
+    }
+    if (vclock_is_virtual()) return len;
+    end = now_ns() + SPI_SIM_OVERHEAD_NSEC
+          + (uint64_t)len * 8 * NSEC_PER_SEC / spi_speed[number][channel];
+    while (now_ns() < end);
+    return len;
+}
+
+int wiringPiSPIxClose(int number, int channel){
+    if (number < 0 || number >= SPI_SIM_MAX_DEV || channel < 0 || channel >= SPI_SIM_MAX_CHAN) {
+        errno = ENODEV;
+        return -1;
+    }
+    spi_speed[number][channel] = 0;
+    return 0;
+}
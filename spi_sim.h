@@ -0,0 +1,65 @@
+#ifndef SPI_SIM_H
+#define SPI_SIM_H
+
+/**
+ * @file spi_sim.h
+ * @brief Simulated KASM board behind the wiringPi SPI calls
+ * @author Aaron Hunter
+ * @date 2025-12-15
+ * @details knodeRT built with -DSPI_SIM includes this header instead of
+ * wiringPi.h and wiringPiSPI.h, so it runs on any Linux host. A transfer
+ * takes as long as clocking the bytes out at the configured speed plus a
+ * fixed driver overhead, and the board echoes the frame on MISO like the
+ * KASM PCB does. Each bus has a wiring limit, SPI_SIM_LIMIT_HZ less
+ * SPI_SIM_LIMIT_STEP_HZ per device number: close to it the echo takes an
+ * occasional bit error, above it every transfer does, so the clock
+ * calibration (knodeRT -k) has something to find.
+ */
+
+/************** defines *****************************/
+#define SPI_SIM_MAX_DEV         8           // SPI devices
+#define SPI_SIM_MAX_CHAN        2           // chip selects per device
+#define SPI_SIM_OVERHEAD_NSEC   (15*1000)   // ioctl and driver time per transfer
+#define SPI_SIM_LIMIT_HZ        20000000    // clock limit of device 0
+#define SPI_SIM_LIMIT_STEP_HZ   2000000     // lower limit per device number
+#define SPI_SIM_MARGINAL_PCT    90          // above this share of the limit some echoes are corrupt
+#define SPI_SIM_MARGINAL_RATE   64          // one transfer in this many in the marginal range
+#define SPI_SIM_DACS            3           // DACs answering maintenance reads per board
+#define SPI_SIM_DEVICE_ID       0x2A15      // DEVICE_ID the simulated DACs report
+
+/**
+ * @brief Initialize the simulated board
+ * @return int 0 on success
+ */
+int wiringPiSetup(void);
+
+/**
+ * @brief Open a simulated SPI bus
+ * @param number SPI device number
+ * @param channel Chip select
+ * @param speed Clock in Hz
+ * @param mode SPI mode, ignored
+ * @return int pseudo file descriptor, -1 if the bus does not exist
+ */
+int wiringPiSPIxSetupMode(int number, int channel, int speed, int mode);
+
+/**
+ * @brief Simulated full duplex transfer
+ * @param number SPI device number
+ * @param channel Chip select
+ * @param data Frame to send, left unchanged as the echoed MISO data unless
+ * the clock is beyond the bus limit
+ * @param len Frame length in bytes
+ * @return int len on success, -1 if the bus was not opened
+ */
+int wiringPiSPIxDataRW(int number, int channel, unsigned char *data, int len);
+
+/**
+ * @brief Close a simulated SPI bus
+ * @param number SPI device number
+ * @param channel Chip select
+ * @return int 0 on success, -1 if the bus does not exist
+ */
+int wiringPiSPIxClose(int number, int channel);
+
+#endif // SPI_SIM_H
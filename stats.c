@@ -0,0 +1,175 @@
+/**
+ * @file stats.c
+ * @brief Runtime statistics for knodeRT
+ * @author Aaron Hunter
+ * @date 2025-12-04
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <syslog.h>
+#include <inttypes.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "stats.h"
+#include "shm_seg.h"
+
+#define SEG_MODE 0664 // anyone may watch the statistics
+#define READ_RETRIES 1000 // seqlock retries before a reader gives up
+
+knode_stats_t knode_stats = {0};
+static stats_shm_t *stats_shm = NULL; // segment published into, NULL when disabled
+
+void stats_log(const knode_stats_t *s){
+    syslog(LOG_NOTICE, "stats: rx %" PRIu64 " bad %" PRIu64 " spin %" PRIu64 " xdp %" PRIu64 " shm %" PRIu64 " overruns %" PRIu64 " delta %" PRIu64
+           " delta dropped %" PRIu64 " gaps %" PRIu64
+           " reordered %" PRIu64 " dup %" PRIu64 " resync %" PRIu64
+           " conceal %" PRIu64 " expired %" PRIu64 " missed %" PRIu64
+           " spi err %" PRIu64 " crc err %" PRIu64 " coalesced %" PRIu64
+           " tlm %" PRIu64 " tlm dropped %" PRIu64 " dl overruns %" PRIu64
+           " maint %" PRIu64 " deferred %" PRIu64 " errors %" PRIu64 " alarms %" PRIu64
+           " path wins %" PRIu64 "/%" PRIu64 " only %" PRIu64 "/%" PRIu64 " lead p99 %" PRIu64
+           " loop p99 %" PRIu64 " max %" PRIu64 " wake late p99 %" PRIu64 " max %" PRIu64
+           " bus skew p99 %" PRIu64 " max %" PRIu64 " ns",
+           s->rx_packets, s->rx_bad_size, s->rx_spin, s->rx_xdp, s->rx_shm, s->shm_overruns, s->rx_delta, s->delta_dropped, s->seq_gaps, s->seq_reordered,
+           s->seq_duplicates, s->seq_resyncs, s->conceal_frames,
+           s->conceal_expired, s->deadline_misses, s->spi_errors, s->crc_errors, s->spi_coalesced,
+           s->tlm_sent, s->tlm_dropped, s->dl_overruns,
+           s->maint_done, s->maint_deferred, s->maint_errors, s->maint_alarms,
+           s->path_wins[0], s->path_wins[1], s->path_only[0], s->path_only[1],
+           hist_percentile(&s->path_lead_ns, 99),
+           hist_percentile(&s->loop_ns, 99), s->loop_ns.max,
+           hist_percentile(&s->wake_late_ns, 99), s->wake_late_ns.max,
+           hist_percentile(&s->bus_skew_ns, 99), s->bus_skew_ns.max);
+}
+
+int stats_write_json(const char *path, const knode_stats_t *s){
+    FILE *fp = fopen(path, "w");
+
+    if (fp == NULL) return -1;
+    fprintf(fp, "{\"rx_packets\": %" PRIu64 ", \"rx_bad_size\": %" PRIu64 ", \"rx_spin\": %" PRIu64 ", \"rx_xdp\": %" PRIu64 ", \"rx_shm\": %" PRIu64 ", \"shm_overruns\": %" PRIu64 ", \"rx_delta\": %" PRIu64
+            ", \"delta_dropped\": %" PRIu64 ", \"seq_gaps\": %" PRIu64 ", \"seq_reordered\": %" PRIu64
+            ", \"seq_duplicates\": %" PRIu64 ", \"seq_resyncs\": %" PRIu64 ", \"conceal_frames\": %" PRIu64
+            ", \"conceal_expired\": %" PRIu64 ", \"deadline_misses\": %" PRIu64
+            ", \"spi_errors\": %" PRIu64 ", \"crc_errors\": %" PRIu64 ", \"spi_coalesced\": %" PRIu64 ", \"tlm_sent\": %" PRIu64
+            ", \"tlm_dropped\": %" PRIu64 ", \"dl_runtime_ns\": %" PRIu64 ", \"dl_overruns\": %" PRIu64
+            ", \"fr_snapshots\": %" PRIu64 ", \"fr_suppressed\": %" PRIu64
+            ", \"maint_done\": %" PRIu64 ", \"maint_deferred\": %" PRIu64 ", \"maint_errors\": %" PRIu64
+            ", \"maint_alarms\": %" PRIu64 ", \"path_wins\": [%" PRIu64 ", %" PRIu64 "]"
+            ", \"path_only\": [%" PRIu64 ", %" PRIu64 "],\n \"cpu_ns\": %" PRIu64 ", \"udp_cpu_ns\": %" PRIu64 ", \"wall_ns\": %" PRIu64 ", \"ready_ns\": %" PRIu64
+            ", \"first_cmd_ns\": %" PRIu64,
+            s->rx_packets, s->rx_bad_size, s->rx_spin, s->rx_xdp, s->rx_shm, s->shm_overruns, s->rx_delta, s->delta_dropped, s->seq_gaps, s->seq_reordered,
+            s->seq_duplicates, s->seq_resyncs, s->conceal_frames,
+            s->conceal_expired, s->deadline_misses, s->spi_errors, s->crc_errors, s->spi_coalesced,
+            s->tlm_sent, s->tlm_dropped, s->dl_runtime_ns, s->dl_overruns, s->fr_snapshots, s->fr_suppressed,
+            s->maint_done, s->maint_deferred, s->maint_errors, s->maint_alarms,
+            s->path_wins[0], s->path_wins[1], s->path_only[0], s->path_only[1], s->cpu_ns, s->udp_cpu_ns, s->wall_ns,
+            s->ready_ns, s->first_cmd_ns);
+    fprintf(fp, ",\n \"loop_us\": ");
+    hist_json(fp, &s->loop_ns, 1e3);
+    fprintf(fp, ",\n \"wake_late_us\": ");
+    hist_json(fp, &s->wake_late_ns, 1e3);
+    fprintf(fp, ",\n \"bus_skew_us\": ");
+    hist_json(fp, &s->bus_skew_ns, 1e3);
+    fprintf(fp, ",\n \"queue_us\": ");
+    hist_json(fp, &s->queue_ns, 1e3);
+    fprintf(fp, ",\n \"spi_us\": ");
+    hist_json(fp, &s->spi_ns, 1e3);
+    fprintf(fp, ",\n \"path_lead_us\": ");
+    hist_json(fp, &s->path_lead_ns, 1e3);
+    fprintf(fp, ",\n \"thread_cpu_ns\": [");
+    for (uint32_t i = 0; i < s->threads && i < STATS_MAX_THREADS; i++) {
+        fprintf(fp, "%s%" PRIu64, i == 0 ? "" : ", ", s->thread_cpu_ns[i]);
+    }
+    fprintf(fp, "],\n \"perf_mask\": %" PRIu32 ", \"perf\": {", s->perf_mask);
+    for (int i = 0; i < PERFCTR_COUNT; i++) {
+        fprintf(fp, "%s\n  \"%s\": {\"udp\": %" PRIu64 ", \"udp_max\": %" PRIu64 ", \"udp_miss\": %" PRIu64
+                ", \"spi\": %" PRIu64 ", \"spi_max\": %" PRIu64 "}", i == 0 ? "" : ",", perfctr_names[i],
+                s->perf_udp[i], s->perf_udp_max[i], s->perf_udp_miss[i], s->perf_spi[i], s->perf_spi_max[i]);
+    }
+    fprintf(fp, "}}\n");
+    return fclose(fp) == 0 ? 0 : -1;
+}
+
+int stats_shm_create(const char *name){
+    int fd = shm_seg_open(name, O_RDWR | O_CREAT, SEG_MODE);
+    stats_shm_t *seg = NULL;
+
+    if (fd < 0) return -1;
+    if (ftruncate(fd, sizeof(stats_shm_t)) != 0) {
+        close(fd);
+        return -1;
+    }
+    seg = mmap(NULL, sizeof(stats_shm_t), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, 0);
+    close(fd);
+    if (seg == MAP_FAILED) return -1;
+    // readers of an earlier run stay attached, the seqlock carries on from where it was
+    if (seg->magic != STATS_SHM_MAGIC || seg->version != STATS_SHM_VERSION ||
+        seg->stats_size != sizeof(knode_stats_t)) {
+        memset(seg, 0, sizeof(*seg));
+        seg->version = STATS_SHM_VERSION;
+        seg->stats_size = sizeof(knode_stats_t);
+        __atomic_store_n(&seg->magic, STATS_SHM_MAGIC, __ATOMIC_RELEASE);
+    }
+    seg->node_pid = (uint32_t)getpid();
+    stats_shm = seg;
+    return 0;
+}
+
+void stats_publish(const knode_stats_t *s, uint64_t now_ns){
+    uint64_t seq = {0};
+
+    if (stats_shm == NULL) return;
+    seq = stats_shm->seq;
+    __atomic_store_n(&stats_shm->seq, seq | 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE); // readers see the odd seq before the new data
+    memcpy(&stats_shm->stats, s, sizeof(*s));
+    stats_shm->publish_ns = now_ns;
+    __atomic_store_n(&stats_shm->seq, (seq | 1) + 1, __ATOMIC_RELEASE);
+}
+
+const stats_shm_t *stats_shm_attach(const char *name){
+    int fd = shm_seg_open(name, O_RDONLY, SEG_MODE);
+    struct stat st = {0};
+    const stats_shm_t *seg = NULL;
+
+    if (fd < 0) return NULL;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(stats_shm_t)) {
+        close(fd);
+        errno = EPROTO;
+        return NULL;
+    }
+    seg = mmap(NULL, sizeof(stats_shm_t), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (seg == MAP_FAILED) return NULL;
+    if (__atomic_load_n(&seg->magic, __ATOMIC_ACQUIRE) != STATS_SHM_MAGIC ||
+        seg->version != STATS_SHM_VERSION || seg->stats_size != sizeof(knode_stats_t)) {
+        munmap((void *)seg, sizeof(stats_shm_t));
+        errno = EPROTO;
+        return NULL;
+    }
+    return seg;
+}
+
+int stats_shm_read(const stats_shm_t *shm, knode_stats_t *s, uint64_t *publish_ns){
+    for (int i = 0; i < READ_RETRIES; i++) {
+        uint64_t seq = __atomic_load_n(&shm->seq, __ATOMIC_ACQUIRE);
+        uint64_t ns = {0};
+
+        if (seq & 1) {
+            usleep(10); // mid copy, a few microseconds at most
+            continue;
+        }
+        memcpy(s, &shm->stats, sizeof(*s));
+        ns = shm->publish_ns;
+        __atomic_thread_fence(__ATOMIC_ACQUIRE); // copy before the second seq read
+        if (__atomic_load_n(&shm->seq, __ATOMIC_RELAXED) == seq) {
+            if (publish_ns != NULL) *publish_ns = ns;
+            return 0;
+        }
+    }
+    return -1;
+}
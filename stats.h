@@ -0,0 +1,147 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdint.h>
+#include "histogram.h"
+#include "perfctr.h"
+
+/**
+ * @file stats.h
+ * @brief Runtime statistics for knodeRT
+ * @author Aaron Hunter
+ * @date 2025-12-04
+ * @details Counters are written by the thread that owns the event and read
+ * for reporting only, so no locking is used. Packets actually lost on the
+ * network are seq_gaps - seq_reordered. The histograms must be set up with
+ * hist_init() before use. With a redundant sender the copies that lose the
+ * race also count in seq_duplicates.
+ *
+ * With knodeRT -m the UDP thread also publishes a copy of the statistics
+ * into a POSIX shared memory segment every STATS_PUBLISH_NSEC. The copy is
+ * guarded by a seqlock, so readers such as kasm_top never block the node,
+ * and the node never waits for a reader.
+ */
+
+/************** defines *****************************/
+#define STATS_MAX_THREADS   6           // UDP thread and up to 5 SPI threads
+#define STATS_MAX_PATHS     2           // paths of a redundant sender, KNODE_MAX_PATHS
+#define STATS_SHM_MAGIC     0x5453534b  // "KSST" little endian
+#define STATS_SHM_VERSION   1
+#define STATS_PUBLISH_NSEC  (10*1000*1000) // interval between shared memory updates
+
+/************** types *****************************/
+struct knode_stats {
+    uint64_t rx_packets;        // valid command packets received
+    uint64_t rx_bad_size;       // packets with an unexpected length or header
+    uint64_t rx_spin;           // datagrams received while spinning (-R spin)
+    uint64_t rx_xdp;            // datagrams taken off the AF_XDP ring (-X)
+    uint64_t rx_shm;            // commands taken from the shared memory segment (-M)
+    uint64_t shm_overruns;      // shared memory commands overwritten before they were read
+    uint64_t rx_delta;          // delta packets received (included in rx_packets when applied)
+    uint64_t delta_dropped;     // deltas dropped because their base was missed
+    uint64_t seq_gaps;          // packets missing according to the sequence numbers
+    uint64_t seq_reordered;     // late packets, dropped because a newer one was applied
+    uint64_t seq_duplicates;    // packets whose sequence number was already seen
+    uint64_t seq_resyncs;       // sender restarts (sequence jumped backwards)
+    uint64_t conceal_frames;    // frames generated by extrapolation
+    uint64_t conceal_expired;   // gaps that outlasted the extrapolation cap
+    uint64_t deadline_misses;   // UDP loop periods that overran
+    uint64_t spi_errors;        // SPI transfers the driver failed
+    uint64_t crc_errors;        // SPI readbacks with a bad crc
+    uint64_t spi_coalesced;     // frames replaced before their SPI thread picked them up
+    uint64_t tlm_sent;          // telemetry datagrams sent
+    uint64_t tlm_dropped;       // telemetry records lost (not collected in time, batch full or send failed)
+    uint64_t dl_runtime_ns;     // SCHED_DEADLINE runtime of the UDP loop, 0 when not in that mode
+    uint64_t dl_overruns;       // UDP loop periods that used up the SCHED_DEADLINE runtime
+    uint64_t fr_snapshots;      // flight recorder snapshots taken (-F)
+    uint64_t fr_suppressed;     // snapshot triggers while one was pending or after the last allowed
+    uint64_t maint_done;        // maintenance register reads completed (-g)
+    uint64_t maint_deferred;    // idle SPI slots a waiting read did not fit in
+    uint64_t maint_errors;      // register reads without a valid response
+    uint64_t maint_alarms;      // health checks that failed: STATUS alarm or DEVICE_ID changed
+    uint64_t path_wins[STATS_MAX_PATHS]; // commands applied from the copy on each path, all on path 0 without redundancy
+    uint64_t path_only[STATS_MAX_PATHS]; // commands of a redundant sender that arrived on this path alone
+    histogram_t loop_ns;        // UDP loop run time per period, wake-up to sleep
+    histogram_t wake_late_ns;   // UDP loop wake-up time after the end of its sleep
+    histogram_t bus_skew_ns;    // SPI completion spread over the buses for one frame
+    histogram_t queue_ns;       // command receive to the start of its SPI transfer, per bus
+    histogram_t spi_ns;         // SPI transfer time
+    histogram_t path_lead_ns;   // redundant sender, kernel receive time of the first copy of a command to the other copy
+    uint32_t threads;           // entries used in thread_cpu_ns
+    uint64_t thread_cpu_ns[STATS_MAX_THREADS]; // CPU time of the UDP thread, then each SPI thread
+    uint32_t perf_mask;         // performance counters open on the RT threads (-p), 1 << PERFCTR_*
+    uint64_t perf_udp[PERFCTR_COUNT];       // UDP loop, totals over all periods
+    uint64_t perf_udp_max[PERFCTR_COUNT];   // UDP loop, largest count in one period
+    uint64_t perf_udp_miss[PERFCTR_COUNT];  // UDP loop, totals over the periods that missed their deadline
+    uint64_t perf_spi[PERFCTR_COUNT];       // SPI threads, totals over all buses
+    uint64_t perf_spi_max[PERFCTR_COUNT];   // SPI threads, largest count for one frame on one bus
+    uint64_t cpu_ns;            // process CPU time, set at exit
+    uint64_t udp_cpu_ns;        // CPU time of the UDP thread, set when it exits
+    uint64_t wall_ns;           // run time, set at exit
+    uint64_t ready_ns;          // process start to UDP port open, warm-up included
+    uint64_t first_cmd_ns;      // first command, receive to SPI transfer done on every bus
+};
+typedef struct knode_stats knode_stats_t;
+
+extern knode_stats_t knode_stats;
+
+struct stats_shm {
+    uint32_t magic;             // STATS_SHM_MAGIC, written last
+    uint16_t version;           // STATS_SHM_VERSION
+    uint16_t reserved;
+    uint32_t stats_size;        // sizeof(knode_stats_t)
+    uint32_t node_pid;          // knodeRT process publishing into the segment
+    uint64_t seq;               // seqlock, odd while the node writes stats
+    uint64_t publish_ns;        // CLOCK_MONOTONIC time of the last update
+    knode_stats_t stats;
+};
+typedef struct stats_shm stats_shm_t;
+
+/**
+ * @brief Write a one line summary of the counters to syslog
+ * @param s Pointer to the statistics to report
+ */
+void stats_log(const knode_stats_t *s);
+
+/**
+ * @brief Write the counters to a file as a JSON object
+ * @param path Output file, overwritten
+ * @param s Pointer to the statistics to write
+ * @return int 0 on success, -1 if the file could not be written
+ */
+int stats_write_json(const char *path, const knode_stats_t *s);
+
+/**
+ * @brief Create or reuse the statistics segment as the node
+ * @param name Segment name, a leading '/' is added if missing
+ * @return int 0 on success, -1 on failure with errno set
+ * @note The segment is left in /dev/shm at exit, so a viewer can show the
+ * final numbers.
+ */
+int stats_shm_create(const char *name);
+
+/**
+ * @brief Copy the statistics into the segment, a no-op if none was created
+ * @param s Pointer to the statistics to publish
+ * @param now_ns CLOCK_MONOTONIC time of the copy
+ */
+void stats_publish(const knode_stats_t *s, uint64_t now_ns);
+
+/**
+ * @brief Map the statistics segment of a running or previously run node read only
+ * @param name Segment name, a leading '/' is added if missing
+ * @return const stats_shm_t* the segment, NULL on failure with errno set,
+ * EPROTO if it is not a knodeRT statistics segment of this version
+ */
+const stats_shm_t *stats_shm_attach(const char *name);
+
+/**
+ * @brief Take a consistent copy of the published statistics
+ * @param shm Attached segment
+ * @param s Output statistics
+ * @param publish_ns Set to the time of the copy, may be NULL
+ * @return int 0 on success, -1 if the node is still writing after many retries
+ */
+int stats_shm_read(const stats_shm_t *shm, knode_stats_t *s, uint64_t *publish_ns);
+
+#endif // STATS_H
@@ -0,0 +1,48 @@
+/**
+ * @file vclock.c
+ * @brief Clock and sleep for the knodeRT loop, real or virtual
+ * @author Aaron Hunter
+ * @date 2025-12-18
+ */
+
+#include <stdint.h>
+#include <time.h>
+#include "vclock.h"
+
+#define NSEC_PER_SEC (1000*1000*1000)
+
+static int vclock_virtual = 0;
+static uint64_t vclock_ns = 0; // virtual time
+
+void vclock_init(int virtual, uint64_t start_ns){
+    vclock_virtual = virtual;
+    vclock_ns = start_ns;
+}
+
+int vclock_is_virtual(void){
+    return vclock_virtual;
+}
+
+void vclock_gettime(struct timespec *ts){
+    uint64_t ns = {0};
+
+    if (vclock_virtual == 0) {
+        clock_gettime(CLOCK_MONOTONIC, ts);
+        return;
+    }
+    ns = __atomic_load_n(&vclock_ns, __ATOMIC_RELAXED);
+    ts->tv_sec = ns / NSEC_PER_SEC;
+    ts->tv_nsec = ns % NSEC_PER_SEC;
+}
+
+void vclock_sleep_until(const struct timespec *ts){
+    uint64_t ns = (uint64_t)ts->tv_sec * NSEC_PER_SEC + ts->tv_nsec;
+
+    if (vclock_virtual == 0) {
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, ts, NULL);
+        return;
+    }
+    if (ns > vclock_ns) {
+        __atomic_store_n(&vclock_ns, ns, __ATOMIC_RELAXED);
+    }
+}
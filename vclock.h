@@ -0,0 +1,44 @@
+#ifndef VCLOCK_H
+#define VCLOCK_H
+
+#include <stdint.h>
+#include <time.h>
+
+/**
+ * @file vclock.h
+ * @brief Clock and sleep for the knodeRT loop, real or virtual
+ * @author Aaron Hunter
+ * @date 2025-12-18
+ * @details In real mode these are CLOCK_MONOTONIC and an absolute
+ * clock_nanosleep. In virtual mode time only moves when the loop sleeps,
+ * and a sleep returns at once with the clock set to the wake-up time, so a
+ * run is deterministic and goes as fast as the CPU allows. Virtual mode is
+ * meant for a single thread, the one that sleeps.
+ */
+
+/**
+ * @brief Select the clock
+ * @param virtual Non-zero for virtual time
+ * @param start_ns Initial virtual time, ignored in real mode
+ */
+void vclock_init(int virtual, uint64_t start_ns);
+
+/**
+ * @brief Check for virtual time
+ * @return int non-zero in virtual mode
+ */
+int vclock_is_virtual(void);
+
+/**
+ * @brief Current time
+ * @param ts Output time, CLOCK_MONOTONIC in real mode
+ */
+void vclock_gettime(struct timespec *ts);
+
+/**
+ * @brief Sleep until an absolute time
+ * @param ts Wake-up time
+ */
+void vclock_sleep_until(const struct timespec *ts);
+
+#endif // VCLOCK_H
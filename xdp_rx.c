@@ -0,0 +1,334 @@
+/**
+ * @file xdp_rx.c
+ * @brief AF_XDP receive path for the knodeRT command port
+ * @author Aaron Hunter
+ * @date 2025-12-22
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <net/if.h>
+#include <arpa/inet.h>
+#include <linux/bpf.h>
+#include <linux/if_link.h>
+#include <linux/if_xdp.h>
+#include "xdp_rx.h"
+
+#ifndef AF_XDP
+#define AF_XDP 44
+#endif
+#ifndef SOL_XDP
+#define SOL_XDP 283
+#endif
+
+#define XDP_MAX_QUEUES  64      // entries of the socket map
+#define HDR_LEN         42      // Ethernet, IPv4 without options and UDP headers
+#define LOG_SIZE        4096    // verifier log kept on a failed load
+
+// BPF instructions, as built by the kernel's linux/filter.h macros
+#define INSN(c, d, s, o, i) ((struct bpf_insn){.code = (c), .dst_reg = (d), .src_reg = (s), .off = (o), .imm = (i)})
+#define LDX(size, d, s, o)  INSN(BPF_LDX | BPF_MEM | (size), d, s, o, 0)
+#define MOV_REG(d, s)       INSN(BPF_ALU64 | BPF_MOV | BPF_X, d, s, 0, 0)
+#define MOV_IMM(d, i)       INSN(BPF_ALU64 | BPF_MOV | BPF_K, d, 0, 0, i)
+#define ADD_IMM(d, i)       INSN(BPF_ALU64 | BPF_ADD | BPF_K, d, 0, 0, i)
+#define AND_IMM(d, i)       INSN(BPF_ALU64 | BPF_AND | BPF_K, d, 0, 0, i)
+#define JGT_REG(d, s, o)    INSN(BPF_JMP | BPF_JGT | BPF_X, d, s, o, 0)
+#define JNE_IMM(d, i, o)    INSN(BPF_JMP | BPF_JNE | BPF_K, d, 0, o, i)
+#define CALL(f)             INSN(BPF_JMP | BPF_CALL, 0, 0, 0, f)
+#define EXIT()              INSN(BPF_JMP | BPF_EXIT, 0, 0, 0, 0)
+#define LD_MAP_FD(d, fd)    INSN(BPF_LD | BPF_DW | BPF_IMM, d, BPF_PSEUDO_MAP_FD, 0, fd), INSN(0, 0, 0, 0, 0)
+
+#define PROG_PASS 23 // index of the XDP_PASS exit in the program
+#define TO_PASS(i) (PROG_PASS - (i) - 1)
+
+/**
+ * @brief bpf() system call, glibc has no wrapper
+ */
+static long sys_bpf(int cmd, union bpf_attr *attr){
+    return syscall(SYS_bpf, cmd, attr, sizeof(*attr));
+}
+
+/**
+ * @brief Load the program that redirects the command port to the socket map
+ * @return int program fd, -1 on failure
+ */
+static int load_prog(int map_fd, uint16_t port){
+    // r1 = struct xdp_md *, packet loads are bounds checked once for HDR_LEN
+    struct bpf_insn prog[] = {
+        LDX(BPF_W, BPF_REG_2, BPF_REG_1, 0),                        // 0: r2 = data
+        LDX(BPF_W, BPF_REG_3, BPF_REG_1, 4),                        // 1: r3 = data_end
+        LDX(BPF_W, BPF_REG_4, BPF_REG_1, 16),                       // 2: r4 = rx_queue_index
+        MOV_REG(BPF_REG_5, BPF_REG_2),                              // 3
+        ADD_IMM(BPF_REG_5, HDR_LEN),                                // 4
+        JGT_REG(BPF_REG_5, BPF_REG_3, TO_PASS(5)),                  // 5: runt
+        LDX(BPF_H, BPF_REG_5, BPF_REG_2, 12),                       // 6: ethertype
+        JNE_IMM(BPF_REG_5, htons(0x0800), TO_PASS(7)),              // 7: not IPv4
+        LDX(BPF_B, BPF_REG_5, BPF_REG_2, 14),                       // 8: version, header length
+        JNE_IMM(BPF_REG_5, 0x45, TO_PASS(9)),                       // 9: IP options
+        LDX(BPF_B, BPF_REG_5, BPF_REG_2, 23),                       // 10: protocol
+        JNE_IMM(BPF_REG_5, IPPROTO_UDP, TO_PASS(11)),               // 11
+        LDX(BPF_H, BPF_REG_5, BPF_REG_2, 20),                       // 12: flags, fragment offset
+        AND_IMM(BPF_REG_5, htons(0x3fff)),                          // 13
+        JNE_IMM(BPF_REG_5, 0, TO_PASS(14)),                         // 14: fragment
+        LDX(BPF_H, BPF_REG_5, BPF_REG_2, 36),                       // 15: destination port
+        JNE_IMM(BPF_REG_5, htons(port), TO_PASS(16)),               // 16
+        LD_MAP_FD(BPF_REG_1, map_fd),                               // 17, 18
+        MOV_REG(BPF_REG_2, BPF_REG_4),                              // 19: key = queue
+        MOV_IMM(BPF_REG_3, XDP_PASS),                               // 20: no socket on the queue
+        CALL(BPF_FUNC_redirect_map),                                // 21
+        EXIT(),                                                     // 22
+        MOV_IMM(BPF_REG_0, XDP_PASS),                               // 23: PROG_PASS
+        EXIT(),                                                     // 24
+    };
+    static char log[LOG_SIZE];
+    union bpf_attr attr;
+    int fd = {0};
+
+    memset(&attr, 0, sizeof(attr));
+    attr.prog_type = BPF_PROG_TYPE_XDP;
+    attr.insn_cnt = sizeof(prog) / sizeof(prog[0]);
+    attr.insns = (uintptr_t)prog;
+    attr.license = (uintptr_t)"Dual MIT/GPL";
+    attr.log_buf = (uintptr_t)log;
+    attr.log_size = sizeof(log);
+    attr.log_level = 1;
+    fd = (int)sys_bpf(BPF_PROG_LOAD, &attr);
+    if (fd < 0) {
+        fprintf(stderr, "XDP program load failed: %s\n%s", strerror(errno), log);
+    }
+    return fd;
+}
+
+/**
+ * @brief Map one of the socket rings
+ * @return int 0 on success, -1 on failure
+ */
+static int map_ring(struct xdp_ring *r, int fd, off_t pgoff, const struct xdp_ring_offset *off, size_t esize){
+    r->map_len = off->desc + XDP_RX_RING_SIZE * esize;
+    r->map = mmap(NULL, r->map_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, pgoff);
+    if (r->map == MAP_FAILED) {
+        r->map = NULL;
+        return -1;
+    }
+    r->producer = (uint32_t *)((uint8_t *)r->map + off->producer);
+    r->consumer = (uint32_t *)((uint8_t *)r->map + off->consumer);
+    r->desc = (uint8_t *)r->map + off->desc;
+    r->mask = XDP_RX_RING_SIZE - 1;
+    return 0;
+}
+
+/**
+ * @brief Create the socket and its UMEM and bind it to the queue
+ * @return int 0 on success, -1 on failure
+ */
+static int open_socket(xdp_rx_t *x, int ifindex, int queue){
+    struct xdp_umem_reg mr = {0};
+    struct xdp_mmap_offsets off = {0};
+    struct sockaddr_xdp sxdp = {0};
+    socklen_t optlen = sizeof(off);
+    int ring = XDP_RX_RING_SIZE;
+
+    x->xsk_fd = socket(AF_XDP, SOCK_RAW, 0);
+    if (x->xsk_fd < 0) return -1;
+    x->umem = mmap(NULL, XDP_RX_FRAMES * XDP_RX_FRAME_SIZE, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+    if (x->umem == MAP_FAILED) {
+        x->umem = NULL;
+        return -1;
+    }
+    mr.addr = (uintptr_t)x->umem;
+    mr.len = XDP_RX_FRAMES * XDP_RX_FRAME_SIZE;
+    mr.chunk_size = XDP_RX_FRAME_SIZE;
+    if (setsockopt(x->xsk_fd, SOL_XDP, XDP_UMEM_REG, &mr, sizeof(mr)) != 0 ||
+        setsockopt(x->xsk_fd, SOL_XDP, XDP_UMEM_FILL_RING, &ring, sizeof(ring)) != 0 ||
+        setsockopt(x->xsk_fd, SOL_XDP, XDP_UMEM_COMPLETION_RING, &ring, sizeof(ring)) != 0 ||
+        setsockopt(x->xsk_fd, SOL_XDP, XDP_RX_RING, &ring, sizeof(ring)) != 0 ||
+        getsockopt(x->xsk_fd, SOL_XDP, XDP_MMAP_OFFSETS, &off, &optlen) != 0) {
+        return -1;
+    }
+    if (map_ring(&x->fill, x->xsk_fd, XDP_UMEM_PGOFF_FILL_RING, &off.fr, sizeof(uint64_t)) != 0 ||
+        map_ring(&x->comp, x->xsk_fd, XDP_UMEM_PGOFF_COMPLETION_RING, &off.cr, sizeof(uint64_t)) != 0 ||
+        map_ring(&x->rx, x->xsk_fd, XDP_PGOFF_RX_RING, &off.rx, sizeof(struct xdp_desc)) != 0) {
+        return -1;
+    }
+    // every frame starts out with the kernel
+    for (uint32_t i = 0; i < XDP_RX_FRAMES; i++) {
+        ((uint64_t *)x->fill.desc)[i & x->fill.mask] = (uint64_t)i * XDP_RX_FRAME_SIZE;
+    }
+    __atomic_store_n(x->fill.producer, XDP_RX_FRAMES, __ATOMIC_RELEASE);
+
+    sxdp.sxdp_family = AF_XDP;
+    sxdp.sxdp_ifindex = ifindex;
+    sxdp.sxdp_queue_id = queue;
+    sxdp.sxdp_flags = XDP_ZEROCOPY;
+    x->zerocopy = 1;
+    if (x->drv_mode == 0 || bind(x->xsk_fd, (struct sockaddr *)&sxdp, sizeof(sxdp)) != 0) {
+        sxdp.sxdp_flags = XDP_COPY; // the driver can't DMA into the UMEM
+        x->zerocopy = 0;
+        if (bind(x->xsk_fd, (struct sockaddr *)&sxdp, sizeof(sxdp)) != 0) return -1;
+    }
+    return 0;
+}
+
+int xdp_rx_open(xdp_rx_t *x, const char *ifname, int queue, uint16_t port){
+    union bpf_attr attr;
+    uint32_t key = (uint32_t)queue;
+    int ifindex = if_nametoindex(ifname);
+
+    memset(x, 0, sizeof(*x));
+    x->xsk_fd = x->prog_fd = x->map_fd = x->link_fd = -1;
+    x->held = UINT64_MAX;
+    if (ifindex == 0) {
+        fprintf(stderr, "XDP: no interface %s\n", ifname);
+        return -1;
+    }
+    if (queue < 0 || queue >= XDP_MAX_QUEUES) {
+        fprintf(stderr, "XDP: queue must be 0 to %d\n", XDP_MAX_QUEUES - 1);
+        return -1;
+    }
+
+    memset(&attr, 0, sizeof(attr));
+    attr.map_type = BPF_MAP_TYPE_XSKMAP;
+    attr.key_size = sizeof(uint32_t);
+    attr.value_size = sizeof(int);
+    attr.max_entries = XDP_MAX_QUEUES;
+    x->map_fd = (int)sys_bpf(BPF_MAP_CREATE, &attr);
+    if (x->map_fd < 0) {
+        fprintf(stderr, "XDP socket map: %s\n", strerror(errno));
+        xdp_rx_close(x);
+        return -1;
+    }
+    x->prog_fd = load_prog(x->map_fd, port);
+    if (x->prog_fd < 0) {
+        xdp_rx_close(x);
+        return -1;
+    }
+
+    // driver mode if the NIC supports XDP, generic mode otherwise
+    memset(&attr, 0, sizeof(attr));
+    attr.link_create.prog_fd = x->prog_fd;
+    attr.link_create.target_ifindex = ifindex;
+    attr.link_create.attach_type = BPF_XDP;
+    attr.link_create.flags = XDP_FLAGS_DRV_MODE;
+    x->link_fd = (int)sys_bpf(BPF_LINK_CREATE, &attr);
+    x->drv_mode = (x->link_fd >= 0);
+    if (x->link_fd < 0) {
+        attr.link_create.flags = XDP_FLAGS_SKB_MODE;
+        x->link_fd = (int)sys_bpf(BPF_LINK_CREATE, &attr);
+    }
+    if (x->link_fd < 0) {
+        fprintf(stderr, "XDP attach to %s: %s\n", ifname, strerror(errno));
+        xdp_rx_close(x);
+        return -1;
+    }
+
+    if (open_socket(x, ifindex, queue) != 0) {
+        fprintf(stderr, "AF_XDP socket on %s queue %d: %s\n", ifname, queue, strerror(errno));
+        xdp_rx_close(x);
+        return -1;
+    }
+    memset(&attr, 0, sizeof(attr));
+    attr.map_fd = x->map_fd;
+    attr.key = (uintptr_t)&key;
+    attr.value = (uintptr_t)&x->xsk_fd;
+    if (sys_bpf(BPF_MAP_UPDATE_ELEM, &attr) != 0) {
+        fprintf(stderr, "XDP socket map update: %s\n", strerror(errno));
+        xdp_rx_close(x);
+        return -1;
+    }
+    return 0;
+}
+
+int xdp_rx_fd(const xdp_rx_t *x){
+    return x->xsk_fd;
+}
+
+/**
+ * @brief Check the UDP checksum over the IPv4 pseudo header
+ * @param ip IPv4 header
+ * @param udp UDP header and payload
+ * @param len UDP length
+ * @return int 1 if the checksum is good or not used
+ */
+static int udp_csum_ok(const uint8_t *ip, const uint8_t *udp, uint32_t len){
+    uint32_t sum = IPPROTO_UDP + len;
+
+    if (udp[6] == 0 && udp[7] == 0) return 1; // sender did not compute one
+    for (int i = 12; i < 20; i += 2) {
+        sum += (uint32_t)(ip[i] << 8 | ip[i + 1]); // addresses
+    }
+    for (uint32_t i = 0; i + 1 < len; i += 2) {
+        sum += (uint32_t)(udp[i] << 8 | udp[i + 1]);
+    }
+    if (len & 1) sum += (uint32_t)udp[len - 1] << 8;
+    while (sum >> 16) sum = (sum & 0xffff) + (sum >> 16);
+    return sum == 0xffff;
+}
+
+ssize_t xdp_rx_next(xdp_rx_t *x, const uint8_t **data, struct sockaddr_in *peer){
+    uint32_t cons = __atomic_load_n(x->rx.consumer, __ATOMIC_RELAXED);
+    uint32_t prod = __atomic_load_n(x->rx.producer, __ATOMIC_ACQUIRE);
+
+    xdp_rx_release(x);
+    for (; cons != prod; cons++) {
+        const struct xdp_desc *d = &((const struct xdp_desc *)x->rx.desc)[cons & x->rx.mask];
+        const uint8_t *p = x->umem + d->addr;
+        uint32_t len = d->len;
+        uint32_t ip_len = {0};
+        uint32_t udp_len = {0};
+
+        x->held = d->addr;
+        __atomic_store_n(x->rx.consumer, cons + 1, __ATOMIC_RELEASE);
+        // the program only passes IPv4 UDP without options, check the lengths
+        if (len >= HDR_LEN) {
+            ip_len = (uint32_t)(p[16] << 8 | p[17]);
+            udp_len = (uint32_t)(p[38] << 8 | p[39]);
+        }
+        if (len < HDR_LEN || ip_len + 14 > len || udp_len < 8 || udp_len + 20 > ip_len ||
+            !udp_csum_ok(p + 14, p + 34, udp_len)) {
+            x->dropped++;
+            xdp_rx_release(x);
+            continue;
+        }
+        memset(peer, 0, sizeof(*peer));
+        peer->sin_family = AF_INET;
+        memcpy(&peer->sin_addr, p + 26, 4);
+        memcpy(&peer->sin_port, p + 34, 2);
+        *data = p + HDR_LEN;
+        return (ssize_t)(udp_len - 8);
+    }
+    return -1;
+}
+
+void xdp_rx_release(xdp_rx_t *x){
+    uint32_t prod = {0};
+
+    if (x->held == UINT64_MAX) return;
+    prod = __atomic_load_n(x->fill.producer, __ATOMIC_RELAXED);
+    ((uint64_t *)x->fill.desc)[prod & x->fill.mask] = x->held & ~(uint64_t)(XDP_RX_FRAME_SIZE - 1);
+    __atomic_store_n(x->fill.producer, prod + 1, __ATOMIC_RELEASE);
+    x->held = UINT64_MAX;
+}
+
+void xdp_rx_close(xdp_rx_t *x){
+    struct xdp_ring *rings[] = {&x->fill, &x->comp, &x->rx};
+
+    for (unsigned i = 0; i < sizeof(rings) / sizeof(rings[0]); i++) {
+        if (rings[i]->map != NULL) munmap(rings[i]->map, rings[i]->map_len);
+        rings[i]->map = NULL;
+    }
+    if (x->xsk_fd >= 0) close(x->xsk_fd);
+    if (x->umem != NULL) munmap(x->umem, XDP_RX_FRAMES * XDP_RX_FRAME_SIZE);
+    if (x->link_fd >= 0) close(x->link_fd); // detaches the program
+    if (x->prog_fd >= 0) close(x->prog_fd);
+    if (x->map_fd >= 0) close(x->map_fd);
+    x->xsk_fd = x->link_fd = x->prog_fd = x->map_fd = -1;
+    x->umem = NULL;
+}
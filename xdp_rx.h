@@ -0,0 +1,99 @@
+#ifndef XDP_RX_H
+#define XDP_RX_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/types.h>
+#include <netinet/in.h>
+
+/**
+ * @file xdp_rx.h
+ * @brief AF_XDP receive path for the knodeRT command port
+ * @author Aaron Hunter
+ * @date 2025-12-22
+ * @details A small XDP program on the interface redirects IPv4 UDP
+ * datagrams for the command port arriving on one receive queue into an
+ * AF_XDP socket, whose UMEM frames knodeRT decodes in place. Everything
+ * else, including command datagrams on other queues, IP fragments and
+ * IPv6, goes up the normal stack to the regular UDP socket. The program
+ * is built and loaded with raw bpf() calls, so no libbpf is needed, and
+ * is detached when the process exits. Needs Linux 5.9 or later and
+ * CAP_NET_ADMIN and CAP_BPF (or root). Driver mode and zero-copy are used
+ * where the driver supports them, otherwise generic mode and copy mode.
+ * Build with make XDP=1, which defines HAVE_XDP.
+ */
+
+/************** defines *****************************/
+#define XDP_RX_RING_SIZE    512     // fill and RX ring entries
+#define XDP_RX_FRAMES       XDP_RX_RING_SIZE // UMEM frames, all fit on the fill ring
+#define XDP_RX_FRAME_SIZE   2048    // bytes per UMEM frame
+
+/************** types *****************************/
+struct xdp_ring {
+    uint32_t *producer;
+    uint32_t *consumer;
+    void *desc;
+    uint32_t mask;
+    void *map;
+    size_t map_len;
+};
+
+struct xdp_rx {
+    int xsk_fd;             // AF_XDP socket, -1 when closed
+    int prog_fd;
+    int map_fd;
+    int link_fd;            // attachment of the program, closing it detaches
+    uint8_t *umem;
+    struct xdp_ring fill;
+    struct xdp_ring comp;
+    struct xdp_ring rx;
+    uint64_t held;          // UMEM address of the frame handed out, UINT64_MAX for none
+    uint64_t dropped;       // frames dropped for a bad length or checksum
+    int drv_mode;           // program runs in the driver rather than generic mode
+    int zerocopy;           // socket bound in zero-copy mode
+};
+typedef struct xdp_rx xdp_rx_t;
+
+/**
+ * @brief Load the program, create the socket and start receiving
+ * @param x Receive path to open
+ * @param ifname Interface to attach to
+ * @param queue Receive queue to take the command port from
+ * @param port Command port, host byte order
+ * @return int 0 on success, -1 on failure with the reason on stderr
+ */
+int xdp_rx_open(xdp_rx_t *x, const char *ifname, int queue, uint16_t port);
+
+/**
+ * @brief File descriptor to poll for POLLIN
+ * @param x Open receive path
+ * @return int the AF_XDP socket
+ */
+int xdp_rx_fd(const xdp_rx_t *x);
+
+/**
+ * @brief Take the next datagram from the RX ring
+ * @param x Open receive path
+ * @param data Set to the UDP payload inside the UMEM frame
+ * @param peer Set to the sender address
+ * @return ssize_t payload length, -1 if the ring is empty
+ * @note The frame stays valid until xdp_rx_release(). Datagrams with bad
+ * lengths or a bad UDP checksum are dropped here and counted in x->dropped.
+ * The frames bypass the stack's checksum handling, so a sender on the same
+ * host or behind a veth with checksum offload (CHECKSUM_PARTIAL) is dropped.
+ */
+ssize_t xdp_rx_next(xdp_rx_t *x, const uint8_t **data, struct sockaddr_in *peer);
+
+/**
+ * @brief Give the frame from xdp_rx_next() back to the kernel
+ * @param x Open receive path
+ */
+void xdp_rx_release(xdp_rx_t *x);
+
+/**
+ * @brief Detach the program and free the socket and UMEM
+ * @param x Receive path, may be partly open
+ */
+void xdp_rx_close(xdp_rx_t *x);
+
+#endif // XDP_RX_H